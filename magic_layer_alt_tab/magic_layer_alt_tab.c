@@ -13,45 +13,264 @@
 // limitations under the License.
 
 #include QMK_KEYBOARD_H
+#include <string.h>
+#include "magic_layer_alt_tab.h"
 
-#ifndef MAGIC_LAYER_ALT_TAB_LAYER
-#    error "Magic Layer Alt-Tab requires MAGIC_LAYER_ALT_TAB_LAYER to be defined. Please set it the layer of your choice in your config.h"
+#ifdef MAGIC_LAYER_ALT_TAB_LAYER
+const magic_switcher_t magic_switchers[] PROGMEM = {
+    {.forward = LALT(KC_TAB), .backward = LSA(KC_TAB), .passthrough_first = KC_BTN1, .passthrough_last = KC_BTN1, .layers = MAGIC_LAYER(MAGIC_LAYER_ALT_TAB_LAYER), .mods = MOD_LALT},
+};
+const uint8_t magic_switcher_count = ARRAY_SIZE(magic_switchers);
 #endif
 
-static bool alt_tab_running = false;
+// Release the mods this long after the last switcher key was released (0 = never)
+#ifndef MAGIC_LAYER_ALT_TAB_IDLE_MS
+#    define MAGIC_LAYER_ALT_TAB_IDLE_MS 0
+#endif
+
+// Repeat the tap this long after a switcher key was pressed and is held (0 = never)
+#ifndef MAGIC_LAYER_ALT_TAB_REPEAT_DELAY_MS
+#    define MAGIC_LAYER_ALT_TAB_REPEAT_DELAY_MS 0
+#endif
+
+// The time between the first repeats, which shrinks by a quarter each time,
+// down to MAGIC_LAYER_ALT_TAB_REPEAT_MIN_INTERVAL_MS
+#ifndef MAGIC_LAYER_ALT_TAB_REPEAT_INTERVAL_MS
+#    define MAGIC_LAYER_ALT_TAB_REPEAT_INTERVAL_MS 150
+#endif
+
+#ifndef MAGIC_LAYER_ALT_TAB_REPEAT_MIN_INTERVAL_MS
+#    define MAGIC_LAYER_ALT_TAB_REPEAT_MIN_INTERVAL_MS 40
+#endif
+
+#define USE_DEFERRED_EXEC (MAGIC_LAYER_ALT_TAB_IDLE_MS > 0 || MAGIC_LAYER_ALT_TAB_REPEAT_DELAY_MS > 0)
+
+#if USE_DEFERRED_EXEC
+#    include "deferred_exec.h"
+#endif
+
+// With the predictive_tap_hold module, skip the releases it replays, except
+// those of switcher keys, so that only a replayed press of another key
+// releases the mods. Releases from the matrix still do.
+#ifdef MAGIC_LAYER_ALT_TAB_PTH_SUBSCRIPTION
+#    include "predictive_tap_hold.h"
+#endif
+
+#define NO_SWITCHER -1
+
+// The running switcher (a copy from PROGMEM), whose mods are held
+static magic_switcher_t active;
+static int8_t           active_index = NO_SWITCHER;
+
+// The forward or backward key that is held, and the mods of its keycode that
+// are registered until its release (e.g. Shift for LSA(KC_TAB))
+static uint16_t held_keycode = KC_NO;
+static uint8_t  held_mods    = 0;
+
+// Computed once from the table, so that most events are skipped with a
+// comparison or two: all switcher layers, and the range of their keycodes.
+static layer_state_t switcher_layers    = 0;
+static uint16_t      first_switcher_key = UINT16_MAX;
+static uint16_t      last_switcher_key  = 0;
+
+#ifdef MAGIC_LAYER_ALT_TAB_PTH_SUBSCRIPTION
+static pth_subscription_t pth_subscriptions[] = {
+    {.first_keycode = 0, .last_keycode = UINT16_MAX, .events = PTH_SUBSCRIBE_PRESS},
+    // the range of the switcher keys, set in keyboard_post_init
+    {.first_keycode = 0, .last_keycode = 0, .events = PTH_SUBSCRIBE_RELEASE},
+};
+#endif
+
+static void add_switcher_key(uint16_t keycode) {
+    if (keycode == KC_NO) {
+        return;
+    }
+    first_switcher_key = MIN(first_switcher_key, keycode);
+    last_switcher_key  = MAX(last_switcher_key, keycode);
+}
+
+void keyboard_post_init_magic_layer_alt_tab(void) {
+    for (uint8_t i = 0; i < magic_switcher_count; i++) {
+        magic_switcher_t s;
+        memcpy_P(&s, &magic_switchers[i], sizeof(s));
+        switcher_layers |= s.layers;
+        add_switcher_key(s.forward);
+        add_switcher_key(s.backward);
+    }
+#ifdef MAGIC_LAYER_ALT_TAB_PTH_SUBSCRIPTION
+    pth_subscriptions[1].first_keycode = first_switcher_key;
+    pth_subscriptions[1].last_keycode  = last_switcher_key;
+#endif
+}
+
+/**
+ * @return whether one of the layers is on. Like layer_state_cmp, an empty
+ *         layer_state means that layer 0 is on.
+ */
+static inline bool is_any_layer_on(layer_state_t layers) {
+    return ((layer_state ? layer_state : 1) & layers) != 0;
+}
 
-static void disable_magic_layer_alt_tab(void) {
-    unregister_mods(MOD_BIT(KC_LALT));
-    alt_tab_running = false;
+static inline bool may_be_switcher_key(uint16_t keycode) {
+    return is_any_layer_on(switcher_layers) && keycode >= first_switcher_key && keycode <= last_switcher_key;
+}
+
+static int8_t find_switcher(uint16_t keycode) {
+    for (uint8_t i = 0; i < magic_switcher_count; i++) {
+        magic_switcher_t s;
+        memcpy_P(&s, &magic_switchers[i], sizeof(s));
+        if ((keycode == s.forward || keycode == s.backward) && is_any_layer_on(s.layers)) {
+            return i;
+        }
+    }
+    return NO_SWITCHER;
+}
+
+static uint8_t to_8_bit_mods(uint8_t mods) {
+    return (mods & 0x10) ? (mods & 0x0F) << 4 : mods;
+}
+
+/**
+ * @return the 8-bit mods of the keycode without those that are held anyway
+ */
+static uint8_t get_extra_mods(uint16_t keycode) {
+    const uint8_t mods = QK_MODS_GET_MODS(keycode) & ~active.mods;
+    return (mods & 0x0F) == 0 ? 0 : to_8_bit_mods(mods);
+}
+
+// Only the key is tapped (not the mods along with it, as tap_code16 would),
+// so that each step sends just its press and release.
+static void tap_held_key(void) {
+    tap_code(QK_MODS_GET_BASIC_KEYCODE(held_keycode));
+}
+
+#if MAGIC_LAYER_ALT_TAB_REPEAT_DELAY_MS > 0
+static deferred_token repeat_token    = INVALID_DEFERRED_TOKEN;
+static uint16_t       repeat_interval = MAGIC_LAYER_ALT_TAB_REPEAT_INTERVAL_MS;
+
+static uint32_t repeat_callback(uint32_t trigger_time, void *cb_arg) {
+    tap_held_key();
+    const uint16_t interval = repeat_interval;
+    repeat_interval         = MAX(MAGIC_LAYER_ALT_TAB_REPEAT_MIN_INTERVAL_MS, repeat_interval - repeat_interval / 4);
+    return interval;
+}
+
+static void start_repeat(void) {
+    repeat_interval = MAGIC_LAYER_ALT_TAB_REPEAT_INTERVAL_MS;
+    repeat_token    = defer_exec(MAGIC_LAYER_ALT_TAB_REPEAT_DELAY_MS, repeat_callback, NULL);
+}
+
+static void stop_repeat(void) {
+    cancel_deferred_exec(repeat_token);
+    repeat_token = INVALID_DEFERRED_TOKEN;
+}
+#else
+#    define start_repeat() ((void)0)
+#    define stop_repeat() ((void)0)
+#endif
+
+static void press_held_key(uint16_t keycode) {
+    held_keycode = keycode;
+    held_mods    = get_extra_mods(keycode);
+    if (held_mods) {
+        register_mods(held_mods);
+    }
+    tap_held_key();
+    start_repeat();
+}
+
+static void release_held_key(void) {
+    stop_repeat();
+    if (held_mods) {
+        unregister_mods(held_mods);
+    }
+    held_keycode = KC_NO;
+    held_mods    = 0;
+}
+
+static void stop_switcher(void);
+
+#if MAGIC_LAYER_ALT_TAB_IDLE_MS > 0
+static deferred_token idle_token = INVALID_DEFERRED_TOKEN;
+
+static uint32_t idle_callback(uint32_t trigger_time, void *cb_arg) {
+    idle_token = INVALID_DEFERRED_TOKEN;
+    stop_switcher();
+    return 0;
+}
+
+static void start_idle_timeout(void) {
+    idle_token = defer_exec(MAGIC_LAYER_ALT_TAB_IDLE_MS, idle_callback, NULL);
+}
+
+static void stop_idle_timeout(void) {
+    cancel_deferred_exec(idle_token);
+    idle_token = INVALID_DEFERRED_TOKEN;
+}
+#else
+#    define start_idle_timeout() ((void)0)
+#    define stop_idle_timeout() ((void)0)
+#endif
+
+static void start_switcher(int8_t index) {
+    memcpy_P(&active, &magic_switchers[index], sizeof(active));
+    register_mods(to_8_bit_mods(active.mods));
+    active_index = index;
+}
+
+static void stop_switcher(void) {
+    stop_idle_timeout();
+    if (held_keycode != KC_NO) {
+        release_held_key();
+    }
+    unregister_mods(to_8_bit_mods(active.mods));
+    active_index = NO_SWITCHER;
 }
 
 bool process_record_magic_layer_alt_tab(uint16_t keycode, keyrecord_t *record) {
-    const bool is_alt_tab_key = keycode == LALT(KC_TAB) || keycode == LSA(KC_TAB);
+    if (active_index == NO_SWITCHER && !may_be_switcher_key(keycode)) {
+        return true;
+    }
+
+#ifdef MAGIC_LAYER_ALT_TAB_PTH_SUBSCRIPTION
+    if (!pth_should_receive(pth_subscriptions, ARRAY_SIZE(pth_subscriptions), keycode, record)) {
+        return true;
+    }
+#endif
 
-    if (!is_alt_tab_key || !IS_LAYER_ON(MAGIC_LAYER_ALT_TAB_LAYER)) {
-        if (alt_tab_running && keycode != KC_BTN1) {
-            disable_magic_layer_alt_tab();
+    const int8_t index = may_be_switcher_key(keycode) ? find_switcher(keycode) : NO_SWITCHER;
+    if (index == NO_SWITCHER) {
+        if (active_index != NO_SWITCHER && (keycode < active.passthrough_first || keycode > active.passthrough_last)) {
+            stop_switcher();
         }
         return true;
     }
 
-    if (!alt_tab_running) {
-        register_mods(MOD_BIT(KC_LALT));
-        alt_tab_running = true;
+    if (!record->event.pressed) {
+        if (keycode == held_keycode) {
+            release_held_key();
+            start_idle_timeout();
+        }
+        return false;
     }
 
-    if (record->event.pressed) {
-        if (keycode == LALT(KC_TAB)) {
-            tap_code16(KC_TAB);
-        } else if (keycode == LSA(KC_TAB)) {
-            tap_code16(LSFT(KC_TAB));
+    if (index != active_index) {
+        if (active_index != NO_SWITCHER) {
+            stop_switcher();
         }
+        start_switcher(index);
+    }
+
+    stop_idle_timeout();
+    if (held_keycode != KC_NO) {
+        release_held_key();
     }
+    press_held_key(keycode);
     return false;
 }
 
 void post_process_record_magic_layer_alt_tab(uint16_t keycode, keyrecord_t *record) {
-    if (alt_tab_running && !IS_LAYER_ON(MAGIC_LAYER_ALT_TAB_LAYER)) {
-        disable_magic_layer_alt_tab();
+    if (active_index != NO_SWITCHER && !is_any_layer_on(active.layers)) {
+        stop_switcher();
     }
-}
\ No newline at end of file
+}
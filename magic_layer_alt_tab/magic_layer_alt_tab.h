@@ -0,0 +1,57 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "quantum.h"
+
+/**
+ * @brief An app switcher, such as Alt-Tab.
+ *
+ * While one of its layers is on, pressing its forward or backward key holds
+ * its mods and taps that key without them, e.g. `LSA(KC_TAB)` holds Alt and
+ * taps `S(KC_TAB)`. The mods are released as soon as you press any other key
+ * (except the passthrough keys) or leave the layers.
+ */
+typedef struct {
+    // the keycodes in your keymap, e.g. LALT(KC_TAB) and LSA(KC_TAB)
+    uint16_t forward;
+    uint16_t backward;
+    // the range of keys that don't release the mods, e.g. KC_BTN1 to KC_BTN1
+    // (KC_NO to KC_NO for none)
+    uint16_t passthrough_first;
+    uint16_t passthrough_last;
+    // the layers it works on, e.g. MAGIC_LAYER(3) | MAGIC_LAYER(4)
+    layer_state_t layers;
+    // the mods that are held, in the format of mod-taps, e.g. MOD_LALT
+    uint8_t mods;
+} magic_switcher_t;
+
+#define MAGIC_LAYER(layer) ((layer_state_t)1 << (layer))
+
+/**
+ * The switchers, which the module reads from PROGMEM. If
+ * MAGIC_LAYER_ALT_TAB_LAYER is defined, they are Alt-Tab on that layer.
+ * Otherwise, define them in your keymap.c, e.g. for macOS and Windows:
+ *
+ *     const magic_switcher_t magic_switchers[] PROGMEM = {
+ *         {.forward = LGUI(KC_TAB), .backward = LSG(KC_TAB), .mods = MOD_LGUI, .layers = MAGIC_LAYER(_MAC_NAV)},
+ *         {.forward = LGUI(KC_GRV), .backward = LSG(KC_GRV), .mods = MOD_LGUI, .layers = MAGIC_LAYER(_MAC_NAV)},
+ *         {.forward = LALT(KC_TAB), .backward = LSA(KC_TAB), .mods = MOD_LALT, .layers = MAGIC_LAYER(_WIN_NAV)},
+ *         {.forward = LCTL(KC_TAB), .backward = RCS(KC_TAB), .mods = MOD_LCTL, .layers = MAGIC_LAYER(_WIN_NAV)},
+ *     };
+ *     const uint8_t magic_switcher_count = ARRAY_SIZE(magic_switchers);
+ */
+extern const magic_switcher_t magic_switchers[] PROGMEM;
+extern const uint8_t          magic_switcher_count;
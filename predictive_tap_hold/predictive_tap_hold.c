@@ -70,11 +70,32 @@ keyrecord_t record {
 #    define SD(x, y) (((y) == 0) ? (x) : ((x) / (y)))
 #endif
 
-#define ATOM_SIDE_TO_STR(side) (((side) == PTH_ATOM_LEFT) ? "L" : ((side) == PTH_ATOM_RIGHT) ? "R" : ((side) == PTH_ATOM_OPPOSITE) ? "O" : ((side) == PTH_ATOM_SAME) ? "S" : "?")
+// In log messages, strings are only made with these, so that PTH_TRACE_ENABLE
+// can record the values instead.
+#ifdef PTH_TRACE_ENABLE
+#    define ATOM_SIDE_TO_STR(side) (side)
+#    define STATUS_TO_STR(status) (status)
+#    define PTH_LOG_KEYCODE(keycode) (keycode)
+#    define PTH_LOG_CHOICE(cond, if_true, if_false) (cond)
+#else
+#    define ATOM_SIDE_TO_STR(side) (((side) == PTH_ATOM_LEFT) ? "L" : ((side) == PTH_ATOM_RIGHT) ? "R" : ((side) == PTH_ATOM_OPPOSITE) ? "O" : ((side) == PTH_ATOM_SAME) ? "S" : "?")
+#    define STATUS_TO_STR(status) (((status) == PTH_IDLE) ? "IDLE" : ((status) == PTH_PRESSED) ? "PRESSED" : ((status) == PTH_SECOND_PRESSED) ? "SECOND_PRESSED" : ((status) == PTH_DECIDED_TAP) ? "DECIDED_TAP" : ((status) == PTH_DECIDED_HOLD) ? "DECIDED_HOLD" : "UNKNOWN")
+#    define PTH_LOG_KEYCODE(keycode) get_keycode_string(keycode)
+#    define PTH_LOG_CHOICE(cond, if_true, if_false) ((cond) ? (if_true) : (if_false))
+#endif // PTH_TRACE_ENABLE
 
 // Never use more than one get_keycode_string call in a macro. Each call uses
 // the same buffer, so in the end you'd get the same result for both calls.
-#if defined(PTH_DEBUG) && defined(CONSOLE_ENABLE)
+#ifdef PTH_TRACE_ENABLE
+// Each log site records its line and up to four values, which
+// tools/pth_trace_decode.py turns back into the message (see Trace).
+#    define PTH_LOG(first_arg) record_trace(__LINE__, 0, 0, 0, 0);
+#    define PTH_LOGF(fmt, ...) PTH_TRACE_VALUES(__VA_ARGS__, 0, 0, 0, 0);
+#    define PTH_TRACE_VALUES(a, b, c, d, ...) record_trace(__LINE__, (int16_t)(a), (int16_t)(b), (int16_t)(c), (int16_t)(d))
+#    define side_to_str(full_side) (full_side)
+
+static void record_trace(uint16_t line, int16_t a, int16_t b, int16_t c, int16_t d);
+#elif defined(PTH_DEBUG) && defined(CONSOLE_ENABLE)
 #    define PTH_LOG(first_arg) print("PTH: " first_arg "\n");
 #    define PTH_LOGF(fmt, first_arg, ...) uprintf("PTH: " fmt "\n", first_arg, ##__VA_ARGS__);
 
@@ -122,9 +143,7 @@ static const char* side_to_str(uint8_t full_side) {
 #    define PTH_LOG(...) ((void)0);
 #    define PTH_LOGF(...) ((void)0);
 #    define side_to_str(full_side) ("")
-#endif // PTH_DEBUG & CONSOLE_ENABLE
-
-#define STATUS_TO_STR(status) (((status) == PTH_IDLE) ? "IDLE" : ((status) == PTH_PRESSED) ? "PRESSED" : ((status) == PTH_SECOND_PRESSED) ? "SECOND_PRESSED" : ((status) == PTH_DECIDED_TAP) ? "DECIDED_TAP" : ((status) == PTH_DECIDED_HOLD) ? "DECIDED_HOLD" : "UNKNOWN")
+#endif // PTH_TRACE_ENABLE, PTH_DEBUG & CONSOLE_ENABLE
 
 // Used for turning tap-hold releases into taps after the actual tap-hold key
 // has been released. For example, if LCTL_T(KC_E) is pressed, C_S_T(KC_A) is
@@ -132,19 +151,68 @@ static const char* side_to_str(uint8_t full_side) {
 // state (i.e. we are ready for the next PTH) and so we still need some way of
 // knowing how previously pressed tap-hold keys have to be send (tap or hold).
 // Hold is the default, so we only need to store those that should be tap.
-//
-// INFO:
-// * This must not be larger than 8 because the bitmask is an uint8_t.
-// * If you use values less than 8, you'll have to mask off bits.
-#define RELEASE_AS_TAP_POSITIONS_SIZE 8
+// The size is PTH_RELEASE_AS_TAP_POSITIONS_SIZE.
 
-// This is the size of the release record array.
-// Release records that don't fit will be directly released.
-//
-// INFO:
-// * This must not be larger than 8 because the bitmask is an uint8_t.
-// * If you use values less than 8, you'll have to mask off bits.
-#define RELEASE_RECORD_SIZE 8
+// The size of the release record array is PTH_RELEASE_RECORD_SIZE. If it is
+// full, the PTH key is decided as if the timeout was reached.
+#if PTH_RELEASE_RECORD_SIZE > 255 || PTH_RELEASE_AS_TAP_POSITIONS_SIZE > 255
+#    error "PTH_RELEASE_RECORD_SIZE and PTH_RELEASE_AS_TAP_POSITIONS_SIZE must not be larger than 255."
+#endif
+
+#if defined(PTH_ADAPTIVE_FACTORS) && !defined(PTH_ADAPTIVE_EEPROM_ADDR)
+#    error "PTH_ADAPTIVE_FACTORS requires PTH_ADAPTIVE_EEPROM_ADDR, the start of PTH_ADAPTIVE_EEPROM_SIZE free bytes in EEPROM."
+#endif
+
+// With telemetry, the usual logic checks each early decision in the background.
+#if defined(PTH_EARLY_DECISION_ENABLE) && defined(PTH_TELEMETRY_ENABLE)
+#    define PTH_EARLY_DECISION_SHADOW
+#endif
+
+// Hooks on the hot path are only called through these macros (see
+// PTH_INLINE_DEFAULT_HOOKS). The default_* functions are the bodies of the
+// weak functions, so they can be inlined.
+#ifdef PTH_INLINE_DEFAULT_HOOKS
+#    define PTH_HOOK(name) default_##name
+#else
+#    define PTH_HOOK(name) pth_##name
+#endif
+
+#ifndef PTH_GET_SIDE
+#    define PTH_GET_SIDE(record) PTH_HOOK(get_side)(record)
+#endif
+#ifndef PTH_SHOULD_HOLD_INSTANTLY
+#    define PTH_SHOULD_HOLD_INSTANTLY(keycode, record) PTH_HOOK(should_hold_instantly)(keycode, record)
+#endif
+#ifndef PTH_SECOND_SHOULD_HOLD_INSTANTLY
+#    define PTH_SECOND_SHOULD_HOLD_INSTANTLY(keycode, record) PTH_HOOK(second_should_hold_instantly)(keycode, record)
+#endif
+#ifndef PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_PRESS
+#    define PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_PRESS() PTH_HOOK(should_choose_tap_when_second_is_same_side_press)()
+#endif
+#ifndef PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_RELEASE
+#    define PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_RELEASE() PTH_HOOK(should_choose_tap_when_second_is_same_side_release)()
+#endif
+#ifndef PTH_GET_TIMEOUT_FOR_FORCING_CHOICE
+#    define PTH_GET_TIMEOUT_FOR_FORCING_CHOICE() PTH_HOOK(get_timeout_for_forcing_choice)()
+#endif
+#ifndef PTH_GET_FORCED_CHOICE_AFTER_TIMEOUT
+#    define PTH_GET_FORCED_CHOICE_AFTER_TIMEOUT() PTH_HOOK(get_forced_choice_after_timeout)()
+#endif
+#ifndef PTH_SHOULD_NEUTRALIZE_MODS
+#    define PTH_SHOULD_NEUTRALIZE_MODS(mod_5_bit) PTH_HOOK(should_neutralize_mods)(mod_5_bit)
+#endif
+#ifndef PTH_GET_CODE_TO_BE_REGISTERED_INSTEAD_WHEN_HOLD_CHOSEN
+#    define PTH_GET_CODE_TO_BE_REGISTERED_INSTEAD_WHEN_HOLD_CHOSEN() PTH_HOOK(get_code_to_be_registered_instead_when_hold_chosen)()
+#endif
+#ifndef PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE
+#    define PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE(keycode, record) PTH_HOOK(should_register_as_hold_when_same_side)(keycode, record)
+#endif
+#ifndef PTH_GET_PREDICTION_FACTOR_FOR_HOLD
+#    define PTH_GET_PREDICTION_FACTOR_FOR_HOLD() PTH_HOOK(get_prediction_factor_for_hold)()
+#endif
+
+// see Weakly defined functions
+static inline uint8_t default_get_side(keyrecord_t* record);
 
 // Maximum duration (ms) considered valid for timers and prediction heuristics.
 // Durations longer than this will be essentially capped, as the task
@@ -154,6 +222,37 @@ static const char* side_to_str(uint8_t full_side) {
 // More is not possible because 16-bit timers are used, which wrap around.
 #define MS_MAX_DUR_FOR_TIMERS 4096
 
+// The type of the timestamps that durations are measured from.
+//
+// With PTH_32_BIT_TIMERS, they wrap around after 49 days instead of 65 s, so
+// a duration is simply capped at MS_MAX_DUR_FOR_TIMERS when it is read, and
+// the *_max_reached flags are never set. Otherwise, the housekeeping sets them
+// once a timer is maxed out, before it can wrap around.
+#ifdef PTH_32_BIT_TIMERS
+typedef uint32_t pth_timer_t;
+#    define PTH_TIMER_READ() timer_read32()
+#    define PTH_TIMER_DIFF(a, b) TIMER_DIFF_32(a, b)
+#    define PTH_ELAPSED(cur_time, timer, max_reached) ((uint16_t)MIN(TIMER_DIFF_32(cur_time, timer), MS_MAX_DUR_FOR_TIMERS))
+#else
+typedef uint16_t pth_timer_t;
+#    define PTH_TIMER_READ() timer_read()
+#    define PTH_TIMER_DIFF(a, b) TIMER_DIFF_16(a, b)
+#    define PTH_ELAPSED(cur_time, timer, max_reached) ((max_reached) ? MS_MAX_DUR_FOR_TIMERS : TIMER_DIFF_16(cur_time, timer))
+#endif // PTH_32_BIT_TIMERS
+
+// for logs, as a duration that isn't capped may exceed 16 bits
+#define PTH_TIMER_ELAPSED(timer) ((uint16_t)PTH_TIMER_DIFF(PTH_TIMER_READ(), timer))
+
+// The durations before a key press, which are used by the predictions once
+// that key is the PTH key.
+typedef struct {
+    int16_t  prev_prev_press_to_prev_press_dur;
+    int16_t  prev_press_to_press_dur;
+    int16_t  prev_prev_overlap_dur;
+    int16_t  prev_overlap_dur;
+    uint16_t release_to_press_dur;
+} press_features_t;
+
 // Sentinel value for an empty key position
 #define EMPTY_KEYPOS (keypos_t){.col = 0xFF, .row = 0xFF}
 
@@ -163,1113 +262,2882 @@ static inline bool keypos_eq(keypos_t p1, keypos_t p2) {
 
 // Static variables for state tracking
 // ----------------------------------------------------------------------------
-static pth_status_t pth_status      = PTH_IDLE;
-static pth_status_t pth_prev_status = PTH_IDLE;
-
-static uint16_t    pth_keycode                  = KC_NO;
-static uint16_t    pth_tap_code_instead_of_hold = KC_NO;
-static keyrecord_t pth_record                   = {.event = {.key = EMPTY_KEYPOS}};
-static uint16_t    pth_press_timer              = 0;
-static bool        pth_press_timer_max_reached  = false;
-static uint8_t     pth_atomic_side              = 0;
-static uint8_t     pth_side_user_bits           = 0;
-
-static bool    pth_was_held_instantly         = false;
-static bool    second_was_held_instantly      = false;
-static bool    instant_layer_was_active       = false;
-static uint8_t layer_before_instant_layer_tap = 0;
-
-static bool        has_second                     = false;
-static keyrecord_t second_record                  = {.event = {.key = EMPTY_KEYPOS}};
-static uint16_t    second_keycode                 = KC_NO;
-static uint16_t    second_press_timer             = 0;
-static bool        second_press_timer_max_reached = false;
-static bool        second_is_tap_hold             = false;
-static bool        second_is_same_side_as_pth     = false;
-static bool        second_to_be_released          = false;
-
-static int16_t timeout_for_forcing_choice       = 0;
-static bool    has_chosen_after_timeout_reached = false;
-
-static uint16_t min_overlap_dur_for_hold = 0;
-
-// -- State captured specifically for prediction --
-static uint16_t pth_press_to_second_press_dur           = 0;
-static uint16_t pth_press_to_second_release_dur         = 0;
-static uint16_t pth_second_dur                          = 0;
-static uint16_t pth_second_press_to_third_press_dur     = 0;
-static int16_t  pth_prev_prev_press_to_prev_press_dur   = -1;
-static int16_t  pth_prev_press_to_pth_press_dur         = -1;
-static int16_t  pth_prev_prev_overlap_dur               = -1;
-static int16_t  pth_prev_overlap_dur                    = -1;
-static float    pth_press_to_press_w_avg                = 0;
-static float    pth_overlap_w_avg                       = 0;
-static uint16_t key_release_before_pth_to_pth_press_dur = 0;
+// -- State of the current PTH key (the session), reset after each decision --
+// Members are ordered by size to avoid padding, and flags are bitfields.
+typedef struct {
+    // -- State captured specifically for prediction --
+    pth_features_t features;
+
+    pth_timer_t press_timer;
+    pth_timer_t second_press_timer;
+    keyrecord_t record;
+    keyrecord_t second_record;
+    uint16_t    keycode;
+    uint16_t    tap_code_instead_of_hold;
+    uint16_t    second_keycode;
+    int16_t     timeout_for_forcing_choice;
+    uint16_t    min_overlap_dur_for_hold;
+
+    uint8_t side_user_bits;
+    uint8_t layer_before_instant_layer_tap;
+#if defined(PTH_POINTING_DEVICE_HOLD) && defined(POINTING_DEVICE_ENABLE)
+    uint8_t pointing_motion; // since the PTH press, up to PTH_POINTING_MOTION_THRESHOLD
+#endif
+    uint8_t status : 3; // pth_status_t
+    uint8_t prev_status : 3;
+    uint8_t atomic_side : 2;
+
+    bool press_timer_max_reached : 1;
+    bool was_held_instantly : 1;
+    bool second_was_held_instantly : 1;
+    bool instant_layer_was_active : 1;
+    bool has_second : 1;
+    bool second_press_timer_max_reached : 1;
+    bool second_is_tap_hold : 1;
+    bool second_is_same_side_as_pth : 1;
+    bool second_to_be_released : 1;
+    bool has_chosen_after_timeout_reached : 1;
+#ifdef PTH_EARLY_DECISION_SHADOW
+    bool early_shadow_pending : 1;
+#endif
+} pth_session_t;
+
+#define PTH_SESSION_INIT {.record = {.event = {.key = EMPTY_KEYPOS}}, .second_record = {.event = {.key = EMPTY_KEYPOS}}}
+
+static pth_session_t pth = PTH_SESSION_INIT;
 
 // -- State about previous presses and releases --
-static uint16_t prev_press_keycode               = KC_NO;
-static uint16_t cur_press_keycode                = KC_NO;
-static uint8_t  down_count                       = 0;
-static uint16_t overlap_timer                    = 0;
-static bool     overlap_timer_max_reached        = false;
-static uint16_t press_to_press_timer             = 0;
-static bool     press_to_press_timer_max_reached = false;
-static uint16_t release_timer                    = 0;
-static bool     release_timer_max_reached        = false;
-static int16_t  prev_press_to_press_dur          = -1;
-static int16_t  cur_press_to_press_dur           = -1;
-static int16_t  prev_overlap_dur                 = -1;
-static int16_t  cur_overlap_dur                  = -1;
-
-// -- Tracks tap-hold key *positions* that should resolve as HOLD on release --
-static keypos_t release_as_tap_positions[RELEASE_AS_TAP_POSITIONS_SIZE];
-static uint8_t  used_release_as_tap_positions_bitmask = 0;
+typedef struct {
+    pth_timer_t overlap_timer;
+    pth_timer_t press_to_press_timer;
+    pth_timer_t release_timer;
+    uint16_t    prev_press_keycode;
+    uint16_t    cur_press_keycode;
+    int16_t     prev_press_to_press_dur;
+    int16_t     cur_press_to_press_dur;
+    int16_t     prev_overlap_dur;
+    int16_t     cur_overlap_dur;
+    uint8_t     down_count;
+    bool        overlap_timer_max_reached : 1;
+    bool        press_to_press_timer_max_reached : 1;
+    bool        release_timer_max_reached : 1;
+} typing_history_t;
+
+static typing_history_t history = {.prev_press_to_press_dur = -1, .cur_press_to_press_dur = -1, .prev_overlap_dur = -1, .cur_overlap_dur = -1};
+// -- Tracks tap-hold key *positions* that should resolve as TAP on release --
+static keypos_t release_as_tap_positions[PTH_RELEASE_AS_TAP_POSITIONS_SIZE];
+static uint8_t  release_as_tap_positions_count      = 0;
+static uint8_t  release_as_tap_positions_high_water = 0;
 
 // -- Tracks releases of keys after PTH and before a third has been pressed. --
-static keyrecord_t release_records[RELEASE_RECORD_SIZE];
-
-// If the bit at index 'i' is 1, it means release_records[i] was released
-// before the second key. If the bit is 0 instead, it was release after second.
-static uint8_t is_before_second_bitmask     = 0;
-static uint8_t used_release_records_bitmask = 0;
+// They are in the order they happened, so the first before_second_count
+// records were released before the second key, and the others after it.
+static keyrecord_t release_records[PTH_RELEASE_RECORD_SIZE];
+static uint8_t     release_records_count      = 0;
+static uint8_t     before_second_count        = 0;
+static uint8_t     release_records_high_water = 0;
+
+#if PTH_SESSION_COUNT > 1
+// -- Positions of older PTH keys that are decided, but still held --
+static keypos_t decided_session_positions[PTH_SESSION_COUNT - 1];
+static uint8_t  decided_session_count = 0;
+
+// -- The second key, which becomes the next PTH key after the decision --
+static bool             has_next_session                     = false;
+static keyrecord_t      next_session_record                  = {.event = {.key = EMPTY_KEYPOS}};
+static uint16_t         next_session_keycode                 = KC_NO;
+static pth_timer_t      next_session_press_timer             = 0;
+static bool             next_session_press_timer_max_reached = false;
+static press_features_t next_session_features;
+#endif // PTH_SESSION_COUNT > 1
 
 // -- Recursion guard --
 static bool is_processing_record_due_to_pth = false;
 
-// Reset and initialization
+#if defined(PTH_TELEMETRY_ENABLE) || defined(PTH_CAPTURE_ENABLE)
+// Set right before a decision is made, so that we know what led to it.
+static uint8_t decision_path = PTH_PATH_NONE;
+
+#    define PTH_DECISION_PATH(path) (decision_path = (path))
+#else
+#    define PTH_DECISION_PATH(path) ((void)0)
+#endif
+
+// Telemetry
 // ----------------------------------------------------------------------------
+#ifdef PTH_TELEMETRY_ENABLE
+// The sum of the oldest index and the count has to fit in a uint8_t.
+_Static_assert(PTH_TELEMETRY_SIZE <= 127, "PTH_TELEMETRY_SIZE must not be larger than 127.");
 
-static void reset_pth_state(void) {
-    // We don't need to reset timers, as the issue would be using a timer
-    // before it can be used, and if we do that we have bigger issues than
-    // using a timer with an invalid value. Same applies to side and others.
-    pth_prev_status              = pth_status;
-    pth_status                   = PTH_IDLE;
-    pth_keycode                  = KC_NO;
-    pth_tap_code_instead_of_hold = KC_NO;
-    pth_record.event.key         = EMPTY_KEYPOS;
-    pth_press_timer_max_reached  = false;
-
-    pth_was_held_instantly         = false;
-    second_was_held_instantly      = false;
-    instant_layer_was_active       = false;
-    layer_before_instant_layer_tap = 0;
-
-    has_second                     = false;
-    second_record.event.key        = EMPTY_KEYPOS;
-    second_keycode                 = KC_NO;
-    second_press_timer_max_reached = false;
-    second_is_tap_hold             = false;
-    second_to_be_released          = false;
-
-    has_chosen_after_timeout_reached = false;
-
-    min_overlap_dur_for_hold = 0;
+static pth_telemetry_record_t   telemetry_records[PTH_TELEMETRY_SIZE];
+static uint8_t                  telemetry_oldest_index = 0;
+static uint8_t                  telemetry_count        = 0;
+static pth_telemetry_counters_t telemetry_counters     = {0};
 
-    PTH_LOG("--------------------------------------------------------------------------------");
-}
+#    define PTH_TELEMETRY_COUNT(counter) count_saturating(&telemetry_counters.counter)
 
-void keyboard_post_init_predictive_tap_hold(void) {
-#ifdef PTH_DISABLED
-    uprintf("Predictive_tap_hold is disabled");
-    return;
-#endif
-    // since we have no data yet, just use one far in the past
-    press_to_press_timer = timer_read() - MS_MAX_DUR_FOR_TIMERS;
-    release_timer        = timer_read() - (MS_MAX_DUR_FOR_TIMERS - 100);
+static void count_saturating(uint16_t* counter) {
+    if (*counter < UINT16_MAX) {
+        (*counter)++;
+    }
 }
 
-static uint16_t get_keycode_same_pos_in_layer(keyrecord_t* record, uint8_t layer) {
-    // thanks u/pgetreuer for the suggestion
-    const keypos_t pos = record->event.key;
+static void record_telemetry_decision(bool hold) {
+    count_saturating(&telemetry_counters.decisions[decision_path]);
+    if (hold) {
+        count_saturating(&telemetry_counters.holds);
+    }
 
-#ifdef VIAL_ENABLE
-    return dynamic_keymap_get_keycode(layer, pos.row, pos.col);
-#else
-    return keycode_at_keymap_location(layer, pos.row, pos.col);
-#endif
+    uint8_t index = telemetry_oldest_index + telemetry_count;
+    if (telemetry_count < PTH_TELEMETRY_SIZE) {
+        telemetry_count++;
+    } else {
+        // overwrite the oldest record
+        count_saturating(&telemetry_counters.dropped_records);
+        if (++telemetry_oldest_index == PTH_TELEMETRY_SIZE) {
+            telemetry_oldest_index = 0;
+        }
+    }
+    if (index >= PTH_TELEMETRY_SIZE) {
+        index -= PTH_TELEMETRY_SIZE;
+    }
+
+    pth_telemetry_record_t* r = &telemetry_records[index];
+
+    r->keycode                         = pth.keycode;
+    r->press_time                      = pth.press_timer;
+    r->decision_time                   = timer_read();
+    r->path                            = decision_path;
+    r->flags                           = (hold ? PTH_TELEMETRY_HOLD : 0) | (pth.has_second ? PTH_TELEMETRY_HAS_SECOND : 0) | (pth.second_to_be_released ? PTH_TELEMETRY_SECOND_RELEASED : 0);
+    r->press_to_second_press_dur       = pth.features.press_to_second_press_dur;
+    r->second_press_to_third_press_dur = pth.features.second_press_to_third_press_dur;
+    r->press_to_second_release_dur     = pth.features.press_to_second_release_dur;
+    r->prev_press_to_pth_press_dur     = pth.features.prev_press_to_pth_press_dur;
+    r->prev_overlap_dur                = pth.features.prev_overlap_dur;
+    r->min_overlap_dur_for_hold        = pth.min_overlap_dur_for_hold;
 }
 
-// Utility functions
-// ----------------------------------------------------------------------------
-// 0b10000: the "right" flag in 5-bit mods
-#define MODS_5_BIT_RL_BIT 0x10
+bool pth_pop_telemetry_record(pth_telemetry_record_t* record) {
+    if (telemetry_count == 0) {
+        return false;
+    }
 
-static inline uint8_t convert_5_bit_mods_to_8_bit(uint8_t mods_5_bit) {
-    if ((mods_5_bit & MODS_5_BIT_RL_BIT) == 0) {
-        // left mods are same in 5 and 8-bit
-        return mods_5_bit;
+    *record = telemetry_records[telemetry_oldest_index];
+    telemetry_count--;
+    if (++telemetry_oldest_index == PTH_TELEMETRY_SIZE) {
+        telemetry_oldest_index = 0;
     }
+    return true;
+}
 
-    // disable RL bit, then shift result by 4 bits
-    return (uint8_t)((mods_5_bit & ~MODS_5_BIT_RL_BIT) << 4);
+const pth_telemetry_counters_t* pth_get_telemetry_counters(void) {
+    return &telemetry_counters;
 }
 
-static uint8_t get_5_bit_mods_of_mod_tap(uint16_t keycode) {
-    // mod_config modifies the mod if certain settings are active (such as swapping keys)
-    return mod_config(QK_MOD_TAP_GET_MODS(keycode));
+void pth_clear_telemetry(void) {
+    telemetry_oldest_index = 0;
+    telemetry_count        = 0;
+    telemetry_counters     = (pth_telemetry_counters_t){0};
 }
 
-/**
- * @brief Sets the bit at `index` in `bitmask` to `is_set`.
- */
-static inline uint8_t change_bit(uint8_t bitmask, uint8_t index, bool is_set) {
-    return (bitmask & ~(1U << index)) | (is_set << index);
+#    ifdef CONSOLE_ENABLE
+void pth_print_telemetry(void) {
+    const pth_telemetry_counters_t* c = &telemetry_counters;
+    uprintf("PTH telemetry: holds=%u release_record_overflows=%u tap_release_overflows=%u output_queue_overflows=%u dropped_records=%u\n", c->holds, c->release_record_overflows, c->tap_release_overflows, c->output_queue_overflows, c->dropped_records);
+#        ifdef PTH_EARLY_DECISION_ENABLE
+    uprintf("  early decisions: %u confirmed=%u wrong=%u\n", c->decisions[PTH_PATH_EARLY], c->early_confirmed, c->early_wrong);
+#        endif
+
+    uprintf("  decisions per path:");
+    for (uint8_t i = 0; i < PTH_PATH_COUNT; i++) {
+        uprintf(" %u", c->decisions[i]);
+    }
+    uprintf("\n");
+
+    pth_telemetry_record_t r;
+    while (pth_pop_telemetry_record(&r)) {
+        uprintf("  keycode=0x%04X press=%u latency=%u path=%u flags=%u p2s=%u s2t=%u p2sr=%u prev_p2p=%d prev_overlap=%d min_overlap=%u\n", r.keycode, r.press_time, TIMER_DIFF_16(r.decision_time, r.press_time), r.path, r.flags, r.press_to_second_press_dur, r.second_press_to_third_press_dur, r.press_to_second_release_dur, r.prev_press_to_pth_press_dur, r.prev_overlap_dur, r.min_overlap_dur_for_hold);
+    }
 }
+#    endif // CONSOLE_ENABLE
+
+#else
+#    define PTH_TELEMETRY_COUNT(counter) ((void)0)
+#endif // PTH_TELEMETRY_ENABLE
+
+#ifdef PTH_TRACE_ENABLE
+// Trace
+// ----------------------------------------------------------------------------
+// The sum of the oldest index and the count has to fit in a uint8_t.
+_Static_assert(PTH_TRACE_SIZE <= 127, "PTH_TRACE_SIZE must not be larger than 127.");
+
+static pth_trace_record_t trace_records[PTH_TRACE_SIZE];
+static uint8_t            trace_oldest_index = 0;
+static uint8_t            trace_count        = 0;
+static uint16_t           trace_dropped      = 0;
+
+static void push_trace_record(uint16_t site, int16_t a, int16_t b, int16_t c, int16_t d) {
+    uint8_t index = trace_oldest_index + trace_count;
+    if (index >= PTH_TRACE_SIZE) {
+        index -= PTH_TRACE_SIZE;
+    }
+    trace_count++;
 
-static inline uint8_t clear_bit(uint8_t bitmask, uint8_t index) {
-    return bitmask & ~(1U << index);
+    trace_records[index] = (pth_trace_record_t){.site = site, .time = timer_read(), .values = {a, b, c, d}};
 }
 
-static inline uint8_t set_bit(uint8_t bitmask, uint8_t index) {
-    return bitmask | (1U << index);
+static void record_trace(uint16_t line, int16_t a, int16_t b, int16_t c, int16_t d) {
+    // After records were dropped, one slot is needed to report that first.
+    if (trace_count >= PTH_TRACE_SIZE - (trace_dropped > 0 ? 1 : 0)) {
+        if (trace_dropped < UINT16_MAX) {
+            trace_dropped++;
+        }
+        return;
+    }
+
+    if (trace_dropped > 0) {
+        push_trace_record(0, (int16_t)trace_dropped, 0, 0, 0);
+        trace_dropped = 0;
+    }
+    push_trace_record((line << 3) | pth.status, a, b, c, d);
 }
 
-/**
- * @brief Determines if two keys are on the same side.
- *
- * Each side configuration determines how the key behaves if it is the PTH key,
- * and how it behaves if it is any other key. So, first we extract the
- * respective atomic side from each configuration.
- *
- * The rules are:
- * 1. If other is opposite, return false (not considered the same side).
- * 2. If other is same, return true;
- * 3. If PTH is opposite, return false.
- * 4. If PTH is same, return true;
- * 5. If both sides are equal, return true, false otherwise.
- *
- * @param other_atomic_side one of PTH_ATOM_LEFT, PTH_ATOM_RIGHT,
- *                          PTH_ATOM_OPPOSITE, PTH_ATOM_SAME
- * @return true if the resulting sides are considered the same, false otherwise.
- */
-static bool is_same_side_as_pth(uint8_t other_atomic_side) {
-    // Combine the two 2-bit atomic sides to form a 4-bit index (0-15).
-    uint8_t index = (pth_atomic_side << 2) | other_atomic_side;
+static bool pop_trace_record(pth_trace_record_t* record) {
+    if (trace_count == 0) {
+        return false;
+    }
 
-    // LUT containing the results for all 16 possible side comparisons.
-    const uint16_t truth_table = 0b1011100010101001;
+    *record = trace_records[trace_oldest_index];
+    trace_count--;
+    if (++trace_oldest_index == PTH_TRACE_SIZE) {
+        trace_oldest_index = 0;
+    }
+    return true;
+}
 
-    // Look up the result in the table.
-    return (truth_table >> index) & 1;
+uint8_t pth_read_trace(uint8_t* buffer, uint8_t size) {
+    uint8_t            written = 0;
+    pth_trace_record_t record;
+    while (written + sizeof(record) <= size && pop_trace_record(&record)) {
+        memcpy(buffer + written, &record, sizeof(record));
+        written += sizeof(record);
+    }
+    return written;
 }
 
-// Convenience function
-static inline bool is_record_same_side_as_pth(keyrecord_t* record) {
-    uint8_t other_side = PTH_GET_OTHER_ATOM_SIDE(pth_get_side(record));
-    return is_same_side_as_pth(other_side);
+#    ifdef CONSOLE_ENABLE
+// One record per call, so that the console isn't flooded while typing.
+static void print_trace(void) {
+    pth_trace_record_t r;
+    if (pop_trace_record(&r)) {
+        uprintf("PTH trace: %04X %04X %04X %04X %04X %04X\n", r.site, r.time, (uint16_t)r.values[0], (uint16_t)r.values[1], (uint16_t)r.values[2], (uint16_t)r.values[3]);
+    }
 }
+#    endif // CONSOLE_ENABLE
+#endif // PTH_TRACE_ENABLE
 
-// Public functions
+#ifdef PTH_CAPTURE_ENABLE
+// Capture
 // ----------------------------------------------------------------------------
-pth_status_t pth_get_status(void) {
-    return pth_status;
+// Records are added to one report, while the other one (if full) waits for
+// the housekeeping task, which sends at most one report per call. So a key
+// event never waits for raw HID.
+#    define CAPTURE_RECORDS_PER_REPORT ((PTH_CAPTURE_REPORT_SIZE - PTH_CAPTURE_HEADER_SIZE) / PTH_CAPTURE_RECORD_SIZE)
+
+static uint8_t  capture_reports[2][PTH_CAPTURE_REPORT_SIZE];
+static uint8_t  capture_filling    = 0;
+static uint8_t  capture_used       = PTH_CAPTURE_HEADER_SIZE;
+static bool     capture_other_full = false;
+static bool     capture_enabled    = true;
+static uint8_t  capture_sequence   = 0;
+static uint16_t capture_dropped    = 0;
+static uint16_t capture_last_time  = 0;
+
+void pth_set_capture_enabled(bool enabled) {
+    capture_enabled = enabled;
 }
 
-pth_status_t pth_get_prev_status(void) {
-    return pth_prev_status;
+bool pth_is_capture_enabled(void) {
+    return capture_enabled;
 }
 
-int16_t pth_get_prev_press_to_pth_press_dur(void) {
-    return pth_prev_press_to_pth_press_dur;
-}
+static void finish_capture_report(void) {
+    uint8_t* report = capture_reports[capture_filling];
+    report[0]       = PTH_CAPTURE_REPORT_ID;
+    report[1]       = capture_sequence++;
+    report[2]       = capture_used - PTH_CAPTURE_HEADER_SIZE;
+    memset(report + capture_used, 0, PTH_CAPTURE_REPORT_SIZE - capture_used);
 
-uint8_t pth_get_pth_atomic_side(void) {
-    return pth_atomic_side;
+    capture_other_full = true;
+    capture_filling ^= 1;
+    capture_used = PTH_CAPTURE_HEADER_SIZE;
 }
 
-uint8_t pth_get_pth_side_user_bits(void) {
-    return pth_side_user_bits;
+static void push_capture_record(uint8_t type, uint8_t info, uint8_t delta, uint8_t a, uint8_t b) {
+    if (capture_used + PTH_CAPTURE_RECORD_SIZE > PTH_CAPTURE_REPORT_SIZE) {
+        finish_capture_report();
+    }
+
+    uint8_t* record = capture_reports[capture_filling] + capture_used;
+    record[0]       = (type << 6) | info;
+    record[1]       = delta;
+    record[2]       = a;
+    record[3]       = b;
+    capture_used += PTH_CAPTURE_RECORD_SIZE;
 }
 
-bool pth_is_second_same_side_as_pth(void) {
-    return second_is_same_side_as_pth;
+static void record_capture(uint8_t type, uint8_t info, uint16_t time, keypos_t pos) {
+    if (!capture_enabled) {
+        return;
+    }
+
+    // A decision can be made at an earlier time than the event before it,
+    // if that event has its own time (PTH_USE_EVENT_TIME).
+    uint16_t delta = TIMER_DIFF_16(time, capture_last_time);
+    if (delta >= UINT16_MAX / 2) {
+        delta = 0;
+        time  = capture_last_time;
+    }
+
+    const uint8_t needed    = 1 + (capture_dropped > 0) + (delta > UINT8_MAX);
+    uint8_t       available = (PTH_CAPTURE_REPORT_SIZE - capture_used) / PTH_CAPTURE_RECORD_SIZE;
+    if (!capture_other_full) {
+        available += CAPTURE_RECORDS_PER_REPORT;
+    }
+    if (available < needed) {
+        if (capture_dropped < UINT16_MAX) {
+            capture_dropped++;
+        }
+        return;
+    }
+
+    if (capture_dropped > 0) {
+        push_capture_record(PTH_CAPTURE_META, PTH_CAPTURE_META_DROPPED, 0, capture_dropped & 0xFF, capture_dropped >> 8);
+        capture_dropped = 0;
+    }
+    if (delta > UINT8_MAX) {
+        push_capture_record(PTH_CAPTURE_META, PTH_CAPTURE_META_PAUSE, 0, delta & 0xFF, delta >> 8);
+        delta = 0;
+    }
+    push_capture_record(type, info, delta, pos.row, pos.col);
+    capture_last_time = time;
 }
 
-keyrecord_t pth_get_pth_record(void) {
-    return pth_record;
+static uint8_t get_capture_class(uint16_t keycode) {
+    if (IS_QK_MOD_TAP(keycode)) {
+        return PTH_CAPTURE_CLASS_MOD_TAP;
+    }
+    if (IS_QK_LAYER_TAP(keycode)) {
+        return PTH_CAPTURE_CLASS_LAYER_TAP;
+    }
+    if (pth_is_tap_hold_keycode(keycode)) {
+        return PTH_CAPTURE_CLASS_TAP_HOLD;
+    }
+    if (IS_QK_MOMENTARY(keycode)) {
+        return PTH_CAPTURE_CLASS_MOMENTARY_LAYER;
+    }
+
+    switch (keycode) {
+        case KC_A ... KC_Z:
+            return PTH_CAPTURE_CLASS_LETTER;
+        case KC_1 ... KC_0:
+            return PTH_CAPTURE_CLASS_DIGIT;
+        case KC_SPC:
+            return PTH_CAPTURE_CLASS_SPACE;
+        case KC_MINS ... KC_SLSH:
+            return PTH_CAPTURE_CLASS_PUNCTUATION;
+        case KC_BSPC:
+            return PTH_CAPTURE_CLASS_BACKSPACE;
+        case KC_LCTL ... KC_RGUI:
+            return PTH_CAPTURE_CLASS_MODIFIER;
+    }
+    return PTH_CAPTURE_CLASS_OTHER;
 }
 
-keyrecord_t pth_get_second_record(void) {
-    return second_record;
+static void send_capture_report(void) {
+    if (!capture_other_full && capture_used > PTH_CAPTURE_HEADER_SIZE && TIMER_DIFF_16(timer_read(), capture_last_time) >= PTH_CAPTURE_FLUSH_MS) {
+        finish_capture_report();
+    }
+
+    if (capture_other_full) {
+        raw_hid_send(capture_reports[capture_filling ^ 1], PTH_CAPTURE_REPORT_SIZE);
+        capture_other_full = false;
+    }
 }
 
-uint16_t pth_get_pth_keycode(void) {
-    return pth_keycode;
+#    define PTH_CAPTURE_KEY_EVENT(keycode, record, time) record_capture((record)->event.pressed ? PTH_CAPTURE_PRESS : PTH_CAPTURE_RELEASE, get_capture_class(keycode), time, (record)->event.key)
+#    define record_capture_decision(hold) record_capture(PTH_CAPTURE_DECISION, decision_path | ((hold) ? PTH_CAPTURE_HOLD : 0), timer_read(), pth.record.event.key)
+#else
+#    define PTH_CAPTURE_KEY_EVENT(keycode, record, time) ((void)0)
+#endif // PTH_CAPTURE_ENABLE
+
+#if defined(PTH_TELEMETRY_ENABLE) || defined(PTH_CAPTURE_ENABLE)
+static void record_decision(bool hold) {
+#    ifdef PTH_TELEMETRY_ENABLE
+    record_telemetry_decision(hold);
+#    endif
+#    ifdef PTH_CAPTURE_ENABLE
+    record_capture_decision(hold);
+#    endif
+    decision_path = PTH_PATH_NONE;
 }
 
-uint16_t pth_get_second_keycode(void) {
-    return second_keycode;
+#    define PTH_RECORD_DECISION(hold) record_decision(hold)
+#else
+#    define PTH_RECORD_DECISION(hold) ((void)0)
+#endif
+
+#ifdef PTH_BENCHMARK_ENABLE
+// Benchmark
+// ----------------------------------------------------------------------------
+// The cycle counters. cycles_since has to handle a counter that wrapped once.
+#    if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+// The DWT cycle counter of Cortex-M3, M4, M7 and M33 (e.g. STM32F4)
+#        define BENCH_DEMCR (*(volatile uint32_t*)0xE000EDFCUL)
+#        define BENCH_DWT_CTRL (*(volatile uint32_t*)0xE0001000UL)
+#        define BENCH_DWT_CYCCNT (*(volatile uint32_t*)0xE0001004UL)
+
+static void start_cycle_counter(void) {
+    // TRCENA, then CYCCNTENA
+    BENCH_DEMCR |= 1UL << 24;
+    BENCH_DWT_CYCCNT = 0;
+    BENCH_DWT_CTRL |= 1UL;
 }
 
-uint16_t pth_get_prev_press_keycode(void) {
-    return prev_press_keycode;
+static inline uint32_t read_cycles(void) {
+    return BENCH_DWT_CYCCNT;
 }
 
-uint16_t pth_get_second_keycode_on_same_layer_as_pth(void) {
-    if (!pth_was_held_instantly || !IS_QK_LAYER_TAP(pth_keycode)) {
-        return KC_NO;
+static inline uint32_t cycles_since(uint32_t start) {
+    return BENCH_DWT_CYCCNT - start;
+}
+#    elif defined(__ARM_ARCH_6M__)
+// Cortex-M0+ (e.g. RP2040) has no DWT cycle counter, so SysTick is used, which
+// counts down to 0 with the core clock and then starts again at its reload
+// value. If it is already running, its reload value is kept, so a path that
+// takes longer than that period is measured modulo the period.
+#        define BENCH_SYST_CSR (*(volatile uint32_t*)0xE000E010UL)
+#        define BENCH_SYST_RVR (*(volatile uint32_t*)0xE000E014UL)
+#        define BENCH_SYST_CVR (*(volatile uint32_t*)0xE000E018UL)
+
+static void start_cycle_counter(void) {
+    if (!(BENCH_SYST_CSR & 1UL)) {
+        BENCH_SYST_RVR = 0xFFFFFFUL;
+        BENCH_SYST_CVR = 0;
+        // core clock, enabled
+        BENCH_SYST_CSR = 0b101;
     }
-    return get_keycode_same_pos_in_layer(&second_record, layer_before_instant_layer_tap);
 }
 
-bool pth_is_second_tap_hold(void) {
-    return second_is_tap_hold;
+static inline uint32_t read_cycles(void) {
+    return BENCH_SYST_CVR;
 }
 
-bool pth_is_processing_internal(void) {
-    return is_processing_record_due_to_pth;
+static inline uint32_t cycles_since(uint32_t start) {
+    const uint32_t now = BENCH_SYST_CVR;
+    return start >= now ? start - now : start + BENCH_SYST_RVR + 1 - now;
+}
+#    elif defined(__AVR__)
+// Timer 1 without a prescaler. It wraps after 65536 cycles (4 ms at 16 MHz),
+// so longer paths (e.g. with waits) are measured modulo that.
+static void start_cycle_counter(void) {
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
 }
 
-bool pth_is_tap_hold_keycode(uint16_t keycode) {
-    switch (keycode) {
-        case QK_MOD_TAP ... QK_MOD_TAP_MAX:
-        case QK_LAYER_TAP ... QK_LAYER_TAP_MAX:
-            return true;
-        case QK_SWAP_HANDS ... QK_SWAP_HANDS_MAX:
-            return !IS_SWAP_HANDS_KEYCODE(keycode);
-    }
-    return false;
+static inline uint32_t read_cycles(void) {
+    return TCNT1;
 }
 
-uint8_t pth_get_all_8_bit_mods(void) {
-    // TODO: Use weak_mods or not?
-#ifdef NO_ACTION_ONESHOT
-    return get_mods(); //| get_weak_mods();
-#else
-    return get_mods() | get_oneshot_mods(); //| get_weak_mods();
-#endif // NO_ACTION_ONESHOT
+static inline uint32_t cycles_since(uint32_t start) {
+    return (uint16_t)(TCNT1 - start);
 }
+#    elif defined(__x86_64__) || defined(__i386__)
+// TSC ticks, e.g. in the simulator
+static void start_cycle_counter(void) {}
 
-uint8_t pth_get_8_bit_mods_of_mod_tap(uint16_t keycode) {
-    return convert_5_bit_mods_to_8_bit(get_5_bit_mods_of_mod_tap(keycode));
+static inline uint32_t read_cycles(void) {
+    return (uint32_t)__builtin_ia32_rdtsc();
 }
 
-bool pth_is_mod_tap_with_any_mods_of(uint16_t keycode, uint8_t mods_8_bit) {
-    return IS_QK_MOD_TAP(keycode) && (pth_get_8_bit_mods_of_mod_tap(keycode) & mods_8_bit) != 0;
+static inline uint32_t cycles_since(uint32_t start) {
+    return (uint32_t)__builtin_ia32_rdtsc() - start;
 }
+#    else
+#        error "PTH_BENCHMARK_ENABLE has no cycle counter for this MCU."
+#    endif
 
-bool pth_default_should_hold_instantly(uint16_t keycode, keyrecord_t* record) {
-#ifdef PTH_DONT_HOLD_INSTANTLY
-        return false;
-#endif
+static pth_benchmark_stats_t bench_stats[PTH_BENCH_COUNT];
+static bool                  bench_running  = false;
+static uint32_t              bench_overhead = 0;
 
-#ifdef CAPS_WORD_ENABLE
-    // Instantly holding will result in a held tap-hold key being processed,
-    // thus breaking caps words.
-    if (is_caps_word_on()) {
-        return false;
+static void record_bench(uint8_t path, uint32_t cycles) {
+    if (!bench_running) {
+        return;
     }
-#endif
 
-    // It seems there are only downsides to instant holding GUI.
-    const uint8_t active_mods_or_gui = pth_get_all_8_bit_mods() | MOD_MASK_GUI;
-    if (pth_is_mod_tap_with_any_mods_of(keycode, active_mods_or_gui)) {
-        // PTH is a mod-tap containing mods that are already active (or GUI).
-        //
-        // This is a workaround for QMK's behavior of reporting a modifier
-        // release to the OS, if a key with multiple modifiers is released,
-        // even if another key with one of those modifiers is still down.
-        //
-        // Example: KC_LSFT down, LCS_T(KC_E) down -> Shift and Ctrl are down,
-        // ... (other presses), LCS_T(KC_E) up, KC_T down. When LCS_T(KC_E) was
-        // released, QMK reported left Shift as released, even though KC_LSFT
-        // is still pressed. The result is that KC_T is not uppercased.
-        //
-        // Of course, this workaround only helps with the instant hold, so if
-        // hold is chosen, this still happens, but that's probably okay.
-        //
-        // A full workaround in your own keymap is to use the right version on
-        // bare modifier keys (e.g. KC_RSFT), and the left version of modifiers
-        // on all tap-hold keys (e.g. LCS_T(KC_A)) or vice versa. It works
-        // because modifiers of different sides don't affect each other. If a
-        // left mod is down, and then a right mod is up, the release of the
-        // left mod will still be reported to the OS when it happens.
-        return false;
+    cycles                   = cycles > bench_overhead ? cycles - bench_overhead : 0;
+    pth_benchmark_stats_t* s = &bench_stats[path];
+    if (s->count == 0 || cycles < s->min) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    // stop counting before the mean would be wrong
+    if (s->count < UINT16_MAX && s->total <= UINT32_MAX - cycles) {
+        s->count++;
+        s->total += cycles;
     }
-
-    return true;
 }
 
-extern const uint8_t pth_side_layout[MATRIX_ROWS][MATRIX_COLS] PROGMEM;
+typedef struct {
+    uint8_t  path;
+    uint32_t start;
+} bench_scope_t;
 
-uint8_t pth_get_side_from_layout(keypos_t pos) {
-    return (uint8_t)pgm_read_byte(&pth_side_layout[pos.row][pos.col]);
+static void end_bench_scope(const bench_scope_t* scope) {
+    record_bench(scope->path, cycles_since(scope->start));
 }
 
-// Weakly defined functions
+// Measures the rest of the enclosing block, no matter where it returns.
+#    define PTH_BENCH_SCOPE(path) const bench_scope_t bench_scope __attribute__((cleanup(end_bench_scope))) = {(path), read_cycles()}
+#else
+#    define PTH_BENCH_SCOPE(path) ((void)0)
+#endif // PTH_BENCHMARK_ENABLE
+
+#ifdef PTH_ADAPTIVE_FACTORS
+// Adaptive factors
 // ----------------------------------------------------------------------------
-__attribute__((weak)) uint8_t pth_get_side(keyrecord_t* record) {
-    return pth_get_side_from_layout(record->event.key);
+// A decision of a PTH key with a second key is remembered, and the following
+// presses tell whether it was corrected:
+//
+// - TAPPED, then PTH_ADAPTIVE_CORRECTION_KEY (TAP_UNDONE), then the same key
+//   is pressed next (TAP_REDONE) and decided as hold. So the tap should have
+//   been a hold.
+// - HELD, then the same key is pressed next (HOLD_REDONE) and decided as tap
+//   with the same second key. So the hold should have been a tap.
+typedef enum { CORRECTION_NONE, CORRECTION_TAPPED, CORRECTION_TAP_UNDONE, CORRECTION_TAP_REDONE, CORRECTION_HELD, CORRECTION_HOLD_REDONE } correction_stage_t;
+
+typedef struct {
+    keypos_t pos;
+    uint16_t second_keycode;
+    uint16_t timer;
+    uint8_t  stage;
+} correction_t;
+
+#    define ADAPTIVE_MAGIC 0x50
+
+// This is also the layout of each slot in EEPROM.
+typedef struct {
+    uint8_t magic;
+    uint8_t sequence;
+    uint8_t checksum;
+    int8_t  steps[MATRIX_ROWS][MATRIX_COLS];
+} adaptive_slot_t;
+
+static correction_t    correction          = {.pos = EMPTY_KEYPOS};
+static adaptive_slot_t adaptive            = {.magic = ADAPTIVE_MAGIC};
+static uint8_t         adaptive_slot_index = PTH_ADAPTIVE_EEPROM_SLOTS - 1;
+static bool            adaptive_is_dirty   = false;
+
+static uint8_t get_adaptive_checksum(const adaptive_slot_t* slot) {
+    uint8_t       sum   = slot->magic + slot->sequence;
+    const int8_t* steps = &slot->steps[0][0];
+    for (uint16_t i = 0; i < MATRIX_ROWS * MATRIX_COLS; i++) {
+        sum += (uint8_t)steps[i];
+    }
+    return sum;
 }
 
-#ifdef PTH_FAST_STREAK_TAP_ENABLE
-__attribute__((weak)) bool pth_is_fast_streak_tap_key(uint16_t keycode) {
-    if ((get_mods() & (MOD_MASK_CG | MOD_BIT_LALT)) != 0) {
-        return false; // Disable when non-Shift (and non-right-Alt) mods are active.
-    }
+static void* get_adaptive_slot_address(uint8_t index) {
+    return (void*)(uintptr_t)(PTH_ADAPTIVE_EEPROM_ADDR + index * sizeof(adaptive_slot_t));
+}
 
-    switch (get_tap_keycode(keycode)) {
-        case KC_A ... KC_Z:
-        case KC_SPC:
-        case KC_DOT:
-        case KC_COMM:
-        case KC_SCLN:
-        case KC_SLSH:
-            return true;
+static void load_adaptive_factors(void) {
+    // The slots are written in turn, each with the next sequence number, so
+    // the newest valid slot is the one whose sequence number is the largest
+    // (with wrap-around).
+    bool found = false;
+    for (uint8_t i = 0; i < PTH_ADAPTIVE_EEPROM_SLOTS; i++) {
+        adaptive_slot_t slot;
+        eeprom_read_block(&slot, get_adaptive_slot_address(i), sizeof(slot));
+        if (slot.magic != ADAPTIVE_MAGIC || slot.checksum != get_adaptive_checksum(&slot)) {
+            continue;
+        }
+        if (!found || (uint8_t)(slot.sequence - adaptive.sequence) < 128) {
+            adaptive            = slot;
+            adaptive_slot_index = i;
+            found               = true;
+        }
     }
-    return false;
-}
 
-__attribute__((weak)) bool pth_predict_fast_streak_tap(void) {
-    return (pth_is_fast_streak_tap_key(pth_keycode) && pth_is_fast_streak_tap_key(prev_press_keycode) && pth_prev_status != PTH_DECIDED_HOLD && pth_prev_press_to_pth_press_dur < 125);
+    // PTH_ADAPTIVE_MAX_STEPS may have been lowered since they were written
+    int8_t* steps = &adaptive.steps[0][0];
+    for (uint16_t i = 0; i < MATRIX_ROWS * MATRIX_COLS; i++) {
+        steps[i] = MAX(MIN(steps[i], PTH_ADAPTIVE_MAX_STEPS), -PTH_ADAPTIVE_MAX_STEPS);
+    }
 }
-#endif // PTH_FAST_STREAK_TAP_ENABLE
 
-#ifndef PTH_DONT_HOLD_INSTANTLY
-__attribute__((weak)) bool pth_should_hold_instantly(uint16_t keycode, keyrecord_t* record) {
-    return pth_default_should_hold_instantly(keycode, record);
-}
+void pth_save_adaptive_factors(void) {
+    if (!adaptive_is_dirty) {
+        return;
+    }
 
-__attribute__((weak)) bool pth_second_should_hold_instantly(uint16_t second_keycode, keyrecord_t* second_record) {
-    return pth_should_hold_instantly(second_keycode, second_record);
+    adaptive_slot_index = (adaptive_slot_index + 1) % PTH_ADAPTIVE_EEPROM_SLOTS;
+    adaptive.sequence++;
+    adaptive.checksum = get_adaptive_checksum(&adaptive);
+    eeprom_update_block(&adaptive, get_adaptive_slot_address(adaptive_slot_index), sizeof(adaptive));
+    adaptive_is_dirty = false;
+
+    PTH_LOGF("Adaptive factors written to slot %u.", adaptive_slot_index);
 }
-#endif // PTH_DONT_HOLD_INSTANTLY
 
-__attribute__((weak)) bool pth_should_choose_tap_when_second_is_same_side_press(void) {
-    // If this is a non-tap-hold same-side second, then that implies key roll.
-    // We consider whether second is tap-hold, even if an instant layer tap is
-    // active, so that it would be possible to use that, and then activate
-    // a mod tap on that new layer.
-    return !second_is_tap_hold;
+void pth_reset_adaptive_factors(void) {
+    memset(adaptive.steps, 0, sizeof(adaptive.steps));
+    adaptive_is_dirty = true;
 }
 
-__attribute__((weak)) bool pth_should_choose_tap_when_second_is_same_side_release(void) {
-    // We haven't made a choice, the second key is on same side as PTH, and
-    // the second key is released before a third is pressed.
-    // It is highly likely that this is a key roll, so choose tap.
-    PTH_LOG("  Same-side second key release implies roll.");
-    return true;
+int8_t pth_get_adaptive_steps(keypos_t pos) {
+    if (pos.row >= MATRIX_ROWS || pos.col >= MATRIX_COLS) {
+        return 0;
+    }
+    return adaptive.steps[pos.row][pos.col];
 }
 
-__attribute__((weak)) int16_t pth_get_timeout_for_forcing_choice(void) {
-    return 700;
+pth_real_t pth_get_adaptive_factor_offset(void) {
+    return (pth_real_t)(pth_get_adaptive_steps(pth.record.event.key) * PTH_REAL(PTH_ADAPTIVE_STEP));
 }
 
-__attribute__((weak)) pth_status_t pth_get_forced_choice_after_timeout(void) {
-    if (has_second) {
-        return PTH_IDLE;
+static void adjust_adaptive_steps(keypos_t pos, int8_t delta) {
+    if (pos.row >= MATRIX_ROWS || pos.col >= MATRIX_COLS) {
+        return;
     }
-    return PTH_DECIDED_HOLD;
-}
 
-__attribute__((weak)) bool pth_should_neutralize_mods(uint8_t mod_5_bit) {
-    // We want to neutralize mods (Alt and Gui) unless they include Shift and
-    // Ctrl, because 1. they don't need to be neutralized, and 2. because doing
-    // so for Ctrl leads to control characters being output in some consoles.
-    // We use the left version, as we don't care whether it's left or right.
-    return (mod_5_bit & (MOD_LCTL | MOD_LSFT)) == 0;
+    int8_t steps = adaptive.steps[pos.row][pos.col] + delta;
+    if (steps > PTH_ADAPTIVE_MAX_STEPS || steps < -PTH_ADAPTIVE_MAX_STEPS) {
+        return;
+    }
+
+    adaptive.steps[pos.row][pos.col] = steps;
+    adaptive_is_dirty                = true;
+    PTH_LOGF("  Correction recognized, adaptive steps of this key are now %d.", steps);
 }
 
-__attribute__((weak)) uint16_t pth_get_code_to_be_registered_instead_when_hold_chosen(void) {
-    return KC_NO;
+static void observe_decision_for_adaptation(bool hold) {
+    if (get_tap_keycode(pth.keycode) == PTH_ADAPTIVE_CORRECTION_KEY) {
+        // part of a correction (if it is a tap-hold itself)
+        return;
+    }
+
+    const keypos_t pos      = pth.record.event.key;
+    const uint16_t cur_time = timer_read();
+
+    if (correction.stage != CORRECTION_NONE && keypos_eq(pos, correction.pos) && TIMER_DIFF_16(cur_time, correction.timer) < PTH_ADAPTIVE_CORRECTION_MS) {
+        if (hold && correction.stage == CORRECTION_TAP_REDONE) {
+            adjust_adaptive_steps(pos, 1);
+            correction.stage = CORRECTION_NONE;
+            return;
+        }
+
+        if (!hold && correction.stage == CORRECTION_HOLD_REDONE && pth.has_second && pth.second_keycode == correction.second_keycode) {
+            adjust_adaptive_steps(pos, -1);
+            correction.stage = CORRECTION_NONE;
+            return;
+        }
+    }
+
+    // Without a second key, there was nothing to predict.
+    if (!pth.has_second) {
+        correction.stage = CORRECTION_NONE;
+        return;
+    }
+
+    correction = (correction_t){.pos = pos, .second_keycode = pth.second_keycode, .timer = cur_time, .stage = hold ? CORRECTION_HELD : CORRECTION_TAPPED};
 }
 
-__attribute__((weak)) bool pth_should_register_as_hold_when_same_side(uint16_t keycode, keyrecord_t* record) {
-    return true;
+static void observe_press_for_adaptation(uint16_t keycode, keypos_t pos, uint16_t cur_time) {
+    if (correction.stage == CORRECTION_NONE) {
+        return;
+    }
+
+    if (TIMER_DIFF_16(cur_time, correction.timer) >= PTH_ADAPTIVE_CORRECTION_MS) {
+        correction.stage = CORRECTION_NONE;
+        return;
+    }
+
+    switch (correction.stage) {
+        case CORRECTION_TAPPED:
+        case CORRECTION_TAP_UNDONE:
+            if (get_tap_keycode(keycode) == PTH_ADAPTIVE_CORRECTION_KEY) {
+                correction.stage = CORRECTION_TAP_UNDONE;
+                correction.timer = cur_time;
+            } else if (correction.stage == CORRECTION_TAP_UNDONE) {
+                correction.stage = keypos_eq(pos, correction.pos) ? CORRECTION_TAP_REDONE : CORRECTION_NONE;
+            }
+            break;
+        case CORRECTION_HELD:
+            // typing it again has to start with the same key
+            correction.stage = keypos_eq(pos, correction.pos) ? CORRECTION_HOLD_REDONE : CORRECTION_NONE;
+            break;
+        default:
+            // the decision of the key pressed again will tell
+            break;
+    }
 }
+#else
+#    define observe_decision_for_adaptation(hold) ((void)0)
+#    define observe_press_for_adaptation(keycode, pos, cur_time) ((void)0)
+#endif // PTH_ADAPTIVE_FACTORS
 
-// Key handling
+#ifdef PTH_ADAPTIVE_TIMEOUT
+// Adaptive timeout
 // ----------------------------------------------------------------------------
-static void process_record_with_new_time(keyrecord_t* record) {
-    record->event.time              = timer_read();
-    is_processing_record_due_to_pth = true;
-    process_record(record);
-    is_processing_record_due_to_pth = false;
+// For the last PTH_ADAPTIVE_TIMEOUT_KEYS PTH keys, two histograms of
+// durations are kept, in bins of TIMEOUT_BIN_MS (the last one also counts
+// everything longer):
+//
+// - tapped: from press to release, when it was decided as tap. A timeout
+//   shorter than these would have turned them into holds.
+// - held: from press to the next press of another key (or its release, if
+//   there was none), when it was decided as hold.
+//
+// The timeout of a key is the percentile of its taps, once it has enough
+// samples of both. So a key that is only tapped briefly commits sooner when
+// it is held alone, while a key that is rarely held keeps the default.
+// Taps with a second key are decided without the timeout, so a shorter one
+// doesn't hide their long durations.
+#    define TIMEOUT_BIN_MS 50
+#    define TIMEOUT_BINS 14
+
+typedef struct {
+    keypos_t pos;
+    uint8_t  tapped[TIMEOUT_BINS];
+    uint8_t  held[TIMEOUT_BINS];
+} timeout_histograms_t;
+
+static timeout_histograms_t timeout_histograms[PTH_ADAPTIVE_TIMEOUT_KEYS];
+
+typedef enum { TIMEOUT_UNDECIDED, TIMEOUT_TAPPED, TIMEOUT_HELD } timeout_decision_t;
+
+// The last PTH key, until it is released and decided. Its release is seen
+// before the decision it may cause.
+static struct {
+    keypos_t pos;
+    uint16_t timer;
+    uint16_t release_dur;
+    uint8_t  decision;          // timeout_decision_t
+    bool     other_pressed : 1; // another key was pressed since its press
+    bool     released : 1;
+} timeout_watch = {.pos = EMPTY_KEYPOS};
+
+static uint16_t get_histogram_count(const uint8_t* bins) {
+    uint16_t count = 0;
+    for (uint8_t i = 0; i < TIMEOUT_BINS; i++) {
+        count += bins[i];
+    }
+    return count;
 }
 
-static void process_register_record(keyrecord_t* record) {
-    record->event.pressed = true;
-    process_record_with_new_time(record);
+static uint16_t get_sample_count(const timeout_histograms_t* h) {
+    return get_histogram_count(h->tapped) + get_histogram_count(h->held);
 }
 
-static void process_unregister_record(keyrecord_t* record) {
-    record->event.pressed = false;
-    process_record_with_new_time(record);
+static timeout_histograms_t* find_timeout_histograms(keypos_t pos) {
+    for (uint8_t i = 0; i < PTH_ADAPTIVE_TIMEOUT_KEYS; i++) {
+        if (keypos_eq(timeout_histograms[i].pos, pos)) {
+            return &timeout_histograms[i];
+        }
+    }
+    return NULL;
 }
 
-static inline void set_record_to_tap(keyrecord_t* record) {
-    record->tap.interrupted = true;
-    record->tap.count       = 1;
+static void add_timeout_sample(keypos_t pos, bool held, uint16_t dur) {
+    timeout_histograms_t* h = find_timeout_histograms(pos);
+    if (h == NULL) {
+        // An unused entry has no samples, so it is taken first.
+        h = &timeout_histograms[0];
+        for (uint8_t i = 1; i < PTH_ADAPTIVE_TIMEOUT_KEYS; i++) {
+            if (get_sample_count(&timeout_histograms[i]) < get_sample_count(h)) {
+                h = &timeout_histograms[i];
+            }
+        }
+        *h = (timeout_histograms_t){.pos = pos};
+    }
+
+    uint8_t*      bins = held ? h->held : h->tapped;
+    const uint8_t bin  = MIN(dur / TIMEOUT_BIN_MS, TIMEOUT_BINS - 1);
+    if (bins[bin] == UINT8_MAX) {
+        // Halving both keeps their ratio, while older samples fade out.
+        for (uint8_t i = 0; i < TIMEOUT_BINS; i++) {
+            h->tapped[i] /= 2;
+            h->held[i] /= 2;
+        }
+    }
+    bins[bin]++;
+    PTH_LOGF("  Adaptive timeout: %s after %u ms.", PTH_LOG_CHOICE(held, "held", "tapped"), dur);
 }
 
-static inline void set_record_to_hold(keyrecord_t* record) {
-    record->tap.count = 0;
+/**
+ * @return the end of the bin in which PTH_ADAPTIVE_TIMEOUT_PERCENTILE % of
+ *         the samples are reached.
+ */
+static uint16_t get_histogram_percentile(const uint8_t* bins, uint16_t count) {
+    const uint16_t target = ((uint32_t)count * PTH_ADAPTIVE_TIMEOUT_PERCENTILE + 99) / 100;
+    uint16_t       sum    = 0;
+    uint8_t        i      = 0;
+    for (; i < TIMEOUT_BINS - 1; i++) {
+        sum += bins[i];
+        if (sum >= target) {
+            break;
+        }
+    }
+    return (i + 1) * TIMEOUT_BIN_MS;
 }
 
-static void process_register_record_as_hold(keyrecord_t* record) {
-    set_record_to_hold(record);
-    record->event.pressed = true;
-    process_record_with_new_time(record);
+int16_t pth_get_adaptive_timeout(keypos_t pos, int16_t timeout) {
+    const timeout_histograms_t* h = find_timeout_histograms(pos);
+    if (h == NULL || timeout <= 0) {
+        return timeout;
+    }
+
+    const uint16_t tapped_count = get_histogram_count(h->tapped);
+    if (tapped_count < PTH_ADAPTIVE_TIMEOUT_MIN_SAMPLES || get_histogram_count(h->held) < PTH_ADAPTIVE_TIMEOUT_MIN_SAMPLES) {
+        return timeout;
+    }
+
+    const uint16_t adapted = MAX(get_histogram_percentile(h->tapped, tapped_count), PTH_ADAPTIVE_TIMEOUT_MIN);
+    return MIN(adapted, (uint16_t)timeout);
 }
 
-static void process_unregister_record_as_hold(keyrecord_t* record) {
-    set_record_to_hold(record);
-    record->event.pressed = false;
-    process_record_with_new_time(record);
+void pth_reset_adaptive_timeouts(void) {
+    for (uint8_t i = 0; i < PTH_ADAPTIVE_TIMEOUT_KEYS; i++) {
+        timeout_histograms[i] = (timeout_histograms_t){.pos = EMPTY_KEYPOS};
+    }
+    timeout_watch.pos = EMPTY_KEYPOS;
 }
 
-static void process_register_record_as_tap(keyrecord_t* record) {
-    set_record_to_tap(record);
-    record->event.pressed = true;
-    process_record_with_new_time(record);
+static void start_timeout_watch(keypos_t pos, uint16_t cur_time) {
+    timeout_watch.pos           = pos;
+    timeout_watch.timer         = cur_time;
+    timeout_watch.decision      = TIMEOUT_UNDECIDED;
+    timeout_watch.other_pressed = false;
+    timeout_watch.released      = false;
 }
 
-static void process_unregister_record_as_tap(keyrecord_t* record) {
-    set_record_to_tap(record);
-    record->event.pressed = false;
-    process_record_with_new_time(record);
+static void end_timeout_watch(void) {
+    if (timeout_watch.decision == TIMEOUT_TAPPED) {
+        add_timeout_sample(timeout_watch.pos, false, timeout_watch.release_dur);
+    } else if (!timeout_watch.other_pressed) {
+        add_timeout_sample(timeout_watch.pos, true, timeout_watch.release_dur);
+    }
+    timeout_watch.pos = EMPTY_KEYPOS;
 }
 
-// will only be called if PTH was not held instantly
-static void register_pth_hold(void) {
-    if (pth_tap_code_instead_of_hold == KC_NO) {
-        process_register_record_as_hold(&pth_record);
+static void observe_event_for_timeout(bool pressed, keypos_t pos, uint16_t cur_time) {
+    if (keypos_eq(timeout_watch.pos, EMPTY_KEYPOS)) {
+        return;
+    }
 
-        // Users must know that if the second was held instantly, but the PTH
-        // was not, then we will not re-register the second, i.e. second will
-        // be down before the PTH key, even though PTH was actually first.
-        // As a result, second will not be affected by a PTH layer change.
-        //
-        // This has the benefit of allowing you to press an MT and an LT, which
-        // are both on the same layer, in any order, given that you configure
-        // pth_should_hold_instantly so that it returns false for the LT.
-        if (has_second && !second_was_held_instantly && IS_QK_LAYER_TAP(pth_keycode)) {
-            // If PTH was held instantly, then second is already from the right
-            // layer. If second was held instantly, then it still is, so no
-            // update is needed. Here, none of that is true and the PTH key is
-            // an LT, so second is out of date, as the layer wasn't active yet.
-            second_keycode     = get_keycode_same_pos_in_layer(&second_record, QK_LAYER_TAP_GET_LAYER(pth_keycode));
-            second_is_tap_hold = pth_is_tap_hold_keycode(second_keycode);
+    const uint16_t dur = TIMER_DIFF_16(cur_time, timeout_watch.timer);
+    if (!keypos_eq(pos, timeout_watch.pos)) {
+        if (pressed && !timeout_watch.other_pressed) {
+            timeout_watch.other_pressed = true;
+            if (timeout_watch.decision == TIMEOUT_HELD) {
+                add_timeout_sample(timeout_watch.pos, true, dur);
+            }
         }
-    } else {
-        register_code16(pth_tap_code_instead_of_hold);
+        return;
     }
-}
 
-static void unregister_pth_hold(void) {
-    if (pth_tap_code_instead_of_hold == KC_NO) {
-        process_unregister_record_as_hold(&pth_record);
-    } else {
-        unregister_code16(pth_tap_code_instead_of_hold);
+    if (!pressed) {
+        timeout_watch.release_dur = dur;
+        timeout_watch.released    = true;
+        if (timeout_watch.decision != TIMEOUT_UNDECIDED) {
+            end_timeout_watch();
+        }
     }
 }
 
-/*
- * We will call this in those situations where we will or can create
- * a tap that is so short that the OS might ignore it.
- */
-static void send_and_wait(void) {
-    send_keyboard_report();
-#if TAP_CODE_DELAY > 0
-    wait_ms(TAP_CODE_DELAY);
-#endif
+static void observe_decision_for_timeout(bool hold) {
+    if (!keypos_eq(timeout_watch.pos, pth.record.event.key) || timeout_watch.decision != TIMEOUT_UNDECIDED) {
+        return;
+    }
+
+    timeout_watch.decision = hold ? TIMEOUT_HELD : TIMEOUT_TAPPED;
+    if (hold && timeout_watch.other_pressed) {
+        // the other key was the second
+        add_timeout_sample(timeout_watch.pos, true, pth.features.press_to_second_press_dur);
+    }
+    if (timeout_watch.released) {
+        end_timeout_watch();
+    }
 }
+#else
+#    define start_timeout_watch(pos, cur_time) ((void)0)
+#    define observe_event_for_timeout(pressed, pos, cur_time) ((void)0)
+#    define observe_decision_for_timeout(hold) ((void)0)
+#endif // PTH_ADAPTIVE_TIMEOUT
 
-// Handling of tap-hold releases that should be taps
+#ifdef PTH_TYPING_STATS_ENABLE
+// Typing statistics
 // ----------------------------------------------------------------------------
-/**
- * @return true if the position existed in the array and was removed
- */
-static bool remove_pos_from_tap_releases(keypos_t pos) {
-    uint8_t to_check_bitmask = used_release_as_tap_positions_bitmask;
-    while (to_check_bitmask != 0) {
-        // This counts trailing zeros in an unsigned int. Note that it is
-        // undefined for a value of 0. The result is also equal to the index of
-        // the least significant set bit. (e.g. the index is 2 for 0101 0100)
-        uint8_t lsb_set_index = __builtin_ctz(to_check_bitmask);
-
-        if (keypos_eq(release_as_tap_positions[lsb_set_index], pos)) {
-            used_release_as_tap_positions_bitmask = clear_bit(used_release_as_tap_positions_bitmask, lsb_set_index);
-            return true;
-        }
+// Each kind has a ring buffer of its last durations and running sums of them,
+// so that adding a duration only subtracts the one that falls out.
+#    if PTH_TYPING_STATS_SIZE < 1 || PTH_TYPING_STATS_SIZE > 255
+#        error "PTH_TYPING_STATS_SIZE must be between 1 and 255"
+#    endif
 
-        // Clear the bit, so next iteration we get the next lowest.
-        to_check_bitmask = clear_bit(to_check_bitmask, lsb_set_index);
+typedef struct {
+    uint16_t durs[PTH_TYPING_STATS_SIZE];
+    // 4096^2 * 255 still fits into 32 bits
+    uint32_t sum_of_squares;
+    uint32_t sum;
+    // in 1/256 ms
+    int32_t ema;
+    uint8_t next;
+    uint8_t count;
+} duration_stats_t;
+
+static duration_stats_t typing_stats[PTH_STATS_KIND_COUNT];
+
+static void record_typing_stat(pth_stats_kind_t kind, uint16_t dur) {
+    duration_stats_t* stats = &typing_stats[kind];
+
+    const int32_t scaled = (int32_t)dur << 8;
+    if (stats->count == 0) {
+        stats->ema = scaled;
+    } else {
+        stats->ema += (scaled - stats->ema) >> PTH_TYPING_STATS_EMA_SHIFT;
     }
 
-    return false;
+    if (stats->count == PTH_TYPING_STATS_SIZE) {
+        const uint16_t oldest = stats->durs[stats->next];
+        stats->sum -= oldest;
+        stats->sum_of_squares -= (uint32_t)oldest * oldest;
+    } else {
+        stats->count++;
+    }
+
+    stats->durs[stats->next] = dur;
+    stats->sum += dur;
+    stats->sum_of_squares += (uint32_t)dur * dur;
+    stats->next = stats->next + 1 == PTH_TYPING_STATS_SIZE ? 0 : stats->next + 1;
 }
 
-static void add_pos_to_tap_releases(keypos_t pos) {
-    // Never call __builtin_ctz(~x) directly, as ~x will be an int, so the result
-    // will be larger than what you expect. For example:
-    // 255 = 0b1111_1111
-    // ~255 = 0b11111111111111111111111100000000
-    // So the result of ctz(~255) will be 0b1000 = 8 instead of 0
-    // To prevent that, store the result of ~x in an uint8_t variable.
-    uint8_t empty_release_as_tap_positions_bitmask = ~used_release_as_tap_positions_bitmask;
-    if (empty_release_as_tap_positions_bitmask == 0) {
-        PTH_LOGF("  There was not enough space to store (%u, %u) in release_as_tap_positions.", pos.col, pos.row);
+int16_t pth_get_typing_history_dur(pth_stats_kind_t kind, uint8_t age) {
+    const duration_stats_t* stats = &typing_stats[kind];
+    if (age >= stats->count) {
+        return -1;
+    }
+
+    // the newest is right before next
+    int16_t i = (int16_t)stats->next - 1 - age;
+    if (i < 0) {
+        i += PTH_TYPING_STATS_SIZE;
+    }
+    return stats->durs[i];
+}
+
+void pth_get_typing_stats(pth_stats_kind_t kind, pth_typing_stats_t* result) {
+    const duration_stats_t* stats = &typing_stats[kind];
+
+    *result = (pth_typing_stats_t){0};
+    if (stats->count == 0) {
         return;
     }
 
-    uint8_t lsb_set_index = __builtin_ctz(empty_release_as_tap_positions_bitmask);
+    result->count = stats->count;
+    result->last  = pth_get_typing_history_dur(kind, 0);
+    result->min   = UINT16_MAX;
+    for (uint8_t i = 0; i < stats->count; i++) {
+        const uint16_t dur = stats->durs[i];
+        if (dur < result->min) {
+            result->min = dur;
+        }
+        if (dur > result->max) {
+            result->max = dur;
+        }
+    }
 
-    release_as_tap_positions[lsb_set_index] = pos;
-    used_release_as_tap_positions_bitmask   = set_bit(used_release_as_tap_positions_bitmask, lsb_set_index);
+    // sum * sum could overflow, so it is divided by count in two parts
+    const uint8_t  count           = stats->count;
+    const uint32_t sum             = stats->sum;
+    const uint32_t sum_squared_avg = sum * (sum / count) + sum * (sum % count) / count;
+    result->mean                   = (sum + count / 2) / count;
+    result->variance               = (stats->sum_of_squares - sum_squared_avg) / count;
+    result->ema                    = (stats->ema + 128) >> 8;
 }
+#else
+#    define record_typing_stat(kind, dur) ((void)0)
+#endif // PTH_TYPING_STATS_ENABLE
 
-// Handling of release records to preserve order of presses and releases
+// Keycode cache
 // ----------------------------------------------------------------------------
-// Using an enum instead of boolean for cleaner code
-typedef enum { AFTER_SECOND, BEFORE_SECOND } release_time_t;
-
-static inline uint8_t get_to_be_released_bitmask(release_time_t release_time) {
-    const bool is_before_second = release_time == BEFORE_SECOND;
+#ifdef VIAL_ENABLE
+// Each dynamic_keymap_get_keycode reads EEPROM, which is slow on boards that
+// emulate it in flash. A sequence only needs a few keycodes, but e.g. that of
+// the second key on another layer may be needed more than once, and also by
+// the user functions, so they are kept until the next sequence starts.
+typedef struct {
+    uint8_t  layer;
+    keypos_t pos;
+    uint16_t keycode;
+} cached_keycode_t;
 
-    // -is_before_second = ~is_before_second + 1
-    //
-    // With is_before_second:
-    //  true =        0000 0001,  false =        0000 0000
-    // ~true =        1111 1110, ~false =        1111 1111
-    // ~true + 1 =    1111 1111, ~false + 1 =    0000 0000
-    // ~(~true + 1) = 0000 0000, ~(~false + 1) = 1111 1111
-    //
-    // So, if is_before_second is true, we get 0000 0000 for
-    // ~(-is_before_second), and if it's false, we get 1111 1111.
-    //
-    // Let's say is_before_second_bitmask is 1001 0101.
-    // Bits with 1 are for "before second" and 0 are for "after second".
-    //
-    // Now we XOR is_before_second_bitmask and the above result:
-    // If is_before_second is true:  1001 0101 ^ 0000 0000 = 1001 0101
-    // If is_before_second is false: 1001 0101 ^ 1111 1111 = 0110 1010
-    //
-    // We get a bitmask where only those bits are set that match the current
-    // release time.
-    uint8_t same_release_time_bitmask = is_before_second_bitmask ^ ~(-is_before_second);
+static cached_keycode_t keycode_cache[PTH_KEYCODE_CACHE_SIZE];
+static uint8_t          keycode_cache_count = 0;
+static uint8_t          keycode_cache_next  = 0; // replaced once it is full
 
-    // Finally, we have to check if we actually have a record for those bits.
-    return used_release_records_bitmask & same_release_time_bitmask;
+void pth_clear_keycode_cache(void) {
+    keycode_cache_count = 0;
+    keycode_cache_next  = 0;
 }
 
-static bool process_release_records(release_time_t release_time, bool wait_before_first) {
-    uint8_t to_be_released_bitmask = get_to_be_released_bitmask(release_time);
+static uint16_t get_cached_dynamic_keycode(uint8_t layer, keypos_t pos) {
+    for (uint8_t i = 0; i < keycode_cache_count; i++) {
+        const cached_keycode_t* entry = &keycode_cache[i];
+        if (entry->layer == layer && entry->pos.row == pos.row && entry->pos.col == pos.col) {
+            return entry->keycode;
+        }
+    }
 
-    // If no bit is set, there's nothing to release.
-    if (to_be_released_bitmask == 0) {
-        return false;
+    const uint16_t keycode            = dynamic_keymap_get_keycode(layer, pos.row, pos.col);
+    keycode_cache[keycode_cache_next] = (cached_keycode_t){.layer = layer, .pos = pos, .keycode = keycode};
+    keycode_cache_next                = (keycode_cache_next + 1) % PTH_KEYCODE_CACHE_SIZE;
+    if (keycode_cache_count < PTH_KEYCODE_CACHE_SIZE) {
+        keycode_cache_count++;
     }
+    return keycode;
+}
+#else
+#    define pth_clear_keycode_cache() ((void)0)
+#    define PTH_PREFETCH_SECOND_KEYCODE() ((void)0)
+#endif // VIAL_ENABLE
+
+// Reset and initialization
+// ----------------------------------------------------------------------------
 
-    // Already remove the bits whose records will be released now.
-    used_release_records_bitmask &= ~to_be_released_bitmask;
+static void reset_pth_state(void) {
+    // Everything is reset at once (which is smaller and faster than doing it
+    // one by one), so timers and durations are zero until they are set again.
+    const uint8_t prev_status = pth.status;
+    pth                       = (pth_session_t)PTH_SESSION_INIT;
+    pth.prev_status           = prev_status;
+    pth.features.down_count   = history.down_count;
+    pth_clear_keycode_cache();
 
-    bool waited = !wait_before_first;
+    PTH_LOG("--------------------------------------------------------------------------------");
+}
 
-    while (to_be_released_bitmask != 0) {
-        uint8_t lsb_set_index = __builtin_ctz(to_be_released_bitmask);
+// see Housekeeping
+static void expire_deadline(void);
 
-        if (!waited) {
-            send_and_wait();
-            waited = true;
-        }
+void keyboard_post_init_predictive_tap_hold(void) {
+#ifdef PTH_DISABLED
+    uprintf("Predictive_tap_hold is disabled");
+    return;
+#endif
+    // since we have no data yet, just use one far in the past
+    history.press_to_press_timer = PTH_TIMER_READ() - MS_MAX_DUR_FOR_TIMERS;
+    history.release_timer        = PTH_TIMER_READ() - (MS_MAX_DUR_FOR_TIMERS - 100);
 
-        process_record_with_new_time(&release_records[lsb_set_index]);
+    expire_deadline();
 
-        to_be_released_bitmask = clear_bit(to_be_released_bitmask, lsb_set_index);
-    }
+#ifdef PTH_ADAPTIVE_FACTORS
+    load_adaptive_factors();
+#endif
 
-    return waited;
+#ifdef PTH_ADAPTIVE_TIMEOUT
+    pth_reset_adaptive_timeouts();
+#endif
+
+#ifdef PTH_KEY_CACHE_ENABLE
+    pth_rebuild_key_cache();
+#endif
 }
 
-/**
- * @brief Processes releases of the supplied kind and resets their records.
- * Will wait only if there is a release record of the supplied kind.
- * We do this to avoid any unnecessary waits.
- *
- * @return true if we waited.
- */
-static bool process_release_records_and_wait_before_first(release_time_t release_time) {
-    return process_release_records(release_time, true);
+static uint16_t get_keycode_same_pos_in_layer(keyrecord_t* record, uint8_t layer) {
+    // thanks u/pgetreuer for the suggestion
+    const keypos_t pos = record->event.key;
+
+#ifdef VIAL_ENABLE
+    return get_cached_dynamic_keycode(layer, pos);
+#else
+    return keycode_at_keymap_location(layer, pos.row, pos.col);
+#endif
 }
 
+#ifdef VIAL_ENABLE
 /**
- * @brief Adds a release record to the array. If the array is full, processes
- *        the record immediately.
+ * @brief If the PTH key is a Layer-Tap, the second key has a keycode on
+ *        another layer too, which the decision needs (see register_pth_hold
+ *        and make_decision_tap). It's read now, so the decision doesn't wait
+ *        for EEPROM.
  */
-static void add_release_record(keyrecord_t* record, release_time_t release_time) {
-    uint8_t has_no_record_bitmask = ~used_release_records_bitmask;
-    if (has_no_record_bitmask == 0) {
-        // Every bit is set. Process the record immediately as a fallback.
-        process_record(record);
+static void prefetch_second_keycode(void) {
+    if (!IS_QK_LAYER_TAP(pth.keycode)) {
+        return;
     }
+    const uint8_t layer = pth.was_held_instantly ? pth.layer_before_instant_layer_tap : QK_LAYER_TAP_GET_LAYER(pth.keycode);
+    get_keycode_same_pos_in_layer(&pth.second_record, layer);
+}
 
-    // the least significant bit that is not set (i.e. the last zero)
-    uint8_t lsb_unset_index          = __builtin_ctz(has_no_record_bitmask);
-    release_records[lsb_unset_index] = *record;
+#    define PTH_PREFETCH_SECOND_KEYCODE() prefetch_second_keycode()
+#endif // VIAL_ENABLE
 
-    const bool is_before_second  = release_time == BEFORE_SECOND;
-    is_before_second_bitmask     = change_bit(is_before_second_bitmask, lsb_unset_index, is_before_second);
-    used_release_records_bitmask = set_bit(used_release_records_bitmask, lsb_unset_index);
+extern const uint8_t pth_side_layout[MATRIX_ROWS][MATRIX_COLS] PROGMEM;
+
+static inline uint8_t read_side_from_layout(uint8_t row, uint8_t col) {
+#ifdef PTH_SIDES_FROM_SPLIT
+    // The rows of the left half always come first, no matter which half is
+    // the master.
+    return row < MATRIX_ROWS / 2 ? PTH_L : PTH_R;
+#else
+    return (uint8_t)pgm_read_byte(&pth_side_layout[row][col]);
+#endif
 }
 
-static float weighted_avg(float v3, float v4) {
-    // a value < 0 should not count towards the average (and v4 is never < 0)
-    if (v3 < 0) {
-        return v4;
+// Utility functions
+// ----------------------------------------------------------------------------
+// 0b10000: the "right" flag in 5-bit mods
+#define MODS_5_BIT_RL_BIT 0x10
+
+static inline uint8_t convert_5_bit_mods_to_8_bit(uint8_t mods_5_bit) {
+    if ((mods_5_bit & MODS_5_BIT_RL_BIT) == 0) {
+        // left mods are same in 5 and 8-bit
+        return mods_5_bit;
     }
 
-    // each weight is the result of E**index divided by the sum of them all
-    return 0.2689414213699951f * v3 + 0.7310585786300049f * v4;
+    // disable RL bit, then shift result by 4 bits
+    return (uint8_t)((mods_5_bit & ~MODS_5_BIT_RL_BIT) << 4);
+}
+
+static uint8_t get_5_bit_mods_of_mod_tap(uint16_t keycode) {
+    // mod_config modifies the mod if certain settings are active (such as swapping keys)
+    return mod_config(QK_MOD_TAP_GET_MODS(keycode));
 }
 
-// Default prediction functions (can be used in your own weak function overrides)
-//=============================================================================
 /**
- * Auto-generated decision tree prediction function.
+ * @brief Determines if two keys are on the same side.
  *
- * At most 7 comparisons are necessary to get a result.
+ * Each side configuration determines how the key behaves if it is the PTH key,
+ * and how it behaves if it is any other key. So, first we extract the
+ * respective atomic side from each configuration.
  *
- * Mod:      50,599 /  68,121 (74.28 %)
- * Non-mod: 306,692 / 310,294 (98.84 %)
- * Total:   357,291 / 378,415 (94.42 %)
+ * The rules are:
+ * 1. If other is opposite, return false (not considered the same side).
+ * 2. If other is same, return true;
+ * 3. If PTH is opposite, return false.
+ * 4. If PTH is same, return true;
+ * 5. If both sides are equal, return true, false otherwise.
  *
- * @return float predicted overlap time in ms.
+ * @param other_atomic_side one of PTH_ATOM_LEFT, PTH_ATOM_RIGHT,
+ *                          PTH_ATOM_OPPOSITE, PTH_ATOM_SAME
+ * @return true if the resulting sides are considered the same, false otherwise.
  */
-float pth_default_get_hold_prediction_when_third_press(void) {
-    // Initialize to -1 because we may not have that information yet.
-    float opt_next_dur            = -1.0f;
-    float opt_th_down_next_up_dur = -1.0f;
+static bool is_same_side_as_pth(uint8_t other_atomic_side) {
+    // Combine the two 2-bit atomic sides to form a 4-bit index (0-15).
+    uint8_t index = (pth.atomic_side << 2) | other_atomic_side;
+
+    // LUT containing the results for all 16 possible side comparisons.
+    const uint16_t truth_table = 0b1011100010101001;
+
+    // Look up the result in the table.
+    return (truth_table >> index) & 1;
+}
+
+// Convenience function
+static inline bool is_record_same_side_as_pth(keyrecord_t* record) {
+    uint8_t other_side = PTH_GET_OTHER_ATOM_SIDE(PTH_GET_SIDE(record));
+    return is_same_side_as_pth(other_side);
+}
 
-    if (second_to_be_released) {
-        opt_next_dur            = (float)pth_second_dur;
-        opt_th_down_next_up_dur = (float)pth_press_to_second_release_dur;
+// Key attribute cache
+// ----------------------------------------------------------------------------
+#ifdef PTH_KEY_CACHE_ENABLE
+// The side of each position, and its attributes (PTH_KEY_ATTR_*) on each of
+// the first PTH_KEY_CACHE_LAYERS layers.
+// get_layer_of_pos shifts the layer state by PTH_KEY_CACHE_LAYERS.
+_Static_assert(PTH_KEY_CACHE_LAYERS < sizeof(layer_state_t) * 8, "PTH_KEY_CACHE_LAYERS must be smaller than the number of layers.");
+
+static uint8_t key_cache_sides[MATRIX_ROWS][MATRIX_COLS];
+static uint8_t key_cache_attributes[PTH_KEY_CACHE_LAYERS][MATRIX_ROWS][MATRIX_COLS];
+
+static uint8_t get_key_attributes_of_keycode(uint16_t keycode) {
+    uint8_t attributes = 0;
+    if (keycode == KC_TRNS) {
+        attributes |= PTH_KEY_ATTR_TRANSPARENT;
+    }
+    if (pth_is_tap_hold_keycode(keycode)) {
+        attributes |= PTH_KEY_ATTR_TAP_HOLD;
     }
+    if (IS_QK_MOD_TAP(keycode)) {
+        attributes |= get_5_bit_mods_of_mod_tap(keycode) & PTH_KEY_ATTR_MODS_MASK;
+    }
+    return attributes;
+}
 
-    // clang-format off
-return (
-  pth_prev_press_to_pth_press_dur <= 759
-  ? (
-    opt_th_down_next_up_dur <= 150
-    ? (
-      pth_press_to_second_press_dur <= 170
-      ? (
-        pth_second_press_to_third_press_dur <= 107
-        ? 0.040555656f
-        : (
-          opt_th_down_next_up_dur <= 109
-          ? 0.14262922f
-          : (
-            pth_press_to_second_press_dur <= 55
-            ? 0.3217576f
-            : 0.8006757f
-          )
-        )
-      )
-      : (
-        pth_press_to_second_press_dur <= 216
-        ? (
-          down_count <= 0
-          ? (
-            pth_second_press_to_third_press_dur <= 77
-            ? 0.38718662f
-            : 0.6451292f
-          )
-          : 0.22810061f
-        )
-        : (
-          down_count <= 0
-          ? 0.910299f
-          : (
-            pth_press_to_second_press_dur <= 264
-            ? 0.4814815f
-            : 0.8877551f
-          )
-        )
-      )
-    )
-    : (
-      pth_second_press_to_third_press_dur <= 145
-      ? (
-        pth_press_to_second_press_dur <= 92
-        ? (
-          down_count <= 0
-          ? (
-            key_release_before_pth_to_pth_press_dur <= 112
-            ? 0.43078628f
-            : 0.6967871f
-          )
-          : (
-            pth_press_to_press_w_avg <= 63.602364f
-            ? 0.51724136f
-            : 0.16554306f
-          )
-        )
-        : (
-          down_count <= 0
-          ? 0.82194614f
-          : (
-            pth_press_to_press_w_avg <= 105.37883f
-            ? 0.64830506f
-            : 0.35095447f
-          )
-        )
-      )
-      : (
-        pth_press_to_second_press_dur <= 59
-        ? (
-          opt_next_dur <= 130
-          ? 0.6714801f
-          : (
-            pth_prev_press_to_pth_press_dur <= 303
-            ? 0.27037036f
-            : 0.7083333f
-          )
-        )
-        : 0.93728805f
-      )
-    )
-  )
-  : (
-    pth_press_to_press_w_avg <= 994.01086f
-    ? (
-      opt_th_down_next_up_dur <= 120
-      ? (
-        pth_press_to_second_press_dur <= 139
-        ? (
-          key_release_before_pth_to_pth_press_dur <= 443
-          ? 0.84f
-          : (
-            key_release_before_pth_to_pth_press_dur <= 1110
-            ? 0.12546816f
-            : 0.54545456f
-          )
-        )
-        : 0.83798885f
-      )
-      : (
-        pth_second_press_to_third_press_dur <= 127
-        ? (
-          pth_press_to_second_press_dur <= 146
-          ? (
-            key_release_before_pth_to_pth_press_dur <= 916
-            ? 0.4074074f
-            : 0.9166667f
-          )
-          : 0.9607843f
-        )
-        : 0.97471267f
-      )
-    )
-    : (
-      pth_press_to_second_press_dur <= 19
-      ? 0.06451613f
-      : (
-        pth_prev_press_to_pth_press_dur <= 1449
-        ? (
-          pth_press_to_second_press_dur <= 111
-          ? (
-            key_release_before_pth_to_pth_press_dur <= 1777
-            ? 0.6754386f
-            : 0.1f
-          )
-          : 0.9519231f
-        )
-        : 0.99276936f
-      )
-    )
-  )
-);
-    // clang-format on
+void pth_rebuild_key_cache(void) {
+    // The keymap changed, and the whole of it mustn't end up in there.
+    pth_clear_keycode_cache();
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            key_cache_sides[row][col] = read_side_from_layout(row, col);
+
+            keyrecord_t record = {.event = {.key = {.row = row, .col = col}}};
+            for (uint8_t layer = 0; layer < PTH_KEY_CACHE_LAYERS; layer++) {
+                key_cache_attributes[layer][row][col] = get_key_attributes_of_keycode(get_keycode_same_pos_in_layer(&record, layer));
+            }
+        }
+    }
+    pth_clear_keycode_cache();
 }
 
-/**
- * Auto-generated decision tree prediction function.
- * At most 7 comparisons are necessary to get a result.
- *
- * Mod:       741,259 /  1,057,871 (70.07 %)
- * Non-mod: 9,162,154 /  9,190,163 (99.70 %)
- * Total:   9,903,413 / 10,248,034 (96.64 %)
- *
- * @return float prediction value in [0, 1]. > 0.5f is considered hold.
- */
-float pth_default_get_hold_prediction_when_pth_release_after_second_press(void) {
-    // clang-format off
-return (
-  pth_prev_press_to_pth_press_dur <= 1254
-  ? (
-    pth_press_to_second_press_dur <= 214
-    ? (
-      pth_press_to_second_press_dur <= 168
-      ? (
-        pth_prev_press_to_pth_press_dur <= 237
-        ? 0.021824066f
-        : (
-          pth_press_to_second_press_dur <= 124
-          ? 0.06581373f
-          : (
-            pth_prev_prev_press_to_prev_press_dur <= 1603
-            ? 0.12980974f
-            : 0.6515581f
-          )
-        )
-      )
-      : (
-        key_release_before_pth_to_pth_press_dur <= 169
-        ? 0.1548253f
-        : (
-          pth_press_to_second_press_dur <= 186
-          ? (
-            pth_press_to_press_w_avg <= 822.32574f
-            ? 0.3386316f
-            : 0.6540284f
-          )
-          : (
-            pth_prev_press_to_pth_press_dur <= 226
-            ? 0.10697675f
-            : 0.53629214f
-          )
-        )
-      )
-    )
-    : (
-      pth_press_to_second_press_dur <= 247
-      ? (
-        key_release_before_pth_to_pth_press_dur <= 162
-        ? (
-          pth_overlap_w_avg <= 0.13447072f
-          ? (
-            pth_prev_prev_press_to_prev_press_dur <= 165
-            ? 0.63566846f
-            : 0.41175103f
-          )
-          : 0.24768922f
-        )
-        : (
-          down_count <= 0
-          ? (
-            pth_overlap_w_avg <= 17.07778f
-            ? 0.7658702f
-            : 0.4507772f
-          )
-          : 0.08022922f
-        )
-      )
-      : (
-        down_count <= 0
-        ? 0.88925225f
-        : (
-          pth_press_to_second_press_dur <= 312
-          ? 0.26601785f
-          : (
-            pth_prev_press_to_pth_press_dur <= 181
-            ? 0.7529976f
-            : 0.23684211f
-          )
-        )
-      )
-    )
-  )
-  : (
-    key_release_before_pth_to_pth_press_dur <= 1350
-    ? (
-      pth_press_to_second_press_dur <= 139
-      ? (
-        key_release_before_pth_to_pth_press_dur <= 1273
-        ? (
-          pth_prev_prev_press_to_prev_press_dur <= 1588
-          ? (
-            key_release_before_pth_to_pth_press_dur <= 539
-            ? 0.5905512f
-            : 0.25539857f
-          )
-          : (
-            key_release_before_pth_to_pth_press_dur <= 102
-            ? 0.083333336f
-            : 0.8053435f
-          )
-        )
-        : (
-          pth_press_to_press_w_avg <= 1096.1167f
-          ? (
-            pth_press_to_second_press_dur <= 89
-            ? 0.4801762f
-            : 0.7108014f
-          )
-          : 0.42533332f
-        )
-      )
-      : 0.89287937f
-    )
-    : (
-      pth_press_to_second_press_dur <= 17
-      ? (
-        pth_prev_prev_press_to_prev_press_dur <= 146
-        ? 0.01754386f
-        : (
-          key_release_before_pth_to_pth_press_dur <= 3116
-          ? 0.04477612f
-          : (
-            key_release_before_pth_to_pth_press_dur <= 3243
-            ? 0.5714286f
-            : 0.09090909f
-          )
-        )
-      )
-      : (
-        key_release_before_pth_to_pth_press_dur <= 1504
-        ? 0.9103782f
-        : (
-          down_count <= 0
-          ? 0.98845273f
-          : 0.046153847f
-        )
-      )
-    )
-  )
-);
-    // clang-format on
+uint8_t pth_get_key_attributes(keypos_t pos, uint8_t layer) {
+    if (layer < PTH_KEY_CACHE_LAYERS) {
+        return key_cache_attributes[layer][pos.row][pos.col];
+    }
+    keyrecord_t record = {.event = {.key = pos}};
+    return get_key_attributes_of_keycode(get_keycode_same_pos_in_layer(&record, layer));
 }
 
 /**
- * Auto-generated decision tree prediction function.
- * At most 7 comparisons are necessary to get a result.
- *
- * Mod:     420,158 / 435,604 (96.45 %)
- * Non-mod:  60,870 /  85,031 (71.59 %)
- * Total:   481,028 / 520,635 (92.39 %)
- *
- * @return float prediction value in [0, 1]. > 0.5f is considered hold.
+ * @brief Same as QMK's layer_switch_get_layer, but it only reads the cache,
+ *        unless a layer above the cached ones is active.
  */
-float pth_default_get_hold_prediction_when_pth_release_after_second_release(void) {
-    uint16_t opt_next_dur            = pth_second_dur;
-    uint16_t opt_th_down_next_up_dur = pth_press_to_second_release_dur;
+static uint8_t get_layer_of_pos(keypos_t pos) {
+    const layer_state_t layers = layer_state | default_layer_state;
+    if ((layers >> PTH_KEY_CACHE_LAYERS) != 0) {
+        return layer_switch_get_layer(pos);
+    }
 
-    // clang-format off
-return (
-  opt_th_down_next_up_dur <= 143
-  ? (
-    pth_prev_press_to_pth_press_dur <= 1292
-    ? (
-      opt_th_down_next_up_dur <= 116
-      ? 0.09534535f
-      : (
-        key_release_before_pth_to_pth_press_dur <= 118
-        ? 0.27736303f
-        : (
-          pth_prev_press_to_pth_press_dur <= 174
-          ? 0.08959538f
-          : (
-            pth_press_to_second_press_dur <= 29
-            ? 0.32664755f
-            : 0.65463656f
-          )
-        )
-      )
-    )
-    : (
-      pth_press_to_second_press_dur <= 19
-      ? 0.1f
-      : (
-        opt_th_down_next_up_dur <= 64
-        ? (
-          key_release_before_pth_to_pth_press_dur <= 2050
-          ? 0.0625f
-          : (
-            pth_press_to_press_w_avg <= 2830.7092f
-            ? 0.71428573f
-            : 0.5f
-          )
-        )
-        : (
-          key_release_before_pth_to_pth_press_dur <= 1244
-          ? (
-            opt_th_down_next_up_dur <= 107
-            ? 0.33333334f
-            : 0.85714287f
-          )
-          : 0.99616855f
-        )
-      )
-    )
-  )
+    for (int8_t layer = PTH_KEY_CACHE_LAYERS - 1; layer > 0; layer--) {
+        if ((layers & ((layer_state_t)1 << layer)) && !(key_cache_attributes[layer][pos.row][pos.col] & PTH_KEY_ATTR_TRANSPARENT)) {
+            return layer;
+        }
+    }
+    return 0;
+}
+#else
+#    define get_layer_of_pos(pos) layer_switch_get_layer(pos)
+#endif // PTH_KEY_CACHE_ENABLE
+
+// Public functions
+// ----------------------------------------------------------------------------
+pth_status_t pth_get_status(void) {
+    return pth.status;
+}
+
+pth_status_t pth_get_prev_status(void) {
+    return pth.prev_status;
+}
+
+int16_t pth_get_prev_press_to_pth_press_dur(void) {
+    return pth.features.prev_press_to_pth_press_dur;
+}
+
+const pth_features_t* pth_get_features(void) {
+    return &pth.features;
+}
+
+uint8_t pth_get_pth_atomic_side(void) {
+    return pth.atomic_side;
+}
+
+uint8_t pth_get_pth_side_user_bits(void) {
+    return pth.side_user_bits;
+}
+
+bool pth_is_second_same_side_as_pth(void) {
+    return pth.second_is_same_side_as_pth;
+}
+
+keyrecord_t pth_get_pth_record(void) {
+    return pth.record;
+}
+
+keyrecord_t pth_get_second_record(void) {
+    return pth.second_record;
+}
+
+uint16_t pth_get_pth_keycode(void) {
+    return pth.keycode;
+}
+
+uint16_t pth_get_second_keycode(void) {
+    return pth.second_keycode;
+}
+
+uint16_t pth_get_prev_press_keycode(void) {
+    return history.prev_press_keycode;
+}
+
+uint16_t pth_get_second_keycode_on_same_layer_as_pth(void) {
+    if (!pth.was_held_instantly || !IS_QK_LAYER_TAP(pth.keycode)) {
+        return KC_NO;
+    }
+    return get_keycode_same_pos_in_layer(&pth.second_record, pth.layer_before_instant_layer_tap);
+}
+
+bool pth_is_second_tap_hold(void) {
+    return pth.second_is_tap_hold;
+}
+
+bool pth_is_processing_internal(void) {
+    return is_processing_record_due_to_pth;
+}
+
+bool pth_should_receive(const pth_subscription_t* subscriptions, uint8_t count, uint16_t keycode, const keyrecord_t* record) {
+    if (!is_processing_record_due_to_pth) {
+        return true;
+    }
+
+    const uint8_t event = record->event.pressed ? PTH_SUBSCRIBE_PRESS : PTH_SUBSCRIBE_RELEASE;
+    for (uint8_t i = 0; i < count; i++) {
+        const pth_subscription_t* s = &subscriptions[i];
+        if ((s->events & event) && keycode >= s->first_keycode && keycode <= s->last_keycode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t pth_get_release_records_high_water(void) {
+    return release_records_high_water;
+}
+
+uint8_t pth_get_release_as_tap_positions_high_water(void) {
+    return release_as_tap_positions_high_water;
+}
+
+bool pth_is_tap_hold_keycode(uint16_t keycode) {
+    switch (keycode) {
+        case QK_MOD_TAP ... QK_MOD_TAP_MAX:
+        case QK_LAYER_TAP ... QK_LAYER_TAP_MAX:
+            return true;
+        case QK_SWAP_HANDS ... QK_SWAP_HANDS_MAX:
+            return !IS_SWAP_HANDS_KEYCODE(keycode);
+#ifdef PTH_TAP_DANCE_ENABLE
+        case QK_TAP_DANCE ... QK_TAP_DANCE_MAX:
+            return true;
+#endif
+    }
+    return false;
+}
+
+/**
+ * @brief Same as pth_is_tap_hold_keycode, except for keys with a non-zero
+ *        tapping term. QMK has already decided those before we get their
+ *        record, so they are handled like any other key. A record that was
+ *        delayed because it comes after the PTH key is also sent with the tap
+ *        or hold that QMK chose.
+ */
+static bool is_tap_hold_for_pth(uint16_t keycode, keyrecord_t* record) {
+#ifdef TAPPING_TERM_PER_KEY
+    if (get_tapping_term(keycode, record) != 0) {
+        return false;
+    }
+#endif
+    return pth_is_tap_hold_keycode(keycode);
+}
+
+uint8_t pth_get_all_8_bit_mods(void) {
+    // TODO: Use weak_mods or not?
+#ifdef NO_ACTION_ONESHOT
+    return get_mods(); //| get_weak_mods();
+#else
+    return get_mods() | get_oneshot_mods(); //| get_weak_mods();
+#endif // NO_ACTION_ONESHOT
+}
+
+uint8_t pth_get_8_bit_mods_of_mod_tap(uint16_t keycode) {
+    return convert_5_bit_mods_to_8_bit(get_5_bit_mods_of_mod_tap(keycode));
+}
+
+bool pth_is_mod_tap_with_any_mods_of(uint16_t keycode, uint8_t mods_8_bit) {
+    return IS_QK_MOD_TAP(keycode) && (pth_get_8_bit_mods_of_mod_tap(keycode) & mods_8_bit) != 0;
+}
+
+bool pth_default_should_hold_instantly(uint16_t keycode, keyrecord_t* record) {
+#ifdef PTH_DONT_HOLD_INSTANTLY
+        return false;
+#endif
+
+#ifdef PTH_TAP_DANCE_ENABLE
+    // The hold would finish the dance, which can't be undone by a tap.
+    if (IS_QK_TAP_DANCE(keycode)) {
+        return false;
+    }
+#endif
+
+#ifdef CAPS_WORD_ENABLE
+    // Instantly holding will result in a held tap-hold key being processed,
+    // thus breaking caps words.
+    if (is_caps_word_on()) {
+        return false;
+    }
+#endif
+
+    // It seems there are only downsides to instant holding GUI.
+    const uint8_t active_mods_or_gui = pth_get_all_8_bit_mods() | MOD_MASK_GUI;
+    if (pth_is_mod_tap_with_any_mods_of(keycode, active_mods_or_gui)) {
+        // PTH is a mod-tap containing mods that are already active (or GUI).
+        //
+        // This is a workaround for QMK's behavior of reporting a modifier
+        // release to the OS, if a key with multiple modifiers is released,
+        // even if another key with one of those modifiers is still down.
+        //
+        // Example: KC_LSFT down, LCS_T(KC_E) down -> Shift and Ctrl are down,
+        // ... (other presses), LCS_T(KC_E) up, KC_T down. When LCS_T(KC_E) was
+        // released, QMK reported left Shift as released, even though KC_LSFT
+        // is still pressed. The result is that KC_T is not uppercased.
+        //
+        // Of course, this workaround only helps with the instant hold, so if
+        // hold is chosen, this still happens, but that's probably okay.
+        //
+        // A full workaround in your own keymap is to use the right version on
+        // bare modifier keys (e.g. KC_RSFT), and the left version of modifiers
+        // on all tap-hold keys (e.g. LCS_T(KC_A)) or vice versa. It works
+        // because modifiers of different sides don't affect each other. If a
+        // left mod is down, and then a right mod is up, the release of the
+        // left mod will still be reported to the OS when it happens.
+        return false;
+    }
+
+    return true;
+}
+
+uint8_t pth_get_side_from_layout(keypos_t pos) {
+#ifdef PTH_KEY_CACHE_ENABLE
+    return key_cache_sides[pos.row][pos.col];
+#else
+    return read_side_from_layout(pos.row, pos.col);
+#endif
+}
+
+// Weakly defined functions
+// ----------------------------------------------------------------------------
+static inline uint8_t default_get_side(keyrecord_t* record) {
+    return pth_get_side_from_layout(record->event.key);
+}
+
+__attribute__((weak)) uint8_t pth_get_side(keyrecord_t* record) {
+    return default_get_side(record);
+}
+
+#ifdef PTH_FAST_STREAK_TAP_ENABLE
+__attribute__((weak)) bool pth_is_fast_streak_tap_key(uint16_t keycode) {
+    if ((get_mods() & (MOD_MASK_CG | MOD_BIT_LALT)) != 0) {
+        return false; // Disable when non-Shift (and non-right-Alt) mods are active.
+    }
+
+    switch (get_tap_keycode(keycode)) {
+        case KC_A ... KC_Z:
+        case KC_SPC:
+        case KC_DOT:
+        case KC_COMM:
+        case KC_SCLN:
+        case KC_SLSH:
+            return true;
+    }
+    return false;
+}
+
+__attribute__((weak)) bool pth_predict_fast_streak_tap(void) {
+    return (pth_is_fast_streak_tap_key(pth.keycode) && pth_is_fast_streak_tap_key(history.prev_press_keycode) && pth.prev_status != PTH_DECIDED_HOLD && pth.features.prev_press_to_pth_press_dur < 125);
+}
+#endif // PTH_FAST_STREAK_TAP_ENABLE
+
+#ifndef PTH_DONT_HOLD_INSTANTLY
+static inline bool default_should_hold_instantly(uint16_t keycode, keyrecord_t* record) {
+    return pth_default_should_hold_instantly(keycode, record);
+}
+
+__attribute__((weak)) bool pth_should_hold_instantly(uint16_t keycode, keyrecord_t* record) {
+    return default_should_hold_instantly(keycode, record);
+}
+
+static inline bool default_second_should_hold_instantly(uint16_t second_keycode, keyrecord_t* second_record) {
+    return PTH_SHOULD_HOLD_INSTANTLY(second_keycode, second_record);
+}
+
+__attribute__((weak)) bool pth_second_should_hold_instantly(uint16_t second_keycode, keyrecord_t* second_record) {
+    return default_second_should_hold_instantly(second_keycode, second_record);
+}
+#endif // PTH_DONT_HOLD_INSTANTLY
+
+static inline bool default_should_choose_tap_when_second_is_same_side_press(void) {
+    // If this is a non-tap-hold same-side second, then that implies key roll.
+    // We consider whether second is tap-hold, even if an instant layer tap is
+    // active, so that it would be possible to use that, and then activate
+    // a mod tap on that new layer.
+    return !pth.second_is_tap_hold;
+}
+
+__attribute__((weak)) bool pth_should_choose_tap_when_second_is_same_side_press(void) {
+    return default_should_choose_tap_when_second_is_same_side_press();
+}
+
+static inline bool default_should_choose_tap_when_second_is_same_side_release(void) {
+    // We haven't made a choice, the second key is on same side as PTH, and
+    // the second key is released before a third is pressed.
+    // It is highly likely that this is a key roll, so choose tap.
+    PTH_LOG("  Same-side second key release implies roll.");
+    return true;
+}
+
+__attribute__((weak)) bool pth_should_choose_tap_when_second_is_same_side_release(void) {
+    return default_should_choose_tap_when_second_is_same_side_release();
+}
+
+static inline int16_t default_get_timeout_for_forcing_choice(void) {
+#ifdef PTH_ADAPTIVE_TIMEOUT
+    return pth_get_adaptive_timeout(pth.record.event.key, 700);
+#else
+    return 700;
+#endif
+}
+
+__attribute__((weak)) int16_t pth_get_timeout_for_forcing_choice(void) {
+    return default_get_timeout_for_forcing_choice();
+}
+
+static inline pth_status_t default_get_forced_choice_after_timeout(void) {
+    if (pth.has_second) {
+        return PTH_IDLE;
+    }
+    return PTH_DECIDED_HOLD;
+}
+
+__attribute__((weak)) pth_status_t pth_get_forced_choice_after_timeout(void) {
+    return default_get_forced_choice_after_timeout();
+}
+
+#ifdef PTH_POINTING_DEVICE_HOLD
+__attribute__((weak)) bool pth_should_hold_when_pointing(pth_pointing_t pointing, uint16_t keycode) {
+    return pointing == PTH_POINTING_BUTTON || IS_QK_MOD_TAP(pth.keycode);
+}
+#endif // PTH_POINTING_DEVICE_HOLD
+
+static inline bool default_should_neutralize_mods(uint8_t mod_5_bit) {
+    // We want to neutralize mods (Alt and Gui) unless they include Shift and
+    // Ctrl, because 1. they don't need to be neutralized, and 2. because doing
+    // so for Ctrl leads to control characters being output in some consoles.
+    // We use the left version, as we don't care whether it's left or right.
+    return (mod_5_bit & (MOD_LCTL | MOD_LSFT)) == 0;
+}
+
+__attribute__((weak)) bool pth_should_neutralize_mods(uint8_t mod_5_bit) {
+    return default_should_neutralize_mods(mod_5_bit);
+}
+
+static inline uint16_t default_get_code_to_be_registered_instead_when_hold_chosen(void) {
+    return KC_NO;
+}
+
+__attribute__((weak)) uint16_t pth_get_code_to_be_registered_instead_when_hold_chosen(void) {
+    return default_get_code_to_be_registered_instead_when_hold_chosen();
+}
+
+static inline bool default_should_register_as_hold_when_same_side(uint16_t keycode, keyrecord_t* record) {
+    return true;
+}
+
+__attribute__((weak)) bool pth_should_register_as_hold_when_same_side(uint16_t keycode, keyrecord_t* record) {
+    return default_should_register_as_hold_when_same_side(keycode, record);
+}
+
+// Output queue
+// ----------------------------------------------------------------------------
+#ifdef PTH_TAP_DANCE_ENABLE
+// The time the event of the record that is being sent happened.
+static uint16_t sent_event_time = 0;
+#endif
+
+static void process_record_now(keyrecord_t* record) {
+#ifdef PTH_TAP_DANCE_ENABLE
+    sent_event_time = record->event.time;
+#endif
+    record->event.time              = timer_read();
+    is_processing_record_due_to_pth = true;
+    process_record(record);
+    is_processing_record_due_to_pth = false;
+}
+
+#if defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+// Batched flush
+// ----------------------------------------------------------------------------
+// The keys we pressed less than TAP_CODE_DELAY ago. Only the release of one of
+// them has to wait (for the rest of the delay), as the OS might ignore such a
+// short tap. Everything else is sent right after the previous event.
+typedef struct {
+    uint16_t id;
+    uint16_t time;
+} recent_press_t;
+
+// Positions and keycodes (at most QK_MODS_MAX for register_code16) never
+// have the same id.
+#    define POS_TO_OUTPUT_ID(pos) (0x8000 | ((uint16_t)(pos).row << 8) | (pos).col)
+
+#    define RECENT_PRESSES_SIZE 4
+
+static recent_press_t recent_presses[RECENT_PRESSES_SIZE];
+static uint8_t        recent_presses_count = 0;
+
+static void forget_old_presses(uint16_t cur_time) {
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < recent_presses_count; i++) {
+        if (TIMER_DIFF_16(cur_time, recent_presses[i].time) < TAP_CODE_DELAY) {
+            recent_presses[kept++] = recent_presses[i];
+        }
+    }
+    recent_presses_count = kept;
+}
+
+/**
+ * @return how many ms the release of `id` has to wait, which is 0 unless we
+ *         pressed it less than TAP_CODE_DELAY ago.
+ */
+static uint16_t get_ms_to_wait_before_release(uint16_t id) {
+    const uint16_t cur_time = timer_read();
+    forget_old_presses(cur_time);
+
+    for (uint8_t i = 0; i < recent_presses_count; i++) {
+        if (recent_presses[i].id == id) {
+            return TAP_CODE_DELAY - TIMER_DIFF_16(cur_time, recent_presses[i].time);
+        }
+    }
+    return 0;
+}
+
+static void remember_press(uint16_t id) {
+    uint16_t cur_time = timer_read();
+    forget_old_presses(cur_time);
+
+    if (recent_presses_count == RECENT_PRESSES_SIZE) {
+        // Rare, as a decision presses only a few keys. So we simply wait
+        // until the oldest one may be released.
+        send_keyboard_report();
+        wait_ms(TAP_CODE_DELAY - TIMER_DIFF_16(cur_time, recent_presses[0].time));
+        cur_time = timer_read();
+        forget_old_presses(cur_time);
+    }
+
+    recent_presses[recent_presses_count++] = (recent_press_t){.id = id, .time = cur_time};
+}
+#endif // PTH_BATCHED_FLUSH && TAP_CODE_DELAY > 0
+
+#ifdef PTH_NON_BLOCKING_FLUSH
+// Instead of blocking with wait_ms, everything we send is put into this queue,
+// once we have to wait. The housekeeping task then continues sending, when the
+// wait is over. Whenever the queue is not empty, even the events that QMK
+// would normally handle are added to it, so that the order stays the same.
+typedef enum { OUTPUT_RECORD, OUTPUT_REGISTER_CODE16, OUTPUT_UNREGISTER_CODE16, OUTPUT_SEND_AND_WAIT, OUTPUT_WAIT } output_type_t;
+
+typedef struct {
+    uint8_t type; // output_type_t
+    union {
+        keyrecord_t record;
+        uint16_t    code;
+    };
+} output_t;
+
+#    if defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+#        define REMEMBER_PRESS(id) remember_press(id)
+#        define REMEMBER_PRESS_OF_RECORD(record) ((record)->event.pressed ? remember_press(POS_TO_OUTPUT_ID((record)->event.key)) : (void)0)
+
+/**
+ * @brief Starts waiting, if the output is the release of a key that we
+ *        pressed less than TAP_CODE_DELAY ago.
+ *
+ * @return true if we have to wait before running the output.
+ */
+static bool start_waiting_before(const output_t* output);
+#    else
+#        define REMEMBER_PRESS(id) ((void)0)
+#        define REMEMBER_PRESS_OF_RECORD(record) ((void)0)
+#        define start_waiting_before(output) false
+#    endif // PTH_BATCHED_FLUSH && TAP_CODE_DELAY > 0
+
+static output_t output_queue[PTH_OUTPUT_QUEUE_SIZE];
+static uint8_t  output_queue_first_index = 0;
+static uint8_t  output_queue_count       = 0;
+static bool     output_is_waiting        = false;
+static uint16_t output_wait_timer        = 0;
+
+static bool is_output_waiting(void) {
+    if (output_is_waiting && TIMER_DIFF_16(timer_read(), output_wait_timer) >= TAP_CODE_DELAY) {
+        output_is_waiting = false;
+    }
+    return output_is_waiting;
+}
+
+#    if defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+static bool start_waiting_before(const output_t* output) {
+    uint16_t ms = 0;
+    if (output->type == OUTPUT_RECORD && !output->record.event.pressed) {
+        ms = get_ms_to_wait_before_release(POS_TO_OUTPUT_ID(output->record.event.key));
+    } else if (output->type == OUTPUT_UNREGISTER_CODE16) {
+        ms = get_ms_to_wait_before_release(output->code);
+    }
+
+    if (ms == 0) {
+        return false;
+    }
+
+    // The wait ends when TAP_CODE_DELAY has passed since the press.
+    send_keyboard_report();
+    output_is_waiting = true;
+    output_wait_timer = timer_read() - (TAP_CODE_DELAY - ms);
+    return true;
+}
+#    endif // PTH_BATCHED_FLUSH && TAP_CODE_DELAY > 0
+
+static void run_output(output_t* output) {
+    switch (output->type) {
+        case OUTPUT_RECORD:
+            process_record_now(&output->record);
+            REMEMBER_PRESS_OF_RECORD(&output->record);
+            break;
+        case OUTPUT_REGISTER_CODE16:
+            register_code16(output->code);
+            REMEMBER_PRESS(output->code);
+            break;
+        case OUTPUT_UNREGISTER_CODE16:
+            unregister_code16(output->code);
+            break;
+        case OUTPUT_SEND_AND_WAIT:
+            send_keyboard_report();
+            // fall through
+        case OUTPUT_WAIT:
+            output_is_waiting = true;
+            output_wait_timer = timer_read();
+            break;
+    }
+}
+
+static void run_first_output(void) {
+    // Copy it, so the slot is free before the output is run.
+    output_t output = output_queue[output_queue_first_index];
+
+    if (++output_queue_first_index == PTH_OUTPUT_QUEUE_SIZE) {
+        output_queue_first_index = 0;
+    }
+    output_queue_count--;
+
+    run_output(&output);
+}
+
+/**
+ * @brief Runs queued outputs in order, until we have to wait.
+ */
+static void process_output_queue(void) {
+    while (output_queue_count > 0 && !is_output_waiting() && !start_waiting_before(&output_queue[output_queue_first_index])) {
+        run_first_output();
+    }
+}
+
+static void add_output(output_t* output) {
+    if (output_queue_count == 0 && !is_output_waiting() && !start_waiting_before(output)) {
+        run_output(output);
+        return;
+    }
+
+    if (output_queue_count == PTH_OUTPUT_QUEUE_SIZE) {
+        // Block, as losing or reordering an output would be far worse.
+        PTH_LOG("  Output queue is full, so we wait.");
+        PTH_TELEMETRY_COUNT(output_queue_overflows);
+        if (is_output_waiting() || start_waiting_before(&output_queue[output_queue_first_index])) {
+            wait_ms(TAP_CODE_DELAY - TIMER_DIFF_16(timer_read(), output_wait_timer));
+            output_is_waiting = false;
+        }
+        run_first_output();
+    }
+
+    uint8_t index = output_queue_first_index + output_queue_count;
+    if (index >= PTH_OUTPUT_QUEUE_SIZE) {
+        index -= PTH_OUTPUT_QUEUE_SIZE;
+    }
+    output_queue[index] = *output;
+    output_queue_count++;
+}
+
+static void add_code16_output(output_type_t type, uint16_t code) {
+    output_t output = {.type = type, .code = code};
+    add_output(&output);
+}
+
+static void process_record_with_new_time(keyrecord_t* record) {
+    output_t output = {.type = OUTPUT_RECORD, .record = *record};
+    add_output(&output);
+}
+
+static void register_code16_in_order(uint16_t code) {
+    add_code16_output(OUTPUT_REGISTER_CODE16, code);
+}
+
+static void unregister_code16_in_order(uint16_t code) {
+    add_code16_output(OUTPUT_UNREGISTER_CODE16, code);
+}
+
+static void tap_code16_in_order(uint16_t code) {
+    // Same as tap_code16, but without blocking.
+    add_code16_output(OUTPUT_REGISTER_CODE16, code);
+#    if TAP_CODE_DELAY > 0
+    add_code16_output(OUTPUT_WAIT, KC_NO);
+#    endif
+    add_code16_output(OUTPUT_UNREGISTER_CODE16, code);
+}
+
+/**
+ * @return true if QMK may process the record now. Otherwise, it was added to
+ *         the output queue, as QMK would process it too early.
+ */
+static bool can_qmk_process_record(keyrecord_t* record) {
+#    if defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+    output_t output = {.type = OUTPUT_RECORD, .record = *record};
+    if (output_queue_count == 0 && !is_output_waiting() && !start_waiting_before(&output)) {
+        return true;
+    }
+#    else
+    if (output_queue_count == 0 && !is_output_waiting()) {
+        return true;
+    }
+#    endif // PTH_BATCHED_FLUSH && TAP_CODE_DELAY > 0
+    process_record_with_new_time(record);
+    return false;
+}
+#elif defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+static void wait_before_release(uint16_t id) {
+    uint16_t ms = get_ms_to_wait_before_release(id);
+    if (ms > 0) {
+        send_keyboard_report();
+        wait_ms(ms);
+    }
+}
+
+static void process_record_with_new_time(keyrecord_t* record) {
+    const uint16_t id = POS_TO_OUTPUT_ID(record->event.key);
+    if (record->event.pressed) {
+        process_record_now(record);
+        remember_press(id);
+    } else {
+        wait_before_release(id);
+        process_record_now(record);
+    }
+}
+
+static void register_code16_in_order(uint16_t code) {
+    register_code16(code);
+    remember_press(code);
+}
+
+static void unregister_code16_in_order(uint16_t code) {
+    wait_before_release(code);
+    unregister_code16(code);
+}
+
+static bool can_qmk_process_record(keyrecord_t* record) {
+    if (!record->event.pressed) {
+        wait_before_release(POS_TO_OUTPUT_ID(record->event.key));
+    }
+    return true;
+}
+
+#    define tap_code16_in_order(code) tap_code16(code)
+#else
+#    define process_record_with_new_time(record) process_record_now(record)
+#    define register_code16_in_order(code) register_code16(code)
+#    define unregister_code16_in_order(code) unregister_code16(code)
+#    define tap_code16_in_order(code) tap_code16(code)
+#    define can_qmk_process_record(record) true
+#endif // PTH_NON_BLOCKING_FLUSH
+
+// Key handling
+// ----------------------------------------------------------------------------
+
+static void process_register_record(keyrecord_t* record) {
+    record->event.pressed = true;
+    process_record_with_new_time(record);
+}
+
+static void process_unregister_record(keyrecord_t* record) {
+    record->event.pressed = false;
+    process_record_with_new_time(record);
+}
+
+static inline void set_record_to_tap(keyrecord_t* record) {
+    record->tap.interrupted = true;
+    record->tap.count       = 1;
+}
+
+static inline void set_record_to_hold(keyrecord_t* record) {
+    record->tap.count = 0;
+}
+
+static void process_register_record_as_hold(keyrecord_t* record) {
+    set_record_to_hold(record);
+    record->event.pressed = true;
+    process_record_with_new_time(record);
+}
+
+static void process_unregister_record_as_hold(keyrecord_t* record) {
+    set_record_to_hold(record);
+    record->event.pressed = false;
+    process_record_with_new_time(record);
+}
+
+static void process_register_record_as_tap(keyrecord_t* record) {
+    set_record_to_tap(record);
+    record->event.pressed = true;
+    process_record_with_new_time(record);
+}
+
+static void process_unregister_record_as_tap(keyrecord_t* record) {
+    set_record_to_tap(record);
+    record->event.pressed = false;
+    process_record_with_new_time(record);
+}
+
+// will only be called if PTH was not held instantly
+static void register_pth_hold(void) {
+    if (pth.tap_code_instead_of_hold == KC_NO) {
+        process_register_record_as_hold(&pth.record);
+
+        // Users must know that if the second was held instantly, but the PTH
+        // was not, then we will not re-register the second, i.e. second will
+        // be down before the PTH key, even though PTH was actually first.
+        // As a result, second will not be affected by a PTH layer change.
+        //
+        // This has the benefit of allowing you to press an MT and an LT, which
+        // are both on the same layer, in any order, given that you configure
+        // pth_should_hold_instantly so that it returns false for the LT.
+        if (pth.has_second && !pth.second_was_held_instantly && IS_QK_LAYER_TAP(pth.keycode)) {
+            // If PTH was held instantly, then second is already from the right
+            // layer. If second was held instantly, then it still is, so no
+            // update is needed. Here, none of that is true and the PTH key is
+            // an LT, so second is out of date, as the layer wasn't active yet.
+            pth.second_keycode     = get_keycode_same_pos_in_layer(&pth.second_record, QK_LAYER_TAP_GET_LAYER(pth.keycode));
+            pth.second_is_tap_hold = is_tap_hold_for_pth(pth.second_keycode, &pth.second_record);
+        }
+    } else {
+        register_code16_in_order(pth.tap_code_instead_of_hold);
+    }
+}
+
+static void unregister_pth_hold(void) {
+    if (pth.tap_code_instead_of_hold == KC_NO) {
+        process_unregister_record_as_hold(&pth.record);
+    } else {
+        unregister_code16_in_order(pth.tap_code_instead_of_hold);
+    }
+}
+
+/*
+ * We will call this in those situations where we will or can create
+ * a tap that is so short that the OS might ignore it.
+ */
+static void send_and_wait(void) {
+#if defined(PTH_BATCHED_FLUSH) && TAP_CODE_DELAY > 0
+    // The release that follows waits, but only if it has to.
+#elif defined(PTH_NON_BLOCKING_FLUSH) && TAP_CODE_DELAY > 0
+    add_code16_output(OUTPUT_SEND_AND_WAIT, KC_NO);
+#else
+    send_keyboard_report();
+#    if TAP_CODE_DELAY > 0
+    wait_ms(TAP_CODE_DELAY);
+#    endif
+#endif
+}
+
+// Handling of tap-hold releases that should be taps
+// ----------------------------------------------------------------------------
+/**
+ * @return true if the position existed in the array and was removed
+ */
+static bool remove_pos_from_tap_releases(keypos_t pos) {
+    for (uint8_t i = 0; i < release_as_tap_positions_count; i++) {
+        if (keypos_eq(release_as_tap_positions[i], pos)) {
+            // the order doesn't matter, so the last one takes its place
+            release_as_tap_positions[i] = release_as_tap_positions[--release_as_tap_positions_count];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool are_tap_releases_full(void) {
+    return release_as_tap_positions_count == PTH_RELEASE_AS_TAP_POSITIONS_SIZE;
+}
+
+/**
+ * @return false if there was no space for the position. The key must then not
+ *         be sent as tap, as QMK would release it as hold.
+ */
+static bool add_pos_to_tap_releases(keypos_t pos) {
+    if (are_tap_releases_full()) {
+        PTH_TELEMETRY_COUNT(tap_release_overflows);
+        PTH_LOGF("  There was not enough space to store (%u, %u) in release_as_tap_positions.", pos.col, pos.row);
+        return false;
+    }
+
+    release_as_tap_positions[release_as_tap_positions_count++] = pos;
+    release_as_tap_positions_high_water                        = MAX(release_as_tap_positions_high_water, release_as_tap_positions_count);
+    return true;
+}
+
+/**
+ * @brief Registers a tap-hold key that is still down as tap, or as hold if its
+ *        release can't be stored.
+ */
+static void process_register_record_as_tap_or_hold_if_full(keyrecord_t* record) {
+    if (add_pos_to_tap_releases(record->event.key)) {
+        process_register_record_as_tap(record);
+    } else {
+        process_register_record_as_hold(record);
+    }
+}
+
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+/**
+ * @brief Resets the state right after the PTH key was sent as tap. If its
+ *        release can't be stored, the state is kept, so that we release it
+ *        like without PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN.
+ */
+static void reset_pth_state_after_tap(void) {
+    if (add_pos_to_tap_releases(pth.record.event.key)) {
+        reset_pth_state();
+    }
+}
+#endif
+
+// Handling of release records to preserve order of presses and releases
+// ----------------------------------------------------------------------------
+// Using an enum instead of boolean for cleaner code
+typedef enum { AFTER_SECOND, BEFORE_SECOND } release_time_t;
+
+static bool process_release_records(release_time_t release_time, bool wait_before_first) {
+    // BEFORE_SECOND releases always come before AFTER_SECOND releases.
+    const uint8_t first = release_time == BEFORE_SECOND ? 0 : before_second_count;
+    const uint8_t end   = release_time == BEFORE_SECOND ? before_second_count : release_records_count;
+
+    // If there is no record, there's nothing to release.
+    if (first == end) {
+        return false;
+    }
+
+    if (wait_before_first) {
+        send_and_wait();
+    }
+
+    for (uint8_t i = first; i < end; i++) {
+        process_record_with_new_time(&release_records[i]);
+    }
+
+    // Remove the released records, while keeping the order of the others.
+    for (uint8_t i = end; i < release_records_count; i++) {
+        release_records[i - (end - first)] = release_records[i];
+    }
+    release_records_count -= end - first;
+    if (release_time == BEFORE_SECOND) {
+        before_second_count = 0;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Processes releases of the supplied kind and resets their records.
+ * Will wait only if there is a release record of the supplied kind.
+ * We do this to avoid any unnecessary waits.
+ *
+ * @return true if we waited.
+ */
+static bool process_release_records_and_wait_before_first(release_time_t release_time) {
+    return process_release_records(release_time, true);
+}
+
+// see Decision making functions
+static void make_decision_tap(void);
+static void make_decision_hold(void);
+#if PTH_SESSION_COUNT > 1
+static void start_next_session(void);
+#endif
+
+/**
+ * @brief Decides the PTH key because there is no space left for a release.
+ *        With a second key, this is the same prediction as for a third press.
+ *        Without one, the PTH key was only pressed while earlier keys were
+ *        released (like in a roll), so tap is chosen.
+ */
+static void decide_because_release_records_are_full(void) {
+    const bool hold = pth.has_second && pth_predict_hold_when_third_press();
+    PTH_LOGF("  Release records are full. Prediction: %s", PTH_LOG_CHOICE(hold, "hold", "tap"));
+    if (hold) {
+        make_decision_hold();
+        return;
+    }
+
+    make_decision_tap();
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+    reset_pth_state_after_tap();
+#endif
+}
+
+/**
+ * @brief Adds a release record to the array. If the array is full, the PTH
+ *        key is decided now, which processes the cached releases in order,
+ *        and then the record is processed.
+ */
+static void add_release_record(keyrecord_t* record, release_time_t release_time) {
+    if (release_records_count == PTH_RELEASE_RECORD_SIZE) {
+        PTH_TELEMETRY_COUNT(release_record_overflows);
+        decide_because_release_records_are_full();
+#if PTH_SESSION_COUNT > 1
+        // The second key became the next PTH key, and its press hasn't been
+        // sent yet, so the release has to wait for its decision.
+        start_next_session();
+        if (pth.status == PTH_PRESSED) {
+            add_release_record(record, BEFORE_SECOND);
+            return;
+        }
+#endif
+        process_record_with_new_time(record);
+        return;
+    }
+
+    // BEFORE_SECOND releases only happen before any AFTER_SECOND release.
+    release_records[release_records_count++] = *record;
+    if (release_time == BEFORE_SECOND) {
+        before_second_count++;
+    }
+    release_records_high_water = MAX(release_records_high_water, release_records_count);
+}
+
+#ifdef PTH_FIXED_POINT
+static pth_avg_t weighted_avg(int16_t v3, int16_t v4) {
+    // a value < 0 should not count towards the average (and v4 is never < 0)
+    if (v3 < 0) {
+        return (pth_avg_t)v4 * 65536;
+    }
+
+    // The weights below in 1/65536. They are rounded, so that they sum up to 1.
+    return 17625L * v3 + 47911L * v4;
+}
+#else
+static float weighted_avg(float v3, float v4) {
+    // a value < 0 should not count towards the average (and v4 is never < 0)
+    if (v3 < 0) {
+        return v4;
+    }
+
+    // each weight is the result of E**index divided by the sum of them all
+    return 0.2689414213699951f * v3 + 0.7310585786300049f * v4;
+}
+#endif // PTH_FIXED_POINT
+
+// Default prediction functions (can be used in your own weak function overrides)
+//=============================================================================
+#ifdef PTH_MODEL_INTERPRETER
+#    include "predictive_tap_hold_models.h"
+
+static int32_t get_feature(uint8_t feature) {
+    switch (feature) {
+        case PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR:
+            return pth.features.prev_press_to_pth_press_dur;
+        case PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR:
+            return pth.features.prev_prev_press_to_prev_press_dur;
+        case PTH_FEATURE_PREV_PREV_OVERLAP_DUR:
+            return pth.features.prev_prev_overlap_dur;
+        case PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR:
+            return pth.features.key_release_before_pth_to_pth_press_dur;
+        case PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR:
+            return pth.features.press_to_second_press_dur;
+        case PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR:
+            return pth.features.second_press_to_third_press_dur;
+        case PTH_FEATURE_SECOND_DUR:
+            return pth.second_to_be_released ? pth.features.second_dur : -1;
+        case PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR:
+            return pth.second_to_be_released ? pth.features.press_to_second_release_dur : -1;
+        case PTH_FEATURE_DOWN_COUNT:
+            return pth.features.down_count;
+        case PTH_FEATURE_PRESS_TO_PRESS_W_AVG:
+            return PTH_AVG_TO_FIXED(pth.features.press_to_press_w_avg);
+        case PTH_FEATURE_OVERLAP_W_AVG:
+            return PTH_AVG_TO_FIXED(pth.features.overlap_w_avg);
+        default:
+            return 0;
+    }
+}
+
+__attribute__((weak)) const pth_model_node_t* pth_get_model(pth_model_t model) {
+    switch (model) {
+        case PTH_MODEL_THIRD_PRESS:
+            return pth_third_press_model;
+        case PTH_MODEL_PTH_RELEASE_AFTER_SECOND_PRESS:
+            return pth_pth_release_after_second_press_model;
+#    ifdef PTH_EARLY_DECISION_ENABLE
+        case PTH_MODEL_SECOND_PRESS:
+            return pth_second_press_model;
+#    endif
+        default:
+            return pth_pth_release_after_second_release_model;
+    }
+}
+
+pth_real_t pth_evaluate_model(const pth_model_node_t* nodes) {
+    const pth_model_node_t* node = nodes;
+    while (true) {
+        uint8_t feature = pgm_read_byte(&node->feature);
+        int32_t value   = (int32_t)pgm_read_dword(&node->value);
+
+        if (feature == PTH_MODEL_LEAF) {
+#    ifdef PTH_FIXED_POINT
+            // from 1/65536 to 1/PTH_REAL_ONE (rounded)
+            return (pth_real_t)((value + (1L << (15 - PTH_REAL_SHIFT))) >> (16 - PTH_REAL_SHIFT));
+#    else
+            return value / 65536.0f;
+#    endif // PTH_FIXED_POINT
+        }
+
+        node += (get_feature(feature) <= value) ? 1 : pgm_read_byte(&node->right);
+    }
+}
+
+pth_real_t pth_default_get_hold_prediction_when_third_press(void) {
+    return pth_evaluate_model(pth_get_model(PTH_MODEL_THIRD_PRESS));
+}
+
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_press(void) {
+    return pth_evaluate_model(pth_get_model(PTH_MODEL_PTH_RELEASE_AFTER_SECOND_PRESS));
+}
+
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_release(void) {
+    return pth_evaluate_model(pth_get_model(PTH_MODEL_PTH_RELEASE_AFTER_SECOND_RELEASE));
+}
+
+#    ifdef PTH_EARLY_DECISION_ENABLE
+pth_real_t pth_default_get_hold_prediction_when_second_press(void) {
+    return pth_evaluate_model(pth_get_model(PTH_MODEL_SECOND_PRESS));
+}
+#    endif
+#else
+#    ifdef PTH_SMALL_MODELS
+/**
+ * Auto-generated decision tree prediction function, the full tree (see below)
+ * pruned for PTH_SMALL_MODELS by tools/pth_model_gen.py --ternary.
+ *
+ * At most 4 comparisons are necessary to get a result.
+ *
+ * Training samples at the leaves: 90.73 % correct before, 88.98 % after.
+ * Same decision as the full tree: 94.95 %
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_third_press(void) {
+    int16_t opt_th_down_next_up_dur = pth.second_to_be_released ? (int16_t)pth.features.press_to_second_release_dur : -1;
+
+    // clang-format off
+return (
+  pth.features.prev_press_to_pth_press_dur <= 759
+  ? (
+    opt_th_down_next_up_dur <= 150
+    ? (
+      pth.features.press_to_second_press_dur <= 170
+      ? PTH_REAL(0.06948028f)
+      : (
+        pth.features.press_to_second_press_dur <= 216
+        ? PTH_REAL(0.41739476f)
+        : PTH_REAL(0.87793427f)
+      )
+    )
+    : (
+      pth.features.second_press_to_third_press_dur <= 145
+      ? (
+        pth.features.press_to_second_press_dur <= 92
+        ? PTH_REAL(0.35153707f)
+        : PTH_REAL(0.56357143f)
+      )
+      : (
+        pth.features.press_to_second_press_dur <= 59
+        ? PTH_REAL(0.48336252f)
+        : PTH_REAL(0.93728805f)
+      )
+    )
+  )
+  : (
+    pth.features.press_to_press_w_avg <= PTH_AVG(994.01086f)
+    ? (
+      opt_th_down_next_up_dur <= 120
+      ? (
+        pth.features.press_to_second_press_dur <= 139
+        ? PTH_REAL(0.16491228f)
+        : PTH_REAL(0.83798885f)
+      )
+      : PTH_REAL(0.94285714f)
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 19
+      ? PTH_REAL(0.06451613f)
+      : PTH_REAL(0.96213532f)
+    )
+  )
+);
+    // clang-format on
+}
+
+/**
+ * Auto-generated decision tree prediction function, the full tree (see below)
+ * pruned for PTH_SMALL_MODELS by tools/pth_model_gen.py --ternary.
+ *
+ * At most 4 comparisons are necessary to get a result.
+ *
+ * Training samples at the leaves: 84.84 % correct before, 83.08 % after.
+ * Same decision as the full tree: 91.30 %
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_press(void) {
+    // clang-format off
+return (
+  pth.features.prev_press_to_pth_press_dur <= 1254
+  ? (
+    pth.features.press_to_second_press_dur <= 214
+    ? PTH_REAL(0.15571608f)
+    : (
+      pth.features.press_to_second_press_dur <= 247
+      ? (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 162
+        ? PTH_REAL(0.39172196f)
+        : PTH_REAL(0.71707317f)
+      )
+      : (
+        pth.features.down_count <= 0
+        ? PTH_REAL(0.88925225f)
+        : PTH_REAL(0.38566351f)
+      )
+    )
+  )
+  : (
+    pth.features.key_release_before_pth_to_pth_press_dur <= 1350
+    ? (
+      pth.features.press_to_second_press_dur <= 139
+      ? PTH_REAL(0.34656573f)
+      : PTH_REAL(0.89287937f)
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 17
+      ? PTH_REAL(0.063380282f)
+      : PTH_REAL(0.97088728f)
+    )
+  )
+);
+    // clang-format on
+}
+
+/**
+ * Auto-generated decision tree prediction function, the full tree (see below)
+ * pruned for PTH_SMALL_MODELS by tools/pth_model_gen.py --ternary.
+ *
+ * At most 4 comparisons are necessary to get a result.
+ *
+ * Training samples at the leaves: 78.25 % correct before, 75.34 % after.
+ * Same decision as the full tree: 85.76 %
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_release(void) {
+    uint16_t opt_th_down_next_up_dur = pth.features.press_to_second_release_dur;
+
+    // clang-format off
+return (
+  opt_th_down_next_up_dur <= 143
+  ? (
+    pth.features.prev_press_to_pth_press_dur <= 1292
+    ? (
+      opt_th_down_next_up_dur <= 116
+      ? PTH_REAL(0.09534535f)
+      : (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 118
+        ? PTH_REAL(0.27736303f)
+        : PTH_REAL(0.5394052f)
+      )
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 19
+      ? PTH_REAL(0.1f)
+      : (
+        opt_th_down_next_up_dur <= 64
+        ? PTH_REAL(0.28f)
+        : PTH_REAL(0.98523985f)
+      )
+    )
+  )
+  : (
+    pth.features.key_release_before_pth_to_pth_press_dur <= 125
+    ? (
+      pth.features.press_to_second_press_dur <= 107
+      ? (
+        pth.features.down_count <= 0
+        ? PTH_REAL(0.57380746f)
+        : PTH_REAL(0.24063401f)
+      )
+      : PTH_REAL(0.81205748f)
+    )
+    : PTH_REAL(0.97178076f)
+  )
+);
+    // clang-format on
+}
+#    else
+// These are also the source of the tables in predictive_tap_hold_models.h.
+// After changing a tree, run tools/pth_model_gen.py.
+/**
+ * Auto-generated decision tree prediction function.
+ *
+ * At most 7 comparisons are necessary to get a result.
+ *
+ * Mod:      50,599 /  68,121 (74.28 %)
+ * Non-mod: 306,692 / 310,294 (98.84 %)
+ * Total:   357,291 / 378,415 (94.42 %)
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_third_press(void) {
+    // Initialize to -1 because we may not have that information yet.
+    int16_t opt_next_dur            = -1;
+    int16_t opt_th_down_next_up_dur = -1;
+
+    if (pth.second_to_be_released) {
+        opt_next_dur            = (int16_t)pth.features.second_dur;
+        opt_th_down_next_up_dur = (int16_t)pth.features.press_to_second_release_dur;
+    }
+
+    // clang-format off
+return (
+  pth.features.prev_press_to_pth_press_dur <= 759
+  ? (
+    opt_th_down_next_up_dur <= 150
+    ? (
+      pth.features.press_to_second_press_dur <= 170
+      ? (
+        pth.features.second_press_to_third_press_dur <= 107
+        ? PTH_REAL(0.040555656f)
+        : (
+          opt_th_down_next_up_dur <= 109
+          ? PTH_REAL(0.14262922f)
+          : (
+            pth.features.press_to_second_press_dur <= 55
+            ? PTH_REAL(0.3217576f)
+            : PTH_REAL(0.8006757f)
+          )
+        )
+      )
+      : (
+        pth.features.press_to_second_press_dur <= 216
+        ? (
+          pth.features.down_count <= 0
+          ? (
+            pth.features.second_press_to_third_press_dur <= 77
+            ? PTH_REAL(0.38718662f)
+            : PTH_REAL(0.6451292f)
+          )
+          : PTH_REAL(0.22810061f)
+        )
+        : (
+          pth.features.down_count <= 0
+          ? PTH_REAL(0.910299f)
+          : (
+            pth.features.press_to_second_press_dur <= 264
+            ? PTH_REAL(0.4814815f)
+            : PTH_REAL(0.8877551f)
+          )
+        )
+      )
+    )
+    : (
+      pth.features.second_press_to_third_press_dur <= 145
+      ? (
+        pth.features.press_to_second_press_dur <= 92
+        ? (
+          pth.features.down_count <= 0
+          ? (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 112
+            ? PTH_REAL(0.43078628f)
+            : PTH_REAL(0.6967871f)
+          )
+          : (
+            pth.features.press_to_press_w_avg <= PTH_AVG(63.602364f)
+            ? PTH_REAL(0.51724136f)
+            : PTH_REAL(0.16554306f)
+          )
+        )
+        : (
+          pth.features.down_count <= 0
+          ? PTH_REAL(0.82194614f)
+          : (
+            pth.features.press_to_press_w_avg <= PTH_AVG(105.37883f)
+            ? PTH_REAL(0.64830506f)
+            : PTH_REAL(0.35095447f)
+          )
+        )
+      )
+      : (
+        pth.features.press_to_second_press_dur <= 59
+        ? (
+          opt_next_dur <= 130
+          ? PTH_REAL(0.6714801f)
+          : (
+            pth.features.prev_press_to_pth_press_dur <= 303
+            ? PTH_REAL(0.27037036f)
+            : PTH_REAL(0.7083333f)
+          )
+        )
+        : PTH_REAL(0.93728805f)
+      )
+    )
+  )
+  : (
+    pth.features.press_to_press_w_avg <= PTH_AVG(994.01086f)
+    ? (
+      opt_th_down_next_up_dur <= 120
+      ? (
+        pth.features.press_to_second_press_dur <= 139
+        ? (
+          pth.features.key_release_before_pth_to_pth_press_dur <= 443
+          ? PTH_REAL(0.84f)
+          : (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 1110
+            ? PTH_REAL(0.12546816f)
+            : PTH_REAL(0.54545456f)
+          )
+        )
+        : PTH_REAL(0.83798885f)
+      )
+      : (
+        pth.features.second_press_to_third_press_dur <= 127
+        ? (
+          pth.features.press_to_second_press_dur <= 146
+          ? (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 916
+            ? PTH_REAL(0.4074074f)
+            : PTH_REAL(0.9166667f)
+          )
+          : PTH_REAL(0.9607843f)
+        )
+        : PTH_REAL(0.97471267f)
+      )
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 19
+      ? PTH_REAL(0.06451613f)
+      : (
+        pth.features.prev_press_to_pth_press_dur <= 1449
+        ? (
+          pth.features.press_to_second_press_dur <= 111
+          ? (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 1777
+            ? PTH_REAL(0.6754386f)
+            : PTH_REAL(0.1f)
+          )
+          : PTH_REAL(0.9519231f)
+        )
+        : PTH_REAL(0.99276936f)
+      )
+    )
+  )
+);
+    // clang-format on
+}
+
+/**
+ * Auto-generated decision tree prediction function.
+ * At most 7 comparisons are necessary to get a result.
+ *
+ * Mod:       741,259 /  1,057,871 (70.07 %)
+ * Non-mod: 9,162,154 /  9,190,163 (99.70 %)
+ * Total:   9,903,413 / 10,248,034 (96.64 %)
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_press(void) {
+    // clang-format off
+return (
+  pth.features.prev_press_to_pth_press_dur <= 1254
+  ? (
+    pth.features.press_to_second_press_dur <= 214
+    ? (
+      pth.features.press_to_second_press_dur <= 168
+      ? (
+        pth.features.prev_press_to_pth_press_dur <= 237
+        ? PTH_REAL(0.021824066f)
+        : (
+          pth.features.press_to_second_press_dur <= 124
+          ? PTH_REAL(0.06581373f)
+          : (
+            pth.features.prev_prev_press_to_prev_press_dur <= 1603
+            ? PTH_REAL(0.12980974f)
+            : PTH_REAL(0.6515581f)
+          )
+        )
+      )
+      : (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 169
+        ? PTH_REAL(0.1548253f)
+        : (
+          pth.features.press_to_second_press_dur <= 186
+          ? (
+            pth.features.press_to_press_w_avg <= PTH_AVG(822.32574f)
+            ? PTH_REAL(0.3386316f)
+            : PTH_REAL(0.6540284f)
+          )
+          : (
+            pth.features.prev_press_to_pth_press_dur <= 226
+            ? PTH_REAL(0.10697675f)
+            : PTH_REAL(0.53629214f)
+          )
+        )
+      )
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 247
+      ? (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 162
+        ? (
+          pth.features.overlap_w_avg <= PTH_AVG(0.13447072f)
+          ? (
+            pth.features.prev_prev_press_to_prev_press_dur <= 165
+            ? PTH_REAL(0.63566846f)
+            : PTH_REAL(0.41175103f)
+          )
+          : PTH_REAL(0.24768922f)
+        )
+        : (
+          pth.features.down_count <= 0
+          ? (
+            pth.features.overlap_w_avg <= PTH_AVG(17.07778f)
+            ? PTH_REAL(0.7658702f)
+            : PTH_REAL(0.4507772f)
+          )
+          : PTH_REAL(0.08022922f)
+        )
+      )
+      : (
+        pth.features.down_count <= 0
+        ? PTH_REAL(0.88925225f)
+        : (
+          pth.features.press_to_second_press_dur <= 312
+          ? PTH_REAL(0.26601785f)
+          : (
+            pth.features.prev_press_to_pth_press_dur <= 181
+            ? PTH_REAL(0.7529976f)
+            : PTH_REAL(0.23684211f)
+          )
+        )
+      )
+    )
+  )
+  : (
+    pth.features.key_release_before_pth_to_pth_press_dur <= 1350
+    ? (
+      pth.features.press_to_second_press_dur <= 139
+      ? (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 1273
+        ? (
+          pth.features.prev_prev_press_to_prev_press_dur <= 1588
+          ? (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 539
+            ? PTH_REAL(0.5905512f)
+            : PTH_REAL(0.25539857f)
+          )
+          : (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 102
+            ? PTH_REAL(0.083333336f)
+            : PTH_REAL(0.8053435f)
+          )
+        )
+        : (
+          pth.features.press_to_press_w_avg <= PTH_AVG(1096.1167f)
+          ? (
+            pth.features.press_to_second_press_dur <= 89
+            ? PTH_REAL(0.4801762f)
+            : PTH_REAL(0.7108014f)
+          )
+          : PTH_REAL(0.42533332f)
+        )
+      )
+      : PTH_REAL(0.89287937f)
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 17
+      ? (
+        pth.features.prev_prev_press_to_prev_press_dur <= 146
+        ? PTH_REAL(0.01754386f)
+        : (
+          pth.features.key_release_before_pth_to_pth_press_dur <= 3116
+          ? PTH_REAL(0.04477612f)
+          : (
+            pth.features.key_release_before_pth_to_pth_press_dur <= 3243
+            ? PTH_REAL(0.5714286f)
+            : PTH_REAL(0.09090909f)
+          )
+        )
+      )
+      : (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 1504
+        ? PTH_REAL(0.9103782f)
+        : (
+          pth.features.down_count <= 0
+          ? PTH_REAL(0.98845273f)
+          : PTH_REAL(0.046153847f)
+        )
+      )
+    )
+  )
+);
+    // clang-format on
+}
+
+/**
+ * Auto-generated decision tree prediction function.
+ * At most 7 comparisons are necessary to get a result.
+ *
+ * Mod:     420,158 / 435,604 (96.45 %)
+ * Non-mod:  60,870 /  85,031 (71.59 %)
+ * Total:   481,028 / 520,635 (92.39 %)
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_release(void) {
+    uint16_t opt_next_dur            = pth.features.second_dur;
+    uint16_t opt_th_down_next_up_dur = pth.features.press_to_second_release_dur;
+
+    // clang-format off
+return (
+  opt_th_down_next_up_dur <= 143
+  ? (
+    pth.features.prev_press_to_pth_press_dur <= 1292
+    ? (
+      opt_th_down_next_up_dur <= 116
+      ? PTH_REAL(0.09534535f)
+      : (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 118
+        ? PTH_REAL(0.27736303f)
+        : (
+          pth.features.prev_press_to_pth_press_dur <= 174
+          ? PTH_REAL(0.08959538f)
+          : (
+            pth.features.press_to_second_press_dur <= 29
+            ? PTH_REAL(0.32664755f)
+            : PTH_REAL(0.65463656f)
+          )
+        )
+      )
+    )
+    : (
+      pth.features.press_to_second_press_dur <= 19
+      ? PTH_REAL(0.1f)
+      : (
+        opt_th_down_next_up_dur <= 64
+        ? (
+          pth.features.key_release_before_pth_to_pth_press_dur <= 2050
+          ? PTH_REAL(0.0625f)
+          : (
+            pth.features.press_to_press_w_avg <= PTH_AVG(2830.7092f)
+            ? PTH_REAL(0.71428573f)
+            : PTH_REAL(0.5f)
+          )
+        )
+        : (
+          pth.features.key_release_before_pth_to_pth_press_dur <= 1244
+          ? (
+            opt_th_down_next_up_dur <= 107
+            ? PTH_REAL(0.33333334f)
+            : PTH_REAL(0.85714287f)
+          )
+          : PTH_REAL(0.99616855f)
+        )
+      )
+    )
+  )
   : (
-    key_release_before_pth_to_pth_press_dur <= 125
+    pth.features.key_release_before_pth_to_pth_press_dur <= 125
     ? (
-      pth_press_to_second_press_dur <= 107
+      pth.features.press_to_second_press_dur <= 107
       ? (
-        down_count <= 0
+        pth.features.down_count <= 0
         ? (
-          pth_press_to_second_press_dur <= 77
+          pth.features.press_to_second_press_dur <= 77
           ? (
-            key_release_before_pth_to_pth_press_dur <= 47
-            ? 0.42004812f
-            : 0.58709514f
+            pth.features.key_release_before_pth_to_pth_press_dur <= 47
+            ? PTH_REAL(0.42004812f)
+            : PTH_REAL(0.58709514f)
           )
-          : 0.70079845f
+          : PTH_REAL(0.70079845f)
         )
-        : 0.24063401f
+        : PTH_REAL(0.24063401f)
       )
       : (
         opt_th_down_next_up_dur <= 182
         ? (
-          pth_prev_prev_overlap_dur <= 0
+          pth.features.prev_prev_overlap_dur <= 0
           ? (
             opt_next_dur <= 43
-            ? 0.4791367f
-            : 0.8005192f
+            ? PTH_REAL(0.4791367f)
+            : PTH_REAL(0.8005192f)
           )
           : (
             opt_next_dur <= 54
-            ? 0.23857868f
-            : 0.50877196f
+            ? PTH_REAL(0.23857868f)
+            : PTH_REAL(0.50877196f)
           )
         )
         : (
-          pth_press_to_second_press_dur <= 167
-          ? 0.8571564f
+          pth.features.press_to_second_press_dur <= 167
+          ? PTH_REAL(0.8571564f)
           : (
             opt_next_dur <= 17
-            ? 0.30452675f
-            : 0.96995705f
+            ? PTH_REAL(0.30452675f)
+            : PTH_REAL(0.96995705f)
           )
         )
       )
     )
     : (
-      down_count <= 0
+      pth.features.down_count <= 0
       ? (
-        pth_press_to_press_w_avg <= 867.94495f
-        ? 0.94516844f
+        pth.features.press_to_press_w_avg <= PTH_AVG(867.94495f)
+        ? PTH_REAL(0.94516844f)
         : (
-          pth_press_to_second_press_dur <= 11
-          ? 0.14285715f
-          : 0.9992744f
+          pth.features.press_to_second_press_dur <= 11
+          ? PTH_REAL(0.14285715f)
+          : PTH_REAL(0.9992744f)
         )
       )
       : (
-        pth_prev_prev_press_to_prev_press_dur <= 311
+        pth.features.prev_prev_press_to_prev_press_dur <= 311
         ? (
           opt_th_down_next_up_dur <= 238
-          ? 0.15384616f
+          ? PTH_REAL(0.15384616f)
           : (
-            pth_press_to_second_press_dur <= 175
-            ? 0.43137255f
-            : 0.74390244f
+            pth.features.press_to_second_press_dur <= 175
+            ? PTH_REAL(0.43137255f)
+            : PTH_REAL(0.74390244f)
           )
         )
         : (
           opt_th_down_next_up_dur <= 178
           ? (
-            pth_prev_press_to_pth_press_dur <= 96
-            ? 0.54285717f
-            : 0.0952381f
+            pth.features.prev_press_to_pth_press_dur <= 96
+            ? PTH_REAL(0.54285717f)
+            : PTH_REAL(0.0952381f)
           )
           : (
-            pth_prev_press_to_pth_press_dur <= 187
-            ? 0.91690546f
-            : 0.2f
+            pth.features.prev_press_to_pth_press_dur <= 187
+            ? PTH_REAL(0.91690546f)
+            : PTH_REAL(0.2f)
           )
         )
       )
@@ -1278,354 +3146,1286 @@ return (
 );
     // clang-format on
 }
+#    endif // PTH_SMALL_MODELS
+
+#    ifdef PTH_EARLY_DECISION_ENABLE
+/**
+ * Derived from the samples of the three trained trees by
+ * tools/pth_model_gen.py, using only the features that are known at the
+ * second press. Each leaf is the share of holds among the second presses
+ * that reach it.
+ *
+ * At most 5 comparisons are necessary to get a result.
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_second_press(void) {
+    // clang-format off
+    return (
+  pth.features.prev_press_to_pth_press_dur <= 1254
+  ? (
+    pth.features.press_to_second_press_dur <= 111
+    ? PTH_REAL(0.4176734f)
+    : (
+      pth.features.press_to_second_press_dur <= 186
+      ? (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 162
+        ? (
+          pth.features.press_to_second_press_dur <= 167
+          ? PTH_REAL(0.16568683f)
+          : PTH_REAL(0.074289354f)
+        )
+        : (
+          pth.features.press_to_press_w_avg <= PTH_AVG(867.94495f)
+          ? PTH_REAL(0.035458531f)
+          : PTH_REAL(0.16147655f)
+        )
+      )
+      : PTH_REAL(0.17377944f)
+    )
+  )
+  : (
+    pth.features.key_release_before_pth_to_pth_press_dur <= 1350
+    ? (
+      pth.features.press_to_second_press_dur <= 139
+      ? (
+        pth.features.key_release_before_pth_to_pth_press_dur <= 916
+        ? PTH_REAL(0.23786979f)
+        : (
+          pth.features.key_release_before_pth_to_pth_press_dur <= 1273
+          ? PTH_REAL(0.084923232f)
+          : PTH_REAL(0.16194476f)
+        )
+      )
+      : PTH_REAL(0.59893779f)
+    )
+    : (
+      pth.features.key_release_before_pth_to_pth_press_dur <= 1504
+      ? PTH_REAL(0.62282647f)
+      : (
+        pth.features.press_to_second_press_dur <= 19
+        ? PTH_REAL(0.88962517f)
+        : PTH_REAL(0.92106219f)
+      )
+    )
+  )
+);
+    // clang-format on
+}
+#    endif // PTH_EARLY_DECISION_ENABLE
+
+#endif // PTH_MODEL_INTERPRETER
+
+/**
+ * @brief The default prediction for the minimum overlap time for a hold.
+ *
+ * Mod:                 991,319 /  1,496,055 (66.26 %)
+ * Non-mod:           9,527,683 /  9,582,518 (99.43 %)
+ * Total:            10,519,002 / 11,078,573 (94.95 %)
+ *
+ * @return float predicted overlap time in ms.
+ */
+#ifdef PTH_FIXED_POINT
+uint16_t pth_default_get_overlap_ms_for_hold_prediction(void) {
+    // Same as the float version below, with the first term scaled by 4 and
+    // the second by 4096. Since 80583 is odd and the subtrahend is even, the
+    // first divisor can never be 0.
+    int32_t second = pth.features.press_to_second_press_dur;
+    int32_t a      = (second * 80583L) / (80583L - 4L * (pth.features.prev_press_to_pth_press_dur - pth.features.prev_prev_overlap_dur) * second);
+
+    int32_t b = 82500157L - (pth.features.prev_press_to_pth_press_dur - 3L * pth.features.prev_prev_overlap_dur) * 41972L;
+    b         = (SD(b, second) - 133362L) / 4096;
+
+    int32_t guess = ABS(MAX(a, b));
+    return (uint16_t)MIN(guess, UINT16_MAX);
+}
+#else
+float pth_default_get_overlap_ms_for_hold_prediction(void) {
+    // clang-format off
+    float guess = ABS(
+        MAX(pth.features.press_to_second_press_dur *
+                SD(20145.72453837935f,
+                   20145.72453837935f -
+                       (((float)pth.features.prev_press_to_pth_press_dur) -
+                        pth.features.prev_prev_overlap_dur) *
+                           pth.features.press_to_second_press_dur),
+            SD(20141.63979839019f - ((pth.features.prev_press_to_pth_press_dur -
+                                      2.0f * pth.features.prev_prev_overlap_dur) -
+                                     pth.features.prev_prev_overlap_dur) *
+                                        10.24699665838974f,
+               pth.features.press_to_second_press_dur) -
+                32.559018051648636f));
+    // clang-format on
+
+    return (uint16_t)guess;
+}
+#endif // PTH_FIXED_POINT
+
+#ifdef PTH_FAST_STREAK_TAP_ENABLE
+// should be simple, as this will be called on every tap-hold press when IDLE
+float pth_default_get_fast_streak_tap_prediction(void) {
+    float s = ((float)pth.features.prev_prev_overlap_dur) - pth.features.prev_press_to_pth_press_dur;
+    return ABS(SD(s, 4.280551301886473f - pth.features.prev_press_to_pth_press_dur));
+}
+
+float pth_conservative_get_fast_streak_tap_prediction(void) {
+    float s = ((float)pth.features.prev_prev_overlap_dur) - pth.features.prev_press_to_pth_press_dur;
+    return ABS(SD(s, s + 5.3131340976019885f * PTH_AVG_TO_FLOAT(pth.features.overlap_w_avg)));
+}
+#endif // PTH_FAST_STREAK_TAP_ENABLE
+
+static inline pth_real_t default_get_prediction_factor_for_hold(void) {
+    // will be 1 for PTH_5H and 2 for PTH_10H, and 3 for PTH_15H
+    uint8_t    mp = PTH_GET_USER_BIT_ENCODED_VALUE(pth_get_pth_side_user_bits());
+    pth_real_t f  = PTH_REAL_ONE;
+    if (mp > 0 && mp <= 3) {
+        f -= mp * PTH_REAL(0.05f);
+    }
+#ifdef PTH_ADAPTIVE_FACTORS
+    f += pth_get_adaptive_factor_offset();
+#endif
+    return f;
+}
+
+__attribute__((weak)) pth_real_t pth_get_prediction_factor_for_hold(void) {
+    return default_get_prediction_factor_for_hold();
+}
+
+// Prediction functions
+// ----------------------------------------------------------------------------
+__attribute__((weak)) pth_real_t pth_get_hold_prediction_when_third_press(const pth_features_t* features) {
+    return pth_default_get_hold_prediction_when_third_press();
+}
+
+__attribute__((weak)) pth_real_t pth_get_hold_prediction_when_pth_release_after_second_press(const pth_features_t* features) {
+    return pth_default_get_hold_prediction_when_pth_release_after_second_press();
+}
+
+__attribute__((weak)) pth_real_t pth_get_hold_prediction_when_pth_release_after_second_release(const pth_features_t* features) {
+    return pth_default_get_hold_prediction_when_pth_release_after_second_release();
+}
+
+#ifdef PTH_FIXED_POINT
+__attribute__((weak)) uint16_t pth_get_overlap_ms_for_hold_prediction(const pth_features_t* features) {
+#else
+__attribute__((weak)) float pth_get_overlap_ms_for_hold_prediction(const pth_features_t* features) {
+#endif // PTH_FIXED_POINT
+    return pth_default_get_overlap_ms_for_hold_prediction();
+}
+
+__attribute__((weak)) bool pth_predict_hold_when_third_press(void) {
+    pth_real_t p = pth_get_hold_prediction_when_third_press(&pth.features);
+    p            = PTH_REAL_MUL(p, PTH_GET_PREDICTION_FACTOR_FOR_HOLD());
+    return p > PTH_REAL(0.5f);
+}
+
+__attribute__((weak)) bool pth_predict_hold_when_pth_release_after_second_press(void) {
+    pth_real_t p = pth_get_hold_prediction_when_pth_release_after_second_press(&pth.features);
+    p            = PTH_REAL_MUL(p, PTH_GET_PREDICTION_FACTOR_FOR_HOLD());
+    return p > PTH_REAL(0.5f);
+}
+
+__attribute__((weak)) bool pth_predict_hold_when_pth_release_after_second_release(void) {
+    pth_real_t p = pth_get_hold_prediction_when_pth_release_after_second_release(&pth.features);
+    p            = PTH_REAL_MUL(p, PTH_GET_PREDICTION_FACTOR_FOR_HOLD());
+    return p > PTH_REAL(0.5f);
+}
+
+__attribute__((weak)) uint16_t pth_predict_min_overlap_for_hold_in_ms(void) {
+    pth_real_t pf = PTH_GET_PREDICTION_FACTOR_FOR_HOLD();
+
+    if (pth_is_second_same_side_as_pth()) {
+        // If second is same side, we want the overlap required to be larger,
+        // as it is more likely this is intended as a tap.
+        pf -= PTH_REAL(0.10f);
+    }
+
+    // a large overlap estimate makes hold less likely
+    pth_real_t f = PTH_REAL_ONE + (PTH_REAL_ONE - pf);
+#ifdef PTH_FIXED_POINT
+    uint32_t overlap = ((uint32_t)pth_get_overlap_ms_for_hold_prediction(&pth.features) * (uint16_t)MAX(f, 0)) >> PTH_REAL_SHIFT;
+    return (uint16_t)MIN(overlap, UINT16_MAX);
+#else
+    return pth_get_overlap_ms_for_hold_prediction(&pth.features) * f;
+#endif // PTH_FIXED_POINT
+}
+
+#ifdef PTH_EARLY_DECISION_ENABLE
+__attribute__((weak)) pth_real_t pth_get_early_decision_margin(void) {
+    return PTH_REAL(0.4f);
+}
+
+__attribute__((weak)) pth_real_t pth_get_hold_prediction_when_second_press(const pth_features_t* features) {
+    return pth_default_get_hold_prediction_when_second_press();
+}
+
+__attribute__((weak)) pth_status_t pth_predict_early_decision_when_second_press(void) {
+    pth_real_t p      = pth_get_hold_prediction_when_second_press(&pth.features);
+    p                 = PTH_REAL_MUL(p, PTH_GET_PREDICTION_FACTOR_FOR_HOLD());
+    pth_real_t margin = pth_get_early_decision_margin();
+
+    if (p > PTH_REAL(0.5f) + margin) {
+        return PTH_DECIDED_HOLD;
+    }
+    if (p < PTH_REAL(0.5f) - margin) {
+        return PTH_DECIDED_TAP;
+    }
+    return PTH_SECOND_PRESSED;
+}
+#endif // PTH_EARLY_DECISION_ENABLE
+
+static bool should_neutralize_mods(uint16_t keycode, bool was_held_instantly) {
+    return (was_held_instantly && IS_QK_MOD_TAP(keycode) && PTH_SHOULD_NEUTRALIZE_MODS(get_5_bit_mods_of_mod_tap(keycode)));
+}
+
+// Decision making functions
+// ----------------------------------------------------------------------------
+#if PTH_SESSION_COUNT > 1
+// see Sessions
+static bool should_hand_over_second(void);
+static void hand_over_second(void);
+#endif
+
+static void make_decision_tap(void) {
+    if (pth.status >= PTH_DECIDED_TAP) {
+        return;
+    }
+    PTH_BENCH_SCOPE(PTH_BENCH_DECISION_TAP);
+
+    PTH_LOGF("  -> DECIDED_TAP after %u ms", PTH_TIMER_ELAPSED(pth.press_timer));
+
+    pth.status = PTH_DECIDED_TAP;
+    PTH_RECORD_DECISION(false);
+    observe_decision_for_adaptation(false);
+    observe_decision_for_timeout(false);
+
+    if (should_neutralize_mods(pth.keycode, pth.was_held_instantly) || should_neutralize_mods(pth.second_keycode, pth.second_was_held_instantly)) {
+        // Neutralize modifiers acting on their own (e.g. ALT).
+        tap_code16_in_order(PTH_INSTANT_MOD_TAP_SUPPRESSION_KEY);
+    }
+
+    // TODO: If both held instantly, does the order ever matter?
+    if (pth.was_held_instantly) {
+        if (IS_QK_LAYER_TAP(pth.keycode) && pth.has_second) {
+            // PTH is LT and was held instantly, so second is outdated.
+            pth.second_keycode     = get_keycode_same_pos_in_layer(&pth.second_record, pth.layer_before_instant_layer_tap);
+            pth.second_is_tap_hold = is_tap_hold_for_pth(pth.second_keycode, &pth.second_record);
+            PTH_LOGF("  Disabling PTH instant layer. Second key will be: %s", PTH_LOG_KEYCODE(pth.second_keycode));
+        }
+        process_unregister_record_as_hold(&pth.record);
+    }
+
+    if (pth.second_was_held_instantly) {
+        process_unregister_record_as_hold(&pth.second_record);
+    }
+
+    process_register_record_as_tap(&pth.record);
+    process_release_records_and_wait_before_first(BEFORE_SECOND);
+
+    if (!pth.has_second) {
+        return;
+    }
+
+#if PTH_SESSION_COUNT > 1
+    if (should_hand_over_second()) {
+        hand_over_second();
+        return;
+    }
+#endif
+
+    if (pth.second_is_tap_hold) {
+        // add it to array, so we can release as tap even after we have reset
+        // state, or hold it if there's no space
+        if (pth.second_to_be_released || add_pos_to_tap_releases(pth.second_record.event.key)) {
+            set_record_to_tap(&pth.second_record);
+        } else {
+            set_record_to_hold(&pth.second_record);
+        }
+    }
+
+    PTH_LOGF("  Registering second key. (layer_state=%u default_layer_state=%u)", layer_state, default_layer_state);
+    process_register_record(&pth.second_record);
+    bool waited = process_release_records_and_wait_before_first(AFTER_SECOND);
+
+    if (pth.second_to_be_released) {
+        if (!waited) {
+            send_and_wait();
+        }
+        process_unregister_record(&pth.second_record);
+    }
+}
+
+static void make_decision_hold(void) {
+    if (pth.status >= PTH_DECIDED_TAP) {
+        return;
+    }
+    PTH_BENCH_SCOPE(PTH_BENCH_DECISION_HOLD);
+
+    PTH_LOGF("  -> DECIDED_HOLD after %u ms", PTH_TIMER_ELAPSED(pth.press_timer));
+
+    pth.status = PTH_DECIDED_HOLD;
+    PTH_RECORD_DECISION(true);
+    observe_decision_for_adaptation(true);
+    observe_decision_for_timeout(true);
+
+    if (!pth.was_held_instantly) {
+        register_pth_hold();
+    }
+    process_release_records(BEFORE_SECOND, pth.was_held_instantly);
+
+    if (!pth.has_second) {
+        return;
+    }
+
+#if PTH_SESSION_COUNT > 1
+    if (should_hand_over_second()) {
+        hand_over_second();
+        return;
+    }
+#endif
+
+    // Users expect the following sequence to result in an uppercase A and B:
+    // KC_LSFT down, LCTL_T(KC_A) down [PTH key], LSFT_T(KC_B) down, KC_LSFT up,
+    // LCTL_T(KC_A) up. The algorithm predicts tap. At that point KC_LSFT is
+    // already up. If we had already unregistered the Shift, then we would get
+    // 'ab' instead of 'AB'. That's why we have to collect releases after and
+    // before the second key is pressed, so that we can release them at the
+    // right time when a choice for tap or hold is made. That way, we can't
+    // preserve the duration between presses, but we can preserve the order.
+    //
+    // Be aware, that there is one edge case where we can't do so completely:
+    //
+    // PTH is pressed and instantly held, a key X is released (which we cache,
+    // i.e. not process yet), second is down and instantly held. So the second
+    // is already held, but in reality X was released before second is pressed.
+    //
+    // That said, it seems like it's not an issue, as modifiers (usually) only
+    // affect keys when they're being pressed down, and not afterwards. An
+    // KC_LSFT will not make an KC_E uppercase, if it was down before KC_LSFT.
+    if (!pth.second_was_held_instantly) {
+        if (pth.second_is_tap_hold) {
+            if (pth.second_is_same_side_as_pth && PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE(pth.second_keycode, &pth.second_record)) {
+                // Same-side tap-hold becomes hold to allow multiple holds at
+                // the same time. For consistency, we do it, even if second was
+                // already released.
+                set_record_to_hold(&pth.second_record);
+            } else {
+                // other side becomes tap (or hold, if there's no space to
+                // store its release)
+                if (pth.second_to_be_released || add_pos_to_tap_releases(pth.second_record.event.key)) {
+                    set_record_to_tap(&pth.second_record);
+                } else {
+                    set_record_to_hold(&pth.second_record);
+                }
+            }
+        }
+
+        process_register_record(&pth.second_record);
+    }
+
+    // does not wait, if second was held instantly, as that already requires waiting
+    bool waited = process_release_records(AFTER_SECOND, pth.second_was_held_instantly);
+
+    if (pth.second_to_be_released) {
+        if (!waited) {
+            send_and_wait();
+        }
+        process_unregister_record(&pth.second_record);
+    }
+}
+
+static void make_user_choice_or_not(void) {
+    pth.has_chosen_after_timeout_reached = true;
+    pth_status_t choice                  = PTH_GET_FORCED_CHOICE_AFTER_TIMEOUT();
+    PTH_DECISION_PATH(PTH_PATH_TIMEOUT);
+    if (choice == PTH_DECIDED_HOLD) {
+        PTH_LOG("Choose hold because pressed long enough.");
+        make_decision_hold();
+    } else if (choice == PTH_DECIDED_TAP) {
+        PTH_LOG("Choose tap because pressed long enough.");
+        make_decision_tap();
+
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+        reset_pth_state_after_tap();
+#endif
+    }
+}
+
+static void collect_press_features(press_features_t* f, pth_timer_t press_time) {
+    f->release_to_press_dur = PTH_ELAPSED(press_time, history.release_timer, history.release_timer_max_reached);
+
+    // We measure from press to press, and as this is a press, we
+    // don't need to do any special handling here for history.down_count > 0.
+    f->prev_prev_press_to_prev_press_dur = history.prev_press_to_press_dur;
+    f->prev_press_to_press_dur           = history.cur_press_to_press_dur;
+
+    // The following is necessary for consistency!
+    // For example, let's go through some examples:
+    //
+    // x is the current PTH key
+    // lower case = down / pressed
+    // upper case = up / released
+    //
+    // cCdDx -> would provide 2 overlap values
+    //
+    // cCdx (d not released) -> without adding 0, this would only
+    // provide 1 value from that sequence, but as other keys likely
+    // have been pressed before, the prediction algorithm would have
+    // access to much older overlap values that are less relevant.
+    //
+    // For press to press durations, we would get 2 in either case.
+    uint8_t down_count_before_this = history.down_count - 1;
+
+    f->prev_prev_overlap_dur = history.prev_overlap_dur;
+    f->prev_overlap_dur      = history.cur_overlap_dur;
+    if (down_count_before_this == 1) {
+        // still one down, but no overlap (of course, it will overlap with this one)
+        f->prev_prev_overlap_dur = f->prev_overlap_dur;
+        f->prev_overlap_dur      = 0;
+    } else if (down_count_before_this >= 2) {
+        f->prev_prev_overlap_dur = 0;
+
+        // there's still an overlap going on (more than 1 key down),
+        // so determine duration until now and that will be the new last
+        f->prev_overlap_dur = PTH_ELAPSED(PTH_TIMER_READ(), history.overlap_timer, history.overlap_timer_max_reached);
+    }
+}
+
+static void store_press_features_for_pth(const press_features_t* f) {
+    pth.features.key_release_before_pth_to_pth_press_dur = f->release_to_press_dur;
+    pth.features.prev_prev_press_to_prev_press_dur       = f->prev_prev_press_to_prev_press_dur;
+    pth.features.prev_press_to_pth_press_dur             = f->prev_press_to_press_dur;
+    pth.features.prev_prev_overlap_dur                   = f->prev_prev_overlap_dur;
+    pth.features.prev_overlap_dur                        = f->prev_overlap_dur;
+
+    pth.features.press_to_press_w_avg = weighted_avg(pth.features.prev_prev_press_to_prev_press_dur, pth.features.prev_press_to_pth_press_dur);
+    pth.features.overlap_w_avg        = weighted_avg(pth.features.prev_prev_overlap_dur, pth.features.prev_overlap_dur);
+}
+
+static void collect_new_press_to_press_and_overlap_duration(bool is_pressed, pth_timer_t cur_time) {
+    if (is_pressed) {
+        uint16_t p_to_p_dur             = PTH_ELAPSED(cur_time, history.press_to_press_timer, history.press_to_press_timer_max_reached);
+        history.prev_press_to_press_dur = history.cur_press_to_press_dur;
+        history.cur_press_to_press_dur  = p_to_p_dur;
+        PTH_LOGF("  Storing actual press-to-press duration: %u ms", p_to_p_dur);
+        record_typing_stat(PTH_STATS_PRESS_TO_PRESS, p_to_p_dur);
+
+        history.press_to_press_timer             = cur_time;
+        history.press_to_press_timer_max_reached = false;
+        history.down_count++;
+        if (history.down_count == 2) {
+            // Two keys down at the same time, so we have an overlap
+            history.overlap_timer             = cur_time;
+            history.overlap_timer_max_reached = false;
+        }
+    } else {
+        // on release
+        uint16_t overlap = 0;
+        // Check if an overlap was active (history.down_count would have been >= 2 before this release event)
+        if (history.down_count >= 2) {
+            overlap = PTH_ELAPSED(cur_time, history.overlap_timer, history.overlap_timer_max_reached);
+        }
+
+        if (history.down_count > 0) {
+            history.down_count--;
+        }
+        history.prev_overlap_dur = history.cur_overlap_dur;
+        history.cur_overlap_dur  = overlap;
+        PTH_LOGF("  Storing actual overlap duration: %u ms", overlap);
+        record_typing_stat(PTH_STATS_OVERLAP, overlap);
+
+        // We don't want to count overlaps twice, so we set to the current time
+        history.overlap_timer             = cur_time;
+        history.overlap_timer_max_reached = false;
+
+        history.release_timer             = cur_time;
+        history.release_timer_max_reached = false;
+    }
+    pth.features.down_count = history.down_count;
+}
+
+static void collect_second_release_durations(pth_timer_t cur_time) {
+    pth.features.press_to_second_release_dur = PTH_ELAPSED(cur_time, pth.press_timer, pth.press_timer_max_reached);
+    pth.features.second_dur                  = PTH_ELAPSED(cur_time, pth.second_press_timer, pth.second_press_timer_max_reached);
+}
+
+// Sessions
+// ----------------------------------------------------------------------------
+// Only the PTH key can be undecided. Once it is decided, a tap-hold second that
+// is still held (and was not held instantly) is not forced to tap or hold,
+// but becomes the next PTH key, with its own prediction. The same happens to
+// a tap-hold key that is pressed while a decided PTH key is still held.
+//
+// So a younger session only begins after the older one is decided, which
+// means its output is always sent after the output of the older one.
+#if PTH_SESSION_COUNT > 1
+static bool can_start_session(void) {
+    // A hold that registered pth.tap_code_instead_of_hold has to be released
+    // by us, so it can't be left to QMK. Neither can a tap without space for
+    // its release.
+    return decided_session_count < PTH_SESSION_COUNT - 1 && !(pth.status == PTH_DECIDED_HOLD && pth.tap_code_instead_of_hold != KC_NO) && !(pth.status == PTH_DECIDED_TAP && are_tap_releases_full());
+}
+
+static bool should_hand_over_second(void) {
+    return pth.second_is_tap_hold && !pth.second_to_be_released && !pth.second_was_held_instantly && can_start_session();
+}
+
+static void hand_over_second(void) {
+    PTH_LOG("  Second will become the next PTH key.");
+    has_next_session                     = true;
+    next_session_record                  = pth.second_record;
+    next_session_keycode                 = pth.second_keycode;
+    next_session_press_timer             = pth.second_press_timer;
+    next_session_press_timer_max_reached = pth.second_press_timer_max_reached;
+
+    // All remaining release records are AFTER_SECOND, which means that they
+    // happened after the next PTH key was pressed, i.e. before its second.
+    before_second_count = release_records_count;
+}
+
+// The release of a decided PTH key is handled by QMK (hold) or the tap
+// releases (tap), so nothing but its position has to be kept.
+static void end_decided_session(void) {
+    PTH_LOG("  PTH key is decided, but still held. Starting a new session.");
+    if (pth.status == PTH_DECIDED_TAP) {
+        add_pos_to_tap_releases(pth.record.event.key);
+    }
+    decided_session_positions[decided_session_count++] = pth.record.event.key;
+    reset_pth_state();
+}
+
+static void remove_decided_session(keypos_t pos) {
+    for (uint8_t i = 0; i < decided_session_count; i++) {
+        if (keypos_eq(decided_session_positions[i], pos)) {
+            decided_session_positions[i] = decided_session_positions[--decided_session_count];
+            return;
+        }
+    }
+}
+
+/*
+ * Has to be called after each decision. If the second was handed over,
+ * it becomes the PTH key now, as if it had been pressed while we were idle.
+ */
+static void start_next_session(void) {
+    if (!has_next_session) {
+        return;
+    }
+    has_next_session = false;
+
+    if (pth.status >= PTH_DECIDED_TAP) {
+        end_decided_session();
+    }
+
+    pth.status                  = PTH_PRESSED;
+    pth.press_timer             = next_session_press_timer;
+    pth.press_timer_max_reached = next_session_press_timer_max_reached;
+    pth.keycode                 = next_session_keycode;
+    pth.record                  = next_session_record;
+
+    uint8_t side       = PTH_GET_SIDE(&pth.record);
+    pth.side_user_bits = PTH_GET_USER_BITS(side);
+    pth.atomic_side    = PTH_GET_PTH_ATOM_SIDE(side);
+
+    store_press_features_for_pth(&next_session_features);
+
+    pth.tap_code_instead_of_hold   = PTH_GET_CODE_TO_BE_REGISTERED_INSTEAD_WHEN_HOLD_CHOSEN();
+    pth.timeout_for_forcing_choice = PTH_GET_TIMEOUT_FOR_FORCING_CHOICE();
+
+    // As it's down for a while already, it is not held instantly.
+    PTH_LOGF("  -> PRESSED (second became PTH key) %u ms after its press. (side=%s timeout_for_forcing_choice=%u)", PTH_TIMER_ELAPSED(pth.press_timer), ATOM_SIDE_TO_STR(pth.atomic_side), pth.timeout_for_forcing_choice);
+
+    if (pth.timeout_for_forcing_choice == 0) {
+        make_user_choice_or_not();
+    }
+
+    // its timers may have been running for a while
+    expire_deadline();
+}
+#else
+#    define start_next_session() ((void)0)
+#endif // PTH_SESSION_COUNT > 1
+
+// Core Processing Function (State Machine)
+// ----------------------------------------------------------------------------
+#ifdef PTH_EARLY_DECISION_SHADOW
+// Early decisions
+// ----------------------------------------------------------------------------
+// After an early decision, the durations are still collected until the event
+// on which the usual logic would have decided. Its prediction then tells if
+// the early one was right. This only changes the telemetry.
+static void check_early_decision(bool hold) {
+    bool early_hold          = pth.status == PTH_DECIDED_HOLD;
+    pth.early_shadow_pending = false;
+
+    PTH_LOGF("  Early %s %s by the usual logic.", PTH_LOG_CHOICE(early_hold, "hold", "tap"), PTH_LOG_CHOICE(hold == early_hold, "confirmed", "contradicted"));
+    if (hold == early_hold) {
+        PTH_TELEMETRY_COUNT(early_confirmed);
+    } else {
+        PTH_TELEMETRY_COUNT(early_wrong);
+    }
+}
+
+static void shadow_early_decision(bool cur_is_pressed, keypos_t cur_pos, pth_timer_t cur_time) {
+    if (cur_is_pressed) {
+        pth.features.second_press_to_third_press_dur = PTH_TIMER_DIFF(cur_time, pth.second_press_timer);
+        check_early_decision(pth_predict_hold_when_third_press());
+    } else if (keypos_eq(cur_pos, pth.record.event.key)) {
+        check_early_decision(pth.second_to_be_released ? pth_predict_hold_when_pth_release_after_second_release() : pth_predict_hold_when_pth_release_after_second_press());
+    } else if (keypos_eq(cur_pos, pth.second_record.event.key)) {
+        pth.second_to_be_released = true;
+        collect_second_release_durations(cur_time);
+    }
+}
+#endif // PTH_EARLY_DECISION_SHADOW
+
+#ifdef PTH_POINTING_DEVICE_HOLD
+static bool is_hold_for_mouse_key(uint16_t keycode) {
+    if (!IS_MOUSE_KEYCODE(keycode)) {
+        return false;
+    }
+    const bool is_button = keycode >= KC_BTN1 && keycode <= KC_BTN8;
+    return pth_should_hold_when_pointing(is_button ? PTH_POINTING_BUTTON : PTH_POINTING_MOTION, keycode);
+}
+#else
+#    define is_hold_for_mouse_key(keycode) false
+#endif // PTH_POINTING_DEVICE_HOLD
+
+static bool process_key_event(uint16_t keycode, keyrecord_t* record, pth_timer_t cur_time) {
+    const bool     cur_is_pressed = record->event.pressed;
+    const keypos_t cur_pos        = record->event.key;
+    const bool     is_tap_hold    = is_tap_hold_for_pth(keycode, record);
+
+#ifdef PTH_EARLY_DECISION_SHADOW
+    if (pth.early_shadow_pending) {
+        shadow_early_decision(cur_is_pressed, cur_pos, cur_time);
+    }
+#endif
+
+    // --- State Machine Logic ---
+    switch (pth.status) {
+        // =============================================================================
+        case PTH_IDLE:
+            if (cur_is_pressed && is_tap_hold) {
+                // New PTH key
+                pth.status = PTH_PRESSED;
+
+                pth.press_timer = cur_time;
+                pth.keycode     = keycode;
+                pth.record      = *record;
+                start_timeout_watch(cur_pos, cur_time);
+
+                uint8_t side       = PTH_GET_SIDE(&pth.record);
+                pth.side_user_bits = PTH_GET_USER_BITS(side);
+                pth.atomic_side    = PTH_GET_PTH_ATOM_SIDE(side);
+
+                press_features_t features;
+                collect_press_features(&features, pth.press_timer);
+                store_press_features_for_pth(&features);
+
+                pth.tap_code_instead_of_hold   = PTH_GET_CODE_TO_BE_REGISTERED_INSTEAD_WHEN_HOLD_CHOSEN();
+                pth.timeout_for_forcing_choice = PTH_GET_TIMEOUT_FOR_FORCING_CHOICE();
+
+                PTH_LOGF("  -> PRESSED (new PTH key) after %u ms from last release. (side=%s timeout_for_forcing_choice=%u)", pth.features.key_release_before_pth_to_pth_press_dur, ATOM_SIDE_TO_STR(pth.atomic_side), pth.timeout_for_forcing_choice);
+
+                if (pth.tap_code_instead_of_hold != KC_NO) {
+                    PTH_LOGF("   Will register %s instead, if hold is chosen, so instant hold disabled.", PTH_LOG_KEYCODE(pth.tap_code_instead_of_hold));
+                }
+
+                if (pth.timeout_for_forcing_choice == 0) {
+                    make_user_choice_or_not();
+                    if (pth.status >= PTH_DECIDED_TAP) {
+                        return false;
+                    }
+                }
+
+#ifdef PTH_FAST_STREAK_TAP_ENABLE
+                if (pth_predict_fast_streak_tap()) {
+                    PTH_LOG("  Fast Streak Tap predicted.");
+                    PTH_DECISION_PATH(PTH_PATH_FAST_STREAK);
+#    ifdef PTH_FAST_STREAK_TAP_RESET_IMMEDIATELY
+                    // have to remember PTH tap release as we will reset immediately
+                    if (!are_tap_releases_full()) {
+                        PTH_RECORD_DECISION(false);
+                        process_register_record_as_tap(&pth.record);
+                        add_pos_to_tap_releases(pth.record.event.key);
+                        reset_pth_state();
+                        return false;
+                    }
+#    endif
+                    make_decision_tap();
+                    return false;
+                }
+#endif // PTH_FAST_STREAK_TAP_ENABLE
+
+#ifdef PTH_DONT_HOLD_INSTANTLY
+                pth.was_held_instantly = false;
+#else
+                pth.was_held_instantly = pth.tap_code_instead_of_hold == KC_NO && PTH_SHOULD_HOLD_INSTANTLY(pth.keycode, &pth.record);
+#endif // PTH_DONT_HOLD_INSTANTLY
+
+                if (pth.was_held_instantly) {
+                    if (IS_QK_LAYER_TAP(keycode)) {
+                        pth.instant_layer_was_active       = true;
+                        pth.layer_before_instant_layer_tap = get_layer_of_pos(pth.record.event.key);
+                        PTH_LOGF("  Layer before instant layer: %u", pth.layer_before_instant_layer_tap);
+                    }
+                    PTH_LOG("  Instantly holding PTH.");
+                    process_register_record_as_hold(&pth.record);
+                }
+
+                return false;
+            }
+
+            break;
+
+        // =============================================================================
+        case PTH_PRESSED:
+            if (cur_is_pressed && is_hold_for_mouse_key(keycode)) {
+                // The mouse key is then handled like any key after a hold.
+                PTH_LOG("  Mouse key pressed, so choose HOLD.");
+                PTH_DECISION_PATH(PTH_PATH_POINTING);
+                make_decision_hold();
+                return process_key_event(keycode, record, cur_time);
+            }
+
+            if (cur_is_pressed) {
+                // Second key pressed
+                pth.status = PTH_SECOND_PRESSED;
+
+                pth.has_second                 = true;
+                pth.second_press_timer         = cur_time;
+                pth.second_keycode             = keycode;
+                pth.second_record              = *record;
+                pth.second_is_tap_hold         = is_tap_hold;
+                pth.second_is_same_side_as_pth = is_record_same_side_as_pth(record);
+
+                pth.features.press_to_second_press_dur = PTH_ELAPSED(pth.second_press_timer, pth.press_timer, pth.press_timer_max_reached);
+
+                PTH_LOGF("  -> SECOND_PRESSED after %u ms from PTH press", pth.features.press_to_second_press_dur);
+                PTH_PREFETCH_SECOND_KEYCODE();
+
+#if PTH_SESSION_COUNT > 1
+                // in case it becomes the next PTH key
+                collect_press_features(&next_session_features, cur_time);
+#endif
+
+                if (pth.was_held_instantly && pth.instant_layer_was_active && pth.second_keycode == KC_NO) {
+                    PTH_LOG("  PTH's instant layer led to second key being KC_NO, so we choose tap.");
+                    PTH_DECISION_PATH(PTH_PATH_SECOND_PRESS);
+                    make_decision_tap();
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+                    reset_pth_state_after_tap();
+#endif
+                    return false;
+                }
+
+                // Previously, this was only done, when they're on opposite
+                // sides, but the overlap prediction seems to be more accurate
+                // than third key prediction (far less data with third keys).
+                if (pth.second_is_tap_hold || !pth.second_is_same_side_as_pth) {
+                    pth.min_overlap_dur_for_hold = MIN(PTH_MS_MAX_OVERLAP, MAX(PTH_MS_MIN_OVERLAP, pth_predict_min_overlap_for_hold_in_ms()));
+                    PTH_LOGF("  Predicted minimum overlap for hold: %u ms", pth.min_overlap_dur_for_hold);
+                }
+
+                if (!pth.second_is_same_side_as_pth) {
+#ifdef PTH_EARLY_DECISION_ENABLE
+                    pth_status_t early = pth_predict_early_decision_when_second_press();
+                    if (early == PTH_DECIDED_TAP || early == PTH_DECIDED_HOLD) {
+                        PTH_LOGF("  Second is opposite-side press. Early prediction: %s", PTH_LOG_CHOICE(early == PTH_DECIDED_HOLD, "hold", "tap"));
+                        PTH_DECISION_PATH(PTH_PATH_EARLY);
+                        if (early == PTH_DECIDED_HOLD) {
+                            make_decision_hold();
+                        } else {
+                            make_decision_tap();
+                        }
+#    ifdef PTH_EARLY_DECISION_SHADOW
+                        pth.early_shadow_pending = true;
+#    endif
+#    ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+                        if (early == PTH_DECIDED_TAP) {
+                            reset_pth_state_after_tap();
+                        }
+#    endif
+                        return false;
+                    }
+#endif // PTH_EARLY_DECISION_ENABLE
+                    PTH_LOG("  Second is opposite-side press, so we are done for now.");
+                    return false;
+                }
 
-/**
- * @brief The default prediction for the minimum overlap time for a hold.
- *
- * Mod:                 991,319 /  1,496,055 (66.26 %)
- * Non-mod:           9,527,683 /  9,582,518 (99.43 %)
- * Total:            10,519,002 / 11,078,573 (94.95 %)
- *
- * @return float predicted overlap time in ms.
- */
-float pth_default_get_overlap_ms_for_hold_prediction(void) {
-    // clang-format off
-    float guess = ABS(
-        MAX(pth_press_to_second_press_dur *
-                SD(20145.72453837935f,
-                   20145.72453837935f -
-                       (((float)pth_prev_press_to_pth_press_dur) -
-                        pth_prev_prev_overlap_dur) *
-                           pth_press_to_second_press_dur),
-            SD(20141.63979839019f - ((pth_prev_press_to_pth_press_dur -
-                                      2.0f * pth_prev_prev_overlap_dur) -
-                                     pth_prev_prev_overlap_dur) *
-                                        10.24699665838974f,
-               pth_press_to_second_press_dur) -
-                32.559018051648636f));
-    // clang-format on
+                // PTH and second are on the same side.
+                // ------------------------------------
 
-    return (uint16_t)guess;
-}
+                if (PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_PRESS()) {
+                    PTH_LOG("  Second is same-side press and should_choose returned true.");
+                    PTH_DECISION_PATH(PTH_PATH_SECOND_PRESS);
+                    make_decision_tap();
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+                    reset_pth_state_after_tap();
+#endif
+                    return false;
+                }
 
-#ifdef PTH_FAST_STREAK_TAP_ENABLE
-// should be simple, as this will be called on every tap-hold press when IDLE
-float pth_default_get_fast_streak_tap_prediction(void) {
-    float s = ((float)pth_prev_prev_overlap_dur) - pth_prev_press_to_pth_press_dur;
-    return ABS(SD(s, 4.280551301886473f - pth_prev_press_to_pth_press_dur));
-}
+#ifdef PTH_DONT_HOLD_INSTANTLY
+                if (pth.second_is_tap_hold) {
+#else
+                if (pth.second_is_tap_hold && PTH_SECOND_SHOULD_HOLD_INSTANTLY(pth.second_keycode, &pth.second_record)) {
+#endif // PTH_DONT_HOLD_INSTANTLY
+                    if (!pth.instant_layer_was_active && IS_QK_LAYER_TAP(pth.second_keycode)) {
+                        // Remember the layer in case we have to undo the
+                        // instant layer switch, when tap is chosen.
+                        pth.layer_before_instant_layer_tap = get_layer_of_pos(pth.second_record.event.key);
+                        pth.instant_layer_was_active       = true;
+                        PTH_LOGF("  Layer before instant layer: %u", pth.layer_before_instant_layer_tap);
+                    }
 
-float pth_conservative_get_fast_streak_tap_prediction(void) {
-    float s = ((float)pth_prev_prev_overlap_dur) - pth_prev_press_to_pth_press_dur;
-    return ABS(SD(s, s + 5.3131340976019885f * pth_overlap_w_avg));
-}
-#endif // PTH_FAST_STREAK_TAP_ENABLE
+                    PTH_LOG("  Instantly holding second.");
+                    pth.second_was_held_instantly = true;
+                    process_register_record_as_hold(&pth.second_record);
+                }
 
-__attribute__((weak)) float pth_get_prediction_factor_for_hold(void) {
-    // will be 1 for PTH_5H and 2 for PTH_10H, and 3 for PTH_15H
-    uint8_t mp = PTH_GET_USER_BIT_ENCODED_VALUE(pth_get_pth_side_user_bits());
-    if (mp == 0 || mp > 3) {
-        return 1.0f;
-    }
-    return 1.0f - mp * 0.05f;
-}
+                return false;
+            } else {
+                // A key was released
+                if (keypos_eq(cur_pos, pth.record.event.key)) {
+                    // PTH key released and no other key pressed yet, so resolve as tap
+                    PTH_LOG("  PTH key released before second press. Resetting!");
 
-// Prediction functions
-// ----------------------------------------------------------------------------
-__attribute__((weak)) bool pth_predict_hold_when_third_press(void) {
-    float p = pth_default_get_hold_prediction_when_third_press();
-    p *= pth_get_prediction_factor_for_hold();
-    return p > 0.5f;
-}
+                    PTH_DECISION_PATH(PTH_PATH_PTH_RELEASE);
+                    make_decision_tap();
+                    send_and_wait();
+                    process_unregister_record_as_tap(&pth.record);
+                    reset_pth_state();
+                    return false;
+                }
 
-__attribute__((weak)) bool pth_predict_hold_when_pth_release_after_second_press(void) {
-    float p = pth_default_get_hold_prediction_when_pth_release_after_second_press();
-    p *= pth_get_prediction_factor_for_hold();
-    return p > 0.5f;
-}
+                // Keys, that are released before or after second is pressed, are
+                // cached, so that we can replay them in the correct order. Users
+                // rightly expect LSFT down, LCTL_T(KC_A) down, LFST up, tap chosen
+                // to result in an uppercase A.
+                PTH_LOG("  This BEFORE_SECOND release is cached. It will be processed later.");
+                add_release_record(record, BEFORE_SECOND);
+            }
 
-__attribute__((weak)) bool pth_predict_hold_when_pth_release_after_second_release(void) {
-    float p = pth_default_get_hold_prediction_when_pth_release_after_second_release();
-    p *= pth_get_prediction_factor_for_hold();
-    return p > 0.5f;
-}
+            return false;
 
-__attribute__((weak)) uint16_t pth_predict_min_overlap_for_hold_in_ms(void) {
-    float pf = pth_get_prediction_factor_for_hold();
+        // =============================================================================
+        case PTH_SECOND_PRESSED:
+            if (cur_is_pressed) {
+                // Third key pressed
+                pth.features.second_press_to_third_press_dur = PTH_ELAPSED(cur_time, pth.second_press_timer, pth.second_press_timer_max_reached);
 
-    if (pth_is_second_same_side_as_pth()) {
-        // If second is same side, we want the overlap required to be larger,
-        // as it is more likely this is intended as a tap.
-        pf -= 0.10f;
-    }
+                // We run the following prediction, even if a minimum overlap
+                // for hold was previously predicted, as the following function
+                // is more likely to make a better prediction, as it has been
+                // trained specifically for cases like this one (third press).
+                // More importantly, it is really time to make a decision now.
+                bool hold = pth_predict_hold_when_third_press();
+                PTH_LOGF("  Third key pressed. Prediction: %s", PTH_LOG_CHOICE(hold, "hold", "tap"));
+                PTH_DECISION_PATH(PTH_PATH_THIRD_PRESS);
 
-    // a large overlap estimate makes hold less likely
-    float f = 1.0f + (1.0f - pf);
-    return pth_default_get_overlap_ms_for_hold_prediction() * f;
-}
+                bool third_is_tap_hold = is_tap_hold;
+                if (hold) {
+                    make_decision_hold();
+                } else {
+                    make_decision_tap();
 
-static bool should_neutralize_mods(uint16_t keycode, bool was_held_instantly) {
-    return (was_held_instantly && IS_QK_MOD_TAP(keycode) && pth_should_neutralize_mods(get_5_bit_mods_of_mod_tap(keycode)));
-}
+                    if (pth.instant_layer_was_active) {
+                        // If an instant layer was active before the tap
+                        // decision was made, then the current keycode and
+                        // is_tap_hold is outdated, so get the new one.
+                        keycode           = get_keycode_same_pos_in_layer(record, pth.layer_before_instant_layer_tap);
+                        third_is_tap_hold = is_tap_hold_for_pth(keycode, record);
+                    }
+                }
 
-// Decision making functions
-// ----------------------------------------------------------------------------
-static void make_decision_tap(void) {
-    if (pth_status >= PTH_DECIDED_TAP) {
-        return;
-    }
+#if PTH_SESSION_COUNT > 1
+                if (has_next_session) {
+                    // The third key is the second of the next PTH key.
+                    start_next_session();
+                    return process_key_event(keycode, record, cur_time);
+                }
+#endif
+
+                if (third_is_tap_hold) {
+                    if (hold && is_record_same_side_as_pth(record) && PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE(keycode, record)) {
+                        // Third is same-side tap-hold, so resolve as hold
+                        process_register_record_as_hold(record);
+                    } else {
+                        // Tap was chosen, or third is on other side than PTH
+                        process_register_record_as_tap_or_hold_if_full(record);
+                    }
+                } else {
+                    // Third is not tap-hold, but we handle this manually, as
+                    // we just now registered other keys so time has passed.
+                    process_record_with_new_time(record);
+                }
+
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+                if (!hold) {
+                    reset_pth_state_after_tap();
+                }
+#endif
+                return false;
+            } else {
+                // A key was released
+                if (keypos_eq(cur_pos, pth.record.event.key)) {
+                    // PTH key released
+                    bool hold = false;
 
-    PTH_LOGF("  -> DECIDED_TAP after %u ms", timer_elapsed(pth_press_timer));
+                    if (!pth.second_is_same_side_as_pth) {
+                        // second is on different side
+                        if (pth.second_to_be_released) {
+                            hold = pth_predict_hold_when_pth_release_after_second_release();
+                        } else {
+                            hold = pth_predict_hold_when_pth_release_after_second_press();
+                        }
+                    }
+                    PTH_LOGF("  PTH released after second. Prediction: %s - Resetting!", PTH_LOG_CHOICE(hold, "hold", "tap"));
+                    PTH_DECISION_PATH(PTH_PATH_PTH_RELEASE);
 
-    pth_status = PTH_DECIDED_TAP;
+                    if (hold) {
+                        make_decision_hold();
+                        unregister_pth_hold();
+                    } else {
+                        make_decision_tap();
+                        send_and_wait();
+                        process_unregister_record_as_tap(&pth.record);
+                    }
 
-    if (should_neutralize_mods(pth_keycode, pth_was_held_instantly) || should_neutralize_mods(second_keycode, second_was_held_instantly)) {
-        // Neutralize modifiers acting on their own (e.g. ALT).
-        tap_code16(PTH_INSTANT_MOD_TAP_SUPPRESSION_KEY);
-    }
+                    // We directly reset here, as the PTH key was released,
+                    // which means that no other presses must be influenced by it,
+                    // and we must be ready for a new PTH key.
+                    reset_pth_state();
+                    return false;
+                } else if (keypos_eq(cur_pos, pth.second_record.event.key)) {
+                    PTH_LOG("  Second key released before PTH key.");
+                    // Second key released
+                    // This will not be set in cases where second is released
+                    // after the third is pressed, but that is fine, as then
+                    // the decision has already been made, and the default
+                    // logic (or release records) will handle second just fine.
+                    pth.second_to_be_released = true;
+                    collect_second_release_durations(cur_time);
+                    PTH_LOGF("  Second was pressed for %u ms. The duration from PTH press to this release is %u ms.", pth.features.second_dur, pth.features.press_to_second_release_dur);
 
-    // TODO: If both held instantly, does the order ever matter?
-    if (pth_was_held_instantly) {
-        if (IS_QK_LAYER_TAP(pth_keycode)) {
-            // PTH is LT and was held instantly, so second is outdated.
-            second_keycode     = get_keycode_same_pos_in_layer(&second_record, layer_before_instant_layer_tap);
-            second_is_tap_hold = pth_is_tap_hold_keycode(second_keycode);
-            PTH_LOGF("  Disabling PTH instant layer. Second key will be: %s", get_keycode_string(second_keycode));
-        }
-        process_unregister_record_as_hold(&pth_record);
+                    if (pth.second_is_same_side_as_pth && PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_RELEASE()) {
+                        PTH_DECISION_PATH(PTH_PATH_SECOND_RELEASE);
+                        make_decision_tap();
+#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
+                        reset_pth_state_after_tap();
+#endif
+                        return false;
+                    }
+
+                    // When the second key is released before a third is pressed (as right now),
+                    // then make_decision_tap or make_decision_hold handle the release,
+                    // so it may already have happened just now.
+                    // Otherwise, the release will be handled later.
+                    return false;
+                }
+
+                // See PTH_PRESSED release handling for further information.
+                PTH_LOG("  This AFTER_SECOND release is cached. It will be processed later.");
+                add_release_record(record, AFTER_SECOND);
+            }
+
+            return false;
+
+        // =============================================================================
+        case PTH_DECIDED_TAP:
+            if (cur_is_pressed) {
+                // Another key pressed after PTH decided tap
+                if (is_tap_hold) {
+#if PTH_SESSION_COUNT > 1
+                    if (can_start_session()) {
+                        end_decided_session();
+                        return process_key_event(keycode, record, cur_time);
+                    }
+#endif
+                    process_register_record_as_tap_or_hold_if_full(record);
+                    return false;
+                }
+            } else {
+                // A key was released
+                if (keypos_eq(cur_pos, pth.record.event.key)) {
+                    // PTH key released
+                    PTH_LOG("  Releasing decided TAP key. Resetting!");
+
+                    // As we may just now have chosen and send tap, we wait
+                    // a bit to make sure the tap will definitely be accepted.
+                    send_and_wait();
+                    process_unregister_record_as_tap(&pth.record);
+                    reset_pth_state();
+                    return false;
+                }
+            }
+
+            break;
+
+        // =============================================================================
+        case PTH_DECIDED_HOLD:
+            if (cur_is_pressed) {
+                // Another key pressed after PTH decided hold
+                if (is_tap_hold) {
+#if PTH_SESSION_COUNT > 1
+                    if (can_start_session()) {
+                        end_decided_session();
+                        return process_key_event(keycode, record, cur_time);
+                    }
+#endif
+                    if (is_record_same_side_as_pth(record) && PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE(keycode, record)) {
+                        // Same-hand tap-hold resolves as hold
+                        process_register_record_as_hold(record);
+                    } else {
+                        // Opposite-hand tap-hold resolves as tap
+                        process_register_record_as_tap_or_hold_if_full(record);
+                    }
+                    return false;
+                }
+            } else {
+                // A key was released
+                if (keypos_eq(cur_pos, pth.record.event.key)) {
+                    // PTH key released
+                    PTH_LOG("  Releasing decided hold key. Resetting!");
+
+                    unregister_pth_hold();
+                    reset_pth_state();
+                    return false;
+                }
+            }
+
+            break;
+
+            // =============================================================================
     }
 
-    if (second_was_held_instantly) {
-        process_unregister_record_as_hold(&second_record);
+    if (!cur_is_pressed && !pth.second_was_held_instantly && keypos_eq(cur_pos, pth.second_record.event.key)) {
+        // As second will be pressed when the decision is made (unless held
+        // instantly), it is possible that the press was just now registered.
+        // So, to avoid really short taps that are not registered by the OS,
+        // we add a tiny delay.
+        send_and_wait();
     }
 
-    process_register_record_as_tap(&pth_record);
-    process_release_records_and_wait_before_first(BEFORE_SECOND);
+    PTH_LOG("  QMK will handle this.");
+    // Hold is the default, and if a release was supposed to be a tap instead,
+    // that release would have been handled already. So we do nothing special.
+    return can_qmk_process_record(record);
+}
 
-    if (!has_second) {
-        return;
-    }
+#ifdef PTH_TAP_DANCE_ENABLE
+// Tap dance
+// ----------------------------------------------------------------------------
+// The records of tap dance keys with a tapping term of 0 never reach QMK's
+// process_tap_dance. Instead, the ones we send (as tap or hold) are counted
+// here, and the actions of the keymap are called with our own state. Like in
+// QMK, only one dance is active. Those with a non-zero term are left to QMK.
+typedef struct {
+    tap_dance_state_t state;
+    pth_timer_t       press_time; // of the last tap
+    uint16_t          keycode;    // KC_NO if no dance is active
+    uint16_t          tap_gap;    // between the last two taps
+    uint16_t          term;
+} active_dance_t;
+
+static active_dance_t dance = {.keycode = KC_NO};
+
+// For indices without an action, so that nothing is called.
+static tap_dance_action_t no_dance_action;
+
+static tap_dance_action_t* get_dance_action(void) {
+    const uint16_t index = QK_TAP_DANCE_GET_INDEX(dance.keycode);
+    return index < tap_dance_count() ? tap_dance_get(index) : &no_dance_action;
+}
 
-    if (second_is_tap_hold) {
-        if (!second_to_be_released) {
-            // add it to array, so we can release as hold even after we have reset state
-            add_pos_to_tap_releases(second_record.event.key);
-        }
-        set_record_to_tap(&second_record);
+static inline void call_dance_fn(tap_dance_action_t* action, tap_dance_user_fn_t fn) {
+    if (fn != NULL) {
+        fn(&dance.state, action->user_data);
     }
+}
+
+static bool is_dance_waiting(void) {
+    // While the dance key is the undecided PTH key, the next tap has begun.
+    return dance.keycode != KC_NO && !dance.state.pressed && !dance.state.finished && !((pth.status == PTH_PRESSED || pth.status == PTH_SECOND_PRESSED) && pth.keycode == dance.keycode);
+}
+
+static void reset_dance(void) {
+    tap_dance_action_t* action = get_dance_action();
+    call_dance_fn(action, action->fn.on_reset);
+    dance.keycode = KC_NO;
+}
 
-    PTH_LOGF("  Registering second key. (layer_state=%u default_layer_state=%u)", layer_state, default_layer_state);
-    process_register_record(&second_record);
-    bool waited = process_release_records_and_wait_before_first(AFTER_SECOND);
+static void finish_dance(void) {
+    PTH_LOGF("  Tap dance finished after %u taps (%s).", dance.state.count, PTH_LOG_CHOICE(dance.state.pressed, "held", "released"));
+    tap_dance_action_t* action = get_dance_action();
+    dance.state.finished       = true;
+    call_dance_fn(action, action->fn.on_dance_finished);
 
-    if (second_to_be_released) {
-        if (!waited) {
-            send_and_wait();
-        }
-        process_unregister_record(&second_record);
+    if (!dance.state.pressed) {
+        reset_dance();
     }
 }
 
-static void make_decision_hold(void) {
-    if (pth_status >= PTH_DECIDED_TAP) {
+/**
+ * @brief Finishes the dance, as another key is sent after it.
+ */
+static void interrupt_dance(uint16_t keycode) {
+    if (dance.keycode == KC_NO || dance.state.finished) {
         return;
     }
+    dance.state.interrupted          = true;
+    dance.state.interrupting_keycode = keycode;
+    finish_dance();
+}
 
-    PTH_LOGF("  -> DECIDED_HOLD after %u ms", timer_elapsed(pth_press_timer));
+static void process_dance_release(uint16_t keycode) {
+    if (keycode != dance.keycode) {
+        // Its dance was already ended by another one.
+        return;
+    }
 
-    pth_status = PTH_DECIDED_HOLD;
+    tap_dance_action_t* action = get_dance_action();
+    dance.state.pressed        = false;
+    call_dance_fn(action, action->fn.on_each_release);
 
-    if (!pth_was_held_instantly) {
-        register_pth_hold();
+    if (dance.state.finished) {
+        reset_dance();
+        return;
     }
-    process_release_records(BEFORE_SECOND, pth_was_held_instantly);
 
-    if (!has_second) {
-        return;
+    dance.term = pth_get_tap_dance_term(keycode, &dance.state);
+    if (PTH_TIMER_DIFF(PTH_TIMER_READ(), dance.press_time) >= dance.term) {
+        finish_dance();
+    } else {
+        // The housekeeping task finishes it, unless another tap follows.
+        expire_deadline();
     }
+}
 
-    // Users expect the following sequence to result in an uppercase A and B:
-    // KC_LSFT down, LCTL_T(KC_A) down [PTH key], LSFT_T(KC_B) down, KC_LSFT up,
-    // LCTL_T(KC_A) up. The algorithm predicts tap. At that point KC_LSFT is
-    // already up. If we had already unregistered the Shift, then we would get
-    // 'ab' instead of 'AB'. That's why we have to collect releases after and
-    // before the second key is pressed, so that we can release them at the
-    // right time when a choice for tap or hold is made. That way, we can't
-    // preserve the duration between presses, but we can preserve the order.
-    //
-    // Be aware, that there is one edge case where we can't do so completely:
-    //
-    // PTH is pressed and instantly held, a key X is released (which we cache,
-    // i.e. not process yet), second is down and instantly held. So the second
-    // is already held, but in reality X was released before second is pressed.
-    //
-    // That said, it seems like it's not an issue, as modifiers (usually) only
-    // affect keys when they're being pressed down, and not afterwards. An
-    // KC_LSFT will not make an KC_E uppercase, if it was down before KC_LSFT.
-    if (!second_was_held_instantly) {
-        if (second_is_tap_hold) {
-            if (second_is_same_side_as_pth && pth_should_register_as_hold_when_same_side(second_keycode, &second_record)) {
-                // Same-side tap-hold becomes hold to allow multiple holds at
-                // the same time. For consistency, we do it, even if second was
-                // already released.
-                set_record_to_hold(&second_record);
-            } else {
-                // other side becomes tap
-                if (!second_to_be_released) {
-                    add_pos_to_tap_releases(second_record.event.key);
-                }
-                set_record_to_tap(&second_record);
+/**
+ * @return the time the event of the record happened. If we send it after a
+ *         decision, that's earlier than now, and other keys may have been
+ *         pressed since.
+ */
+static pth_timer_t get_dance_event_time(const keyrecord_t* record) {
+    const uint16_t time = is_processing_record_due_to_pth ? sent_event_time : record->event.time;
+    return PTH_TIMER_READ() - TIMER_DIFF_16(timer_read(), time);
+}
+
+static void process_dance_press(uint16_t keycode, keyrecord_t* record) {
+    const pth_timer_t press_time = get_dance_event_time(record);
+    if (keycode == dance.keycode && !dance.state.finished) {
+        dance.tap_gap = PTH_TIMER_DIFF(press_time, dance.press_time);
+    } else {
+        if (dance.keycode != KC_NO) {
+            interrupt_dance(keycode);
+            if (dance.keycode != KC_NO) {
+                // still held, but a dance can only be released once it's active
+                reset_dance();
             }
         }
+        dance.state   = (tap_dance_state_t){0};
+        dance.keycode = keycode;
+        dance.tap_gap = 0;
+    }
 
-        process_register_record(&second_record);
+    dance.press_time = press_time;
+    if (dance.state.count < UINT8_MAX) {
+        dance.state.count++;
     }
+    dance.state.pressed = true;
 
-    // does not wait, if second was held instantly, as that already requires waiting
-    bool waited = process_release_records(AFTER_SECOND, second_was_held_instantly);
+    tap_dance_action_t* action = get_dance_action();
+    call_dance_fn(action, action->fn.on_each_tap);
 
-    if (second_to_be_released) {
-        if (!waited) {
-            send_and_wait();
-        }
-        process_unregister_record(&second_record);
+    if (record->tap.count == 0) {
+        // A hold ends the dance.
+        finish_dance();
     }
 }
 
-static void make_user_choice_or_not(void) {
-    has_chosen_after_timeout_reached = true;
-    pth_status_t choice              = pth_get_forced_choice_after_timeout();
-    if (choice == PTH_DECIDED_HOLD) {
-        PTH_LOG("Choose hold because pressed long enough.");
-        make_decision_hold();
-    } else if (choice == PTH_DECIDED_TAP) {
-        PTH_LOG("Choose tap because pressed long enough.");
-        make_decision_tap();
+/**
+ * @brief Handles a record that QMK is about to process.
+ *
+ * @return false if it is a tap dance key decided by us, which we handled.
+ */
+static bool process_dance_or_interrupt(uint16_t keycode, keyrecord_t* record) {
+    if (IS_QK_TAP_DANCE(keycode) && is_tap_hold_for_pth(keycode, record)) {
+        record->event.pressed ? process_dance_press(keycode, record) : process_dance_release(keycode);
+        return false;
+    }
 
-#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
-        add_pos_to_tap_releases(pth_record.event.key);
-        reset_pth_state();
-#endif
+    if (record->event.pressed) {
+        interrupt_dance(keycode);
     }
+    return true;
 }
 
-static void store_press_to_press_and_overlap_for_pth(void) {
-    // We measure from press to press, and as this is a press, we
-    // don't need to do any special handling here for down_count > 0.
-    pth_prev_prev_press_to_prev_press_dur = prev_press_to_press_dur;
-    pth_prev_press_to_pth_press_dur       = cur_press_to_press_dur;
-
-    // The following is necessary for consistency!
-    // For example, let's go through some examples:
-    //
-    // x is the current PTH key
-    // lower case = down / pressed
-    // upper case = up / released
-    //
-    // cCdDx -> would provide 2 overlap values
-    //
-    // cCdx (d not released) -> without adding 0, this would only
-    // provide 1 value from that sequence, but as other keys likely
-    // have been pressed before, the prediction algorithm would have
-    // access to much older overlap values that are less relevant.
-    //
-    // For press to press durations, we would get 2 in either case.
-    uint8_t down_count_before_this = down_count - 1;
-
-    pth_prev_prev_overlap_dur = prev_overlap_dur;
-    pth_prev_overlap_dur      = cur_overlap_dur;
-    if (down_count_before_this == 1) {
-        // still one down, but no overlap (of course, it will overlap with this one)
-        pth_prev_prev_overlap_dur = pth_prev_overlap_dur;
-        pth_prev_overlap_dur      = 0;
-    } else if (down_count_before_this >= 2) {
-        pth_prev_prev_overlap_dur = 0;
-
-        // there's still an overlap going on (more than 1 key down),
-        // so determine duration until now and that will be the new last
-        if (overlap_timer_max_reached) {
-            pth_prev_overlap_dur = MS_MAX_DUR_FOR_TIMERS;
-        } else {
-            pth_prev_overlap_dur = timer_elapsed(overlap_timer);
-        }
+static inline uint16_t default_get_tap_dance_term(void) {
+    if (dance.tap_gap == 0) {
+        return PTH_TAP_DANCE_TERM;
     }
+    const uint32_t term = (uint32_t)dance.tap_gap * 3 / 2;
+    return (uint16_t)MAX(MIN(term, PTH_TAP_DANCE_TERM), PTH_TAP_DANCE_MIN_TERM);
+}
 
-    pth_press_to_press_w_avg = weighted_avg(pth_prev_prev_press_to_prev_press_dur, pth_prev_press_to_pth_press_dur);
-    pth_overlap_w_avg        = weighted_avg(pth_prev_prev_overlap_dur, pth_prev_overlap_dur);
+__attribute__((weak)) uint16_t pth_get_tap_dance_term(uint16_t keycode, const tap_dance_state_t* state) {
+    return default_get_tap_dance_term();
 }
 
-static void collect_new_press_to_press_and_overlap_duration(bool is_pressed, uint16_t cur_time) {
-    if (is_pressed) {
-        uint16_t p_to_p_dur;
-        if (press_to_press_timer_max_reached) {
-            p_to_p_dur = MS_MAX_DUR_FOR_TIMERS;
-        } else {
-            p_to_p_dur = TIMER_DIFF_16(cur_time, press_to_press_timer);
-        }
-        prev_press_to_press_dur = cur_press_to_press_dur;
-        cur_press_to_press_dur  = p_to_p_dur;
-        PTH_LOGF("  Storing actual press-to-press duration: %u ms", p_to_p_dur);
+#    define PTH_PROCESS_DANCE_OR_INTERRUPT(keycode, record) process_dance_or_interrupt(keycode, record)
+#else
+#    define PTH_PROCESS_DANCE_OR_INTERRUPT(keycode, record) true
+#endif // PTH_TAP_DANCE_ENABLE
 
-        press_to_press_timer             = cur_time;
-        press_to_press_timer_max_reached = false;
-        down_count++;
-        if (down_count == 2) {
-            // Two keys down at the same time, so we have an overlap
-            overlap_timer             = cur_time;
-            overlap_timer_max_reached = false;
-        }
-    } else {
-        // on release
-        uint16_t overlap = 0;
-        // Check if an overlap was active (down_count would have been >= 2 before this release event)
-        if (down_count >= 2) {
-            if (overlap_timer_max_reached) {
-                overlap = MS_MAX_DUR_FOR_TIMERS;
-            } else {
-                overlap = TIMER_DIFF_16(cur_time, overlap_timer);
-            }
-        }
+// Event time
+// ----------------------------------------------------------------------------
+#if defined(SPLIT_KEYBOARD) && PTH_SPLIT_SECONDARY_DELAY_MS > 0
+static pth_timer_t last_event_time = 0;
+#endif
 
-        if (down_count > 0) {
-            down_count--;
-        }
-        prev_overlap_dur = cur_overlap_dur;
-        cur_overlap_dur  = overlap;
-        PTH_LOGF("  Storing actual overlap duration: %u ms", overlap);
+/**
+ * @return the time the event happened, which is used for all durations.
+ */
+static pth_timer_t get_event_time(keyrecord_t* record) {
+#if defined(PTH_USE_EVENT_TIME) && defined(PTH_32_BIT_TIMERS)
+    // the event only has the lower 16 bits
+    const pth_timer_t now  = PTH_TIMER_READ();
+    pth_timer_t       time = now - TIMER_DIFF_16((uint16_t)now, record->event.time);
+#elif defined(PTH_USE_EVENT_TIME)
+    pth_timer_t time = record->event.time;
+#else
+    pth_timer_t time = PTH_TIMER_READ();
+#endif
 
-        // We don't want to count overlaps twice, so we set to the current time
-        overlap_timer             = cur_time;
-        overlap_timer_max_reached = false;
+#if defined(SPLIT_KEYBOARD) && PTH_SPLIT_SECONDARY_DELAY_MS > 0
+    // Events of the other half arrive after the transport delay.
+    if ((record->event.key.row < MATRIX_ROWS / 2) != is_keyboard_left()) {
+        time -= PTH_SPLIT_SECONDARY_DELAY_MS;
+    }
 
-        release_timer             = cur_time;
-        release_timer_max_reached = false;
+    // But never before the previous event, as PTH relies on the order in
+    // which QMK reports the events, so no duration may be negative.
+    if (PTH_TIMER_DIFF(last_event_time, time) <= PTH_SPLIT_SECONDARY_DELAY_MS) {
+        time = last_event_time;
     }
+    last_event_time = time;
+#endif
+    return time;
 }
 
-// Core Processing Function (State Machine)
-// ----------------------------------------------------------------------------
-bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
-#ifdef PTH_DISABLED
-    return true;
-#endif
+static bool process_record_pth(uint16_t keycode, keyrecord_t* record) {
     // Initial checks - don't handle internal events or non-key events
     if (is_processing_record_due_to_pth || !IS_KEYEVENT(record->event)) {
         return true; // let the processing continue
     }
 
     const bool cur_is_pressed = record->event.pressed;
-    PTH_LOGF("Key %s is %s (side=%s) - Status: %s", get_keycode_string(keycode), cur_is_pressed ? "DOWN" : "UP", side_to_str(pth_get_side(record)), STATUS_TO_STR(pth_status));
-
-#ifdef TAPPING_TERM_PER_KEY
-    if (get_tapping_term(keycode, record) != 0) {
-        // TODO: Investigate how this works with overlapping tap-holds, such as
-        // first handled by us, second by QMK OR first by QMK, second by us
-        PTH_LOG("  QMK will handle this, as the tapping term of this key is not zero.");
-        return true;
-    }
-#endif
+    PTH_LOGF("Key %s is %s (side=%s) - Status: %s", PTH_LOG_KEYCODE(keycode), PTH_LOG_CHOICE(cur_is_pressed, "DOWN", "UP"), side_to_str(PTH_GET_SIDE(record)), STATUS_TO_STR(pth.status));
 
-#ifdef TAP_DANCE_ENABLE
+#if defined(TAP_DANCE_ENABLE) && !defined(PTH_TAP_DANCE_ENABLE)
     if (IS_QK_TAP_DANCE(keycode)) {
         PTH_LOG("  QMK will handle this, as it's a tap dance.");
         return true;
@@ -1639,8 +4439,12 @@ bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
     }
 #endif
 
-    const uint16_t cur_time = timer_read();
-    const keypos_t cur_pos  = record->event.key;
+    // The timers will change, so they have to be checked again.
+    expire_deadline();
+
+    const pth_timer_t cur_time = get_event_time(record);
+    const keypos_t    cur_pos  = record->event.key;
+    PTH_CAPTURE_KEY_EVENT(keycode, record, cur_time);
 
     // We collect here, even though this event may not end up being reported to
     // the OS for a while or it may be reported in a slightly different order
@@ -1650,8 +4454,13 @@ bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
     collect_new_press_to_press_and_overlap_duration(cur_is_pressed, cur_time);
 
     if (cur_is_pressed) {
-        prev_press_keycode = cur_press_keycode;
-        cur_press_keycode  = keycode;
+        observe_press_for_adaptation(keycode, cur_pos, cur_time);
+    }
+    observe_event_for_timeout(cur_is_pressed, cur_pos, cur_time);
+
+    if (cur_is_pressed) {
+        history.prev_press_keycode = history.cur_press_keycode;
+        history.cur_press_keycode  = keycode;
     } else {
         // A key is released.
 
@@ -1660,8 +4469,11 @@ bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
         // And not checking, also makes sure that if some glitch causes a
         // release with a keycode from a different layer than the associated
         // press, it will still be handled here.
+#if PTH_SESSION_COUNT > 1
+        remove_decided_session(cur_pos);
+#endif
         if (remove_pos_from_tap_releases(cur_pos)) {
-            if (pth_status == PTH_PRESSED || pth_status == PTH_SECOND_PRESSED) {
+            if (pth.status == PTH_PRESSED || pth.status == PTH_SECOND_PRESSED) {
                 // We set it to tap, as it will be cached for future release.
                 // See the release handling of PTH_PRESSED for an explanation.
                 PTH_LOG("  Position was in tap_releases and status is PTH_PRESSED or SECOND_PRESSED, so set as tap (release will happen later).");
@@ -1674,435 +4486,480 @@ bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
         }
     }
 
-    const bool is_tap_hold = pth_is_tap_hold_keycode(keycode);
-
-    // --- State Machine Logic ---
-    switch (pth_status) {
-        // =============================================================================
-        case PTH_IDLE:
-            if (cur_is_pressed && is_tap_hold) {
-                // New PTH key
-                pth_status = PTH_PRESSED;
-
-                pth_press_timer = cur_time;
-                pth_keycode     = keycode;
-                pth_record      = *record;
-
-                uint8_t side       = pth_get_side(&pth_record);
-                pth_side_user_bits = PTH_GET_USER_BITS(side);
-                pth_atomic_side    = PTH_GET_PTH_ATOM_SIDE(side);
-
-                if (release_timer_max_reached) {
-                    key_release_before_pth_to_pth_press_dur = MS_MAX_DUR_FOR_TIMERS;
-                } else {
-                    key_release_before_pth_to_pth_press_dur = TIMER_DIFF_16(pth_press_timer, release_timer);
-                }
-                store_press_to_press_and_overlap_for_pth();
-
-                pth_tap_code_instead_of_hold = pth_get_code_to_be_registered_instead_when_hold_chosen();
-                timeout_for_forcing_choice   = pth_get_timeout_for_forcing_choice();
-
-                PTH_LOGF("  -> PRESSED (new PTH key) after %u ms from last release. (side=%s timeout_for_forcing_choice=%u)", key_release_before_pth_to_pth_press_dur, ATOM_SIDE_TO_STR(pth_atomic_side), timeout_for_forcing_choice);
-
-                if (pth_tap_code_instead_of_hold != KC_NO) {
-                    PTH_LOGF("   Will register %s instead, if hold is chosen, so instant hold disabled.", get_keycode_string(pth_tap_code_instead_of_hold));
-                }
-
-                if (timeout_for_forcing_choice == 0) {
-                    make_user_choice_or_not();
-                    if (pth_status >= PTH_DECIDED_TAP) {
-                        return false;
-                    }
-                }
-
-#ifdef PTH_FAST_STREAK_TAP_ENABLE
-                if (pth_predict_fast_streak_tap()) {
-                    PTH_LOG("  Fast Streak Tap predicted.");
-#    ifdef PTH_FAST_STREAK_TAP_RESET_IMMEDIATELY
-                    process_register_record_as_tap(&pth_record);
-
-                    // have to remember PTH tap release as we will reset immediately
-                    add_pos_to_tap_releases(pth_record.event.key);
-                    reset_pth_state();
-#    else
-                    make_decision_tap();
-#    endif
-                    return false;
-                }
-#endif // PTH_FAST_STREAK_TAP_ENABLE
-
-#ifdef PTH_DONT_HOLD_INSTANTLY
-                pth_was_held_instantly = false;
-#else
-                pth_was_held_instantly = pth_tap_code_instead_of_hold == KC_NO && pth_should_hold_instantly(pth_keycode, &pth_record);
-#endif // PTH_DONT_HOLD_INSTANTLY
-
-                if (pth_was_held_instantly) {
-                    if (IS_QK_LAYER_TAP(keycode)) {
-                        instant_layer_was_active       = true;
-                        layer_before_instant_layer_tap = layer_switch_get_layer(pth_record.event.key);
-                        PTH_LOGF("  Layer before instant layer: %u", layer_before_instant_layer_tap);
-                    }
-                    PTH_LOG("  Instantly holding PTH.");
-                    process_register_record_as_hold(&pth_record);
-                }
-
-                return false;
-            }
-
-            break;
-
-        // =============================================================================
-        case PTH_PRESSED:
-            if (cur_is_pressed) {
-                // Second key pressed
-                pth_status = PTH_SECOND_PRESSED;
-
-                has_second                 = true;
-                second_press_timer         = cur_time;
-                second_keycode             = keycode;
-                second_record              = *record;
-                second_is_tap_hold         = is_tap_hold;
-                second_is_same_side_as_pth = is_record_same_side_as_pth(record);
-
-                if (pth_press_timer_max_reached) {
-                    pth_press_to_second_press_dur = MS_MAX_DUR_FOR_TIMERS;
-                } else {
-                    pth_press_to_second_press_dur = TIMER_DIFF_16(second_press_timer, pth_press_timer);
-                }
-
-                PTH_LOGF("  -> SECOND_PRESSED after %u ms from PTH press", pth_press_to_second_press_dur);
-
-                if (pth_was_held_instantly && instant_layer_was_active && second_keycode == KC_NO) {
-                    PTH_LOG("  PTH's instant layer led to second key being KC_NO, so we choose tap.");
-                    make_decision_tap();
-#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
-                    add_pos_to_tap_releases(pth_record.event.key);
-                    reset_pth_state();
-#endif
-                    return false;
-                }
-
-                // Previously, this was only done, when they're on opposite
-                // sides, but the overlap prediction seems to be more accurate
-                // than third key prediction (far less data with third keys).
-                if (second_is_tap_hold || !second_is_same_side_as_pth) {
-                    min_overlap_dur_for_hold = MIN(PTH_MS_MAX_OVERLAP, MAX(PTH_MS_MIN_OVERLAP, pth_predict_min_overlap_for_hold_in_ms()));
-                    PTH_LOGF("  Predicted minimum overlap for hold: %u ms", min_overlap_dur_for_hold);
-                }
-
-                if (!second_is_same_side_as_pth) {
-                    PTH_LOG("  Second is opposite-side press, so we are done for now.");
-                    return false;
-                }
-
-                // PTH and second are on the same side.
-                // ------------------------------------
+    const bool result = process_key_event(keycode, record, cur_time);
+    start_next_session();
+    return result;
+}
 
-                if (pth_should_choose_tap_when_second_is_same_side_press()) {
-                    PTH_LOG("  Second is same-side press and should_choose returned true.");
-                    make_decision_tap();
-#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
-                    add_pos_to_tap_releases(pth_record.event.key);
-                    reset_pth_state();
+bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record) {
+#ifdef PTH_DISABLED
+    return true;
 #endif
-                    return false;
-                }
+    // The records we send come back here, so the tap dance sees them in the
+    // order in which they are sent.
+    return process_record_pth(keycode, record) && PTH_PROCESS_DANCE_OR_INTERRUPT(keycode, record);
+}
 
-#ifdef PTH_DONT_HOLD_INSTANTLY
-                if (second_is_tap_hold){
+// Housekeeping (runs constantly)
+// ----------------------------------------------------------------------------
+// Instead of checking each timer on every scan, we calculate when the next one
+// expires (the deadline), and only then check them all. Any key event may
+// change the timers, so it makes the deadline expire immediately.
+#ifdef PTH_USE_DEFERRED_EXEC
+static deferred_token deadline_token = INVALID_DEFERRED_TOKEN;
 #else
-                if (second_is_tap_hold && pth_second_should_hold_instantly(second_keycode, &second_record)) {
-#endif // PTH_DONT_HOLD_INSTANTLY
-                    if (!instant_layer_was_active && IS_QK_LAYER_TAP(second_keycode)) {
-                        // Remember the layer in case we have to undo the
-                        // instant layer switch, when tap is chosen.
-                        layer_before_instant_layer_tap = layer_switch_get_layer(second_record.event.key);
-                        instant_layer_was_active       = true;
-                        PTH_LOGF("  Layer before instant layer: %u", layer_before_instant_layer_tap);
-                    }
-
-                    PTH_LOG("  Instantly holding second.");
-                    second_was_held_instantly = true;
-                    process_register_record_as_hold(&second_record);
-                }
-
-                return false;
-            } else {
-                // A key was released
-                if (keypos_eq(cur_pos, pth_record.event.key)) {
-                    // PTH key released and no other key pressed yet, so resolve as tap
-                    PTH_LOG("  PTH key released before second press. Resetting!");
-
-                    make_decision_tap();
-                    send_and_wait();
-                    process_unregister_record_as_tap(&pth_record);
-                    reset_pth_state();
-                    return false;
-                }
-
-                // Keys, that are released before or after second is pressed, are
-                // cached, so that we can replay them in the correct order. Users
-                // rightly expect LSFT down, LCTL_T(KC_A) down, LFST up, tap chosen
-                // to result in an uppercase A.
-                PTH_LOG("  This BEFORE_SECOND release is cached. It will be processed later.");
-                add_release_record(record, BEFORE_SECOND);
-            }
-
-            return false;
+static uint16_t next_deadline = 0;
+#endif
 
-        // =============================================================================
-        case PTH_SECOND_PRESSED:
-            if (cur_is_pressed) {
-                // Third key pressed
-                if (second_press_timer_max_reached) {
-                    pth_second_press_to_third_press_dur = MS_MAX_DUR_FOR_TIMERS;
-                } else {
-                    pth_second_press_to_third_press_dur = TIMER_DIFF_16(cur_time, second_press_timer);
-                }
+static inline uint16_t get_remaining_ms(pth_timer_t cur_time, pth_timer_t timer, uint16_t dur) {
+    pth_timer_t elapsed = PTH_TIMER_DIFF(cur_time, timer);
+    return elapsed >= dur ? 0 : dur - elapsed;
+}
 
-                // We run the following prediction, even if a minimum overlap
-                // for hold was previously predicted, as the following function
-                // is more likely to make a better prediction, as it has been
-                // trained specifically for cases like this one (third press).
-                // More importantly, it is really time to make a decision now.
-                bool hold = pth_predict_hold_when_third_press();
-                PTH_LOGF("  Third key pressed. Prediction: %s", hold ? "hold" : "tap");
+/**
+ * @return the time in ms until the next timer check is due.
+ */
+static uint16_t get_ms_until_next_deadline(pth_timer_t cur_time) {
+    // If nothing is pending, we still check once in a while.
+    uint16_t remaining = MS_MAX_DUR_FOR_TIMERS;
 
-                bool third_is_tap_hold = is_tap_hold;
-                if (hold) {
-                    make_decision_hold();
-                } else {
-                    make_decision_tap();
+#ifndef PTH_32_BIT_TIMERS
+    if (!history.release_timer_max_reached) {
+        remaining = MIN(remaining, get_remaining_ms(cur_time, history.release_timer, MS_MAX_DUR_FOR_TIMERS));
+    }
 
-                    if (instant_layer_was_active) {
-                        // If an instant layer was active before the tap
-                        // decision was made, then the current keycode and
-                        // is_tap_hold is outdated, so get the new one.
-                        keycode           = get_keycode_same_pos_in_layer(record, layer_before_instant_layer_tap);
-                        third_is_tap_hold = pth_is_tap_hold_keycode(keycode);
-                    }
-                }
+    if (!history.overlap_timer_max_reached && history.down_count >= 2) {
+        remaining = MIN(remaining, get_remaining_ms(cur_time, history.overlap_timer, MS_MAX_DUR_FOR_TIMERS));
+    }
+#endif // PTH_32_BIT_TIMERS
 
-                if (third_is_tap_hold) {
-                    if (hold && is_record_same_side_as_pth(record) && pth_should_register_as_hold_when_same_side(keycode, record)) {
-                        // Third is same-side tap-hold, so resolve as hold
-                        process_register_record_as_hold(record);
-                    } else {
-                        // Tap was chosen, or third is on other side than PTH
-                        add_pos_to_tap_releases(cur_pos);
-                        process_register_record_as_tap(record);
-                    }
-                } else {
-                    // Third is not tap-hold, but we handle this manually, as
-                    // we just now registered other keys so time has passed.
-                    process_record_with_new_time(record);
-                }
+#if !defined(PTH_32_BIT_TIMERS) || defined(PTH_ADAPTIVE_FACTORS)
+    if (!history.press_to_press_timer_max_reached) {
+        remaining = MIN(remaining, get_remaining_ms(cur_time, history.press_to_press_timer, MS_MAX_DUR_FOR_TIMERS));
+    }
+#endif // !PTH_32_BIT_TIMERS || PTH_ADAPTIVE_FACTORS
 
-#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
-                if (!hold) {
-                    add_pos_to_tap_releases(pth_record.event.key);
-                    reset_pth_state();
-                }
+#ifdef PTH_EARLY_DECISION_SHADOW
+    if (pth.early_shadow_pending && pth.min_overlap_dur_for_hold > 0) {
+        remaining = MIN(remaining, get_remaining_ms(cur_time, pth.second_press_timer, pth.min_overlap_dur_for_hold));
+    }
 #endif
-                return false;
-            } else {
-                // A key was released
-                if (keypos_eq(cur_pos, pth_record.event.key)) {
-                    // PTH key released
-                    bool hold = false;
 
-                    if (!second_is_same_side_as_pth) {
-                        // second is on different side
-                        if (second_to_be_released) {
-                            hold = pth_predict_hold_when_pth_release_after_second_release();
-                        } else {
-                            hold = pth_predict_hold_when_pth_release_after_second_press();
-                        }
-                    }
-                    PTH_LOGF("  PTH released after second. Prediction: %s - Resetting!", hold ? "hold" : "tap");
+#ifdef PTH_TAP_DANCE_ENABLE
+    if (is_dance_waiting()) {
+        remaining = MIN(remaining, get_remaining_ms(cur_time, dance.press_time, dance.term));
+    }
+#endif
 
-                    if (hold) {
-                        make_decision_hold();
-                        unregister_pth_hold();
-                    } else {
-                        make_decision_tap();
-                        send_and_wait();
-                        process_unregister_record_as_tap(&pth_record);
-                    }
+    if (pth.status == PTH_IDLE || pth.status >= PTH_DECIDED_TAP) {
+        return remaining;
+    }
 
-                    // We directly reset here, as the PTH key was released,
-                    // which means that no other presses must be influenced by it,
-                    // and we must be ready for a new PTH key.
-                    reset_pth_state();
-                    return false;
-                } else if (keypos_eq(cur_pos, second_record.event.key)) {
-                    PTH_LOG("  Second key released before PTH key.");
-                    // Second key released
-                    // This will not be set in cases where second is released
-                    // after the third is pressed, but that is fine, as then
-                    // the decision has already been made, and the default
-                    // logic (or release records) will handle second just fine.
-                    second_to_be_released = true;
+    if (!pth.second_press_timer_max_reached && pth.status == PTH_SECOND_PRESSED) {
+        if (pth.min_overlap_dur_for_hold > 0) {
+            remaining = MIN(remaining, get_remaining_ms(cur_time, pth.second_press_timer, pth.min_overlap_dur_for_hold));
+        }
+#ifndef PTH_32_BIT_TIMERS
+        remaining = MIN(remaining, get_remaining_ms(cur_time, pth.second_press_timer, MS_MAX_DUR_FOR_TIMERS));
+#endif
+    }
 
-                    if (second_is_same_side_as_pth && pth_should_choose_tap_when_second_is_same_side_release()) {
-                        make_decision_tap();
-#ifdef PTH_RESET_IMMEDIATELY_WHEN_TAP_CHOSEN
-                        add_pos_to_tap_releases(pth_record.event.key);
-                        reset_pth_state();
+    if (!pth.press_timer_max_reached) {
+#ifndef PTH_32_BIT_TIMERS
+        remaining = MIN(remaining, get_remaining_ms(cur_time, pth.press_timer, MS_MAX_DUR_FOR_TIMERS));
 #endif
-                        return false;
-                    }
+        if (!pth.has_chosen_after_timeout_reached && pth.timeout_for_forcing_choice > 0) {
+            remaining = MIN(remaining, get_remaining_ms(cur_time, pth.press_timer, pth.timeout_for_forcing_choice));
+        }
+    }
 
-                    if (pth_press_timer_max_reached) {
-                        pth_press_to_second_release_dur = MS_MAX_DUR_FOR_TIMERS;
-                    } else {
-                        pth_press_to_second_release_dur = TIMER_DIFF_16(cur_time, pth_press_timer);
-                    }
+    return remaining;
+}
 
-                    if (second_press_timer_max_reached) {
-                        pth_second_dur = MS_MAX_DUR_FOR_TIMERS;
-                    } else {
-                        pth_second_dur = TIMER_DIFF_16(cur_time, second_press_timer);
-                    }
-                    PTH_LOGF("  Second was pressed for %u ms. The duration from PTH press to this release is %u ms.", pth_second_dur, pth_press_to_second_release_dur);
+static void check_timers(void) {
+    pth_timer_t cur_time = PTH_TIMER_READ();
 
-                    // When the second key is released before a third is pressed (as right now),
-                    // then make_decision_tap or make_decision_hold handle the release,
-                    // so it may already have happened just now.
-                    // Otherwise, the release will be handled later.
-                    return false;
-                }
+#ifndef PTH_32_BIT_TIMERS
+    if (!history.release_timer_max_reached) {
+        if (TIMER_DIFF_16(cur_time, history.release_timer) >= MS_MAX_DUR_FOR_TIMERS) {
+            history.release_timer_max_reached = true;
+        }
+    }
 
-                // See PTH_PRESSED release handling for further information.
-                PTH_LOG("  This AFTER_SECOND release is cached. It will be processed later.");
-                add_release_record(record, AFTER_SECOND);
+    // history.overlap_timer is relevant if two or more keys are currently down.
+    if (!history.overlap_timer_max_reached && history.down_count >= 2) {
+        if (TIMER_DIFF_16(cur_time, history.overlap_timer) >= MS_MAX_DUR_FOR_TIMERS) {
+            history.overlap_timer_max_reached = true;
+        }
+    }
+#endif // PTH_32_BIT_TIMERS
+
+#if !defined(PTH_32_BIT_TIMERS) || defined(PTH_ADAPTIVE_FACTORS)
+    // This timer tracks the duration since the *last* key press.
+    // history.press_to_press_timer is always relevant.
+    if (!history.press_to_press_timer_max_reached) {
+        if (PTH_TIMER_DIFF(cur_time, history.press_to_press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
+            history.press_to_press_timer_max_reached = true;
+#    ifdef PTH_ADAPTIVE_FACTORS
+            // Nobody is typing right now, so it's a good time to write EEPROM.
+            if (history.down_count == 0) {
+                pth_save_adaptive_factors();
             }
+#    endif
+        }
+    }
+#endif // !PTH_32_BIT_TIMERS || PTH_ADAPTIVE_FACTORS
 
-            return false;
+#ifdef PTH_EARLY_DECISION_SHADOW
+    if (pth.early_shadow_pending && pth.min_overlap_dur_for_hold > 0 && PTH_TIMER_DIFF(cur_time, pth.second_press_timer) >= pth.min_overlap_dur_for_hold) {
+        // the usual logic would have chosen hold now
+        check_early_decision(true);
+    }
+#endif
 
-        // =============================================================================
-        case PTH_DECIDED_TAP:
-            if (cur_is_pressed) {
-                // Another key pressed after PTH decided tap
-                if (is_tap_hold) {
-                    add_pos_to_tap_releases(record->event.key);
-                    process_register_record_as_tap(record);
-                    return false;
-                }
-            } else {
-                // A key was released
-                if (keypos_eq(cur_pos, pth_record.event.key)) {
-                    // PTH key released
-                    PTH_LOG("  Releasing decided TAP key. Resetting!");
+#ifdef PTH_TAP_DANCE_ENABLE
+    if (is_dance_waiting() && PTH_TIMER_DIFF(cur_time, dance.press_time) >= dance.term) {
+        PTH_LOG("Housekeeping: No further tap, so the tap dance is finished.");
+        finish_dance();
+    }
+#endif
 
-                    // As we may just now have chosen and send tap, we wait
-                    // a bit to make sure the tap will definitely be accepted.
-                    send_and_wait();
-                    process_unregister_record_as_tap(&pth_record);
-                    reset_pth_state();
-                    return false;
-                }
-            }
+    if (pth.status == PTH_IDLE || pth.status >= PTH_DECIDED_TAP) {
+        return;
+    }
 
-            break;
+    // pth.second_press_timer is relevant if a second key has been pressed in a PTH sequence.
+    if (!pth.second_press_timer_max_reached && pth.status == PTH_SECOND_PRESSED) {
+        if (pth.min_overlap_dur_for_hold > 0 && PTH_TIMER_DIFF(cur_time, pth.second_press_timer) >= pth.min_overlap_dur_for_hold) {
+            PTH_LOG("Housekeeping: Overlap large enough, so choose HOLD.");
+            PTH_DECISION_PATH(PTH_PATH_OVERLAP);
+            make_decision_hold();
+            return; // the rest of the checks don't matter anymore
+        }
+#ifndef PTH_32_BIT_TIMERS
+        if (TIMER_DIFF_16(cur_time, pth.second_press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
+            pth.second_press_timer_max_reached = true;
+        }
+#endif
+    }
 
-        // =============================================================================
-        case PTH_DECIDED_HOLD:
-            if (cur_is_pressed) {
-                // Another key pressed after PTH decided hold
-                if (is_tap_hold) {
-                    if (is_record_same_side_as_pth(record) && pth_should_register_as_hold_when_same_side(keycode, record)) {
-                        // Same-hand tap-hold resolves as hold
-                        process_register_record_as_hold(record);
-                    } else {
-                        // Opposite-hand tap-hold resolves as tap
-                        add_pos_to_tap_releases(cur_pos);
-                        process_register_record_as_tap(record);
-                    }
-                    return false;
-                }
-            } else {
-                // A key was released
-                if (keypos_eq(cur_pos, pth_record.event.key)) {
-                    // PTH key released
-                    PTH_LOG("  Releasing decided hold key. Resetting!");
+    // pth.press_timer is relevant if a PTH sequence is active before a decision.
+    if (!pth.press_timer_max_reached) { // must be PTH_PRESSED or PTH_SECOND_PRESSED
+#ifndef PTH_32_BIT_TIMERS
+        if (TIMER_DIFF_16(cur_time, pth.press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
+            pth.press_timer_max_reached = true;
+            return;
+        }
+#endif
+        if (!pth.has_chosen_after_timeout_reached && pth.timeout_for_forcing_choice > 0 && PTH_TIMER_DIFF(cur_time, pth.press_timer) >= (uint16_t)pth.timeout_for_forcing_choice) {
+            make_user_choice_or_not();
+        }
+    }
+}
 
-                    unregister_pth_hold();
-                    reset_pth_state();
-                    return false;
-                }
-            }
+#ifdef PTH_USE_DEFERRED_EXEC
+static uint32_t deadline_callback(uint32_t trigger_time, void* cb_arg) {
+    check_timers();
+    start_next_session();
 
-            break;
+    // 0 would cancel the callback
+    return MAX(get_ms_until_next_deadline(PTH_TIMER_READ()), 1);
+}
+#endif
 
-            // =============================================================================
+static void expire_deadline(void) {
+#ifdef PTH_USE_DEFERRED_EXEC
+    if (!extend_deferred_exec(deadline_token, 1)) {
+        // not scheduled yet (or QMK ran out of deferred executors last time)
+        deadline_token = defer_exec(1, deadline_callback, NULL);
     }
+#else
+    next_deadline = timer_read();
+#endif
+}
 
-    if (!cur_is_pressed && !second_was_held_instantly && keypos_eq(cur_pos, second_record.event.key)) {
-        // As second will be pressed when the decision is made (unless held
-        // instantly), it is possible that the press was just now registered.
-        // So, to avoid really short taps that are not registered by the OS,
-        // we add a tiny delay.
-        send_and_wait();
+void housekeeping_task_predictive_tap_hold(void) {
+#ifdef PTH_DISABLED
+    return;
+#endif
+#ifdef PTH_NON_BLOCKING_FLUSH
+    process_output_queue();
+#endif
+#if defined(PTH_TRACE_ENABLE) && defined(CONSOLE_ENABLE)
+    print_trace();
+#endif
+#ifdef PTH_CAPTURE_ENABLE
+    send_capture_report();
+#endif
+#ifndef PTH_USE_DEFERRED_EXEC
+    if (!timer_expired(timer_read(), next_deadline)) {
+        return;
     }
 
-    PTH_LOG("  QMK will handle this.");
-    // Hold is the default, and if a release was supposed to be a tap instead,
-    // that release would have been handled already. So we do nothing special.
-    return true;
+    check_timers();
+    start_next_session();
+    next_deadline = timer_read() + get_ms_until_next_deadline(PTH_TIMER_READ());
+#endif
 }
 
-// Housekeeping (runs constantly)
+#if defined(PTH_POINTING_DEVICE_HOLD) && defined(POINTING_DEVICE_ENABLE)
+// Pointing device
 // ----------------------------------------------------------------------------
-void housekeeping_task_predictive_tap_hold(void) {
+// The buttons of the last report, so that only new presses count.
+static uint8_t pointing_buttons = 0;
+
+static void hold_for_pointing(pth_pointing_t pointing, uint16_t keycode) {
+    if (!pth_should_hold_when_pointing(pointing, keycode)) {
+        return;
+    }
+
+    PTH_LOGF("Pointing device %s, so choose HOLD.", PTH_LOG_CHOICE(pointing == PTH_POINTING_BUTTON, "button pressed", "moved"));
+    PTH_DECISION_PATH(PTH_PATH_POINTING);
+    make_decision_hold();
+}
+
+report_mouse_t pointing_device_task_predictive_tap_hold(report_mouse_t mouse_report) {
 #ifdef PTH_DISABLED
-    return;
+    return mouse_report;
 #endif
-    uint16_t cur_time = timer_read();
+    const uint8_t pressed_buttons = mouse_report.buttons & ~pointing_buttons;
+    pointing_buttons              = mouse_report.buttons;
+    if (pth.status != PTH_PRESSED) {
+        return mouse_report;
+    }
 
-    if (!release_timer_max_reached) {
-        if (TIMER_DIFF_16(cur_time, release_timer) >= MS_MAX_DUR_FOR_TIMERS) {
-            release_timer_max_reached = true;
+    if (pressed_buttons != 0) {
+        // the first of the new buttons
+        uint8_t button = 0;
+        while (!(pressed_buttons & (1 << button))) {
+            button++;
         }
+        hold_for_pointing(PTH_POINTING_BUTTON, KC_BTN1 + button);
+    } else if (pth.pointing_motion < PTH_POINTING_MOTION_THRESHOLD) {
+        const uint16_t motion = ABS(mouse_report.x) + ABS(mouse_report.y) + ABS(mouse_report.h) + ABS(mouse_report.v);
+        pth.pointing_motion   = MIN(pth.pointing_motion + motion, PTH_POINTING_MOTION_THRESHOLD);
+        if (pth.pointing_motion == PTH_POINTING_MOTION_THRESHOLD) {
+            hold_for_pointing(PTH_POINTING_MOTION, KC_NO);
+        }
+    }
+
+    // The hold was sent before this report, so the click is modified.
+    return mouse_report;
+}
+#endif // PTH_POINTING_DEVICE_HOLD && POINTING_DEVICE_ENABLE
+
+#ifdef PTH_BENCHMARK_ENABLE
+// Benchmark driver
+// ----------------------------------------------------------------------------
+enum { BENCH_PTH, BENCH_OPPOSITE, BENCH_SAME, BENCH_THIRD, BENCH_KEY_COUNT };
+
+// no event, only the time passes
+#    define BENCH_WAIT BENCH_KEY_COUNT
+
+#    define BENCH_DOWN 0x80
+#    define BENCH_UP 0x00
+
+// Each event is the key (ORed with BENCH_DOWN or BENCH_UP) and the ms until
+// the next event, so that every path is taken.
+static const uint8_t bench_events[][2] PROGMEM = {
+    // tap without a second key
+    {BENCH_PTH | BENCH_DOWN, 80},
+    {BENCH_PTH | BENCH_UP, 150},
+    // PTH released after second pressed
+    {BENCH_PTH | BENCH_DOWN, 40},
+    {BENCH_OPPOSITE | BENCH_DOWN, 30},
+    {BENCH_PTH | BENCH_UP, 50},
+    {BENCH_OPPOSITE | BENCH_UP, 150},
+    // PTH released after second released
+    {BENCH_PTH | BENCH_DOWN, 60},
+    {BENCH_OPPOSITE | BENCH_DOWN, 30},
+    {BENCH_OPPOSITE | BENCH_UP, 40},
+    {BENCH_PTH | BENCH_UP, 150},
+    // hold after the minimum overlap
+    {BENCH_PTH | BENCH_DOWN, 150},
+    {BENCH_OPPOSITE | BENCH_DOWN, 250},
+    {BENCH_OPPOSITE | BENCH_UP, 60},
+    {BENCH_PTH | BENCH_UP, 150},
+    // third key pressed
+    {BENCH_PTH | BENCH_DOWN, 50},
+    {BENCH_OPPOSITE | BENCH_DOWN, 20},
+    {BENCH_THIRD | BENCH_DOWN, 30},
+    {BENCH_PTH | BENCH_UP, 20},
+    {BENCH_OPPOSITE | BENCH_UP, 20},
+    {BENCH_THIRD | BENCH_UP, 150},
+    // second key on the same side
+    {BENCH_PTH | BENCH_DOWN, 50},
+    {BENCH_SAME | BENCH_DOWN, 60},
+    {BENCH_SAME | BENCH_UP, 30},
+    {BENCH_PTH | BENCH_UP, 150},
+    // forced choice after the timeout
+    {BENCH_PTH | BENCH_DOWN, 250},
+    {BENCH_WAIT, 250},
+    {BENCH_WAIT, 250},
+    {BENCH_PTH | BENCH_UP, 150},
+};
+
+static keypos_t bench_keys[BENCH_KEY_COUNT];
+
+// Discards the result, but not the call.
+#    define BENCH_CALL(path, call)                                  \
+        do {                                                        \
+            const uint32_t            start        = read_cycles(); \
+            volatile __typeof__(call) bench_result = (call);        \
+            record_bench((path), cycles_since(start));              \
+            (void)bench_result;                                     \
+        } while (0)
+
+static uint8_t get_bench_key_atom(keypos_t pos, bool as_pth, uint8_t pth_atom) {
+    keyrecord_t record = {.event = {.key = pos, .type = KEY_EVENT}};
+    uint8_t     side   = PTH_GET_SIDE(&record);
+    if (as_pth) {
+        return PTH_GET_PTH_ATOM_SIDE(side);
     }
 
-    // overlap_timer is relevant if two or more keys are currently down.
-    if (!overlap_timer_max_reached && down_count >= 2) {
-        if (TIMER_DIFF_16(cur_time, overlap_timer) >= MS_MAX_DUR_FOR_TIMERS) {
-            overlap_timer_max_reached = true;
+    uint8_t atom = PTH_GET_OTHER_ATOM_SIDE(side);
+    if (atom == PTH_ATOM_OPPOSITE) {
+        return pth_atom ^ 1;
+    }
+    return atom == PTH_ATOM_SAME ? pth_atom : atom;
+}
+
+static bool find_bench_keys(void) {
+    bool found[BENCH_KEY_COUNT] = {false};
+
+    for (uint8_t row = 0; row < MATRIX_ROWS && !found[BENCH_PTH]; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS && !found[BENCH_PTH]; col++) {
+            const keypos_t pos = {.row = row, .col = col};
+            if (IS_QK_MOD_TAP(keycode_at_keymap_location(0, row, col)) && get_bench_key_atom(pos, true, 0) <= PTH_ATOM_RIGHT) {
+                bench_keys[BENCH_PTH] = pos;
+                found[BENCH_PTH]      = true;
+            }
         }
     }
+    if (!found[BENCH_PTH]) {
+        return false;
+    }
 
-    // This timer tracks the duration since the *last* key press.
-    // press_to_press_timer is always relevant.
-    if (!press_to_press_timer_max_reached) {
-        if (TIMER_DIFF_16(cur_time, press_to_press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
-            press_to_press_timer_max_reached = true;
+    const uint8_t pth_atom = get_bench_key_atom(bench_keys[BENCH_PTH], true, 0);
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            const keypos_t pos     = {.row = row, .col = col};
+            const uint16_t keycode = keycode_at_keymap_location(0, row, col);
+            if (keycode < KC_A || keycode > KC_0) {
+                continue;
+            }
+
+            // the first two on the opposite side are the second and the third
+            uint8_t key = BENCH_SAME;
+            if (get_bench_key_atom(pos, false, pth_atom) != pth_atom) {
+                key = found[BENCH_OPPOSITE] ? BENCH_THIRD : BENCH_OPPOSITE;
+            }
+            if (!found[key]) {
+                bench_keys[key] = pos;
+                found[key]      = true;
+            }
         }
     }
+    return found[BENCH_OPPOSITE] && found[BENCH_SAME] && found[BENCH_THIRD];
+}
 
-    if (pth_status == PTH_IDLE || pth_status >= PTH_DECIDED_TAP) {
-        return;
+static void run_bench_predictions(void) {
+    BENCH_CALL(PTH_BENCH_THIRD_PRESS, pth_default_get_hold_prediction_when_third_press());
+    BENCH_CALL(PTH_BENCH_PTH_RELEASE_AFTER_SECOND_PRESS, pth_default_get_hold_prediction_when_pth_release_after_second_press());
+    BENCH_CALL(PTH_BENCH_PTH_RELEASE_AFTER_SECOND_RELEASE, pth_default_get_hold_prediction_when_pth_release_after_second_release());
+    BENCH_CALL(PTH_BENCH_OVERLAP, pth_default_get_overlap_ms_for_hold_prediction());
+#    ifdef PTH_EARLY_DECISION_ENABLE
+    BENCH_CALL(PTH_BENCH_SECOND_PRESS, pth_default_get_hold_prediction_when_second_press());
+#    endif
+#    ifdef PTH_FAST_STREAK_TAP_ENABLE
+    BENCH_CALL(PTH_BENCH_FAST_STREAK, pth_default_get_fast_streak_tap_prediction());
+#    endif
+}
+
+// Runs the housekeeping task about once per ms, like the main loop.
+static void run_bench_housekeeping(uint8_t ms) {
+    const uint16_t start = timer_read();
+    while (TIMER_DIFF_16(timer_read(), start) < ms) {
+        {
+            PTH_BENCH_SCOPE(PTH_BENCH_HOUSEKEEPING);
+            housekeeping_task_predictive_tap_hold();
+#    ifdef PTH_USE_DEFERRED_EXEC
+            deferred_exec_task();
+#    endif
+        }
+        wait_ms(1);
     }
+}
 
-    // second_press_timer is relevant if a second key has been pressed in a PTH sequence.
-    if (!second_press_timer_max_reached && pth_status == PTH_SECOND_PRESSED) {
-        if (min_overlap_dur_for_hold > 0 && TIMER_DIFF_16(cur_time, second_press_timer) >= min_overlap_dur_for_hold) {
-            PTH_LOG("Housekeeping: Overlap large enough, so choose HOLD.");
-            make_decision_hold();
-            return; // the rest of the checks don't matter anymore
-        } else if (TIMER_DIFF_16(cur_time, second_press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
-            second_press_timer_max_reached = true;
+static void run_bench_event(uint8_t key, bool pressed) {
+    keyrecord_t    record  = {.event = {.key = bench_keys[key], .time = timer_read(), .type = KEY_EVENT, .pressed = pressed}};
+    const uint16_t keycode = keycode_at_keymap_location(get_layer_of_pos(record.event.key), record.event.key.row, record.event.key.col);
+
+    {
+        PTH_BENCH_SCOPE(PTH_BENCH_PROCESS_RECORD);
+        process_record_predictive_tap_hold(keycode, &record);
+    }
+
+    // The features are only meaningful while PTH is undecided.
+    if (pth.status == PTH_PRESSED || pth.status == PTH_SECOND_PRESSED) {
+        run_bench_predictions();
+    }
+}
+
+bool pth_run_benchmark(uint8_t iterations) {
+    if (pth.status != PTH_IDLE || is_processing_record_due_to_pth || !find_bench_keys()) {
+        return false;
+    }
+
+    start_cycle_counter();
+    bench_overhead = UINT32_MAX;
+    for (uint8_t i = 0; i < 8; i++) {
+        const uint32_t start  = read_cycles();
+        const uint32_t cycles = cycles_since(start);
+        bench_overhead        = MIN(bench_overhead, cycles);
+    }
+    memset(bench_stats, 0, sizeof(bench_stats));
+
+    // Nothing of this should reach the host.
+    host_driver_t* driver = host_get_driver();
+    host_set_driver(NULL);
+    bench_running = true;
+
+    for (uint8_t i = 0; i < iterations; i++) {
+        for (uint8_t e = 0; e < sizeof(bench_events) / sizeof(bench_events[0]); e++) {
+            const uint8_t key = pgm_read_byte(&bench_events[e][0]);
+            if (key != BENCH_WAIT) {
+                run_bench_event(key & ~BENCH_DOWN, key & BENCH_DOWN);
+            }
+            run_bench_housekeeping(pgm_read_byte(&bench_events[e][1]));
         }
     }
 
-    // pth_press_timer is relevant if a PTH sequence is active before a decision.
-    if (!pth_press_timer_max_reached) { // must be PTH_PRESSED or PTH_SECOND_PRESSED
-        if (TIMER_DIFF_16(cur_time, pth_press_timer) >= MS_MAX_DUR_FOR_TIMERS) {
-            pth_press_timer_max_reached = true;
-        } else if (!has_chosen_after_timeout_reached && timeout_for_forcing_choice > 0 && TIMER_DIFF_16(cur_time, pth_press_timer) >= timeout_for_forcing_choice) {
-            make_user_choice_or_not();
+    bench_running = false;
+    clear_keyboard();
+    host_set_driver(driver);
+
+#    ifdef CONSOLE_ENABLE
+    pth_print_benchmark();
+#    endif
+    return true;
+}
+
+const pth_benchmark_stats_t* pth_get_benchmark_stats(void) {
+    return bench_stats;
+}
+
+#    ifdef CONSOLE_ENABLE
+void pth_print_benchmark(void) {
+    static const char* const names[PTH_BENCH_COUNT] = {"process_record", "housekeeping", "decision_tap", "decision_hold", "third_press", "release_after_press", "release_after_release", "overlap", "second_press", "fast_streak"};
+
+    uprintf("PTH benchmark: path count min mean max (cycles, overhead of %lu subtracted)\n", (unsigned long)bench_overhead);
+    for (uint8_t i = 0; i < PTH_BENCH_COUNT; i++) {
+        const pth_benchmark_stats_t* s = &bench_stats[i];
+        if (s->count > 0) {
+            uprintf("  %s %u %lu %lu %lu\n", names[i], s->count, (unsigned long)s->min, (unsigned long)(s->total / s->count), (unsigned long)s->max);
         }
     }
 }
+#    endif // CONSOLE_ENABLE
+#endif // PTH_BENCHMARK_ENABLE
@@ -25,6 +25,33 @@
 #    include <string.h>
 #endif
 
+#ifdef PTH_TRACE_ENABLE
+#    include "print.h"
+#    include <string.h>
+#endif
+
+#ifdef PTH_CAPTURE_ENABLE
+#    include "raw_hid.h"
+#    include <string.h>
+#endif
+
+#ifdef PTH_BENCHMARK_ENABLE
+#    include <string.h>
+#endif
+
+#ifdef PTH_USE_DEFERRED_EXEC
+#    include "deferred_exec.h"
+#endif
+
+#ifdef PTH_ADAPTIVE_FACTORS
+#    include "eeprom.h"
+#    include <string.h>
+#endif
+
+#if defined(PTH_POINTING_DEVICE_HOLD) && defined(POINTING_DEVICE_ENABLE)
+#    include "pointing_device.h"
+#endif
+
 #ifdef VIAL_ENABLE
 #    include "dynamic_keymap.h"
 #else
@@ -57,6 +84,221 @@
  */
 // #    define PTH_FAST_STREAK_TAP_RESET_IMMEDIATELY
 
+/**
+ * Add this to make a decision right when a second key on the opposite side
+ * is pressed, if the prediction for that moment is confident enough (see
+ * pth_get_early_decision_margin). Otherwise, the usual logic decides later.
+ * With PTH_TELEMETRY_ENABLE, the usual logic still runs in the background to
+ * count how often it agrees with the early decision.
+ */
+// #    define PTH_EARLY_DECISION_ENABLE
+
+/**
+ * Add this to keep the last PTH_TYPING_STATS_SIZE press-to-press and overlap
+ * durations, with their mean, variance, minimum, maximum and an exponential
+ * moving average (see pth_get_typing_stats). They are meant for your own
+ * predictions, e.g. pth_predict_fast_streak_tap, and don't change the
+ * default ones.
+ */
+// #    define PTH_TYPING_STATS_ENABLE
+
+/**
+ * The hooks that PTH calls on (almost) every event are weak functions, so
+ * that you can override them in keymap.c. A weak function can't be inlined,
+ * though. Add this to make PTH call its default implementations directly
+ * instead, so that the compiler can fold them (e.g. the timeout of 700 ms).
+ * Overriding one of the following functions then has no effect, but you can
+ * replace each of them by defining its macro in config.h, for example:
+ *
+ *     #define PTH_GET_TIMEOUT_FOR_FORCING_CHOICE() 500
+ *
+ * PTH_GET_SIDE(record), PTH_SHOULD_HOLD_INSTANTLY(keycode, record),
+ * PTH_SECOND_SHOULD_HOLD_INSTANTLY(keycode, record),
+ * PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_PRESS(),
+ * PTH_SHOULD_CHOOSE_TAP_WHEN_SECOND_IS_SAME_SIDE_RELEASE(),
+ * PTH_GET_TIMEOUT_FOR_FORCING_CHOICE(), PTH_GET_FORCED_CHOICE_AFTER_TIMEOUT(),
+ * PTH_SHOULD_NEUTRALIZE_MODS(mod_5_bit),
+ * PTH_GET_CODE_TO_BE_REGISTERED_INSTEAD_WHEN_HOLD_CHOSEN(),
+ * PTH_SHOULD_REGISTER_AS_HOLD_WHEN_SAME_SIDE(keycode, record) and
+ * PTH_GET_PREDICTION_FACTOR_FOR_HOLD().
+ *
+ * Such a macro also works without this option, in which case the functions
+ * you didn't replace stay weak. The functions can still be called either way.
+ */
+// #    define PTH_INLINE_DEFAULT_HOOKS
+
+/**
+ * Add this to make the default prediction functions use integer math only.
+ * That way, boards without an FPU (e.g. ATmega32U4) need no soft-float
+ * routines for them, which saves flash and many cycles per key event.
+ *
+ * Probabilities and factors become fixed-point numbers (see `pth_real_t`),
+ * the weighted averages and the overlap prediction are calculated in fixed
+ * point too. The decisions match those of the float version, except for
+ * values within a tiny fraction of a threshold.
+ */
+// #    define PTH_FIXED_POINT
+
+/**
+ * Add this to record every PTH decision (when and how it was made) in a small
+ * ring buffer and to count decisions per path and overflows of the internal
+ * arrays. See the "Telemetry" functions below for how to read them. Without
+ * it, none of this is compiled in.
+ */
+// #    define PTH_TELEMETRY_ENABLE
+
+/**
+ * PTH_DEBUG formats every message while the event is processed, which takes
+ * long enough to change the timings that are being debugged. Add this to
+ * record each message as a small binary record (its line in
+ * predictive_tap_hold.c, the time, the status and up to four values) instead.
+ * With CONSOLE_ENABLE, the housekeeping task prints one record per call as
+ * hex. Or read them with pth_read_trace, e.g. to send them via raw HID.
+ * tools/pth_trace_decode.py turns them back into the messages of PTH_DEBUG.
+ * This replaces PTH_DEBUG, and doesn't need KEYCODE_STRING_ENABLE.
+ */
+// #    define PTH_TRACE_ENABLE
+
+/**
+ * Add this to stream every key event (its position, a coarse class of its
+ * keycode and the time) and every PTH decision to the host via raw HID, e.g.
+ * to retrain the predictions on your own typing. The records are collected in
+ * one report while the housekeeping task sends the other one, so neither
+ * console nor waiting is needed. Requires RAW_ENABLE = yes. See "Capture"
+ * below for the format, and tools/pth_capture_decode.py for reading it.
+ */
+// #    define PTH_CAPTURE_ENABLE
+
+/**
+ * Add this for a benchmark build: pth_run_benchmark drives synthetic key
+ * sequences through the real code and measures the cycles of
+ * process_record_predictive_tap_hold, the housekeeping task, the decisions
+ * (including their flush) and each default prediction function. It uses the
+ * DWT cycle counter on Cortex-M3/M4/M7, SysTick on Cortex-M0+ (RP2040), and
+ * Timer 1 on AVR, which must not be used by anything else.
+ */
+// #    define PTH_BENCHMARK_ENABLE
+
+/**
+ * By default, tap dance keys are left to QMK, which decides them with its
+ * fixed TAPPING_TERM, regardless of PTH. Add this to decide them like any
+ * other tap-hold key instead (requires TAP_DANCE_ENABLE = yes). Each tap or
+ * hold is counted by PTH, which calls the tap dance actions of your keymap
+ * itself, and the dance ends with a hold, when another key is sent, or when
+ * no tap follows within pth_get_tap_dance_term. With TAPPING_TERM_PER_KEY,
+ * tap dance keys with a non-zero tapping term are still left to QMK.
+ */
+// #    define PTH_TAP_DANCE_ENABLE
+
+/**
+ * By default, PTH calls wait_ms(TAP_CODE_DELAY) between the events it sends
+ * after a decision, which stops the matrix scan. Add this to queue those
+ * events instead. The housekeeping task then sends them once each delay has
+ * passed, in exactly the same order. Only has an effect if TAP_CODE_DELAY > 0.
+ */
+// #    define PTH_NON_BLOCKING_FLUSH
+
+/**
+ * By default, PTH waits TAP_CODE_DELAY at fixed points of a flush, e.g. before
+ * every release of the PTH key. Add this to only wait before the release of a
+ * key that PTH pressed less than TAP_CODE_DELAY ago, and only for the rest of
+ * the delay. All other events are sent right after each other, in the same
+ * order. Works with and without PTH_NON_BLOCKING_FLUSH.
+ */
+// #    define PTH_BATCHED_FLUSH
+
+/**
+ * By default, the durations between events are measured with timer_read()
+ * when PTH processes an event. Add this to use the time of the matrix scan
+ * that created the event (record->event.time) instead, so that events that
+ * QMK delayed (e.g. while a flush was waiting) are timed correctly.
+ */
+// #    define PTH_USE_EVENT_TIME
+
+/**
+ * The timers of the durations are 16-bit, so the housekeeping marks each of
+ * them as maxed out before it wraps around. Add this to use 32-bit timers
+ * (timer_read32) instead, for which a duration is simply capped when it is
+ * read, so that the housekeeping doesn't have to wake up for them.
+ */
+// #    define PTH_32_BIT_TIMERS
+
+/**
+ * Add this to derive the side of each key from the halves of a split keyboard
+ * (the rows of the left half come first), so that you don't have to define
+ * pth_side_layout. Every key of the left half is PTH_L, every key of the
+ * right half PTH_R.
+ */
+// #    define PTH_SIDES_FROM_SPLIT
+
+/**
+ * The housekeeping task only compares the current time with the time when the
+ * next timer expires. Add this to use QMK's deferred execution for that
+ * instead, so it isn't called on every scan at all (requires
+ * DEFERRED_EXEC_ENABLE = yes in your rules.mk).
+ */
+// #    define PTH_USE_DEFERRED_EXEC
+
+/**
+ * Add this to copy the side of each key from pth_side_layout, and whether it
+ * is a tap-hold (plus its mods) and transparent on the first
+ * PTH_KEY_CACHE_LAYERS layers, into RAM when the keyboard starts. Looking
+ * up a side or the active layer of a key is then a plain RAM access.
+ * If your keymap can change at runtime (e.g. VIA or Vial), call
+ * `pth_rebuild_key_cache()` afterwards.
+ */
+// #    define PTH_KEY_CACHE_ENABLE
+
+/**
+ * Add this to store the three default decision trees as data (see
+ * `pth_model_node_t`) in PROGMEM, which a small loop evaluates, instead of
+ * compiling them into code. Different models can then be used without
+ * changing the code by overriding `pth_get_model`. The tables are generated
+ * with tools/pth_model_gen.py.
+ */
+// #    define PTH_MODEL_INTERPRETER
+
+/**
+ * Add this to use the three default decision trees pruned to at most 4
+ * comparisons (59 instead of 199 nodes), which saves flash on small boards at
+ * the cost of a few wrong decisions more. See "Small Models" in the README.
+ */
+// #    define PTH_SMALL_MODELS
+
+/**
+ * Add this to learn a factor per key from your corrections, which is added to
+ * the one of `pth_get_prediction_factor_for_hold`. If a tap is followed by
+ * PTH_ADAPTIVE_CORRECTION_KEY and then a hold of the same key, that key is
+ * made more likely to be a hold. If a hold is followed by typing the same two
+ * keys again, but with a tap, it is made less likely to be a hold.
+ *
+ * The factors are kept in RAM and written to EEPROM at
+ * PTH_ADAPTIVE_EEPROM_ADDR (which you have to define) when no key was
+ * pressed for a few seconds, but only if they changed. Each write goes to the
+ * next of PTH_ADAPTIVE_EEPROM_SLOTS slots, which spreads the wear.
+ */
+// #    define PTH_ADAPTIVE_FACTORS
+
+/**
+ * Add this to adapt the timeout of `pth_get_timeout_for_forcing_choice` to
+ * each PTH key. For the last PTH_ADAPTIVE_TIMEOUT_KEYS PTH keys, the
+ * durations of lone presses (no other key pressed before the release) and
+ * of holds until the next key are kept in histograms in RAM. The timeout is
+ * the larger of their PTH_ADAPTIVE_TIMEOUT_PERCENTILE, but at least
+ * PTH_ADAPTIVE_TIMEOUT_MIN, and at most the default.
+ */
+// #    define PTH_ADAPTIVE_TIMEOUT
+
+/**
+ * Add this to hold the PTH key right away when a mouse button is pressed or
+ * the pointer moves before any other key, so that modified clicks and drags
+ * don't wait for the second key logic or the timeout. Mouse keys are always
+ * checked. With POINTING_DEVICE_ENABLE, so are the reports of the pointing
+ * device (see `pointing_device_task_predictive_tap_hold`). Which of them
+ * count is decided by `pth_should_hold_when_pointing`.
+ */
+// #    define PTH_POINTING_DEVICE_HOLD
+
 /**
  * Only basic, unmodified HID keycodes work, not KC_NO or KC_TRNS.
  * Avoid F24 because GUI + F24 triggers a screenshot on Windows.
@@ -98,6 +340,240 @@
 #    define PTH_MS_MIN_OVERLAP 39
 #endif
 
+/**
+ * The number of key releases that can be cached while the PTH key is
+ * undecided (to keep them in order). If more keys are released, the PTH key
+ * is decided right away (with the prediction for a third press if a second
+ * key is down, otherwise as a tap). Each record needs 8 (or 10) bytes of RAM.
+ * See `pth_get_release_records_high_water()` to find a fitting size.
+ */
+#ifndef PTH_RELEASE_RECORD_SIZE
+#    define PTH_RELEASE_RECORD_SIZE 8
+#endif
+
+/**
+ * The number of tap-hold keys that were sent as tap and are still down. Each
+ * needs 2 bytes of RAM. If all are in use, the next key that would be sent as
+ * tap while it is still down is sent as hold instead. See
+ * `pth_get_release_as_tap_positions_high_water()` to find a fitting size.
+ */
+#ifndef PTH_RELEASE_AS_TAP_POSITIONS_SIZE
+#    define PTH_RELEASE_AS_TAP_POSITIONS_SIZE 8
+#endif
+
+/**
+ * The number of events the PTH_NON_BLOCKING_FLUSH queue holds. If it is full,
+ * PTH waits like it would without the queue. Each event needs 10 bytes of RAM.
+ */
+#ifndef PTH_OUTPUT_QUEUE_SIZE
+#    define PTH_OUTPUT_QUEUE_SIZE 16
+#endif
+
+/**
+ * The number of layers (starting at 0) whose key attributes are cached with
+ * PTH_KEY_CACHE_ENABLE. The cache needs MATRIX_ROWS * MATRIX_COLS bytes for
+ * the sides and as many bytes again per layer. Lookups on higher layers read
+ * the keymap directly. It must be smaller than the number of bits of
+ * layer_state_t (16 or 32).
+ */
+#ifndef PTH_KEY_CACHE_LAYERS
+#    define PTH_KEY_CACHE_LAYERS 4
+#endif
+
+/**
+ * With VIAL_ENABLE, the keymap is read from (often emulated) EEPROM, so the
+ * keycodes PTH reads during a tap-hold sequence are kept in RAM until the
+ * next one starts. Each entry needs 4 bytes of RAM.
+ */
+#ifndef PTH_KEYCODE_CACHE_SIZE
+#    define PTH_KEYCODE_CACHE_SIZE 4
+#endif
+
+/**
+ * The number of decision records the telemetry ring buffer holds. When it is
+ * full, the oldest record is overwritten. Each record needs 20 bytes of RAM.
+ * It must not be larger than 127.
+ */
+#ifndef PTH_TELEMETRY_SIZE
+#    define PTH_TELEMETRY_SIZE 8
+#endif
+
+/**
+ * The number of records the trace buffer (see PTH_TRACE_ENABLE) holds. If it
+ * is full, new records are dropped (and counted). Each record needs 12 bytes
+ * of RAM. A single event can lead to about ten records. It must not be
+ * larger than 127.
+ */
+#ifndef PTH_TRACE_SIZE
+#    define PTH_TRACE_SIZE 32
+#endif
+
+/**
+ * The size of the reports of PTH_CAPTURE_ENABLE. It has to be the size of
+ * QMK's raw HID reports (RAW_EPSIZE, 32 by default).
+ */
+#ifndef PTH_CAPTURE_REPORT_SIZE
+#    define PTH_CAPTURE_REPORT_SIZE 32
+#endif
+
+/**
+ * The first byte of each capture report, so that the host can tell them apart
+ * from other raw HID reports (e.g. those of VIA).
+ */
+#ifndef PTH_CAPTURE_REPORT_ID
+#    define PTH_CAPTURE_REPORT_ID 0x50
+#endif
+
+/**
+ * A capture report that isn't full is sent once no record was added for this
+ * many ms.
+ */
+#ifndef PTH_CAPTURE_FLUSH_MS
+#    define PTH_CAPTURE_FLUSH_MS 100
+#endif
+
+/**
+ * The number of durations of each kind that PTH_TYPING_STATS_ENABLE keeps
+ * (at most 255). Each one needs 2 bytes of RAM.
+ */
+#ifndef PTH_TYPING_STATS_SIZE
+#    define PTH_TYPING_STATS_SIZE 8
+#endif
+
+/**
+ * The weight of a new duration in the moving average of
+ * PTH_TYPING_STATS_ENABLE is 1 / 2^PTH_TYPING_STATS_EMA_SHIFT, so with 2,
+ * the durations before it weigh 3/4 in total.
+ */
+#ifndef PTH_TYPING_STATS_EMA_SHIFT
+#    define PTH_TYPING_STATS_EMA_SHIFT 2
+#endif
+
+/**
+ * The number of tap-hold keys that can each have their own session at the
+ * same time, i.e. the PTH key (the only one that is undecided) and up to
+ * PTH_SESSION_COUNT - 1 older PTH keys that are decided but still held.
+ *
+ * With 1 (the default), a tap-hold key that is pressed while the PTH key is
+ * undecided or held is forced to tap or hold together with the PTH key. With
+ * more, it gets its own prediction once the PTH key is decided. Sessions
+ * are always decided and sent in the order their keys were pressed.
+ */
+#ifndef PTH_SESSION_COUNT
+#    define PTH_SESSION_COUNT 1
+#endif
+
+/**
+ * On a split keyboard, events of the half that is not connected by USB reach
+ * PTH after the transport delay, i.e. later than they happened. This much
+ * (in ms) is subtracted from their time, so that the durations between keys
+ * of both halves, which the predictions rely on, are not too long. Measure
+ * it for your transport, or leave it at 0 to disable the compensation.
+ */
+#ifndef PTH_SPLIT_SECONDARY_DELAY_MS
+#    define PTH_SPLIT_SECONDARY_DELAY_MS 0
+#endif
+
+/**
+ * The factor (see PTH_ADAPTIVE_FACTORS) of a key changes in steps of
+ * PTH_ADAPTIVE_STEP, up to PTH_ADAPTIVE_MAX_STEPS in either direction. So by
+ * default, it stays within +/- 0.1.
+ */
+#ifndef PTH_ADAPTIVE_STEP
+#    define PTH_ADAPTIVE_STEP 0.01f
+#endif
+
+#ifndef PTH_ADAPTIVE_MAX_STEPS
+#    define PTH_ADAPTIVE_MAX_STEPS 10
+#endif
+
+/**
+ * How long (in ms) after a decision, or after the last correction key, the
+ * next step of a correction is expected.
+ */
+#ifndef PTH_ADAPTIVE_CORRECTION_MS
+#    define PTH_ADAPTIVE_CORRECTION_MS 1000
+#endif
+
+/**
+ * The key that undoes a wrong tap. It is compared with the tap keycode of the
+ * pressed key, so a Layer-Tap on KC_BSPC counts too.
+ */
+#ifndef PTH_ADAPTIVE_CORRECTION_KEY
+#    define PTH_ADAPTIVE_CORRECTION_KEY KC_BSPC
+#endif
+
+/**
+ * The number of slots in EEPROM that are written in turn. Each needs
+ * 3 + MATRIX_ROWS * MATRIX_COLS bytes, so all of them together need
+ * PTH_ADAPTIVE_EEPROM_SIZE bytes, starting at PTH_ADAPTIVE_EEPROM_ADDR.
+ */
+#ifndef PTH_ADAPTIVE_EEPROM_SLOTS
+#    define PTH_ADAPTIVE_EEPROM_SLOTS 4
+#endif
+
+#define PTH_ADAPTIVE_EEPROM_SIZE (PTH_ADAPTIVE_EEPROM_SLOTS * (3 + MATRIX_ROWS * MATRIX_COLS))
+
+/**
+ * With PTH_ADAPTIVE_TIMEOUT, the number of keys whose durations are kept
+ * (30 bytes each). If another key becomes the PTH key, it replaces the one
+ * with the fewest samples.
+ */
+#ifndef PTH_ADAPTIVE_TIMEOUT_KEYS
+#    define PTH_ADAPTIVE_TIMEOUT_KEYS 8
+#endif
+
+/**
+ * The share of lone presses (in %) that still become taps, and of holds
+ * whose next key comes before the timeout.
+ */
+#ifndef PTH_ADAPTIVE_TIMEOUT_PERCENTILE
+#    define PTH_ADAPTIVE_TIMEOUT_PERCENTILE 95
+#endif
+
+/**
+ * The shortest timeout (in ms) that is used.
+ */
+#ifndef PTH_ADAPTIVE_TIMEOUT_MIN
+#    define PTH_ADAPTIVE_TIMEOUT_MIN 200
+#endif
+
+/**
+ * A key keeps the default timeout, until it has this many lone presses and
+ * this many holds.
+ */
+#ifndef PTH_ADAPTIVE_TIMEOUT_MIN_SAMPLES
+#    define PTH_ADAPTIVE_TIMEOUT_MIN_SAMPLES 20
+#endif
+
+/**
+ * With PTH_POINTING_DEVICE_HOLD, the pointing device has to move this far
+ * (the sum of the absolute x, y, h and v values of its reports since the PTH
+ * press) to count as motion, so that sensor noise doesn't turn taps into
+ * holds.
+ */
+#ifndef PTH_POINTING_MOTION_THRESHOLD
+#    define PTH_POINTING_MOTION_THRESHOLD 8
+#endif
+
+/**
+ * With PTH_TAP_DANCE_ENABLE, the next tap of a dance must be pressed within
+ * PTH_TAP_DANCE_TERM ms after the first one. After that, the pace of the
+ * previous taps is used, but at least PTH_TAP_DANCE_MIN_TERM ms (and at most
+ * PTH_TAP_DANCE_TERM ms).
+ */
+#ifndef PTH_TAP_DANCE_TERM
+#    define PTH_TAP_DANCE_TERM 200
+#endif
+
+#ifndef PTH_TAP_DANCE_MIN_TERM
+#    define PTH_TAP_DANCE_MIN_TERM 100
+#endif
+
+#if defined(PTH_TAP_DANCE_ENABLE) && !defined(TAP_DANCE_ENABLE)
+#    error "PTH_TAP_DANCE_ENABLE requires TAP_DANCE_ENABLE = yes in your rules.mk"
+#endif
+
 // Macros
 //=============================================================================
 /**
@@ -153,6 +629,98 @@ extern "C" {
 
 typedef enum { PTH_IDLE, PTH_PRESSED, PTH_SECOND_PRESSED, PTH_DECIDED_TAP, PTH_DECIDED_HOLD } pth_status_t;
 
+/**
+ * The type of prediction values and factors, such as the return value of
+ * `pth_get_prediction_factor_for_hold`.
+ *
+ * It is a float, unless PTH_FIXED_POINT is defined. Then it is a fixed-point
+ * number where PTH_REAL_ONE equals 1.0. Use `PTH_REAL(0.95f)` for constants
+ * and `PTH_REAL_MUL(a, b)` for multiplications, so your code works with both.
+ */
+#ifdef PTH_FIXED_POINT
+typedef int16_t pth_real_t;
+#    define PTH_REAL_SHIFT 10
+#    define PTH_REAL_ONE (1 << PTH_REAL_SHIFT)
+#    define PTH_REAL(x) ((pth_real_t)((x) * PTH_REAL_ONE + ((x) < 0 ? -0.5f : 0.5f)))
+#    define PTH_REAL_MUL(a, b) ((pth_real_t)(((int32_t)(a) * (b)) >> PTH_REAL_SHIFT))
+#else
+typedef float pth_real_t;
+#    define PTH_REAL_ONE 1.0f
+#    define PTH_REAL(x) (x)
+#    define PTH_REAL_MUL(a, b) ((a) * (b))
+#endif // PTH_FIXED_POINT
+
+/**
+ * The type of the weighted averages of durations.
+ *
+ * With PTH_FIXED_POINT, they are stored in 1/65536 ms, which is precise enough
+ * to compare them with the (float) thresholds of the trees. `PTH_AVG(ms)`
+ * converts such a threshold at compile time, and `PTH_AVG_TO_FLOAT(avg)`
+ * returns the value in ms.
+ */
+#ifdef PTH_FIXED_POINT
+typedef int32_t pth_avg_t;
+#    define PTH_AVG(ms) ((pth_avg_t)((ms) * 65536.0))
+#    define PTH_AVG_TO_FLOAT(avg) ((avg) / 65536.0f)
+#    define PTH_AVG_TO_FIXED(avg) (avg)
+#else
+typedef float pth_avg_t;
+#    define PTH_AVG(ms) (ms)
+#    define PTH_AVG_TO_FLOAT(avg) (avg)
+#    define PTH_AVG_TO_FIXED(avg) ((int32_t)((avg) * 65536.0f))
+#endif // PTH_FIXED_POINT
+
+/**
+ * Everything the predictions know about the current PTH key (all durations in
+ * ms). It is filled as the events arrive, so reading it is free.
+ *
+ * The durations of the PTH press are set when it is pressed. The others are
+ * zero until their event happened, which is always the case when the
+ * prediction hook of that event is called (e.g. `second_dur` is set once the
+ * second key was released). `pth_get_features` returns the current one.
+ */
+typedef struct {
+    pth_avg_t press_to_press_w_avg;
+    pth_avg_t overlap_w_avg;
+    uint16_t  press_to_second_press_dur;
+    uint16_t  press_to_second_release_dur;
+    uint16_t  second_dur;
+    uint16_t  second_press_to_third_press_dur;
+    int16_t   prev_prev_press_to_prev_press_dur;
+    int16_t   prev_press_to_pth_press_dur;
+    int16_t   prev_prev_overlap_dur;
+    int16_t   prev_overlap_dur;
+    uint16_t  key_release_before_pth_to_pth_press_dur;
+    // the number of keys that are down
+    uint8_t down_count;
+} pth_features_t;
+
+/**
+ * The path (i.e. the event) that led to a PTH decision.
+ */
+typedef enum {
+    PTH_PATH_NONE,
+    // third key pressed (pth_predict_hold_when_third_press)
+    PTH_PATH_THIRD_PRESS,
+    // PTH released, with or without a second key
+    PTH_PATH_PTH_RELEASE,
+    // second key pressed, e.g. pth_should_choose_tap_when_second_is_same_side_press
+    PTH_PATH_SECOND_PRESS,
+    // pth_should_choose_tap_when_second_is_same_side_release
+    PTH_PATH_SECOND_RELEASE,
+    // predicted minimum overlap reached in housekeeping
+    PTH_PATH_OVERLAP,
+    // pth_get_forced_choice_after_timeout
+    PTH_PATH_TIMEOUT,
+    // Fast Streak Tap
+    PTH_PATH_FAST_STREAK,
+    // pth_predict_early_decision_when_second_press
+    PTH_PATH_EARLY,
+    // pth_should_hold_when_pointing
+    PTH_PATH_POINTING,
+    PTH_PATH_COUNT
+} pth_decision_path_t;
+
 typedef enum {
     // always left
     PTH_L = PTH_ENCODE_KEY_SIDES(PTH_ATOM_LEFT, PTH_ATOM_LEFT),
@@ -216,6 +784,31 @@ bool pth_is_fast_streak_tap_key(uint16_t keycode);
 bool pth_predict_fast_streak_tap(void);
 #endif // PTH_FAST_STREAK_TAP_ENABLE
 
+#ifdef PTH_EARLY_DECISION_ENABLE
+/**
+ * @brief Decides how far the prediction at the second press has to be from
+ *        0.5 for an early decision. So with the default of `0.4`, a
+ *        prediction above 0.9 leads to hold and one below 0.1 to tap.
+ *
+ * With PTH_FIXED_POINT, return a fixed-point value, e.g. `PTH_REAL(0.4f)`.
+ */
+pth_real_t pth_get_early_decision_margin(void);
+#endif // PTH_EARLY_DECISION_ENABLE
+
+#ifdef PTH_TAP_DANCE_ENABLE
+/**
+ * @brief Returns how long (in ms) after the last press of a tap dance key
+ *        another press still counts as its next tap. The dance is finished
+ *        once this has passed and the key is released.
+ *
+ * By default, this is PTH_TAP_DANCE_TERM after the first tap. After more
+ * taps, it is 1.5 times the time between the last two (limited to
+ * PTH_TAP_DANCE_MIN_TERM and PTH_TAP_DANCE_TERM), as taps usually come at a
+ * steady pace.
+ */
+uint16_t pth_get_tap_dance_term(uint16_t keycode, const tap_dance_state_t* state);
+#endif // PTH_TAP_DANCE_ENABLE
+
 #ifndef PTH_DONT_HOLD_INSTANTLY
 /**
  * @brief Decide if the PTH should be treated as HELD immediately on press.
@@ -260,7 +853,8 @@ bool pth_should_choose_tap_when_second_is_same_side_release(void);
 /**
  * @brief Returns the timeout in ms after which a decision is forced.
  *
- * By default, returns `700`. If the returned duration has passed, and no
+ * By default, returns `700` (or, with PTH_ADAPTIVE_TIMEOUT, the timeout
+ * learned for the key). If the returned duration has passed, and no
  * choice has been made yet, we run `pth_get_forced_choice_after_timeout`.
  *
  * Must be less than `MS_MAX_DUR_FOR_TIMERS` (about 4 seconds).
@@ -282,6 +876,38 @@ int16_t pth_get_timeout_for_forcing_choice(void);
  */
 pth_status_t pth_get_forced_choice_after_timeout(void);
 
+#ifdef PTH_POINTING_DEVICE_HOLD
+typedef enum {
+    // a mouse key or a button of the pointing device
+    PTH_POINTING_BUTTON,
+    // a mouse key that moves or scrolls, or PTH_POINTING_MOTION_THRESHOLD of
+    // motion of the pointing device
+    PTH_POINTING_MOTION,
+} pth_pointing_t;
+
+/**
+ * @brief Decides if the PTH key is held right away, because a mouse button
+ *        was pressed or the pointer moved while it is down and no other key
+ *        was pressed yet.
+ *
+ * `keycode` is the mouse keycode, `KC_BTN1` and up for the buttons of the
+ * pointing device, or `KC_NO` for its motion. The PTH key is in
+ * `pth_get_pth_keycode()`. By default, returns true for buttons, and for
+ * motion if the PTH key is a mod-tap (e.g. for Shift-drag), but not for
+ * layer-taps, whose layer may only be meant for the next key.
+ */
+bool pth_should_hold_when_pointing(pth_pointing_t pointing, uint16_t keycode);
+
+#    ifdef POINTING_DEVICE_ENABLE
+/**
+ * @brief Checks the reports of the pointing device. QMK calls it for the
+ *        module. Without the module, call it from your
+ *        `pointing_device_task_user` and return its result.
+ */
+report_mouse_t pointing_device_task_predictive_tap_hold(report_mouse_t mouse_report);
+#    endif
+#endif // PTH_POINTING_DEVICE_HOLD
+
 /**
  * @brief Decides if a mod-tap's modifiers should be "neutralized" on tap by
  *        sending a keypress (e.g., F23). Will receive 5-bit packed mods, such
@@ -331,8 +957,10 @@ bool pth_should_register_as_hold_when_same_side(uint16_t keycode, keyrecord_t* r
  * By default, returns `0.95` if `pth_get_pth_side_user_bits()` equals
  * `PTH_5H`, `0.9` for `PTH_10H`, and `0.85` for `PTH_15H`, thus making holds 5 %,
  * 10 %, and 15 % harder respectively on keys using them.
+ *
+ * With PTH_FIXED_POINT, return a fixed-point value, e.g. `PTH_REAL(0.9f)`.
  */
-float pth_get_prediction_factor_for_hold(void);
+pth_real_t pth_get_prediction_factor_for_hold(void);
 
 // Prediction functions (weakly defined)
 //=============================================================================
@@ -367,6 +995,54 @@ bool pth_predict_hold_when_pth_release_after_second_release(void);
  */
 uint16_t pth_predict_min_overlap_for_hold_in_ms(void);
 
+/**
+ * @brief The models used by the prediction functions above, which apply
+ *        `pth_get_prediction_factor_for_hold` to their result. Override these
+ *        to replace a default model, but keep the factors and thresholds.
+ *
+ * By default, they return the `pth_default_get_...` prediction of the same
+ * name, which reads the same features.
+ *
+ * @param features the features of the current PTH key (see `pth_features_t`)
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_get_hold_prediction_when_third_press(const pth_features_t* features);
+pth_real_t pth_get_hold_prediction_when_pth_release_after_second_press(const pth_features_t* features);
+pth_real_t pth_get_hold_prediction_when_pth_release_after_second_release(const pth_features_t* features);
+
+/**
+ * @brief The model of `pth_predict_min_overlap_for_hold_in_ms`.
+ *
+ * @return predicted overlap time in ms (whole ms with PTH_FIXED_POINT).
+ */
+#ifdef PTH_FIXED_POINT
+uint16_t pth_get_overlap_ms_for_hold_prediction(const pth_features_t* features);
+#else
+float pth_get_overlap_ms_for_hold_prediction(const pth_features_t* features);
+#endif // PTH_FIXED_POINT
+
+#ifdef PTH_EARLY_DECISION_ENABLE
+/**
+ * @brief The model of `pth_predict_early_decision_when_second_press`.
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_get_hold_prediction_when_second_press(const pth_features_t* features);
+
+/**
+ * @brief Prediction function called when a second key on the opposite side
+ *        is pressed (after the minimum overlap was predicted).
+ *
+ * By default, multiplies `pth_get_hold_prediction_when_second_press`
+ * with `pth_get_prediction_factor_for_hold` and compares the result with
+ * `pth_get_early_decision_margin`.
+ *
+ * @return PTH_DECIDED_TAP or PTH_DECIDED_HOLD to decide now, anything else
+ *         (e.g. PTH_SECOND_PRESSED) to wait for the usual logic.
+ */
+pth_status_t pth_predict_early_decision_when_second_press(void);
+#endif // PTH_EARLY_DECISION_ENABLE
+
 #ifdef PTH_FAST_STREAK_TAP_ENABLE
 // These might be useful in pth_predict_fast_streak_tap.
 
@@ -386,32 +1062,117 @@ float pth_conservative_get_fast_streak_tap_prediction(void);
 /**
  * @brief The default prediction when a third key is pressed.
  *
- * @return float prediction value in [0, 1]. > 0.5f is considered hold.
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
  */
-float pth_default_get_hold_prediction_when_third_press(void);
+pth_real_t pth_default_get_hold_prediction_when_third_press(void);
 
 /**
  * @brief The default prediction when the PTH key is released after the
  *        second key was pressed (and is still down).
  *
- * @return float prediction value in [0, 1]. > 0.5f is considered hold.
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
  */
-float pth_default_get_hold_prediction_when_pth_release_after_second_press(void);
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_press(void);
 
 /**
  * @brief The default prediction when the PTH key is released after the
  *        second key was also released.
  *
- * @return float prediction value in [0, 1]. > 0.5f is considered hold.
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
  */
-float pth_default_get_hold_prediction_when_pth_release_after_second_release(void);
+pth_real_t pth_default_get_hold_prediction_when_pth_release_after_second_release(void);
+
+#ifdef PTH_EARLY_DECISION_ENABLE
+/**
+ * @brief The default prediction when a second key on the opposite side is
+ *        pressed. It only uses what is known at that moment, and is derived
+ *        from the trained trees, so each result is the share of holds among
+ *        such second presses.
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_default_get_hold_prediction_when_second_press(void);
+#endif // PTH_EARLY_DECISION_ENABLE
 
 /**
  * @brief The default prediction for the minimum overlap time for a hold.
  *
- * @return predicted overlap time in ms.
+ * @return predicted overlap time in ms (whole ms with PTH_FIXED_POINT).
  */
+#ifdef PTH_FIXED_POINT
+uint16_t pth_default_get_overlap_ms_for_hold_prediction(void);
+#else
 float pth_default_get_overlap_ms_for_hold_prediction(void);
+#endif // PTH_FIXED_POINT
+
+#ifdef PTH_MODEL_INTERPRETER
+// Decision tree models (PTH_MODEL_INTERPRETER)
+//=============================================================================
+/**
+ * The values a node of a model can compare with its threshold.
+ *
+ * Durations are in ms. PTH_FEATURE_SECOND_DUR and
+ * PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR are -1 while the second key is
+ * down. The weighted averages are in 1/65536 ms.
+ */
+typedef enum {
+    PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR,
+    PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR,
+    PTH_FEATURE_PREV_PREV_OVERLAP_DUR,
+    PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR,
+    PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR,
+    PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR,
+    PTH_FEATURE_SECOND_DUR,
+    PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR,
+    PTH_FEATURE_DOWN_COUNT,
+    PTH_FEATURE_PRESS_TO_PRESS_W_AVG,
+    PTH_FEATURE_OVERLAP_W_AVG,
+    PTH_FEATURE_COUNT
+} pth_feature_t;
+
+// The feature of a leaf node
+#    define PTH_MODEL_LEAF 0xFF
+
+/**
+ * A node of a decision tree model. The nodes are stored in pre-order, so the
+ * child for `feature <= value` directly follows its parent, and the other one
+ * is `right` nodes after it.
+ *
+ * For a leaf, `feature` is PTH_MODEL_LEAF and `value` is the prediction in
+ * 1/65536 (i.e. 65536 means hold for sure). The packed layout (6 bytes) is
+ * the same on every platform, so a model can also be stored as a binary.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t feature;
+    uint8_t right;
+    int32_t value;
+} pth_model_node_t;
+
+typedef enum {
+    PTH_MODEL_THIRD_PRESS,
+    PTH_MODEL_PTH_RELEASE_AFTER_SECOND_PRESS,
+    PTH_MODEL_PTH_RELEASE_AFTER_SECOND_RELEASE,
+    // only with PTH_EARLY_DECISION_ENABLE
+    PTH_MODEL_SECOND_PRESS,
+} pth_model_t;
+
+/**
+ * @brief Returns the model used by the default prediction function of
+ *        `model`. By default, these are the generated PROGMEM tables.
+ *        Override it to use your own models.
+ *
+ * The nodes are read with pgm_read_*. So on AVR they must be in PROGMEM, on
+ * ARM they can also be in RAM or in a flash page.
+ */
+const pth_model_node_t* pth_get_model(pth_model_t model);
+
+/**
+ * @brief Evaluates a model with the current state of the PTH.
+ *
+ * @return prediction value in [0, 1]. > PTH_REAL(0.5f) is considered hold.
+ */
+pth_real_t pth_evaluate_model(const pth_model_node_t* nodes);
+#endif // PTH_MODEL_INTERPRETER
 
 // Accessor functions
 //=============================================================================
@@ -423,6 +1184,12 @@ pth_status_t pth_get_prev_status(void);
  */
 int16_t pth_get_prev_press_to_pth_press_dur(void);
 
+/**
+ * @return the features of the current PTH key. The pointer is always valid,
+ *         and the features are updated as the events arrive.
+ */
+const pth_features_t* pth_get_features(void);
+
 /**
  * @return PTH_ATOM_LEFT, PTH_ATOM_RIGHT, PTH_ATOM_OPPOSITE or PTH_ATOM_SAME
  */
@@ -473,6 +1240,378 @@ bool pth_is_second_tap_hold(void);
  */
 bool pth_is_processing_internal(void);
 
+// The events of a subscription
+#define PTH_SUBSCRIBE_PRESS 0b01
+#define PTH_SUBSCRIBE_RELEASE 0b10
+
+/**
+ * @brief A range of keycodes, and which of their events should reach a
+ *        handler when PTH replays them (e.g. when it flushes a decision).
+ */
+typedef struct {
+    uint16_t first_keycode;
+    uint16_t last_keycode;
+    uint8_t  events; // PTH_SUBSCRIBE_PRESS and/or PTH_SUBSCRIBE_RELEASE
+} pth_subscription_t;
+
+/**
+ * @brief Filter for the start of a `process_record_*` function, so that the
+ *        records PTH replays only reach it if it subscribed to them. Events
+ *        that don't come from PTH always reach it.
+ *
+ * @param subscriptions An array of subscriptions, one of which must match.
+ * @param count The number of subscriptions.
+ * @return true if the handler should process the record.
+ */
+bool pth_should_receive(const pth_subscription_t* subscriptions, uint8_t count, uint16_t keycode, const keyrecord_t* record);
+
+/**
+ * @return the largest number of release records that were in use at the same
+ *         time since the keyboard started (at most PTH_RELEASE_RECORD_SIZE).
+ */
+uint8_t pth_get_release_records_high_water(void);
+
+/**
+ * @return the largest number of tap-hold keys that were down as tap at the
+ *         same time (at most PTH_RELEASE_AS_TAP_POSITIONS_SIZE).
+ */
+uint8_t pth_get_release_as_tap_positions_high_water(void);
+
+#ifdef VIAL_ENABLE
+// Keycode cache (VIAL_ENABLE)
+//=============================================================================
+/**
+ * @brief Forgets the keycodes read from the dynamic keymap. Call this after
+ *        changing the keymap while a tap-hold key may be undecided, e.g. from
+ *        `dynamic_keymap_set_keycode`.
+ */
+void pth_clear_keycode_cache(void);
+#endif // VIAL_ENABLE
+
+#ifdef PTH_KEY_CACHE_ENABLE
+// Key attribute cache (PTH_KEY_CACHE_ENABLE)
+//=============================================================================
+// the 5-bit mods of a mod-tap (e.g. MOD_LCTL)
+#    define PTH_KEY_ATTR_MODS_MASK 0b00011111
+#    define PTH_KEY_ATTR_TRANSPARENT 0b01000000
+#    define PTH_KEY_ATTR_TAP_HOLD 0b10000000
+
+/**
+ * @brief Reads the keymap and pth_side_layout again. Call this after the
+ *        keymap changed.
+ */
+void pth_rebuild_key_cache(void);
+
+/**
+ * @return the PTH_KEY_ATTR_* bits of the key at `pos` on `layer`.
+ */
+uint8_t pth_get_key_attributes(keypos_t pos, uint8_t layer);
+#endif // PTH_KEY_CACHE_ENABLE
+
+#ifdef PTH_ADAPTIVE_FACTORS
+// Adaptive factors (PTH_ADAPTIVE_FACTORS)
+//=============================================================================
+/**
+ * @return the learned factor of the PTH key, which the default
+ *         `pth_get_prediction_factor_for_hold` adds to its result. Use it if
+ *         you override that function.
+ */
+pth_real_t pth_get_adaptive_factor_offset(void);
+
+/**
+ * @return the learned steps (of PTH_ADAPTIVE_STEP) of the key at `pos`.
+ */
+int8_t pth_get_adaptive_steps(keypos_t pos);
+
+/**
+ * @brief Sets all learned factors back to 0 (written with the next save).
+ */
+void pth_reset_adaptive_factors(void);
+
+/**
+ * @brief Writes the learned factors to EEPROM now, if they changed since the
+ *        last write. This is also done automatically when typing pauses.
+ */
+void pth_save_adaptive_factors(void);
+#endif // PTH_ADAPTIVE_FACTORS
+
+#ifdef PTH_ADAPTIVE_TIMEOUT
+// Adaptive timeout (PTH_ADAPTIVE_TIMEOUT)
+//=============================================================================
+/**
+ * @return the timeout for the key at `pos` learned from its histograms, or
+ *         `timeout` (which is also the upper limit) while there are too few
+ *         samples. The default `pth_get_timeout_for_forcing_choice` returns
+ *         this for 700 ms. Use it if you override that function.
+ */
+int16_t pth_get_adaptive_timeout(keypos_t pos, int16_t timeout);
+
+/**
+ * @brief Forgets all durations, so every key starts with the default timeout.
+ */
+void pth_reset_adaptive_timeouts(void);
+#endif // PTH_ADAPTIVE_TIMEOUT
+
+#ifdef PTH_TYPING_STATS_ENABLE
+// Typing statistics (PTH_TYPING_STATS_ENABLE)
+//=============================================================================
+typedef enum {
+    // from one press to the next one
+    PTH_STATS_PRESS_TO_PRESS,
+    // for each release, how long it overlapped with another key (0 if it
+    // didn't)
+    PTH_STATS_OVERLAP,
+    PTH_STATS_KIND_COUNT
+} pth_stats_kind_t;
+
+/**
+ * @brief Statistics of the last `count` durations of a kind, in ms. Just
+ *        like the features of the predictions, each duration is at most
+ *        4096 ms, so a pause counts as 4096.
+ *
+ * The variance is that of the stored durations (in ms^2), while the moving
+ * average starts with the first duration and then weighs each new one with
+ * 1 / 2^PTH_TYPING_STATS_EMA_SHIFT.
+ */
+typedef struct {
+    uint8_t  count;
+    uint16_t last;
+    uint16_t min;
+    uint16_t max;
+    uint16_t mean;
+    uint32_t variance;
+    uint16_t ema;
+} pth_typing_stats_t;
+
+/**
+ * @brief Fills `stats` with the statistics of the durations up to now, which
+ *        includes the ones of the PTH key and the keys after it. All values
+ *        are 0 until the first duration of that kind.
+ *
+ * Only the minimum and maximum need a loop over the durations, the others are
+ * updated with each key event.
+ */
+void pth_get_typing_stats(pth_stats_kind_t kind, pth_typing_stats_t* stats);
+
+/**
+ * @return the duration `age` durations before the newest one (0 is the newest),
+ *         or -1 if there is none.
+ */
+int16_t pth_get_typing_history_dur(pth_stats_kind_t kind, uint8_t age);
+#endif // PTH_TYPING_STATS_ENABLE
+
+#ifdef PTH_TELEMETRY_ENABLE
+// Telemetry (PTH_TELEMETRY_ENABLE)
+//=============================================================================
+#    define PTH_TELEMETRY_HOLD 0b001
+#    define PTH_TELEMETRY_HAS_SECOND 0b010
+#    define PTH_TELEMETRY_SECOND_RELEASED 0b100
+
+/**
+ * @brief Everything we know about a single PTH decision.
+ *
+ * Times are `timer_read()` values, so the latency of the decision is
+ * `TIMER_DIFF_16(decision_time, press_time)`. The second and third
+ * durations are only meaningful if the corresponding flags or path are set.
+ */
+typedef struct {
+    uint16_t keycode;
+    uint16_t press_time;
+    uint16_t decision_time;
+    uint8_t  path;  // pth_decision_path_t
+    uint8_t  flags; // PTH_TELEMETRY_HOLD, PTH_TELEMETRY_HAS_SECOND, ...
+    uint16_t press_to_second_press_dur;
+    uint16_t second_press_to_third_press_dur;
+    uint16_t press_to_second_release_dur;
+    int16_t  prev_press_to_pth_press_dur;
+    int16_t  prev_overlap_dur;
+    uint16_t min_overlap_dur_for_hold;
+} pth_telemetry_record_t;
+
+/**
+ * @brief Counters since boot (or the last `pth_clear_telemetry`). They
+ *        saturate instead of wrapping around.
+ */
+typedef struct {
+    uint16_t decisions[PTH_PATH_COUNT];
+    uint16_t holds;
+    uint16_t release_record_overflows;
+    uint16_t tap_release_overflows;
+    // only with PTH_NON_BLOCKING_FLUSH
+    uint16_t output_queue_overflows;
+    // records that were overwritten before they were read
+    uint16_t dropped_records;
+    // only with PTH_EARLY_DECISION_ENABLE: early decisions that the usual
+    // logic later confirmed or would have decided differently
+    uint16_t early_confirmed;
+    uint16_t early_wrong;
+} pth_telemetry_counters_t;
+
+/**
+ * @brief Removes the oldest decision record from the ring buffer.
+ *
+ * @return false if there was no record, in which case `record` is unchanged.
+ */
+bool pth_pop_telemetry_record(pth_telemetry_record_t* record);
+
+const pth_telemetry_counters_t* pth_get_telemetry_counters(void);
+
+/**
+ * @brief Resets the counters and discards all decision records.
+ */
+void pth_clear_telemetry(void);
+
+#    ifdef CONSOLE_ENABLE
+/**
+ * @brief Prints the counters and pops and prints all decision records.
+ */
+void pth_print_telemetry(void);
+#    endif
+#endif // PTH_TELEMETRY_ENABLE
+
+#ifdef PTH_TRACE_ENABLE
+// Trace (PTH_TRACE_ENABLE)
+//=============================================================================
+/**
+ * @brief A single log message. `site` is the line of the log site in
+ *        predictive_tap_hold.c shifted left by 3, ORed with the status of the
+ *        PTH key. `time` is the `timer_read()` value. The values are the
+ *        arguments of the message (truncated to 16 bits, strings are recorded
+ *        as the value they are made from).
+ *
+ * A record with site 0 tells that `values[0]` records were dropped before it.
+ */
+typedef struct {
+    uint16_t site;
+    uint16_t time;
+    int16_t  values[4];
+} pth_trace_record_t;
+
+/**
+ * @brief Moves the oldest trace records into `buffer` (as many as fit into
+ *        `size` bytes), e.g. to send them with raw_hid_send. The records are
+ *        copied as they are in RAM (little endian on AVR and ARM).
+ *
+ * @return the number of bytes written, a multiple of the record size.
+ */
+uint8_t pth_read_trace(uint8_t* buffer, uint8_t size);
+#endif // PTH_TRACE_ENABLE
+
+#ifdef PTH_CAPTURE_ENABLE
+// Capture (PTH_CAPTURE_ENABLE)
+//=============================================================================
+// Each report starts with PTH_CAPTURE_REPORT_ID, a sequence number (to find
+// lost reports) and the number of record bytes that follow. Each record has
+// 4 bytes:
+//
+// 0: the type (pth_capture_type_t) in the upper 2 bits and 6 bits of info
+// 1: ms since the previous record. A PTH_CAPTURE_META_PAUSE record comes
+//    first, if it was more than 255 ms.
+// 2: the row of the key (or the low byte of the meta value)
+// 3: the column of the key (or the high byte of the meta value)
+#    define PTH_CAPTURE_HEADER_SIZE 3
+#    define PTH_CAPTURE_RECORD_SIZE 4
+
+typedef enum {
+    // info is the pth_capture_class_t of the keycode
+    PTH_CAPTURE_RELEASE,
+    PTH_CAPTURE_PRESS,
+    // a decision of the PTH key at the position. info is the
+    // pth_decision_path_t, ORed with PTH_CAPTURE_HOLD if it was a hold.
+    PTH_CAPTURE_DECISION,
+    // info is a pth_capture_meta_t
+    PTH_CAPTURE_META,
+} pth_capture_type_t;
+
+#    define PTH_CAPTURE_HOLD 0b100000
+
+typedef enum {
+    // the ms of the pause (in addition to those in byte 1 of the next record)
+    PTH_CAPTURE_META_PAUSE,
+    // the number of records that were dropped, as both reports were full
+    PTH_CAPTURE_META_DROPPED,
+} pth_capture_meta_t;
+
+// Only the class of a keycode is sent, not what was typed.
+typedef enum {
+    PTH_CAPTURE_CLASS_OTHER,
+    PTH_CAPTURE_CLASS_LETTER,
+    PTH_CAPTURE_CLASS_DIGIT,
+    PTH_CAPTURE_CLASS_SPACE,
+    // KC_MINS to KC_SLSH
+    PTH_CAPTURE_CLASS_PUNCTUATION,
+    PTH_CAPTURE_CLASS_BACKSPACE,
+    // KC_LCTL to KC_RGUI
+    PTH_CAPTURE_CLASS_MODIFIER,
+    PTH_CAPTURE_CLASS_MOD_TAP,
+    PTH_CAPTURE_CLASS_LAYER_TAP,
+    // other tap-holds, e.g. SH_T
+    PTH_CAPTURE_CLASS_TAP_HOLD,
+    PTH_CAPTURE_CLASS_MOMENTARY_LAYER,
+} pth_capture_class_t;
+
+/**
+ * @brief Starts or stops adding records (it is started at boot). Records
+ *        that were already added are still sent.
+ */
+void pth_set_capture_enabled(bool enabled);
+
+bool pth_is_capture_enabled(void);
+#endif // PTH_CAPTURE_ENABLE
+
+#ifdef PTH_BENCHMARK_ENABLE
+// Benchmark (PTH_BENCHMARK_ENABLE)
+//=============================================================================
+typedef enum {
+    PTH_BENCH_PROCESS_RECORD,
+    PTH_BENCH_HOUSEKEEPING,
+    // make_decision_tap and make_decision_hold, i.e. mostly the flush
+    PTH_BENCH_DECISION_TAP,
+    PTH_BENCH_DECISION_HOLD,
+    // the default prediction functions
+    PTH_BENCH_THIRD_PRESS,
+    PTH_BENCH_PTH_RELEASE_AFTER_SECOND_PRESS,
+    PTH_BENCH_PTH_RELEASE_AFTER_SECOND_RELEASE,
+    PTH_BENCH_OVERLAP,
+    // only with PTH_EARLY_DECISION_ENABLE and PTH_FAST_STREAK_TAP_ENABLE
+    PTH_BENCH_SECOND_PRESS,
+    PTH_BENCH_FAST_STREAK,
+    PTH_BENCH_COUNT
+} pth_benchmark_path_t;
+
+/**
+ * @brief Cycles of a path, after subtracting the overhead of measuring.
+ *        The mean is `total / count`.
+ */
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+    uint16_t count;
+} pth_benchmark_stats_t;
+
+/**
+ * @brief Replays the synthetic sequences `iterations` times (about 3 s each)
+ *        while the keyboard sends nothing to the host, and prints the results
+ *        with CONSOLE_ENABLE. The keys are the first mod-tap on the base
+ *        layer whose side is left or right, and letters or digits on the same
+ *        and the opposite side. Waits of TAP_CODE_DELAY are part of the
+ *        cycles, so you may want to set it to 0.
+ *
+ * @return false if PTH isn't idle or the keys weren't found.
+ */
+bool pth_run_benchmark(uint8_t iterations);
+
+/**
+ * @return the stats of the last run, indexed by pth_benchmark_path_t.
+ */
+const pth_benchmark_stats_t* pth_get_benchmark_stats(void);
+
+#    ifdef CONSOLE_ENABLE
+void pth_print_benchmark(void);
+#    endif
+#endif // PTH_BENCHMARK_ENABLE
+
 // Utility functions
 //=============================================================================
 /**
@@ -0,0 +1,336 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generated by tools/pth_model_gen.py from the default prediction functions
+// in predictive_tap_hold.c. Do not edit.
+
+#pragma once
+
+// clang-format off
+#ifdef PTH_SMALL_MODELS
+// Pruned to at most 4 comparisons
+
+// pth_default_get_hold_prediction_when_third_press: 23 nodes, at most 4 comparisons
+static const pth_model_node_t pth_third_press_model[] PROGMEM = {
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 14, 759},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 6, 150},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 170},
+    {PTH_MODEL_LEAF, 0, 4553}, // 0.06948028
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 216},
+    {PTH_MODEL_LEAF, 0, 27354}, // 0.41739476
+    {PTH_MODEL_LEAF, 0, 57536}, // 0.87793427
+    {PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR, 4, 145},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 92},
+    {PTH_MODEL_LEAF, 0, 23038}, // 0.35153707
+    {PTH_MODEL_LEAF, 0, 36934}, // 0.56357143
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 59},
+    {PTH_MODEL_LEAF, 0, 31678}, // 0.48336252
+    {PTH_MODEL_LEAF, 0, 61426}, // 0.93728805
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 6, 65143495},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 4, 120},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 139},
+    {PTH_MODEL_LEAF, 0, 10808}, // 0.16491228
+    {PTH_MODEL_LEAF, 0, 54918}, // 0.83798885
+    {PTH_MODEL_LEAF, 0, 61791}, // 0.94285714
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 19},
+    {PTH_MODEL_LEAF, 0, 4228}, // 0.06451613
+    {PTH_MODEL_LEAF, 0, 63055}, // 0.96213532
+};
+
+// pth_default_get_hold_prediction_when_pth_release_after_second_press: 17 nodes, at most 4 comparisons
+static const pth_model_node_t pth_pth_release_after_second_press_model[] PROGMEM = {
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 10, 1254},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 214},
+    {PTH_MODEL_LEAF, 0, 10205}, // 0.15571608
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 247},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 162},
+    {PTH_MODEL_LEAF, 0, 25672}, // 0.39172196
+    {PTH_MODEL_LEAF, 0, 46994}, // 0.71707317
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 58278}, // 0.88925225
+    {PTH_MODEL_LEAF, 0, 25275}, // 0.38566351
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 4, 1350},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 139},
+    {PTH_MODEL_LEAF, 0, 22713}, // 0.34656573
+    {PTH_MODEL_LEAF, 0, 58516}, // 0.89287937
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 17},
+    {PTH_MODEL_LEAF, 0, 4154}, // 0.063380282
+    {PTH_MODEL_LEAF, 0, 63628}, // 0.97088728
+};
+
+// pth_default_get_hold_prediction_when_pth_release_after_second_release: 19 nodes, at most 4 comparisons
+static const pth_model_node_t pth_pth_release_after_second_release_model[] PROGMEM = {
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 12, 143},
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 6, 1292},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 116},
+    {PTH_MODEL_LEAF, 0, 6249}, // 0.09534535
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 118},
+    {PTH_MODEL_LEAF, 0, 18177}, // 0.27736303
+    {PTH_MODEL_LEAF, 0, 35350}, // 0.5394052
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 19},
+    {PTH_MODEL_LEAF, 0, 6554}, // 0.1
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 64},
+    {PTH_MODEL_LEAF, 0, 18350}, // 0.28
+    {PTH_MODEL_LEAF, 0, 64569}, // 0.98523985
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 6, 125},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 107},
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 37605}, // 0.57380746
+    {PTH_MODEL_LEAF, 0, 15770}, // 0.24063401
+    {PTH_MODEL_LEAF, 0, 53219}, // 0.81205748
+    {PTH_MODEL_LEAF, 0, 63687}, // 0.97178076
+};
+#else
+
+// pth_default_get_hold_prediction_when_third_press: 67 nodes, at most 6 comparisons
+static const pth_model_node_t pth_third_press_model[] PROGMEM = {
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 42, 759},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 20, 150},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 170},
+    {PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR, 2, 107},
+    {PTH_MODEL_LEAF, 0, 2658}, // 0.040555656
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 109},
+    {PTH_MODEL_LEAF, 0, 9347}, // 0.14262922
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 55},
+    {PTH_MODEL_LEAF, 0, 21087}, // 0.3217576
+    {PTH_MODEL_LEAF, 0, 52473}, // 0.8006757
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 6, 216},
+    {PTH_FEATURE_DOWN_COUNT, 4, 0},
+    {PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR, 2, 77},
+    {PTH_MODEL_LEAF, 0, 25375}, // 0.38718662
+    {PTH_MODEL_LEAF, 0, 42279}, // 0.6451292
+    {PTH_MODEL_LEAF, 0, 14949}, // 0.22810061
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 59657}, // 0.910299
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 264},
+    {PTH_MODEL_LEAF, 0, 31554}, // 0.4814815
+    {PTH_MODEL_LEAF, 0, 58180}, // 0.8877551
+    {PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR, 14, 145},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 92},
+    {PTH_FEATURE_DOWN_COUNT, 4, 0},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 112},
+    {PTH_MODEL_LEAF, 0, 28232}, // 0.43078628
+    {PTH_MODEL_LEAF, 0, 45665}, // 0.6967871
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 4168244},
+    {PTH_MODEL_LEAF, 0, 33898}, // 0.51724136
+    {PTH_MODEL_LEAF, 0, 10849}, // 0.16554306
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 53867}, // 0.82194614
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 6906107},
+    {PTH_MODEL_LEAF, 0, 42487}, // 0.64830506
+    {PTH_MODEL_LEAF, 0, 23000}, // 0.35095447
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 6, 59},
+    {PTH_FEATURE_SECOND_DUR, 2, 130},
+    {PTH_MODEL_LEAF, 0, 44006}, // 0.6714801
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 303},
+    {PTH_MODEL_LEAF, 0, 17719}, // 0.27037036
+    {PTH_MODEL_LEAF, 0, 46421}, // 0.7083333
+    {PTH_MODEL_LEAF, 0, 61426}, // 0.93728805
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 16, 65143495},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 8, 120},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 6, 139},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 443},
+    {PTH_MODEL_LEAF, 0, 55050}, // 0.84
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 1110},
+    {PTH_MODEL_LEAF, 0, 8223}, // 0.12546816
+    {PTH_MODEL_LEAF, 0, 35747}, // 0.54545456
+    {PTH_MODEL_LEAF, 0, 54918}, // 0.83798885
+    {PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR, 6, 127},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 146},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 916},
+    {PTH_MODEL_LEAF, 0, 26700}, // 0.4074074
+    {PTH_MODEL_LEAF, 0, 60075}, // 0.9166667
+    {PTH_MODEL_LEAF, 0, 62966}, // 0.9607843
+    {PTH_MODEL_LEAF, 0, 63879}, // 0.97471267
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 19},
+    {PTH_MODEL_LEAF, 0, 4228}, // 0.06451613
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 6, 1449},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 111},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 1777},
+    {PTH_MODEL_LEAF, 0, 44266}, // 0.6754386
+    {PTH_MODEL_LEAF, 0, 6554}, // 0.1
+    {PTH_MODEL_LEAF, 0, 62385}, // 0.9519231
+    {PTH_MODEL_LEAF, 0, 65062}, // 0.99276936
+};
+
+// pth_default_get_hold_prediction_when_pth_release_after_second_press: 67 nodes, at most 6 comparisons
+static const pth_model_node_t pth_pth_release_after_second_press_model[] PROGMEM = {
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 38, 1254},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 18, 214},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 168},
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 237},
+    {PTH_MODEL_LEAF, 0, 1430}, // 0.021824066
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 124},
+    {PTH_MODEL_LEAF, 0, 4313}, // 0.06581373
+    {PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR, 2, 1603},
+    {PTH_MODEL_LEAF, 0, 8507}, // 0.12980974
+    {PTH_MODEL_LEAF, 0, 42701}, // 0.6515581
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 169},
+    {PTH_MODEL_LEAF, 0, 10147}, // 0.1548253
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 186},
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 53891939},
+    {PTH_MODEL_LEAF, 0, 22193}, // 0.3386316
+    {PTH_MODEL_LEAF, 0, 42862}, // 0.6540284
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 226},
+    {PTH_MODEL_LEAF, 0, 7011}, // 0.10697675
+    {PTH_MODEL_LEAF, 0, 35146}, // 0.53629214
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 12, 247},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 6, 162},
+    {PTH_FEATURE_OVERLAP_W_AVG, 4, 8812},
+    {PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR, 2, 165},
+    {PTH_MODEL_LEAF, 0, 41659}, // 0.63566846
+    {PTH_MODEL_LEAF, 0, 26985}, // 0.41175103
+    {PTH_MODEL_LEAF, 0, 16233}, // 0.24768922
+    {PTH_FEATURE_DOWN_COUNT, 4, 0},
+    {PTH_FEATURE_OVERLAP_W_AVG, 2, 1119209},
+    {PTH_MODEL_LEAF, 0, 50192}, // 0.7658702
+    {PTH_MODEL_LEAF, 0, 29542}, // 0.4507772
+    {PTH_MODEL_LEAF, 0, 5258}, // 0.08022922
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 58278}, // 0.88925225
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 312},
+    {PTH_MODEL_LEAF, 0, 17434}, // 0.26601785
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 181},
+    {PTH_MODEL_LEAF, 0, 49348}, // 0.7529976
+    {PTH_MODEL_LEAF, 0, 15522}, // 0.23684211
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 16, 1350},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 14, 139},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 8, 1273},
+    {PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR, 4, 1588},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 539},
+    {PTH_MODEL_LEAF, 0, 38702}, // 0.5905512
+    {PTH_MODEL_LEAF, 0, 16738}, // 0.25539857
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 102},
+    {PTH_MODEL_LEAF, 0, 5461}, // 0.083333336
+    {PTH_MODEL_LEAF, 0, 52779}, // 0.8053435
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 4, 71835104},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 89},
+    {PTH_MODEL_LEAF, 0, 31469}, // 0.4801762
+    {PTH_MODEL_LEAF, 0, 46583}, // 0.7108014
+    {PTH_MODEL_LEAF, 0, 27875}, // 0.42533332
+    {PTH_MODEL_LEAF, 0, 58516}, // 0.89287937
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 17},
+    {PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR, 2, 146},
+    {PTH_MODEL_LEAF, 0, 1150}, // 0.01754386
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 3116},
+    {PTH_MODEL_LEAF, 0, 2934}, // 0.04477612
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 3243},
+    {PTH_MODEL_LEAF, 0, 37449}, // 0.5714286
+    {PTH_MODEL_LEAF, 0, 5958}, // 0.09090909
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 1504},
+    {PTH_MODEL_LEAF, 0, 59663}, // 0.9103782
+    {PTH_FEATURE_DOWN_COUNT, 2, 0},
+    {PTH_MODEL_LEAF, 0, 64779}, // 0.98845273
+    {PTH_MODEL_LEAF, 0, 3025}, // 0.046153847
+};
+
+// pth_default_get_hold_prediction_when_pth_release_after_second_release: 65 nodes, at most 6 comparisons
+static const pth_model_node_t pth_pth_release_after_second_release_model[] PROGMEM = {
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 24, 143},
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 10, 1292},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 116},
+    {PTH_MODEL_LEAF, 0, 6249}, // 0.09534535
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 118},
+    {PTH_MODEL_LEAF, 0, 18177}, // 0.27736303
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 174},
+    {PTH_MODEL_LEAF, 0, 5872}, // 0.08959538
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 29},
+    {PTH_MODEL_LEAF, 0, 21407}, // 0.32664755
+    {PTH_MODEL_LEAF, 0, 42902}, // 0.65463656
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 19},
+    {PTH_MODEL_LEAF, 0, 6554}, // 0.1
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 6, 64},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 2050},
+    {PTH_MODEL_LEAF, 0, 4096}, // 0.0625
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 185513358},
+    {PTH_MODEL_LEAF, 0, 46811}, // 0.71428573
+    {PTH_MODEL_LEAF, 0, 32768}, // 0.5
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 4, 1244},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 107},
+    {PTH_MODEL_LEAF, 0, 21845}, // 0.33333334
+    {PTH_MODEL_LEAF, 0, 56174}, // 0.85714287
+    {PTH_MODEL_LEAF, 0, 65285}, // 0.99616855
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 22, 125},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 107},
+    {PTH_FEATURE_DOWN_COUNT, 6, 0},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 4, 77},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 47},
+    {PTH_MODEL_LEAF, 0, 27528}, // 0.42004812
+    {PTH_MODEL_LEAF, 0, 38476}, // 0.58709514
+    {PTH_MODEL_LEAF, 0, 45928}, // 0.70079845
+    {PTH_MODEL_LEAF, 0, 15770}, // 0.24063401
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 8, 182},
+    {PTH_FEATURE_PREV_PREV_OVERLAP_DUR, 4, 0},
+    {PTH_FEATURE_SECOND_DUR, 2, 43},
+    {PTH_MODEL_LEAF, 0, 31401}, // 0.4791367
+    {PTH_MODEL_LEAF, 0, 52463}, // 0.8005192
+    {PTH_FEATURE_SECOND_DUR, 2, 54},
+    {PTH_MODEL_LEAF, 0, 15635}, // 0.23857868
+    {PTH_MODEL_LEAF, 0, 33343}, // 0.50877196
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 167},
+    {PTH_MODEL_LEAF, 0, 56175}, // 0.8571564
+    {PTH_FEATURE_SECOND_DUR, 2, 17},
+    {PTH_MODEL_LEAF, 0, 19957}, // 0.30452675
+    {PTH_MODEL_LEAF, 0, 63567}, // 0.96995705
+    {PTH_FEATURE_DOWN_COUNT, 6, 0},
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 56881640},
+    {PTH_MODEL_LEAF, 0, 61943}, // 0.94516844
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 11},
+    {PTH_MODEL_LEAF, 0, 9362}, // 0.14285715
+    {PTH_MODEL_LEAF, 0, 65488}, // 0.9992744
+    {PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR, 6, 311},
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 2, 238},
+    {PTH_MODEL_LEAF, 0, 10082}, // 0.15384616
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 175},
+    {PTH_MODEL_LEAF, 0, 28270}, // 0.43137255
+    {PTH_MODEL_LEAF, 0, 48752}, // 0.74390244
+    {PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR, 4, 178},
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 96},
+    {PTH_MODEL_LEAF, 0, 35577}, // 0.54285717
+    {PTH_MODEL_LEAF, 0, 6242}, // 0.0952381
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 2, 187},
+    {PTH_MODEL_LEAF, 0, 60090}, // 0.91690546
+    {PTH_MODEL_LEAF, 0, 13107}, // 0.2
+};
+#endif // PTH_SMALL_MODELS
+
+// pth_default_get_hold_prediction_when_second_press: 25 nodes, at most 5 comparisons
+static const pth_model_node_t pth_second_press_model[] PROGMEM = {
+    {PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR, 12, 1254},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 111},
+    {PTH_MODEL_LEAF, 0, 27373}, // 0.4176734
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 8, 186},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 4, 162},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 167},
+    {PTH_MODEL_LEAF, 0, 10858}, // 0.16568683
+    {PTH_MODEL_LEAF, 0, 4869}, // 0.074289354
+    {PTH_FEATURE_PRESS_TO_PRESS_W_AVG, 2, 56881640},
+    {PTH_MODEL_LEAF, 0, 2324}, // 0.035458531
+    {PTH_MODEL_LEAF, 0, 10583}, // 0.16147655
+    {PTH_MODEL_LEAF, 0, 11389}, // 0.17377944
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 8, 1350},
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 6, 139},
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 916},
+    {PTH_MODEL_LEAF, 0, 15589}, // 0.23786979
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 1273},
+    {PTH_MODEL_LEAF, 0, 5566}, // 0.084923232
+    {PTH_MODEL_LEAF, 0, 10613}, // 0.16194476
+    {PTH_MODEL_LEAF, 0, 39252}, // 0.59893779
+    {PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR, 2, 1504},
+    {PTH_MODEL_LEAF, 0, 40818}, // 0.62282647
+    {PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR, 2, 19},
+    {PTH_MODEL_LEAF, 0, 58302}, // 0.88962517
+    {PTH_MODEL_LEAF, 0, 60363}, // 0.92106219
+};
+// clang-format on
@@ -0,0 +1,31 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A minimal stand-in for QMK's deferred_exec.h (implemented in pth_sim.c).
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t deferred_token;
+
+#define INVALID_DEFERRED_TOKEN 0
+
+typedef uint32_t (*deferred_exec_callback)(uint32_t trigger_time, void* cb_arg);
+
+deferred_token defer_exec(uint32_t delay_ms, deferred_exec_callback callback, void* cb_arg);
+bool           extend_deferred_exec(deferred_token token, uint32_t delay_ms);
+bool           cancel_deferred_exec(deferred_token token);
+void           deferred_exec_task(void);
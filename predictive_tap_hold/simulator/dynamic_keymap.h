@@ -0,0 +1,21 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// A minimal stand-in for QMK's dynamic_keymap.h (implemented in pth_sim.c),
+// which the module uses with VIAL_ENABLE.
+
+#pragma once
+
+#include <stdint.h>
+
+uint16_t dynamic_keymap_get_keycode(uint8_t layer, uint8_t row, uint8_t column);
@@ -0,0 +1,1461 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Host-side replay simulator for predictive_tap_hold.c.
+ *
+ * It provides the QMK functions declared in the quantum.h stub (fake timer,
+ * keymap lookup, process_record, HID report), replays timestamped press and
+ * release logs through the real module and reports:
+ *
+ * - the decision accuracy against the intent labels in the log,
+ * - the decision latency per path (third press, PTH release, ...),
+ * - the order of the emitted HID events (with -v),
+ * - the throughput in ns per event and per housekeeping tick.
+ *
+ * See the "Host Simulator" section of the README for the log format.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "quantum.h"
+#include "deferred_exec.h"
+#include "eeprom.h"
+#ifdef VIAL_ENABLE
+#    include "dynamic_keymap.h"
+#endif
+#include "keymap_introspection.h"
+#include "raw_hid.h"
+#include "predictive_tap_hold.h"
+
+// Module hooks, normally declared in QMK's generated community_modules.h
+void keyboard_post_init_predictive_tap_hold(void);
+bool process_record_predictive_tap_hold(uint16_t keycode, keyrecord_t* record);
+void housekeeping_task_predictive_tap_hold(void);
+
+#define SIM_LAYERS 3
+#define SIM_MAX_EVENTS 4096
+#define SIM_MAX_HID_EVENTS 16384
+#define SIM_MAX_REPORT_KEYS 32
+#define SIM_MAX_EMITTED (4 * SIM_MAX_EVENTS)
+
+// Keymap
+// ----------------------------------------------------------------------------
+#ifdef TAP_DANCE_ENABLE
+#    define SIM_DANCE_KEY TD(0)
+#else
+#    define SIM_DANCE_KEY KC_NO
+#endif
+
+// The key for which get_tapping_term returns a non-zero term
+#define SIM_TERM_KEY RALT_T(KC_QUOT)
+
+// clang-format off
+static const uint16_t keymaps[SIM_LAYERS][MATRIX_ROWS][MATRIX_COLS] = {
+    {
+        {KC_Q,         KC_W,         KC_E,         KC_R,         KC_T,          KC_Y,    KC_U,         KC_I,         KC_O,         KC_P},
+        {LGUI_T(KC_A), LALT_T(KC_S), LCTL_T(KC_D), LSFT_T(KC_F), KC_G,          KC_H,    RSFT_T(KC_J), RCTL_T(KC_K), LALT_T(KC_L), RGUI_T(KC_SCLN)},
+        {KC_Z,         KC_X,         KC_C,         KC_V,         KC_B,          KC_N,    KC_M,         KC_COMM,      KC_DOT,       KC_SLSH},
+        {KC_NO,        KC_NO,        KC_ESC,       LT(1, KC_SPC), KC_TAB,       KC_ENT,  LT(2, KC_BSPC), KC_BTN1,    SIM_DANCE_KEY, SIM_TERM_KEY},
+    },
+    {
+        {KC_1,         KC_2,         KC_3,         KC_4,         KC_5,          KC_6,    KC_7,         KC_8,         KC_9,         KC_0},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,       KC_LEFT, KC_DOWN,      KC_UP,        KC_RIGHT,     KC_TRNS},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,       KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,       KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+    },
+    {
+        {KC_MINS,      KC_EQL,       KC_LBRC,      KC_RBRC,      KC_BSLS,       KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_QUOT,       KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_GRV,        KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+        {KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS,       KC_TRNS, KC_TRNS,      KC_TRNS,      KC_TRNS,      KC_TRNS},
+    },
+};
+
+const uint8_t pth_side_layout[MATRIX_ROWS][MATRIX_COLS] PROGMEM = {
+    {PTH_L, PTH_L, PTH_L, PTH_L, PTH_L, PTH_R, PTH_R, PTH_R, PTH_R, PTH_R},
+    {PTH_L, PTH_L, PTH_L, PTH_L, PTH_L, PTH_R, PTH_R, PTH_R, PTH_R, PTH_R},
+    {PTH_L, PTH_L, PTH_L, PTH_L, PTH_L, PTH_R, PTH_R, PTH_R, PTH_R, PTH_R},
+    {PTH_L, PTH_L, PTH_L, PTH_L, PTH_L, PTH_R, PTH_R, PTH_R, PTH_R, PTH_R},
+};
+// clang-format on
+
+// Fake QMK core
+// ----------------------------------------------------------------------------
+layer_state_t layer_state         = 0;
+layer_state_t default_layer_state = 1;
+
+static uint32_t sim_now_ms     = 0;
+static uint32_t sim_blocked_ms = 0;
+static bool     sim_quiet      = false;
+
+uint16_t timer_read(void) {
+    return (uint16_t)sim_now_ms;
+}
+
+uint32_t timer_read32(void) {
+    return sim_now_ms;
+}
+
+uint16_t timer_elapsed(uint16_t last) {
+    return TIMER_DIFF_16(timer_read(), last);
+}
+
+// Like on the keyboard, waiting blocks everything else (including scanning).
+void wait_ms(uint16_t ms) {
+    sim_now_ms += ms;
+    sim_blocked_ms += ms;
+}
+
+// EEPROM, erased (0xFF) at start. Writes are counted per byte, like wear.
+// ----------------------------------------------------------------------------
+#define SIM_EEPROM_SIZE 1024
+
+static uint8_t  eeprom[SIM_EEPROM_SIZE];
+static uint32_t eeprom_writes = 0;
+
+void eeprom_read_block(void* buf, const void* addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    for (size_t i = 0; i < len; i++) {
+        ((uint8_t*)buf)[i] = start + i < SIM_EEPROM_SIZE ? eeprom[start + i] : 0xFF;
+    }
+}
+
+void eeprom_update_block(const void* buf, void* addr, size_t len) {
+    uintptr_t start = (uintptr_t)addr;
+    for (size_t i = 0; i < len && start + i < SIM_EEPROM_SIZE; i++) {
+        if (eeprom[start + i] != ((const uint8_t*)buf)[i]) {
+            eeprom[start + i] = ((const uint8_t*)buf)[i];
+            eeprom_writes++;
+        }
+    }
+}
+
+// Deferred execution, like QMK's, with a few slots. Token i + 1 is slot i.
+// ----------------------------------------------------------------------------
+#define SIM_DEFERRED_SLOTS 4
+
+typedef struct {
+    deferred_exec_callback callback;
+    void*                  cb_arg;
+    uint32_t               trigger_time;
+} sim_deferred_t;
+
+static sim_deferred_t deferred[SIM_DEFERRED_SLOTS];
+
+deferred_token defer_exec(uint32_t delay_ms, deferred_exec_callback callback, void* cb_arg) {
+    if (delay_ms == 0 || callback == NULL) {
+        return INVALID_DEFERRED_TOKEN;
+    }
+    for (uint8_t i = 0; i < SIM_DEFERRED_SLOTS; i++) {
+        if (deferred[i].callback == NULL) {
+            deferred[i] = (sim_deferred_t){.callback = callback, .cb_arg = cb_arg, .trigger_time = sim_now_ms + delay_ms};
+            return i + 1;
+        }
+    }
+    return INVALID_DEFERRED_TOKEN;
+}
+
+bool extend_deferred_exec(deferred_token token, uint32_t delay_ms) {
+    if (token == INVALID_DEFERRED_TOKEN || token > SIM_DEFERRED_SLOTS || deferred[token - 1].callback == NULL || delay_ms == 0) {
+        return false;
+    }
+    deferred[token - 1].trigger_time = sim_now_ms + delay_ms;
+    return true;
+}
+
+bool cancel_deferred_exec(deferred_token token) {
+    if (token == INVALID_DEFERRED_TOKEN || token > SIM_DEFERRED_SLOTS || deferred[token - 1].callback == NULL) {
+        return false;
+    }
+    deferred[token - 1].callback = NULL;
+    return true;
+}
+
+void deferred_exec_task(void) {
+    for (uint8_t i = 0; i < SIM_DEFERRED_SLOTS; i++) {
+        sim_deferred_t* d = &deferred[i];
+        if (d->callback != NULL && sim_now_ms >= d->trigger_time) {
+            uint32_t delay = d->callback(d->trigger_time, d->cb_arg);
+            if (delay == 0) {
+                d->callback = NULL;
+            } else {
+                d->trigger_time = sim_now_ms + delay;
+            }
+        }
+    }
+}
+
+// Raw HID, whose reports are appended to the file given with -c.
+// ----------------------------------------------------------------------------
+static FILE* raw_hid_file = NULL;
+
+void raw_hid_send(uint8_t* data, uint8_t length) {
+    if (raw_hid_file != NULL) {
+        fwrite(data, 1, length, raw_hid_file);
+    }
+}
+
+uint16_t keycode_at_keymap_location(uint8_t layer_num, uint8_t row, uint8_t column) {
+    if (layer_num >= SIM_LAYERS || row >= MATRIX_ROWS || column >= MATRIX_COLS) {
+        return KC_NO;
+    }
+    return keymaps[layer_num][row][column];
+}
+
+#ifdef TAPPING_TERM_PER_KEY
+// All keys but one are left to PTH. QMK's own tapping isn't simulated, so the
+// records of that one arrive as holds.
+uint16_t get_tapping_term(uint16_t keycode, keyrecord_t* record) {
+    return keycode == SIM_TERM_KEY ? 200 : 0;
+}
+#endif
+
+#ifdef TAP_DANCE_ENABLE
+// Tap dance of position 3,8: minus on one tap, equal on two, shift on hold.
+static uint16_t dance_code = KC_NO;
+
+// Whether the dance took the record that is being processed, like QMK's
+// process_tap_dance would.
+static bool dance_took_record = false;
+
+static void dance_each_tap(tap_dance_state_t* state, void* user_data) {
+    dance_took_record = true;
+}
+
+static void dance_each_release(tap_dance_state_t* state, void* user_data) {
+    dance_took_record = true;
+}
+
+static void dance_finished(tap_dance_state_t* state, void* user_data) {
+    if (state->pressed && !state->interrupted) {
+        dance_code = KC_LSFT;
+    } else {
+        dance_code = state->count == 1 ? KC_MINS : KC_EQL;
+    }
+    register_code(dance_code);
+}
+
+static void dance_reset(tap_dance_state_t* state, void* user_data) {
+    unregister_code(dance_code);
+    dance_code = KC_NO;
+}
+
+static tap_dance_action_t tap_dance_actions[] = {
+    ACTION_TAP_DANCE_FN_ADVANCED_WITH_RELEASE(dance_each_tap, dance_each_release, dance_finished, dance_reset),
+};
+
+uint16_t tap_dance_count(void) {
+    return sizeof(tap_dance_actions) / sizeof(tap_dance_actions[0]);
+}
+
+tap_dance_action_t* tap_dance_get(uint16_t tap_dance_idx) {
+    return &tap_dance_actions[tap_dance_idx];
+}
+#endif
+
+#ifdef VIAL_ENABLE
+// The number of reads, each of which would access EEPROM on a keyboard.
+static uint32_t dynamic_keymap_reads = 0;
+
+uint16_t dynamic_keymap_get_keycode(uint8_t layer, uint8_t row, uint8_t column) {
+    dynamic_keymap_reads++;
+    return keycode_at_keymap_location(layer, row, column);
+}
+#endif
+
+void layer_on(uint8_t layer) {
+    layer_state |= 1UL << layer;
+}
+
+void layer_off(uint8_t layer) {
+    layer_state &= ~(1UL << layer);
+}
+
+uint8_t layer_switch_get_layer(keypos_t key) {
+    layer_state_t layers = layer_state | default_layer_state;
+    for (int8_t i = SIM_LAYERS - 1; i >= 0; i--) {
+        if ((layers & (1UL << i)) && keycode_at_keymap_location(i, key.row, key.col) != KC_TRNS) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+bool is_caps_word_on(void) {
+    return false;
+}
+
+bool is_keyboard_left(void) {
+    return true;
+}
+
+// HID report
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint8_t mods;
+    uint8_t count;
+    uint8_t keys[SIM_MAX_REPORT_KEYS];
+} sim_report_t;
+
+typedef struct {
+    uint32_t time;
+    uint8_t  code;
+    bool     pressed;
+} sim_hid_event_t;
+
+static sim_report_t    report;
+static sim_report_t    sent_report;
+static uint32_t        reports_sent = 0;
+static sim_hid_event_t hid_events[SIM_MAX_HID_EVENTS];
+static uint32_t        hid_event_count = 0;
+
+static bool report_has_key(const sim_report_t* r, uint8_t code) {
+    for (uint8_t i = 0; i < r->count; i++) {
+        if (r->keys[i] == code) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_hid_event(uint8_t code, bool pressed) {
+    if (hid_event_count < SIM_MAX_HID_EVENTS) {
+        hid_events[hid_event_count++] = (sim_hid_event_t){.time = sim_now_ms, .code = code, .pressed = pressed};
+    }
+}
+
+static host_driver_t  sim_host_driver;
+static host_driver_t* host_driver = &sim_host_driver;
+
+host_driver_t* host_get_driver(void) {
+    return host_driver;
+}
+
+void host_set_driver(host_driver_t* driver) {
+    host_driver = driver;
+}
+
+void send_keyboard_report(void) {
+    if (host_driver == NULL || memcmp(&report, &sent_report, sizeof(report)) == 0) {
+        return;
+    }
+    reports_sent++;
+
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        const bool was = sent_report.mods & (1 << bit);
+        const bool is  = report.mods & (1 << bit);
+        if (was != is) {
+            add_hid_event(KC_LCTL + bit, is);
+        }
+    }
+    for (uint8_t i = 0; i < sent_report.count; i++) {
+        if (!report_has_key(&report, sent_report.keys[i])) {
+            add_hid_event(sent_report.keys[i], false);
+        }
+    }
+    for (uint8_t i = 0; i < report.count; i++) {
+        if (!report_has_key(&sent_report, report.keys[i])) {
+            add_hid_event(report.keys[i], true);
+        }
+    }
+    sent_report = report;
+}
+
+uint8_t get_mods(void) {
+    return report.mods;
+}
+
+uint8_t get_oneshot_mods(void) {
+    return 0;
+}
+
+void register_mods(uint8_t mods) {
+    report.mods |= mods;
+    send_keyboard_report();
+}
+
+void unregister_mods(uint8_t mods) {
+    report.mods &= ~mods;
+    send_keyboard_report();
+}
+
+void register_code(uint8_t code) {
+    if (code >= KC_LCTL && code <= KC_RGUI) {
+        report.mods |= MOD_BIT(code);
+    } else if (code != KC_NO && !report_has_key(&report, code) && report.count < SIM_MAX_REPORT_KEYS) {
+        report.keys[report.count++] = code;
+    }
+    send_keyboard_report();
+}
+
+void unregister_code(uint8_t code) {
+    if (code >= KC_LCTL && code <= KC_RGUI) {
+        report.mods &= ~MOD_BIT(code);
+    } else {
+        for (uint8_t i = 0; i < report.count; i++) {
+            if (report.keys[i] == code) {
+                report.keys[i] = report.keys[--report.count];
+                break;
+            }
+        }
+    }
+    send_keyboard_report();
+}
+
+static uint8_t mods_5_bit_to_8_bit(uint8_t mods) {
+    return (mods & 0x10) ? (uint8_t)((mods & 0x0F) << 4) : mods;
+}
+
+void register_code16(uint16_t code) {
+    if (IS_QK_MODS(code)) {
+        register_mods(mods_5_bit_to_8_bit(QK_MODS_GET_MODS(code)));
+    }
+    register_code(code & 0xFF);
+}
+
+void unregister_code16(uint16_t code) {
+    unregister_code(code & 0xFF);
+    if (IS_QK_MODS(code)) {
+        unregister_mods(mods_5_bit_to_8_bit(QK_MODS_GET_MODS(code)));
+    }
+}
+
+void clear_keyboard(void) {
+    memset(&report, 0, sizeof(report));
+    send_keyboard_report();
+}
+
+void tap_code16(uint16_t code) {
+    register_code16(code);
+#if TAP_CODE_DELAY > 0
+    wait_ms(TAP_CODE_DELAY);
+#endif
+    unregister_code16(code);
+}
+
+// Decision tracking
+// ----------------------------------------------------------------------------
+// The module only exposes its decisions through the records it processes and
+// its public accessors, which is exactly what we observe here.
+
+typedef enum {
+    PATH_PTH_PRESS,
+    PATH_SECOND_PRESS,
+    PATH_THIRD_PRESS,
+    PATH_PTH_RELEASE,
+    PATH_SECOND_RELEASE,
+    PATH_MIN_OVERLAP,
+    PATH_FORCED_TIMEOUT,
+    PATH_COUNT,
+} sim_path_t;
+
+static const char* const path_names[PATH_COUNT] = {"PTH press", "second press", "third press", "PTH release", "second release", "min-overlap timeout", "forced timeout"};
+
+typedef enum { LABEL_NONE = -1, LABEL_TAP = 0, LABEL_HOLD = 1 } sim_label_t;
+
+typedef struct {
+    bool        active;
+    keypos_t    pos;
+    uint32_t    press_time;
+    sim_label_t label;
+} sim_sequence_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t total_ms;
+    uint32_t max_ms;
+} sim_path_stats_t;
+
+typedef struct {
+    uint32_t         events;
+    uint32_t         sequences;
+    uint32_t         labeled;
+    uint32_t         correct;
+    uint32_t         tap_as_hold;
+    uint32_t         hold_as_tap;
+    sim_path_stats_t paths[PATH_COUNT];
+} sim_stats_t;
+
+static sim_sequence_t sequence;
+static sim_stats_t    stats;
+
+// A sequence whose PTH was released without a tap being registered yet. With
+// PTH_NON_BLOCKING_FLUSH, the tap may be sent later, so we wait for it until
+// the same key is pressed again. If it never comes, hold was chosen.
+static sim_sequence_t released;
+static sim_path_t     released_path;
+static uint32_t       released_latency;
+
+static void finish_released(bool hold);
+
+// Registrations of the tracked PTH position made during the current step.
+static bool step_tap_registered = false;
+
+// The label of the last press of each position. With PTH_SESSION_COUNT > 1,
+// a key can become the PTH key a while after it was pressed.
+static sim_label_t press_labels[MATRIX_ROWS][MATRIX_COLS];
+
+// Source layer cache, like QMK's, so releases use the layer of the press.
+static uint8_t source_layers[MATRIX_ROWS][MATRIX_COLS];
+
+static inline bool pos_eq(keypos_t a, keypos_t b) {
+    return a.row == b.row && a.col == b.col;
+}
+
+static uint16_t get_keycode(keyrecord_t* record) {
+    const keypos_t pos = record->event.key;
+    if (record->event.pressed) {
+        source_layers[pos.row][pos.col] = layer_switch_get_layer(pos);
+    }
+    return keycode_at_keymap_location(source_layers[pos.row][pos.col], pos.row, pos.col);
+}
+
+// Records let through to QMK
+// ----------------------------------------------------------------------------
+// They are compared with the events of the log after each replay (see
+// Invariants).
+typedef struct {
+    uint32_t time;
+    keypos_t pos;
+    bool     pressed;
+    bool     hold;     // the press of a tap-hold key as hold
+    bool     tap;      // the release of a tap-hold key as tap
+    uint32_t replayed; // the number of events of the log replayed before
+} sim_emitted_t;
+
+static sim_emitted_t emitted[SIM_MAX_EMITTED];
+static uint32_t      emitted_count  = 0;
+static uint32_t      replayed_count = 0;
+
+static void track_emitted(uint16_t keycode, keyrecord_t* record, bool is_dance) {
+    if (emitted_count < SIM_MAX_EMITTED) {
+        const bool is_tap_hold   = IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode) || is_dance;
+        emitted[emitted_count++] = (sim_emitted_t){
+            .time     = sim_now_ms,
+            .pos      = record->event.key,
+            .pressed  = record->event.pressed,
+            .hold     = is_tap_hold && record->event.pressed && record->tap.count == 0,
+            .tap      = is_tap_hold && !record->event.pressed && record->tap.count > 0,
+            .replayed = replayed_count,
+        };
+    }
+}
+
+static void process_action(uint16_t keycode, keyrecord_t* record) {
+    const bool pressed = record->event.pressed;
+
+    if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+        if (record->tap.count > 0) {
+            pressed ? register_code(keycode & 0xFF) : unregister_code(keycode & 0xFF);
+        } else if (IS_QK_MOD_TAP(keycode)) {
+            uint8_t mods = mods_5_bit_to_8_bit(QK_MOD_TAP_GET_MODS(keycode));
+            pressed ? register_mods(mods) : unregister_mods(mods);
+        } else {
+            pressed ? layer_on(QK_LAYER_TAP_GET_LAYER(keycode)) : layer_off(QK_LAYER_TAP_GET_LAYER(keycode));
+        }
+    } else if (IS_QK_MOMENTARY(keycode)) {
+        pressed ? layer_on(QK_MOMENTARY_GET_LAYER(keycode)) : layer_off(QK_MOMENTARY_GET_LAYER(keycode));
+    } else if (IS_QK_MODS(keycode)) {
+        pressed ? register_code16(keycode) : unregister_code16(keycode);
+    } else if (keycode > KC_TRNS && keycode <= 0xFF) {
+        pressed ? register_code(keycode) : unregister_code(keycode);
+    }
+}
+
+void process_record(keyrecord_t* record) {
+    const uint16_t keycode = get_keycode(record);
+
+    if (record->event.pressed && pth_is_processing_internal() && record->tap.count > 0) {
+        if (sequence.active && pos_eq(record->event.key, sequence.pos)) {
+            step_tap_registered = true;
+        } else if (released.active && pos_eq(record->event.key, released.pos)) {
+            finish_released(false);
+        }
+    }
+
+#ifdef TAP_DANCE_ENABLE
+    // The records PTH sends meanwhile are processed (and tracked) on their own.
+    const bool outer_took_record = dance_took_record;
+    dance_took_record            = false;
+    const bool is_let_through    = process_record_predictive_tap_hold(keycode, record);
+    const bool took_record       = dance_took_record;
+    dance_took_record            = outer_took_record;
+    if (took_record) {
+        // PTH decided it, and the dance consumed it, so it was let through.
+        track_emitted(keycode, record, true);
+        return;
+    }
+#else
+    const bool is_let_through = process_record_predictive_tap_hold(keycode, record);
+#endif
+    if (!is_let_through) {
+        return;
+    }
+    track_emitted(keycode, record, false);
+    process_action(keycode, record);
+}
+
+// Keycode names
+// ----------------------------------------------------------------------------
+typedef struct {
+    const char* name;
+    uint8_t     code;
+} sim_key_name_t;
+
+static const sim_key_name_t key_names[] = {
+    {"ent", KC_ENT},   {"esc", KC_ESC},   {"bspc", KC_BSPC}, {"tab", KC_TAB},   {"spc", KC_SPC},   {"mins", KC_MINS}, {"eql", KC_EQL},   {"lbrc", KC_LBRC}, {"rbrc", KC_RBRC},
+    {"bsls", KC_BSLS}, {"scln", KC_SCLN}, {"quot", KC_QUOT}, {"grv", KC_GRV},   {"comm", KC_COMM}, {"dot", KC_DOT},   {"slsh", KC_SLSH}, {"f23", KC_F23},   {"left", KC_LEFT},
+    {"down", KC_DOWN}, {"up", KC_UP},     {"right", KC_RIGHT}, {"btn1", KC_BTN1}, {"btn2", KC_BTN2}, {"lctl", KC_LCTL}, {"lsft", KC_LSFT}, {"lalt", KC_LALT}, {"lgui", KC_LGUI},
+    {"rctl", KC_RCTL}, {"rsft", KC_RSFT}, {"ralt", KC_RALT}, {"rgui", KC_RGUI},
+};
+
+static const char* code_name(uint8_t code) {
+    static char buffer[8];
+    if (code >= KC_A && code <= KC_Z) {
+        snprintf(buffer, sizeof(buffer), "%c", 'a' + (code - KC_A));
+        return buffer;
+    }
+    if (code >= KC_1 && code <= KC_0) {
+        snprintf(buffer, sizeof(buffer), "%c", code == KC_0 ? '0' : '1' + (code - KC_1));
+        return buffer;
+    }
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++) {
+        if (key_names[i].code == code) {
+            return key_names[i].name;
+        }
+    }
+    snprintf(buffer, sizeof(buffer), "0x%02X", code);
+    return buffer;
+}
+
+static int name_to_code(const char* name) {
+    if (name[1] == '\0' && name[0] >= 'a' && name[0] <= 'z') {
+        return KC_A + (name[0] - 'a');
+    }
+    if (name[1] == '\0' && name[0] >= '0' && name[0] <= '9') {
+        return name[0] == '0' ? KC_0 : KC_1 + (name[0] - '1');
+    }
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++) {
+        if (strcmp(key_names[i].name, name) == 0) {
+            return key_names[i].code;
+        }
+    }
+    return -1;
+}
+
+const char* get_keycode_string(uint16_t keycode) {
+    static char buffer[24];
+    if (IS_QK_MOD_TAP(keycode)) {
+        snprintf(buffer, sizeof(buffer), "MT(0x%02X,%s)", QK_MOD_TAP_GET_MODS(keycode), code_name(keycode & 0xFF));
+    } else if (IS_QK_LAYER_TAP(keycode)) {
+        snprintf(buffer, sizeof(buffer), "LT(%u,%s)", QK_LAYER_TAP_GET_LAYER(keycode), code_name(keycode & 0xFF));
+    } else if (IS_QK_TAP_DANCE(keycode)) {
+        snprintf(buffer, sizeof(buffer), "TD(%u)", keycode & 0xFF);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%s", code_name(keycode & 0xFF));
+    }
+    return buffer;
+}
+
+// Log parsing
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint32_t    time;
+    keypos_t    pos;
+    bool        pressed;
+    sim_label_t label;
+} sim_event_t;
+
+static sim_event_t events[SIM_MAX_EVENTS];
+static uint32_t    event_count = 0;
+
+static bool find_key(const char* token, keypos_t* pos) {
+    unsigned row, col;
+    if (sscanf(token, "%u,%u", &row, &col) == 2) {
+        if (row >= MATRIX_ROWS || col >= MATRIX_COLS) {
+            return false;
+        }
+        *pos = (keypos_t){.row = row, .col = col};
+        return true;
+    }
+
+    const int code = name_to_code(token);
+    if (code < 0) {
+        return false;
+    }
+    for (uint8_t r = 0; r < MATRIX_ROWS; r++) {
+        for (uint8_t c = 0; c < MATRIX_COLS; c++) {
+            if (get_tap_keycode(keymaps[0][r][c]) == code) {
+                *pos = (keypos_t){.row = r, .col = c};
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool load_log(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    char     line[256];
+    unsigned line_number = 0;
+    event_count          = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char     key[32], action[16], label[16] = "";
+        unsigned time;
+        int      n = sscanf(line, "%u %31s %15s %15s", &time, key, action, label);
+        if (n <= 0) {
+            continue;
+        }
+
+        sim_event_t event = {.time = time, .label = LABEL_NONE};
+        if (n < 3 || !find_key(key, &event.pos)) {
+            fprintf(stderr, "%s:%u: could not parse line\n", path, line_number);
+            fclose(file);
+            return false;
+        }
+        event.pressed = action[0] == 'd';
+        if (strcmp(label, "tap") == 0) {
+            event.label = LABEL_TAP;
+        } else if (strcmp(label, "hold") == 0) {
+            event.label = LABEL_HOLD;
+        }
+        if ((event_count > 0 && time < events[event_count - 1].time) || event_count >= SIM_MAX_EVENTS) {
+            fprintf(stderr, "%s:%u: events must be sorted by time (max %u)\n", path, line_number, SIM_MAX_EVENTS);
+            fclose(file);
+            return false;
+        }
+        events[event_count++] = event;
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Replay
+// ----------------------------------------------------------------------------
+typedef enum { STEP_PRESS, STEP_RELEASE, STEP_HOUSEKEEPING } sim_step_t;
+
+static uint64_t event_ns       = 0;
+static uint64_t housekeeping_ns = 0;
+static uint32_t housekeeping_ticks = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static sim_path_t get_path(sim_step_t step, pth_status_t status_before, bool is_pth_release, int16_t timeout) {
+    switch (step) {
+        case STEP_PRESS:
+            if (status_before == PTH_IDLE) {
+                return PATH_PTH_PRESS;
+            }
+            return status_before == PTH_PRESSED ? PATH_SECOND_PRESS : PATH_THIRD_PRESS;
+        case STEP_RELEASE:
+            return is_pth_release ? PATH_PTH_RELEASE : PATH_SECOND_RELEASE;
+        default:
+            if (timeout > 0 && sim_now_ms - sequence.press_time >= (uint32_t)timeout) {
+                return PATH_FORCED_TIMEOUT;
+            }
+            return PATH_MIN_OVERLAP;
+    }
+}
+
+static void finish(sim_sequence_t* seq, bool hold, sim_path_t path, uint32_t latency) {
+    stats.sequences++;
+    stats.paths[path].count++;
+    stats.paths[path].total_ms += latency;
+    if (latency > stats.paths[path].max_ms) {
+        stats.paths[path].max_ms = latency;
+    }
+
+    if (seq->label != LABEL_NONE) {
+        stats.labeled++;
+        if (hold == (seq->label == LABEL_HOLD)) {
+            stats.correct++;
+        } else if (hold) {
+            stats.tap_as_hold++;
+        } else {
+            stats.hold_as_tap++;
+        }
+    }
+
+    if (!sim_quiet) {
+        printf("  %6u ms  %-3s %-5s after %4u ms via %s%s\n", seq->press_time, code_name(get_tap_keycode(keymaps[0][seq->pos.row][seq->pos.col])), hold ? "HOLD" : "TAP", latency, path_names[path], (seq->label != LABEL_NONE && hold != (seq->label == LABEL_HOLD)) ? "  (wrong)" : "");
+    }
+    seq->active = false;
+}
+
+static void finish_sequence(bool hold, sim_path_t path) {
+    finish(&sequence, hold, path, sim_now_ms - sequence.press_time);
+}
+
+static void finish_released(bool hold) {
+    finish(&released, hold, released_path, released_latency);
+}
+
+static void track_step(sim_step_t step, const sim_event_t* event) {
+    if (released.active && step == STEP_PRESS && pos_eq(event->pos, released.pos)) {
+        finish_released(true);
+    }
+
+    const pth_status_t status_before = pth_get_status();
+    const int16_t      timeout       = sequence.active ? pth_get_timeout_for_forcing_choice() : -1;
+    step_tap_registered              = false;
+
+    // An event whose position is a new PTH key is tracked from the start.
+    bool is_new_candidate = false;
+
+    uint64_t start = now_ns();
+    if (step == STEP_HOUSEKEEPING) {
+        housekeeping_task_predictive_tap_hold();
+        deferred_exec_task();
+        housekeeping_ns += now_ns() - start;
+        housekeeping_ticks++;
+    } else {
+        keyrecord_t record = {.event = {.key = event->pos, .time = (uint16_t)sim_now_ms, .type = KEY_EVENT, .pressed = event->pressed}};
+        if (event->pressed) {
+            press_labels[event->pos.row][event->pos.col] = event->label;
+        }
+
+        if (!sequence.active && event->pressed && status_before == PTH_IDLE) {
+            // Track the press, so tap registrations during this step count.
+            is_new_candidate   = true;
+            sequence           = (sim_sequence_t){.active = true, .pos = event->pos, .press_time = sim_now_ms, .label = event->label};
+        }
+
+        process_record(&record);
+        event_ns += now_ns() - start;
+        stats.events++;
+    }
+
+    if (!sequence.active) {
+        return;
+    }
+
+    const pth_status_t status_after = pth_get_status();
+    const bool         is_pth_pos   = pos_eq(pth_get_pth_record().event.key, sequence.pos);
+
+    if (is_new_candidate && !step_tap_registered && !(status_after != PTH_IDLE && is_pth_pos)) {
+        // Not a PTH key (or not handled by PTH), so nothing to track.
+        sequence.active = false;
+        return;
+    }
+
+    const bool       is_pth_release = step == STEP_RELEASE && pos_eq(event->pos, sequence.pos);
+    const sim_path_t path           = get_path(step, is_new_candidate ? PTH_IDLE : status_before, is_pth_release, timeout);
+
+    // A different key is the undecided PTH key, i.e. this one was decided and
+    // a new session started (PTH_SESSION_COUNT > 1). Its tap may be queued.
+    const bool is_session_started = !is_pth_pos && (status_after == PTH_PRESSED || status_after == PTH_SECOND_PRESSED);
+
+    if (step_tap_registered || (is_pth_pos && status_after == PTH_DECIDED_TAP)) {
+        finish_sequence(false, path);
+    } else if (is_pth_pos && status_after == PTH_DECIDED_HOLD) {
+        finish_sequence(true, path);
+    } else if (is_pth_release || is_session_started) {
+        if (released.active) {
+            finish_released(true);
+        }
+        released         = sequence;
+        released_path    = path;
+        released_latency = sim_now_ms - sequence.press_time;
+        sequence.active  = false;
+    }
+}
+
+static void run_step(sim_step_t step, const sim_event_t* event) {
+    track_step(step, event);
+
+    // A key that was pressed earlier became the PTH key (a new session).
+    const pth_status_t status = pth_get_status();
+    if (!sequence.active && (status == PTH_PRESSED || status == PTH_SECOND_PRESSED)) {
+        const keyrecord_t pth = pth_get_pth_record();
+        sequence              = (sim_sequence_t){.active = true, .pos = pth.event.key, .press_time = sim_now_ms - (uint16_t)((uint16_t)sim_now_ms - pth.event.time), .label = press_labels[pth.event.key.row][pth.event.key.col]};
+    }
+}
+
+static void reset_keyboard(void) {
+    memset(&report, 0, sizeof(report));
+    memset(&sent_report, 0, sizeof(sent_report));
+    layer_state     = 0;
+    sequence.active = false;
+    released.active = false;
+}
+
+static uint32_t replay_offset = 0;
+
+static void replay(uint32_t time_offset) {
+    uint32_t next = 0;
+
+    replay_offset  = time_offset;
+    replayed_count = 0;
+    emitted_count  = 0;
+    sim_now_ms     = time_offset + (event_count > 0 ? events[0].time : 0);
+    while (next < event_count) {
+        // Everything that "happened" while the firmware was blocked (or during
+        // this scan) is only seen now, just like on a real keyboard.
+        while (next < event_count && time_offset + events[next].time <= sim_now_ms) {
+            replayed_count = next + 1;
+            run_step(events[next].pressed ? STEP_PRESS : STEP_RELEASE, &events[next]);
+            next++;
+        }
+        run_step(STEP_HOUSEKEEPING, NULL);
+        sim_now_ms++;
+    }
+
+    // Let pending timeouts expire, and idle long enough for the module to
+    // notice the pause in typing (e.g. to save the adaptive factors).
+    for (uint16_t i = 0; i < 5000; i++) {
+        run_step(STEP_HOUSEKEEPING, NULL);
+        sim_now_ms++;
+    }
+    if (released.active) {
+        finish_released(true);
+    }
+}
+
+// Invariants
+// ----------------------------------------------------------------------------
+// The events of the log are the reference for the records let through to QMK:
+//
+// - Each event is let through exactly once. The release and press with which
+//   PTH replaces an instant hold by a tap count as the original press.
+// - They are let through in the order of the log. Only instant holds may
+//   come before earlier events (see the note in Order of Events of the
+//   README), and taps of tap-hold keys are sent as a whole, so their
+//   release may come before presses made while they were down.
+// - No key, mod or layer is active after the replay.
+// - None is let through more than sim_latency_bound ms after it happened.
+typedef enum {
+    VIOLATION_NONE,
+    VIOLATION_STUCK,
+    VIOLATION_LOST,
+    VIOLATION_ORDER,
+    VIOLATION_LATENCY,
+} sim_violation_t;
+
+static const char* const violation_names[] = {"none", "stuck key", "lost or extra event", "order", "latency"};
+
+static uint32_t sim_latency_bound = 1000;
+static uint32_t max_latency       = 0;
+static char     violation_detail[128];
+
+/**
+ * @return the index of the n-th press (or release) of pos in the log, or -1.
+ */
+static int32_t find_event(keypos_t pos, bool pressed, uint32_t n) {
+    for (uint32_t i = 0; i < event_count; i++) {
+        if (events[i].pressed == pressed && pos_eq(events[i].pos, pos) && n-- == 0) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t count_events(keypos_t pos, bool pressed, uint32_t end) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < end; i++) {
+        count += events[i].pressed == pressed && pos_eq(events[i].pos, pos);
+    }
+    return count;
+}
+
+/**
+ * @return true if the next press of the position of record i is let through
+ *         without a new press in the log, i.e. it replaces the last one.
+ */
+static bool is_replaced(uint32_t i, uint16_t presses) {
+    for (uint32_t j = i + 1; j < emitted_count; j++) {
+        if (emitted[j].pressed && pos_eq(emitted[j].pos, emitted[i].pos)) {
+            return count_events(emitted[j].pos, true, emitted[j].replayed) <= presses;
+        }
+    }
+    return false;
+}
+
+static sim_violation_t violation(sim_violation_t kind, const char* format, uint32_t a, uint32_t b) {
+    snprintf(violation_detail, sizeof(violation_detail), format, a, b);
+    return kind;
+}
+
+static sim_violation_t check_invariants(void) {
+    // The event of the log of each record, or -1 if it was an undone hold.
+    static int32_t  event_of[SIM_MAX_EMITTED];
+    static uint32_t time_of[SIM_MAX_EMITTED];
+    uint16_t        presses[MATRIX_ROWS][MATRIX_COLS]      = {{0}};
+    uint16_t        releases[MATRIX_ROWS][MATRIX_COLS]     = {{0}};
+    uint32_t        last_press[MATRIX_ROWS][MATRIX_COLS]   = {{0}};
+    bool            undone[MATRIX_ROWS][MATRIX_COLS]       = {{false}};
+    bool            held[MATRIX_ROWS][MATRIX_COLS]         = {{false}};
+
+    max_latency = 0;
+    if (report.count > 0 || report.mods != 0 || layer_state != 0) {
+        return violation(VIOLATION_STUCK, "%u keys and mods 0x%02X still down", report.count, report.mods);
+    }
+
+    for (uint32_t i = 0; i < emitted_count; i++) {
+        const sim_emitted_t* e   = &emitted[i];
+        const uint8_t        row = e->pos.row, col = e->pos.col;
+        time_of[i]               = e->time;
+        event_of[i]              = -1;
+
+        if (!e->pressed) {
+            if (held[row][col] && !e->tap && is_replaced(i, presses[row][col])) {
+                // This undoes a hold, e.g. an instant hold replaced by a tap.
+                undone[row][col] = true;
+            } else if (count_events(e->pos, false, e->replayed) > releases[row][col]) {
+                event_of[i] = find_event(e->pos, false, releases[row][col]++);
+            } else {
+                return violation(VIOLATION_LOST, "release %u at %u ms has no event that happened before it", i, e->time - replay_offset);
+            }
+            continue;
+        }
+
+        held[row][col] = e->hold;
+        if (count_events(e->pos, true, e->replayed) > presses[row][col]) {
+            last_press[row][col] = i;
+            event_of[i]          = find_event(e->pos, true, presses[row][col]++);
+            continue;
+        }
+
+        // No new press happened, so this replaces the last one.
+        if (!undone[row][col]) {
+            return violation(VIOLATION_LOST, "press %u at %u ms has no event that happened before it", i, e->time - replay_offset);
+        }
+        undone[row][col]              = false;
+        time_of[last_press[row][col]] = e->time;
+    }
+
+    for (uint32_t i = 0; i < event_count; i++) {
+        const keypos_t pos = events[i].pos;
+        if (count_events(pos, events[i].pressed, event_count) != (events[i].pressed ? presses : releases)[pos.row][pos.col]) {
+            return violation(VIOLATION_LOST, "event at %u ms (%u) was not let through once", events[i].time, i);
+        }
+    }
+
+    // the largest event index of the records so far, apart from instant holds
+    // and tap releases
+    int32_t max_event = -1;
+    for (uint32_t i = 0; i < emitted_count; i++) {
+        const int32_t event = event_of[i];
+        if (event < 0) {
+            continue;
+        }
+        if (event < max_event) {
+            return violation(VIOLATION_ORDER, "event at %u ms (%u) was let through after a later one", events[event].time, (uint32_t)event);
+        }
+        // A hold that was sent while its press was processed is an instant
+        // hold, which comes before the events PTH still caches.
+        const bool is_instant_hold = emitted[i].hold && emitted[i].replayed == (uint32_t)event + 1;
+        if (!is_instant_hold && !emitted[i].tap && event > max_event) {
+            max_event = event;
+        }
+
+        const uint32_t latency = time_of[i] - (replay_offset + events[event].time);
+        if (latency > max_latency) {
+            max_latency = latency;
+        }
+        if (latency > sim_latency_bound) {
+            return violation(VIOLATION_LATENCY, "event at %u ms was let through after %u ms", events[event].time, latency);
+        }
+    }
+    return VIOLATION_NONE;
+}
+
+static void print_report(const char* path, uint32_t first_hid_event) {
+    printf("\n%s\n", path);
+    printf("  events: %u  sequences: %u  labeled: %u\n", stats.events, stats.sequences, stats.labeled);
+    if (stats.labeled > 0) {
+        printf("  accuracy: %u / %u (%.2f %%)  tap chosen for hold: %u  hold chosen for tap: %u\n", stats.correct, stats.labeled, 100.0 * stats.correct / stats.labeled, stats.hold_as_tap, stats.tap_as_hold);
+    }
+
+    printf("  %-20s %6s %8s %7s\n", "path", "count", "mean ms", "max ms");
+    for (uint8_t i = 0; i < PATH_COUNT; i++) {
+        const sim_path_stats_t* p = &stats.paths[i];
+        if (p->count > 0) {
+            printf("  %-20s %6u %8.1f %7u\n", path_names[i], p->count, (double)p->total_ms / p->count, p->max_ms);
+        }
+    }
+    printf("  HID reports: %u  blocked: %u ms\n", reports_sent, sim_blocked_ms);
+#ifdef VIAL_ENABLE
+    printf("  dynamic keymap reads: %u\n", dynamic_keymap_reads);
+#endif
+    printf("  high water: release records %u / %u  tap releases %u / %u\n", pth_get_release_records_high_water(), PTH_RELEASE_RECORD_SIZE, pth_get_release_as_tap_positions_high_water(), PTH_RELEASE_AS_TAP_POSITIONS_SIZE);
+
+#ifdef PTH_ADAPTIVE_FACTORS
+    printf("  adaptive steps:");
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            int8_t steps = pth_get_adaptive_steps((keypos_t){.row = row, .col = col});
+            if (steps != 0) {
+                printf(" %u,%u:%+d", row, col, steps);
+            }
+        }
+    }
+    printf("  EEPROM bytes written: %u\n", eeprom_writes);
+#endif
+
+    const sim_violation_t kind = check_invariants();
+    if (kind == VIOLATION_STUCK) {
+        printf("  WARNING: keys still down after the replay (stuck keys)\n");
+    } else if (kind != VIOLATION_NONE) {
+        printf("  WARNING: %s: %s\n", violation_names[kind], violation_detail);
+    }
+    (void)first_hid_event;
+}
+
+static void print_hid_events(void) {
+    printf("  HID events:\n");
+    for (uint32_t i = 0; i < hid_event_count; i++) {
+        printf("  %6u ms  %c%s\n", hid_events[i].time, hid_events[i].pressed ? '+' : '-', code_name(hid_events[i].code));
+    }
+}
+
+// Fuzzing
+// ----------------------------------------------------------------------------
+// Random press and release streams, replayed and checked with the invariants.
+// A failing stream is reduced to as few keystrokes (a press and its release)
+// as still fail the same way, and written as a log, which replays like any
+// other one.
+static uint32_t fuzz_state = 1;
+
+// xorshift32, so that a seed gives the same streams everywhere
+static uint32_t fuzz_rand(void) {
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 17;
+    fuzz_state ^= fuzz_state << 5;
+    return fuzz_state;
+}
+
+static uint32_t fuzz_range(uint32_t min, uint32_t max) {
+    return min + fuzz_rand() % (max - min + 1);
+}
+
+// The tap dance and the key with a tapping term are only in the logs, so
+// that each seed still generates the stream it always did.
+static bool is_fuzz_key(uint8_t row, uint8_t col) {
+    const uint16_t keycode = keymaps[0][row][col];
+    return keycode != KC_NO && !IS_QK_TAP_DANCE(keycode) && keycode != SIM_TERM_KEY;
+}
+
+static bool is_down(const keypos_t* down, uint8_t down_count, keypos_t pos) {
+    for (uint8_t i = 0; i < down_count; i++) {
+        if (pos_eq(down[i], pos)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Generates a stream of the given number of keystrokes, with up to
+ *        four keys down at once, like fast typing with the odd chord and pause.
+ */
+static void generate_events(uint16_t keystrokes) {
+    keypos_t down[4];
+    uint32_t release_time[4];
+    uint8_t  down_count = 0;
+    uint32_t next_press = 0;
+
+    event_count = 0;
+    while (keystrokes > 0 || down_count > 0) {
+        uint8_t first = 0;
+        for (uint8_t i = 1; i < down_count; i++) {
+            if (release_time[i] < release_time[first]) {
+                first = i;
+            }
+        }
+
+        if (keystrokes > 0 && down_count < 4 && (down_count == 0 || next_press <= release_time[first])) {
+            keypos_t pos;
+            do {
+                pos = (keypos_t){.row = fuzz_range(0, MATRIX_ROWS - 1), .col = fuzz_range(0, MATRIX_COLS - 1)};
+            } while (!is_fuzz_key(pos.row, pos.col) || is_down(down, down_count, pos));
+
+            events[event_count++]    = (sim_event_t){.time = next_press, .pos = pos, .pressed = true, .label = LABEL_NONE};
+            down[down_count]         = pos;
+            release_time[down_count] = next_press + (fuzz_range(0, 3) == 0 ? fuzz_range(150, 700) : fuzz_range(30, 180));
+            down_count++;
+            keystrokes--;
+            next_press += fuzz_range(0, 7) == 0 ? fuzz_range(200, 1500) : fuzz_range(0, 200);
+        } else {
+            events[event_count++] = (sim_event_t){.time = release_time[first], .pos = down[first], .pressed = false, .label = LABEL_NONE};
+            down_count--;
+            down[first]         = down[down_count];
+            release_time[first] = release_time[down_count];
+        }
+    }
+}
+
+static sim_violation_t run_events(void) {
+    reset_keyboard();
+    hid_event_count = 0;
+    replay(sim_now_ms + 10000 - (event_count > 0 ? events[0].time : 0));
+    return check_invariants();
+}
+
+/**
+ * @brief Removes keystrokes (in ever smaller chunks) as long as the stream
+ *        still fails with the same kind of violation.
+ */
+static void minimize_events(sim_violation_t kind) {
+    static sim_event_t kept[SIM_MAX_EVENTS];
+    static uint16_t    keystroke_of[SIM_MAX_EVENTS];
+
+    for (uint16_t chunk = event_count / 4; chunk > 0; chunk /= 2) {
+        for (uint16_t start = 0;;) {
+            // number the keystrokes, each release gets that of its press
+            uint16_t keystrokes = 0;
+            for (uint32_t i = 0; i < event_count; i++) {
+                if (events[i].pressed) {
+                    keystroke_of[i] = keystrokes++;
+                } else {
+                    for (int32_t j = (int32_t)i - 1; j >= 0; j--) {
+                        if (events[j].pressed && pos_eq(events[j].pos, events[i].pos)) {
+                            keystroke_of[i] = keystroke_of[j];
+                            break;
+                        }
+                    }
+                }
+            }
+            if (start >= keystrokes || keystrokes <= 1) {
+                break;
+            }
+
+            const uint32_t kept_count = event_count;
+            memcpy(kept, events, sizeof(events[0]) * kept_count);
+            event_count = 0;
+            for (uint32_t i = 0; i < kept_count; i++) {
+                if (keystroke_of[i] < start || keystroke_of[i] >= start + chunk) {
+                    events[event_count++] = kept[i];
+                }
+            }
+
+            if (event_count == 0 || run_events() != kind) {
+                // still needed, so restore them
+                memcpy(events, kept, sizeof(events[0]) * kept_count);
+                event_count = kept_count;
+                start += chunk;
+            }
+        }
+    }
+}
+
+static bool write_events(const char* dir, const char* name, sim_violation_t kind) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.log", dir, name);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return false;
+    }
+    fprintf(file, "# Found by pth_sim -f: %s: %s\n", violation_names[kind], violation_detail);
+    for (uint32_t i = 0; i < event_count; i++) {
+        fprintf(file, "%u %u,%u %c\n", events[i].time, events[i].pos.row, events[i].pos.col, events[i].pressed ? 'd' : 'u');
+    }
+    fclose(file);
+    printf("  written to %s\n", path);
+    return true;
+}
+
+/**
+ * @return the number of failing streams.
+ */
+static uint32_t fuzz(uint32_t cases, uint32_t seed, const char* corpus_dir) {
+    uint32_t failures  = 0;
+    uint32_t max_seen  = 0;
+    bool     can_write = corpus_dir != NULL && (mkdir(corpus_dir, 0755) == 0 || errno == EEXIST);
+
+    for (uint32_t n = 0; n < cases; n++) {
+        // each case has its own seed, so that it can be generated on its own
+        const uint32_t case_seed = seed + n;
+        fuzz_state               = case_seed * 2654435761u | 1;
+        generate_events(fuzz_range(2, 40));
+
+        memset(&stats, 0, sizeof(stats));
+        const sim_violation_t kind = run_events();
+        if (max_latency > max_seen) {
+            max_seen = max_latency;
+        }
+        if (kind == VIOLATION_NONE) {
+            continue;
+        }
+
+        failures++;
+        const uint32_t original_count = event_count;
+        minimize_events(kind);
+        run_events();
+        printf("seed %u: %s: %s (%u of %u events)\n", case_seed, violation_names[kind], violation_detail, event_count, original_count);
+        if (can_write) {
+            char name[32];
+            snprintf(name, sizeof(name), "fuzz_%u", case_seed);
+            write_events(corpus_dir, name, kind);
+        }
+    }
+    printf("%u of %u streams failed, max latency %u ms (bound %u ms)\n", failures, cases, max_seen, sim_latency_bound);
+    return failures;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [-v] [-q] [-n iterations] [-c file] [-b iterations] [-l ms] log...\n"
+            "       %s -f cases [-s seed] [-o dir] [-l ms]\n"
+            "  -v  print the emitted HID events\n"
+            "  -q  do not print the individual decisions\n"
+            "  -n  replay each log this many times to measure the throughput\n"
+            "  -c  write the raw HID reports (of PTH_CAPTURE_ENABLE) to a file\n"
+            "  -b  run pth_run_benchmark (of PTH_BENCHMARK_ENABLE) first\n"
+            "  -l  the latency above which an event counts as late (default 1000 ms)\n"
+            "  -f  replay this many random streams and check the invariants\n"
+            "  -s  the seed of the first stream (default 1)\n"
+            "  -o  write the minimized failing streams as logs to this directory\n",
+            name, name);
+}
+
+int main(int argc, char** argv) {
+    bool        verbose              = false;
+    uint32_t    iterations           = 0;
+    uint8_t     benchmark_iterations = 0;
+    uint32_t    fuzz_cases           = 0;
+    uint32_t    fuzz_seed            = 1;
+    const char* corpus_dir           = NULL;
+    int         i                    = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            sim_quiet = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            benchmark_iterations = (uint8_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            sim_latency_bound = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            fuzz_cases = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            fuzz_seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            raw_hid_file = fopen(argv[++i], "wb");
+            if (raw_hid_file == NULL) {
+                fprintf(stderr, "Could not open %s\n", argv[i]);
+                return 2;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (i >= argc && fuzz_cases == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    keyboard_post_init_predictive_tap_hold();
+
+    if (benchmark_iterations > 0) {
+#ifdef PTH_BENCHMARK_ENABLE
+        if (!pth_run_benchmark(benchmark_iterations)) {
+            fprintf(stderr, "The benchmark could not find its keys\n");
+            return 1;
+        }
+#else
+        fprintf(stderr, "-b needs -DPTH_BENCHMARK_ENABLE\n");
+        return 2;
+#endif
+    }
+
+    if (fuzz_cases > 0) {
+        sim_quiet = true;
+        return fuzz(fuzz_cases, fuzz_seed, corpus_dir) > 0 ? 1 : 0;
+    }
+
+    int exit_code = 0;
+    for (; i < argc; i++) {
+        if (!load_log(argv[i])) {
+            exit_code = 1;
+            continue;
+        }
+
+        memset(&stats, 0, sizeof(stats));
+        reset_keyboard();
+        reports_sent    = 0;
+        sim_blocked_ms  = 0;
+        hid_event_count = 0;
+#ifdef VIAL_ENABLE
+        dynamic_keymap_reads = 0;
+#endif
+
+        // Start well after the previous log, so that they don't influence each other.
+        const uint32_t offset = sim_now_ms + 10000;
+        if (!sim_quiet) {
+            printf("\n%s decisions:\n", argv[i]);
+        }
+        replay(offset - (event_count > 0 ? events[0].time : 0));
+        print_report(argv[i], 0);
+        if (verbose) {
+            print_hid_events();
+        }
+#if defined(PTH_TELEMETRY_ENABLE) && defined(CONSOLE_ENABLE)
+        pth_print_telemetry();
+        pth_clear_telemetry();
+#endif
+
+        if (iterations > 0) {
+            const bool was_quiet = sim_quiet;
+            sim_quiet            = true;
+            event_ns             = 0;
+            housekeeping_ns      = 0;
+            housekeeping_ticks   = 0;
+            uint32_t event_total = 0;
+
+            for (uint32_t n = 0; n < iterations; n++) {
+                reset_keyboard();
+                hid_event_count = 0;
+                replay(sim_now_ms + 10000 - (event_count > 0 ? events[0].time : 0));
+                event_total += event_count;
+            }
+            sim_quiet = was_quiet;
+            printf("  throughput: %.1f ns/event, %.1f ns/housekeeping tick (%u iterations)\n", (double)event_ns / event_total, (double)housekeeping_ns / housekeeping_ticks, iterations);
+        }
+    }
+    if (raw_hid_file != NULL) {
+        fclose(raw_hid_file);
+    }
+    return exit_code;
+}
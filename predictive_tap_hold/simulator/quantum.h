@@ -0,0 +1,343 @@
+// Copyright 2025 Joschua Gandert (@jgandert)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * A minimal stand-in for QMK's quantum.h, so that predictive_tap_hold.c can be
+ * compiled and run on the host. Only what the module uses is provided, and
+ * values match QMK where it matters (keycode ranges, mod bits, record layout).
+ *
+ * The behavior behind these declarations (fake timer, keymap, HID report,
+ * process_record) lives in pth_sim.c.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef MATRIX_ROWS
+#    define MATRIX_ROWS 4
+#endif
+#ifndef MATRIX_COLS
+#    define MATRIX_COLS 10
+#endif
+
+#ifndef TAPPING_TERM
+#    define TAPPING_TERM 0
+#endif
+
+#ifndef TAP_CODE_DELAY
+#    define TAP_CODE_DELAY 0
+#endif
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+
+// Records
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+
+typedef enum {
+    TICK_EVENT  = 0,
+    KEY_EVENT   = 1,
+    COMBO_EVENT = 3,
+} keyevent_type_t;
+
+typedef struct {
+    keypos_t        key;
+    uint16_t        time;
+    keyevent_type_t type;
+    bool            pressed;
+} keyevent_t;
+
+typedef struct {
+    bool    interrupted : 1;
+    bool    reserved2 : 1;
+    bool    reserved1 : 1;
+    bool    reserved0 : 1;
+    uint8_t count : 4;
+} tap_t;
+
+typedef struct {
+    keyevent_t event;
+    tap_t      tap;
+} keyrecord_t;
+
+#define IS_KEYEVENT(event) ((event).type == KEY_EVENT)
+#define IS_COMBOEVENT(event) ((event).type == COMBO_EVENT)
+
+// Keycodes
+// ----------------------------------------------------------------------------
+enum {
+    KC_NO   = 0x0000,
+    KC_TRNS = 0x0001,
+    KC_A    = 0x0004,
+    KC_B,
+    KC_C,
+    KC_D,
+    KC_E,
+    KC_F,
+    KC_G,
+    KC_H,
+    KC_I,
+    KC_J,
+    KC_K,
+    KC_L,
+    KC_M,
+    KC_N,
+    KC_O,
+    KC_P,
+    KC_Q,
+    KC_R,
+    KC_S,
+    KC_T,
+    KC_U,
+    KC_V,
+    KC_W,
+    KC_X,
+    KC_Y,
+    KC_Z,
+    KC_1,
+    KC_2,
+    KC_3,
+    KC_4,
+    KC_5,
+    KC_6,
+    KC_7,
+    KC_8,
+    KC_9,
+    KC_0,
+    KC_ENT,
+    KC_ESC,
+    KC_BSPC,
+    KC_TAB,
+    KC_SPC,
+    KC_MINS,
+    KC_EQL,
+    KC_LBRC,
+    KC_RBRC,
+    KC_BSLS,
+    KC_NUHS,
+    KC_SCLN,
+    KC_QUOT,
+    KC_GRV,
+    KC_COMM,
+    KC_DOT,
+    KC_SLSH,
+    KC_F23   = 0x0072,
+    KC_LEFT  = 0x0050,
+    KC_DOWN  = 0x0051,
+    KC_UP    = 0x0052,
+    KC_RIGHT = 0x004F,
+    KC_MS_UP = 0x00CD,
+    KC_BTN1  = 0x00D1,
+    KC_BTN2  = 0x00D2,
+    KC_BTN8  = 0x00D8,
+    KC_ACL2  = 0x00DF,
+    KC_LCTL  = 0x00E0,
+    KC_LSFT,
+    KC_LALT,
+    KC_LGUI,
+    KC_RCTL,
+    KC_RSFT,
+    KC_RALT,
+    KC_RGUI,
+};
+
+#define QK_MODS 0x0100
+#define QK_MODS_MAX 0x1FFF
+#define QK_MOD_TAP 0x2000
+#define QK_MOD_TAP_MAX 0x3FFF
+#define QK_LAYER_TAP 0x4000
+#define QK_LAYER_TAP_MAX 0x4FFF
+#define QK_MOMENTARY 0x5220
+#define QK_MOMENTARY_MAX 0x523F
+#define QK_SWAP_HANDS 0x5600
+#define QK_SWAP_HANDS_MAX 0x56FF
+#define QK_TAP_DANCE 0x5700
+#define QK_TAP_DANCE_MAX 0x57FF
+#define QK_SWAP_HANDS_TOGGLE 0x56F0
+#define QK_SWAP_HANDS_ONE_SHOT 0x56F6
+
+#define MOD_LCTL 0x01
+#define MOD_LSFT 0x02
+#define MOD_LALT 0x04
+#define MOD_LGUI 0x08
+#define MOD_RCTL 0x11
+#define MOD_RSFT 0x12
+#define MOD_RALT 0x14
+#define MOD_RGUI 0x18
+
+#define MOD_BIT(code) (1 << ((code) & 0x07))
+#define MOD_BIT_LCTRL 0x01
+#define MOD_BIT_LSHIFT 0x02
+#define MOD_BIT_LALT 0x04
+#define MOD_BIT_LGUI 0x08
+#define MOD_BIT_RCTRL 0x10
+#define MOD_BIT_RSHIFT 0x20
+#define MOD_BIT_RALT 0x40
+#define MOD_BIT_RGUI 0x80
+#define MOD_MASK_CTRL (MOD_BIT_LCTRL | MOD_BIT_RCTRL)
+#define MOD_MASK_SHIFT (MOD_BIT_LSHIFT | MOD_BIT_RSHIFT)
+#define MOD_MASK_ALT (MOD_BIT_LALT | MOD_BIT_RALT)
+#define MOD_MASK_GUI (MOD_BIT_LGUI | MOD_BIT_RGUI)
+#define MOD_MASK_CG (MOD_MASK_CTRL | MOD_MASK_GUI)
+
+#define LCTL(kc) (QK_MODS | (MOD_LCTL << 8) | ((kc) & 0xFF))
+#define LSFT(kc) (QK_MODS | (MOD_LSFT << 8) | ((kc) & 0xFF))
+#define LALT(kc) (QK_MODS | (MOD_LALT << 8) | ((kc) & 0xFF))
+#define LGUI(kc) (QK_MODS | (MOD_LGUI << 8) | ((kc) & 0xFF))
+#define LSA(kc) (QK_MODS | ((MOD_LSFT | MOD_LALT) << 8) | ((kc) & 0xFF))
+#define C(kc) LCTL(kc)
+#define S(kc) LSFT(kc)
+
+#define MT(mod, kc) (QK_MOD_TAP | (((mod) & 0x1F) << 8) | ((kc) & 0xFF))
+#define LCTL_T(kc) MT(MOD_LCTL, kc)
+#define LSFT_T(kc) MT(MOD_LSFT, kc)
+#define LALT_T(kc) MT(MOD_LALT, kc)
+#define LGUI_T(kc) MT(MOD_LGUI, kc)
+#define RCTL_T(kc) MT(MOD_RCTL, kc)
+#define RSFT_T(kc) MT(MOD_RSFT, kc)
+#define RALT_T(kc) MT(MOD_RALT, kc)
+#define RGUI_T(kc) MT(MOD_RGUI, kc)
+#define LT(layer, kc) (QK_LAYER_TAP | (((layer) & 0xF) << 8) | ((kc) & 0xFF))
+#define MO(layer) (QK_MOMENTARY | ((layer) & 0x1F))
+
+#define IS_QK_MODS(code) ((code) >= QK_MODS && (code) <= QK_MODS_MAX)
+#define IS_QK_MOD_TAP(code) ((code) >= QK_MOD_TAP && (code) <= QK_MOD_TAP_MAX)
+#define IS_QK_LAYER_TAP(code) ((code) >= QK_LAYER_TAP && (code) <= QK_LAYER_TAP_MAX)
+#define IS_QK_MOMENTARY(code) ((code) >= QK_MOMENTARY && (code) <= QK_MOMENTARY_MAX)
+#define IS_QK_TAP_DANCE(code) ((code) >= QK_TAP_DANCE && (code) <= QK_TAP_DANCE_MAX)
+#define IS_MOUSE_KEYCODE(code) ((code) >= KC_MS_UP && (code) <= KC_ACL2)
+#define IS_SWAP_HANDS_KEYCODE(code) ((code) >= QK_SWAP_HANDS_TOGGLE && (code) <= QK_SWAP_HANDS_ONE_SHOT)
+
+#define QK_MODS_GET_MODS(kc) (((kc) >> 8) & 0x1F)
+#define QK_MODS_GET_BASIC_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_MOD_TAP_GET_MODS(kc) (((kc) >> 8) & 0x1F)
+#define QK_MOD_TAP_GET_TAP_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_LAYER_TAP_GET_LAYER(kc) (((kc) >> 8) & 0xF)
+#define QK_LAYER_TAP_GET_TAP_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_MOMENTARY_GET_LAYER(kc) ((kc) & 0x1F)
+
+static inline uint16_t get_tap_keycode(uint16_t keycode) {
+    if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+        return keycode & 0xFF;
+    }
+    return keycode;
+}
+
+#define mod_config(mod) (mod)
+
+// Timer
+// ----------------------------------------------------------------------------
+#define TIMER_DIFF_16(a, b) ((uint16_t)((a) - (b)))
+#define TIMER_DIFF_32(a, b) ((uint32_t)((a) - (b)))
+#define timer_expired(current, future) ((uint16_t)((current) - (future)) < UINT16_MAX / 2)
+#define timer_expired32(current, future) ((uint32_t)((current) - (future)) < UINT32_MAX / 2)
+
+uint16_t timer_read(void);
+uint32_t timer_read32(void);
+uint16_t timer_elapsed(uint16_t last);
+void     wait_ms(uint16_t ms);
+
+// Layers
+// ----------------------------------------------------------------------------
+typedef uint32_t layer_state_t;
+
+extern layer_state_t layer_state;
+extern layer_state_t default_layer_state;
+
+#define IS_LAYER_ON(layer) ((layer_state & (1UL << (layer))) != 0)
+
+void    layer_on(uint8_t layer);
+void    layer_off(uint8_t layer);
+uint8_t layer_switch_get_layer(keypos_t key);
+
+// Keyboard
+// ----------------------------------------------------------------------------
+uint8_t get_mods(void);
+uint8_t get_oneshot_mods(void);
+void    register_mods(uint8_t mods);
+void    unregister_mods(uint8_t mods);
+void    register_code(uint8_t code);
+void    unregister_code(uint8_t code);
+void    register_code16(uint16_t code);
+void    unregister_code16(uint16_t code);
+void    tap_code16(uint16_t code);
+void    send_keyboard_report(void);
+void    clear_keyboard(void);
+void    process_record(keyrecord_t* record);
+bool    is_caps_word_on(void);
+bool    is_keyboard_left(void);
+
+#ifdef TAPPING_TERM_PER_KEY
+uint16_t get_tapping_term(uint16_t keycode, keyrecord_t* record);
+#endif
+
+#ifdef TAP_DANCE_ENABLE
+// Tap dance
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint16_t interrupting_keycode;
+    uint8_t  count;
+    uint8_t  weak_mods;
+    uint8_t  oneshot_mods;
+    bool     pressed : 1;
+    bool     finished : 1;
+    bool     interrupted : 1;
+} tap_dance_state_t;
+
+typedef void (*tap_dance_user_fn_t)(tap_dance_state_t* state, void* user_data);
+
+typedef struct {
+    struct {
+        tap_dance_user_fn_t on_each_tap;
+        tap_dance_user_fn_t on_dance_finished;
+        tap_dance_user_fn_t on_reset;
+        tap_dance_user_fn_t on_each_release;
+    } fn;
+    void* user_data;
+} tap_dance_action_t;
+
+#    define ACTION_TAP_DANCE_FN_ADVANCED(user_fn_on_each_tap, user_fn_on_dance_finished, user_fn_on_dance_reset) \
+        { .fn = {user_fn_on_each_tap, user_fn_on_dance_finished, user_fn_on_dance_reset, NULL}, .user_data = NULL, }
+
+#    define ACTION_TAP_DANCE_FN_ADVANCED_WITH_RELEASE(user_fn_on_each_tap, user_fn_on_each_release, user_fn_on_dance_finished, user_fn_on_dance_reset) \
+        { .fn = {user_fn_on_each_tap, user_fn_on_dance_finished, user_fn_on_dance_reset, user_fn_on_each_release}, .user_data = NULL, }
+
+#    define TD(n) (QK_TAP_DANCE | ((n) & 0xFF))
+#    define QK_TAP_DANCE_GET_INDEX(kc) ((kc) & 0xFF)
+#endif // TAP_DANCE_ENABLE
+
+// Host driver (no reports are sent without one)
+// ----------------------------------------------------------------------------
+typedef struct {
+    uint8_t unused;
+} host_driver_t;
+
+host_driver_t* host_get_driver(void);
+void           host_set_driver(host_driver_t* driver);
+
+// Misc
+// ----------------------------------------------------------------------------
+const char* get_keycode_string(uint16_t keycode);
+
+#define print(s) printf("%s", s)
+#define uprintf(...) printf(__VA_ARGS__)
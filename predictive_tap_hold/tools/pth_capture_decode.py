@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+# Copyright 2025 Joschua Gandert (@jgandert)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Decodes the raw HID reports of PTH_CAPTURE_ENABLE.
+
+The reports are read from a file (as written by the simulator with -c) or,
+with --device, directly from the keyboard until Ctrl+C is pressed. The latter
+needs the hidapi package (pip install hidapi):
+
+    python3 tools/pth_capture_decode.py --device 0xFEED:0x0000 > typing.log
+
+By default, the events are written as a log for the simulator, where the
+press of each tap-hold key is labeled with the decision PTH made. Fix the
+labels that were wrong, and the log can be replayed with simulator/pth_sim
+to check your own predictions, or used to train new trees (which
+tools/pth_model_gen.py converts into the model format). With --csv, every
+record is written as a row instead.
+"""
+
+import argparse
+import sys
+
+REPORT_SIZE = 32
+HEADER_SIZE = 3
+RECORD_SIZE = 4
+
+RELEASE, PRESS, DECISION, META = range(4)
+META_PAUSE, META_DROPPED       = range(2)
+HOLD                           = 0b100000
+
+# Must match the order of pth_capture_class_t and pth_decision_path_t
+CLASSES = [
+    "other",
+    "letter",
+    "digit",
+    "space",
+    "punctuation",
+    "backspace",
+    "modifier",
+    "mod_tap",
+    "layer_tap",
+    "tap_hold",
+    "momentary_layer",
+]
+TAP_HOLD_CLASSES = {"mod_tap", "layer_tap", "tap_hold"}
+PATHS            = ["none", "third_press", "pth_release", "second_press", "second_release", "overlap", "timeout", "fast_streak", "early", "pointing"]
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def read_reports(args):
+    if not args.device:
+        f    = open(args.input, "rb") if args.input else sys.stdin.buffer
+        data = f.read()
+        for offset in range(0, len(data) - args.report_size + 1, args.report_size):
+            yield data[offset : offset + args.report_size]
+        return
+
+    import hid
+
+    vid, pid = (int(x, 0) for x in args.device.split(":"))
+    # QMK's raw HID interface
+    paths = [d["path"] for d in hid.enumerate(vid, pid) if d["usage_page"] == 0xFF60 and d["usage"] == 0x61]
+    if not paths:
+        sys.exit("raw HID interface not found")
+
+    device = hid.device()
+    device.open_path(paths[0])
+    print("Capturing, press Ctrl+C to stop.", file=sys.stderr)
+    try:
+        while True:
+            report = bytes(device.read(args.report_size))
+            if report:
+                yield report
+    except KeyboardInterrupt:
+        pass
+    finally:
+        device.close()
+
+
+def decode(reports, report_id):
+    """Returns the events as (time, type, row, col, info), with absolute times."""
+    events   = []
+    time     = 0
+    sequence = None
+    for report in reports:
+        if report[0] != report_id:
+            continue
+        if sequence is not None and report[1] != (sequence + 1) & 0xFF:
+            print(f"warning: {(report[1] - sequence - 1) & 0xFF} reports were lost", file=sys.stderr)
+        sequence = report[1]
+
+        used = min(report[2], len(report) - HEADER_SIZE)
+        for offset in range(HEADER_SIZE, HEADER_SIZE + used - RECORD_SIZE + 1, RECORD_SIZE):
+            kind, info   = report[offset] >> 6, report[offset] & 0b111111
+            delta, a, b  = report[offset + 1 : offset + 4]
+            time        += delta
+            if kind == META:
+                value = a | (b << 8)
+                if info == META_PAUSE:
+                    time += value
+                elif info == META_DROPPED:
+                    print(f"warning: {value} records were dropped at {time} ms", file=sys.stderr)
+                continue
+            events.append((time, kind, a, b, info))
+    return events
+
+
+def write_log(events, out):
+    out.write("# Captured with PTH_CAPTURE_ENABLE. The labels are the decisions of PTH.\n")
+    out.write("# <time ms> <row,col> <d|u> [tap|hold]\n")
+
+    lines = []
+    # the index of the last line of a press of each tap-hold position
+    last_press = {}
+    for time, kind, row, col, info in events:
+        pos = (row, col)
+        if kind == DECISION:
+            if pos in last_press:
+                line      = lines[last_press.pop(pos)]
+                line[3]   = "hold" if info & HOLD else "tap"
+                line[4]  += f" path={name(PATHS, info & ~HOLD)}"
+            continue
+
+        lines.append([time, f"{row},{col}", "d" if kind == PRESS else "u", "", f"# {name(CLASSES, info)}"])
+        if kind == PRESS and name(CLASSES, info) in TAP_HOLD_CLASSES:
+            last_press[pos] = len(lines) - 1
+
+    for time, pos, action, label, comment in lines:
+        out.write(f"{time:<7} {pos:<5} {action} {label:<4} {comment}\n")
+
+
+def write_csv(events, out):
+    out.write("time,type,row,col,class,hold,path\n")
+    for time, kind, row, col, info in events:
+        if kind == DECISION:
+            out.write(f"{time},decision,{row},{col},,{int(bool(info & HOLD))},{name(PATHS, info & ~HOLD)}\n")
+        else:
+            out.write(f"{time},{'press' if kind == PRESS else 'release'},{row},{col},{name(CLASSES, info)},,\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="file with the reports (default: stdin)")
+    parser.add_argument("--device", metavar="VID:PID", help="read the reports from the keyboard instead")
+    parser.add_argument("--csv", action="store_true", help="write all records as CSV")
+    parser.add_argument("--report-id", type=lambda x: int(x, 0), default=0x50, help="PTH_CAPTURE_REPORT_ID (default: 0x50)")
+    parser.add_argument("--report-size", type=int, default=REPORT_SIZE, help="PTH_CAPTURE_REPORT_SIZE (default: 32)")
+    args = parser.parse_args()
+
+    events = decode(read_reports(args), args.report_id)
+    if args.csv:
+        write_csv(events, sys.stdout)
+    else:
+        write_log(events, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,558 @@
+#!/usr/bin/env python3
+# Copyright 2025 Joschua Gandert (@jgandert)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Converts the decision tree prediction functions (nested ternaries, as
+generated by evolve_tap_hold_predictors) into the model format that is
+evaluated by PTH_MODEL_INTERPRETER.
+
+By default, the pth_default_get_hold_prediction_* functions are read
+from predictive_tap_hold.c and predictive_tap_hold_models.h is written:
+
+    python3 tools/pth_model_gen.py
+
+To convert your own tree, pass the file and the name of the function. With
+--binary, the model is also written in its packed binary form (6 bytes per
+node, little endian), e.g. to store it in EEPROM or flash pages:
+
+    python3 tools/pth_model_gen.py --source my_tree.c \\
+        --function my_tree=my_get_hold_prediction --binary my_tree.bin
+
+The trained trees are also written pruned to --max-depth comparisons, for
+PTH_SMALL_MODELS. Each leaf value is the share of holds among the training
+samples at that leaf, so the sample counts are recovered from the values,
+and a pruned subtree becomes a leaf with the share of all its samples. As
+the splits above it stay the same, this is the tree the training would have
+made with that depth. Leaves on the same side of 0.5 are merged. With
+--ternary, the pruned trees are printed as C, for predictive_tap_hold.c.
+
+The tree of PTH_EARLY_DECISION_ENABLE is derived from the same samples. Every
+second press ends in one of the three trained cases, so their samples
+(weighed to the number of holds and taps in the test cases of each) are
+those of all second presses. Only the features that are known at the second press can be used,
+so a leaf of the trained trees is limited to the ranges its path gives those
+features. A new tree is grown over them with the thresholds of the trained
+trees. The samples of a leaf whose range includes a threshold might be on
+either side, so they count on both. The result is compared with the
+pth_default_get_hold_prediction_when_second_press in the source, and printed
+with --ternary.
+"""
+
+import argparse
+import fractions
+import os
+import re
+import math
+import struct
+import sys
+
+# Identifiers used in the trees and the feature they are read from
+FEATURES = {
+    "pth.features.prev_press_to_pth_press_dur": "PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR",
+    "pth.features.prev_prev_press_to_prev_press_dur": "PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR",
+    "pth.features.prev_prev_overlap_dur": "PTH_FEATURE_PREV_PREV_OVERLAP_DUR",
+    "pth.features.key_release_before_pth_to_pth_press_dur": "PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR",
+    "pth.features.press_to_second_press_dur": "PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR",
+    "pth.features.second_press_to_third_press_dur": "PTH_FEATURE_SECOND_PRESS_TO_THIRD_PRESS_DUR",
+    "opt_next_dur": "PTH_FEATURE_SECOND_DUR",
+    "opt_th_down_next_up_dur": "PTH_FEATURE_PRESS_TO_SECOND_RELEASE_DUR",
+    "pth.features.down_count": "PTH_FEATURE_DOWN_COUNT",
+    "pth.features.press_to_press_w_avg": "PTH_FEATURE_PRESS_TO_PRESS_W_AVG",
+    "pth.features.overlap_w_avg": "PTH_FEATURE_OVERLAP_W_AVG",
+}
+
+# The names the trees used before the features were moved into pth_features_t,
+# for trees trained with an older version
+ALIASES = {name.replace("pth.features.", "pth."): name for name in FEATURES}
+ALIASES["history.down_count"] = "pth.features.down_count"
+
+# Must match the order of pth_feature_t
+FEATURE_INDEX = {name: i for i, name in enumerate(FEATURES.values())}
+
+LEAF = 0xFF
+ONE  = 65536
+
+DEFAULT_FUNCTIONS = [
+    ("third_press", "pth_default_get_hold_prediction_when_third_press"),
+    ("pth_release_after_second_press", "pth_default_get_hold_prediction_when_pth_release_after_second_press"),
+    ("pth_release_after_second_release", "pth_default_get_hold_prediction_when_pth_release_after_second_release"),
+    # only used with PTH_EARLY_DECISION_ENABLE
+    ("second_press", "pth_default_get_hold_prediction_when_second_press"),
+]
+
+# The trees that were trained (second_press is derived from them)
+TRAINED = {"third_press", "pth_release_after_second_press", "pth_release_after_second_release"}
+
+# The test cases of each trained tree (see the README), as (mod, non-mod),
+# i.e. (hold, tap). The training samples have a different share of holds,
+# so their holds and taps are weighed to match these.
+TRAINED_CASES = {
+    "third_press": (68121, 310294),
+    "pth_release_after_second_press": (1057871, 9190163),
+    "pth_release_after_second_release": (435604, 85031),
+}
+
+# The features that are known at the second press. The durations of the
+# second and third key, and down_count, change afterwards.
+SECOND_PRESS_FEATURES = {
+    "PTH_FEATURE_PREV_PRESS_TO_PTH_PRESS_DUR",
+    "PTH_FEATURE_PREV_PREV_PRESS_TO_PREV_PRESS_DUR",
+    "PTH_FEATURE_PREV_PREV_OVERLAP_DUR",
+    "PTH_FEATURE_KEY_RELEASE_BEFORE_PTH_TO_PTH_PRESS_DUR",
+    "PTH_FEATURE_PRESS_TO_SECOND_PRESS_DUR",
+    "PTH_FEATURE_PRESS_TO_PRESS_W_AVG",
+    "PTH_FEATURE_OVERLAP_W_AVG",
+}
+
+SECOND_PRESS_MAX_DEPTH = 5
+# the smallest share of all second presses that a leaf may have
+SECOND_PRESS_MIN_LEAF  = 0.005
+# the default of pth_get_early_decision_margin
+EARLY_DECISION_MARGIN  = 0.4
+
+SMALL_MAX_DEPTH = 4
+
+# Reverse of FEATURES, for --ternary
+NAMES = {feature: name for name, feature in FEATURES.items()}
+
+TOKEN = re.compile(r"\s*(PTH_REAL\(([-0-9.e]+)f?\)|PTH_AVG\(([-0-9.e]+)f?\)|[A-Za-z_][A-Za-z_0-9.]*|-?[0-9]+|<=|[?:()])")
+
+
+def tokenize(expr):
+    tokens = []
+    pos    = 0
+    expr   = expr.strip()
+    while pos < len(expr):
+        m = TOKEN.match(expr, pos)
+        if not m:
+            sys.exit(f"unexpected input: {expr[pos:pos + 40]!r}")
+        tokens.append(m)
+        pos = m.end()
+    return tokens
+
+
+class Parser:
+    def __init__(self, tokens):
+        self.tokens = tokens
+        self.pos    = 0
+        self.nodes  = []
+
+    def next(self):
+        t = self.tokens[self.pos]
+        self.pos += 1
+        return t
+
+    def expect(self, s):
+        t = self.next()
+        if t.group(1) != s:
+            sys.exit(f"expected {s!r}, got {t.group(1)!r}")
+
+    def parse(self):
+        t = self.tokens[self.pos]
+        if t.group(1) == "(":
+            self.next()
+            self.parse()
+            self.expect(")")
+            return
+
+        t = self.next()
+        if t.group(2) is not None:
+            value = round(float(t.group(2)) * ONE)
+            self.nodes.append([LEAF, 0, value, t.group(2)])
+            return
+
+        name = ALIASES.get(t.group(1), t.group(1))
+        if name not in FEATURES:
+            sys.exit(f"unknown feature {name!r}")
+        self.expect("<=")
+        t = self.next()
+        if t.group(3) is not None:
+            # same conversion as PTH_AVG with PTH_FIXED_POINT
+            threshold = int(float(t.group(3)) * ONE)
+        else:
+            threshold = int(t.group(1))
+
+        node = [FEATURES[name], 0, threshold, t.group(1)]
+        index = len(self.nodes)
+        self.nodes.append(node)
+        self.expect("?")
+        self.parse()
+        self.expect(":")
+        node[1] = len(self.nodes) - index
+        if node[1] > 255:
+            sys.exit("a subtree has more than 254 nodes")
+        self.parse()
+
+
+def read_tree(source, function):
+    # the last definition, as the ones of PTH_MODEL_INTERPRETER come first
+    matches = list(re.finditer(r"\b" + re.escape(function) + r"\(void\)\s*\{", source))
+    if not matches:
+        sys.exit(f"function {function} not found")
+    m = matches[-1]
+    start = source.index("return (", m.end()) + len("return")
+    end   = source.index(");", start) + 1
+    return source[start:end]
+
+
+def convert(source, function):
+    p = Parser(tokenize(read_tree(source, function)))
+    p.parse()
+    if p.pos != len(p.tokens):
+        sys.exit(f"trailing input in {function}")
+    return p.nodes
+
+
+def check_leaves(name, nodes):
+    # With PTH_FIXED_POINT, PTH_REAL rounds to 1/1024 directly, while the
+    # interpreter rounds the 1/65536 value again. Warn if that differs.
+    for feature, _, value, text in nodes:
+        if feature != LEAF:
+            continue
+        direct = int(float(text) * 1024 + 0.5)
+        if (value + 32) >> 6 != direct:
+            print(f"warning: leaf {text} of {name} differs by 1/1024 with PTH_FIXED_POINT", file=sys.stderr)
+
+
+def depth(nodes, i=0):
+    if nodes[i][0] == LEAF:
+        return 0
+    return 1 + max(depth(nodes, i + 1), depth(nodes, i + nodes[i][1]))
+
+
+def simplest_between(lo, hi):
+    """Returns the fraction with the smallest denominator in [lo, hi]."""
+    whole = lo.numerator // lo.denominator
+    if whole + 1 <= hi or lo == whole:
+        return fractions.Fraction(whole + (lo != whole))
+    inner = simplest_between(1 / (hi - whole), 1 / (lo - whole))
+    return whole + 1 / inner
+
+
+def samples(text):
+    """Returns (holds, samples) of a leaf, the smallest fraction that rounds to its float value."""
+    bits  = struct.unpack("<I", struct.pack("<f", float(text)))[0]
+    value, below, above = (fractions.Fraction(struct.unpack("<f", struct.pack("<I", b))[0]) for b in (bits, bits - 1, bits + 1))
+    share = simplest_between((value + below) / 2, (value + above) / 2)
+    return share.numerator, share.denominator
+
+
+def is_hold(holds, count):
+    return 2 * holds > count
+
+
+def prune(nodes, max_depth, i=0):
+    """Returns the subtree at i pruned to max_depth, and its (holds, samples)."""
+    feature, right, threshold, text = nodes[i]
+    if feature == LEAF:
+        return [nodes[i]], samples(text)
+
+    left, (left_holds, left_count)    = prune(nodes, max_depth - 1, i + 1)
+    rest, (right_holds, right_count) = prune(nodes, max_depth - 1, i + right)
+    holds, count = left_holds + right_holds, left_count + right_count
+
+    merge = is_hold(left_holds, left_count) == is_hold(right_holds, right_count)
+    if max_depth <= 0 or (merge and len(left) == 1 and len(rest) == 1):
+        share = f"{holds / count:.8g}"
+        return [[LEAF, 0, round(holds / count * ONE), share]], (holds, count)
+    return [[feature, len(left) + 1, threshold, text]] + left + rest, (holds, count)
+
+
+def leaf_sides(nodes, i=0, path=()):
+    """Yields the path of conditions to each leaf, with its (holds, samples)."""
+    feature, right, threshold, text = nodes[i]
+    if feature == LEAF:
+        yield path, samples(text)
+        return
+    yield from leaf_sides(nodes, i + 1, path + ((feature, threshold, True),))
+    yield from leaf_sides(nodes, i + right, path + ((feature, threshold, False),))
+
+
+def follow(nodes, path):
+    """Returns whether the leaf that a path of the full tree leads to in nodes is hold."""
+    i = 0
+    while nodes[i][0] != LEAF:
+        feature, right, threshold, _ = nodes[i]
+        taken = [below for f, t, below in path if f == feature and t == threshold]
+        i += 1 if taken[0] else right
+    return is_hold(*samples(nodes[i][3]))
+
+
+def report(name, full, small):
+    """Prints the change in size and in correct training samples."""
+    total = same = full_correct = small_correct = 0
+    for path, (holds, count) in leaf_sides(full):
+        hold        = is_hold(holds, count)
+        small_hold  = follow(small, path)
+        total      += count
+        same       += count if hold == small_hold else 0
+        full_correct  += holds if hold else count - holds
+        small_correct += holds if small_hold else count - holds
+    print(
+        f"{name}: {len(full)} -> {len(small)} nodes, {depth(full)} -> {depth(small)} comparisons, "
+        f"correct {full_correct / total:.2%} -> {small_correct / total:.2%}, same decision {same / total:.2%}",
+        file=sys.stderr,
+    )
+
+
+def second_press_samples(models):
+    """Returns the weighted samples of the trained trees as (ranges, holds, count)."""
+    result = []
+    for name, _, nodes in models:
+        if name not in TRAINED:
+            continue
+        leaves     = list(leaf_sides(nodes))
+        all_holds  = sum(holds for _, (holds, _) in leaves)
+        all_taps   = sum(count - holds for _, (holds, count) in leaves)
+        hold_scale = TRAINED_CASES[name][0] / all_holds
+        tap_scale  = TRAINED_CASES[name][1] / all_taps
+        for path, (holds, count) in leaves:
+            ranges = {}
+            for feature, threshold, below in path:
+                if feature in SECOND_PRESS_FEATURES:
+                    lo, hi = ranges.get(feature, (-math.inf, math.inf))
+                    ranges[feature] = (lo, min(hi, threshold)) if below else (max(lo, threshold), hi)
+            result.append((ranges, holds * hold_scale, holds * hold_scale + (count - holds) * tap_scale))
+    return result
+
+
+def side(ranges, feature, threshold):
+    """Returns -1 if the samples are <= threshold, 1 if they are above, 0 if either."""
+    lo, hi = ranges.get(feature, (-math.inf, math.inf))
+    return -1 if hi <= threshold else 1 if lo >= threshold else 0
+
+
+def partition(samples, feature, threshold):
+    """Splits the samples at the threshold. Those that might be on either side
+    are split like those that are known to be on one (like C4.5 does with
+    missing values). Returns None if one side would have no known samples."""
+    sides = [side(s[0], feature, threshold) for s in samples]
+    below = sum(s[2] for s, d in zip(samples, sides) if d < 0)
+    above = sum(s[2] for s, d in zip(samples, sides) if d > 0)
+    if below == 0 or above == 0:
+        return None
+    share = below / (below + above)
+    left  = [s if d < 0 else (s[0], s[1] * share, s[2] * share) for s, d in zip(samples, sides) if d <= 0]
+    right = [s if d > 0 else (s[0], s[1] * (1 - share), s[2] * (1 - share)) for s, d in zip(samples, sides) if d >= 0]
+    return left, right
+
+
+def early_band(share):
+    """Returns 1 for an early hold, -1 for an early tap, 0 for no early decision."""
+    return 1 if share > 0.5 + EARLY_DECISION_MARGIN else -1 if share < 0.5 - EARLY_DECISION_MARGIN else 0
+
+
+def impurity(samples):
+    holds = sum(s[1] for s in samples)
+    count = sum(s[2] for s in samples)
+    return 2 * holds * (count - holds) / count, count
+
+
+def grow(samples, thresholds, max_depth, min_count):
+    """Returns a tree over the second press features, grown like CART with the Gini impurity."""
+    holds = sum(s[1] for s in samples)
+    count = sum(s[2] for s in samples)
+    leaf  = [[LEAF, 0, round(holds / count * ONE), f"{holds / count:.8g}"]]
+    if max_depth <= 0:
+        return leaf
+
+    parent, _ = impurity(samples)
+    best      = None
+    for feature, texts in sorted(thresholds.items()):
+        for threshold in sorted(texts):
+            split = partition(samples, feature, threshold)
+            if split is None:
+                continue
+            (left_impurity, left_count), (right_impurity, right_count) = impurity(split[0]), impurity(split[1])
+            if min(left_count, right_count) < min_count:
+                continue
+            gain = parent - left_impurity - right_impurity
+            if gain > 1e-9 * count and (best is None or gain > best[0]):
+                best = (gain, feature, threshold) + split
+
+    if best is None:
+        return leaf
+    _, feature, threshold, left, right = best
+    left  = grow(left, thresholds, max_depth - 1, min_count)
+    right = grow(right, thresholds, max_depth - 1, min_count)
+    if len(left) == 1 and len(right) == 1 and early_band(left[0][2] / ONE) == early_band(right[0][2] / ONE):
+        return leaf
+    return [[feature, len(left) + 1, threshold, thresholds[feature][threshold]]] + left + right
+
+
+def derive_second_press(models):
+    samples    = second_press_samples(models)
+    thresholds = {}
+    for name, _, nodes in models:
+        if name in TRAINED:
+            for feature, _, threshold, text in nodes:
+                if feature in SECOND_PRESS_FEATURES:
+                    thresholds.setdefault(feature, {})[threshold] = text
+    total = sum(s[2] for s in samples)
+    return grow(samples, thresholds, SECOND_PRESS_MAX_DEPTH, total * SECOND_PRESS_MIN_LEAF), samples
+
+
+def early_decisions(nodes, samples, i=0):
+    """Yields the samples that reach each leaf (split like in grow), with its band."""
+    feature, right, threshold, _ = nodes[i]
+    if feature == LEAF:
+        yield early_band(threshold / ONE), samples
+        return
+    left, rest = partition(samples, feature, threshold) or (samples, [])
+    yield from early_decisions(nodes, left, i + 1)
+    yield from early_decisions(nodes, rest, i + right)
+
+
+def report_second_press(nodes, samples):
+    """Prints how many second presses are decided early, and how many of them correctly."""
+    total = sum(s[2] for s in samples)
+    early = correct = 0
+    for band, reached in early_decisions(nodes, samples):
+        if band != 0:
+            early   += sum(s[2] for s in reached)
+            correct += sum(s[1] if band > 0 else s[2] - s[1] for s in reached)
+    print(
+        f"second_press: {len(nodes)} nodes, {depth(nodes)} comparisons, decided early {early / total:.2%}, "
+        f"of which correct {correct / early if early else 0:.2%}",
+        file=sys.stderr,
+    )
+
+
+def write_ternary(out, nodes, i=0, indent="  "):
+    feature, right, threshold, text = nodes[i]
+    if feature == LEAF:
+        out.write(f"PTH_REAL({text}f)")
+        return
+    out.write(f"(\n{indent}{NAMES[feature]} <= {text}\n{indent}? ")
+    write_ternary(out, nodes, i + 1, indent + "  ")
+    out.write(f"\n{indent}: ")
+    write_ternary(out, nodes, i + right, indent + "  ")
+    out.write(f"\n{indent[:-2]})")
+
+
+def write_models(out, models):
+    for name, function, nodes in models:
+        out.append("")
+        out.append(f"// {function}: {len(nodes)} nodes, at most {depth(nodes)} comparisons")
+        out.append(f"static const pth_model_node_t pth_{name}_model[] PROGMEM = {{")
+        for feature, right, value, text in nodes:
+            if feature == LEAF:
+                out.append(f"    {{PTH_MODEL_LEAF, 0, {value}}}, // {text}")
+            else:
+                out.append(f"    {{{feature}, {right}, {value}}},")
+        out.append("};")
+
+
+def write_header(path, models, small_models, max_depth):
+    out = []
+    out.append("// Copyright 2025 Joschua Gandert (@jgandert)")
+    out.append("//")
+    out.append("// Licensed under the Apache License, Version 2.0 (the \"License\");")
+    out.append("// you may not use this file except in compliance with the License.")
+    out.append("// You may obtain a copy of the License at")
+    out.append("//")
+    out.append("//     https://www.apache.org/licenses/LICENSE-2.0")
+    out.append("//")
+    out.append("// Unless required by applicable law or agreed to in writing, software")
+    out.append("// distributed under the License is distributed on an \"AS IS\" BASIS,")
+    out.append("// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.")
+    out.append("// See the License for the specific language governing permissions and")
+    out.append("// limitations under the License.")
+    out.append("")
+    out.append("// Generated by tools/pth_model_gen.py from the default prediction functions")
+    out.append("// in predictive_tap_hold.c. Do not edit.")
+    out.append("")
+    out.append("#pragma once")
+    out.append("")
+    out.append("// clang-format off")
+    if small_models:
+        out.append("#ifdef PTH_SMALL_MODELS")
+        out.append(f"// Pruned to at most {max_depth} comparisons")
+        write_models(out, small_models)
+        out.append("#else")
+        write_models(out, [m for m in models if m[0] in TRAINED])
+        out.append("#endif // PTH_SMALL_MODELS")
+        models = [m for m in models if m[0] not in TRAINED]
+    write_models(out, models)
+    out.append("// clang-format on")
+    with open(path, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+def write_binary(path, nodes):
+    with open(path, "wb") as f:
+        for feature, right, value, _ in nodes:
+            index = LEAF if feature == LEAF else FEATURE_INDEX[feature]
+            f.write(struct.pack("<BBi", index, right, value))
+
+
+def main():
+    here = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--source", default=os.path.join(here, "predictive_tap_hold.c"), help="C file with the tree functions")
+    parser.add_argument("--function", action="append", metavar="NAME=FUNCTION", help="model name and function to convert (repeatable)")
+    parser.add_argument("--output", default=os.path.join(here, "predictive_tap_hold_models.h"), help="header to write")
+    parser.add_argument("--binary", help="also write the (single) model in binary form")
+    parser.add_argument("--max-depth", type=int, default=SMALL_MAX_DEPTH, help=f"comparisons of the PTH_SMALL_MODELS trees (default: {SMALL_MAX_DEPTH})")
+    parser.add_argument("--ternary", action="store_true", help="print the pruned trees as C")
+    args = parser.parse_args()
+
+    functions = DEFAULT_FUNCTIONS
+    trained   = TRAINED
+    if args.function:
+        functions = [tuple(f.split("=", 1)) for f in args.function]
+        trained   = set()
+
+    with open(args.source) as f:
+        source = f.read()
+
+    models = []
+    for name, function in functions:
+        nodes = convert(source, function)
+        check_leaves(name, nodes)
+        models.append((name, function, nodes))
+
+    small_models = []
+    for name, function, nodes in models:
+        if name in trained:
+            small = prune(nodes, args.max_depth)[0]
+            report(name, nodes, small)
+            small_models.append((name, function, small))
+            if args.ternary:
+                sys.stdout.write(f"// {function}\nreturn ")
+                write_ternary(sys.stdout, small)
+                sys.stdout.write(";\n\n")
+
+    if not args.function:
+        second_press, samples = derive_second_press(models)
+        report_second_press(second_press, samples)
+        source_tree = next(nodes for name, _, nodes in models if name == "second_press")
+        if [n[:3] for n in source_tree] != [n[:3] for n in second_press]:
+            print("warning: the second_press tree in the source is not the derived one (see --ternary)", file=sys.stderr)
+        if args.ternary:
+            sys.stdout.write("// pth_default_get_hold_prediction_when_second_press\nreturn ")
+            write_ternary(sys.stdout, second_press)
+            sys.stdout.write(";\n\n")
+
+    write_header(args.output, models, small_models, args.max_depth)
+    if args.binary:
+        if len(models) != 1:
+            sys.exit("--binary needs exactly one --function")
+        write_binary(args.binary, models[0][2])
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+# Copyright 2025 Joschua Gandert (@jgandert)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Turns the records of PTH_TRACE_ENABLE back into the messages of PTH_DEBUG.
+
+The messages are read from the PTH_LOG and PTH_LOGF calls in
+predictive_tap_hold.c, so it has to be the version the firmware was built
+from. Reads the console output (e.g. of `qmk console`) from a file or stdin,
+and passes all other lines through:
+
+    qmk console | python3 tools/pth_trace_decode.py
+
+With --binary, the input is the raw records instead (12 bytes each, as
+written by pth_read_trace), e.g. as received via raw HID:
+
+    python3 tools/pth_trace_decode.py --binary trace.bin
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD      = struct.Struct("<HHhhhh")
+TRACE_LINE  = re.compile(r"PTH trace: ((?:[0-9A-Fa-f]{4} ?){6})")
+CONVERSION  = re.compile(r"%([-+ 0#]*\d*(?:\.\d+)?)(?:hh|h|ll|l)?([diuxXcs%])")
+STATUSES    = ["IDLE", "PRESSED", "SECOND_PRESSED", "DECIDED_TAP", "DECIDED_HOLD"]
+ATOM_SIDES  = "LROS"
+
+# The names of basic keycodes, for PTH_LOG_KEYCODE
+KEY_NAMES = {0x00: "KC_NO", 0x01: "KC_TRNS"}
+KEY_NAMES.update({0x04 + i: "KC_" + chr(ord("A") + i) for i in range(26)})
+KEY_NAMES.update({0x1E + i: "KC_" + str((i + 1) % 10) for i in range(10)})
+KEY_NAMES.update({0x3A + i: "KC_F" + str(i + 1) for i in range(12)})
+KEY_NAMES.update(
+    {
+        0x28: "KC_ENT",
+        0x29: "KC_ESC",
+        0x2A: "KC_BSPC",
+        0x2B: "KC_TAB",
+        0x2C: "KC_SPC",
+        0x2D: "KC_MINS",
+        0x2E: "KC_EQL",
+        0x2F: "KC_LBRC",
+        0x30: "KC_RBRC",
+        0x31: "KC_BSLS",
+        0x33: "KC_SCLN",
+        0x34: "KC_QUOT",
+        0x35: "KC_GRV",
+        0x36: "KC_COMM",
+        0x37: "KC_DOT",
+        0x38: "KC_SLSH",
+        0x4F: "KC_RGHT",
+        0x50: "KC_LEFT",
+        0x51: "KC_DOWN",
+        0x52: "KC_UP",
+        0xE0: "KC_LCTL",
+        0xE1: "KC_LSFT",
+        0xE2: "KC_LALT",
+        0xE3: "KC_LGUI",
+        0xE4: "KC_RCTL",
+        0xE5: "KC_RSFT",
+        0xE6: "KC_RALT",
+        0xE7: "KC_RGUI",
+    }
+)
+
+
+def split_args(text, start):
+    """Splits a C argument list that begins after the '(' at start."""
+    args  = []
+    depth = 0
+    cur   = ""
+    i     = start
+    while i < len(text):
+        c = text[i]
+        if c == '"':
+            end = i + 1
+            while text[end] != '"':
+                end += 2 if text[end] == "\\" else 1
+            cur += text[i : end + 1]
+            i = end + 1
+            continue
+        if c == "(":
+            depth += 1
+        elif c == ")":
+            if depth == 0:
+                args.append(cur.strip())
+                return args
+            depth -= 1
+        elif c == "," and depth == 0:
+            args.append(cur.strip())
+            cur = ""
+            i += 1
+            continue
+        cur += c
+        i += 1
+    sys.exit("unterminated log call")
+
+
+def unquote(literal):
+    return bytes(literal[1:-1], "utf-8").decode("unicode_escape")
+
+
+def read_sites(path):
+    sites = {}
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            m = re.search(r"\bPTH_LOGF?\(", line)
+            if not m or line.lstrip().startswith("#"):
+                continue
+            args          = split_args(line, m.end())
+            sites[number] = (unquote(args[0]), args[1:])
+    return sites
+
+
+def keycode_name(value):
+    value &= 0xFFFF
+    if 0x2000 <= value <= 0x3FFF:
+        return f"MT(0x{(value >> 8) & 0x1F:02X},{KEY_NAMES.get(value & 0xFF, hex(value & 0xFF))})"
+    if 0x4000 <= value <= 0x4FFF:
+        return f"LT({(value >> 8) & 0xF},{KEY_NAMES.get(value & 0xFF, hex(value & 0xFF))})"
+    return KEY_NAMES.get(value, f"0x{value:04X}")
+
+
+def side_name(value):
+    name = ATOM_SIDES[(value >> 2) & 0b11] + ATOM_SIDES[value & 0b11]
+    user = (value >> 4) & 0b1111
+    return f"{name}+{user}" if user else name
+
+
+def render(expr, value):
+    """Returns the string (for %s) or number that `expr` had."""
+    m = re.match(r"(\w+)\(", expr)
+    name = m.group(1) if m else None
+    if name == "PTH_LOG_KEYCODE":
+        return keycode_name(value)
+    if name == "PTH_LOG_CHOICE":
+        _, if_true, if_false = split_args(expr, m.end())
+        return unquote(if_true if value else if_false)
+    if name == "ATOM_SIDE_TO_STR":
+        return ATOM_SIDES[value] if 0 <= value < 4 else "?"
+    if name == "side_to_str":
+        return side_name(value & 0xFF)
+    if name == "STATUS_TO_STR":
+        return STATUSES[value] if 0 <= value < len(STATUSES) else "UNKNOWN"
+    return value
+
+
+def format_message(fmt, exprs, values):
+    values = iter(zip(exprs, values))
+
+    def conversion(m):
+        flags, kind = m.group(1), m.group(2)
+        if kind == "%":
+            return "%"
+        expr, value = next(values)
+        value       = render(expr, value)
+        if kind == "s":
+            return ("%" + flags + "s") % value
+        if kind in "uxX":
+            value &= 0xFFFF
+        return ("%" + flags + ("d" if kind in "diu" else kind)) % value
+
+    return CONVERSION.sub(conversion, fmt)
+
+
+def decode(record, sites, timestamps):
+    site, time, *values = record
+    if site == 0:
+        message = f"({values[0] & 0xFFFF} trace records dropped)"
+    else:
+        line = site >> 3
+        if line in sites:
+            fmt, exprs = sites[line]
+            message    = format_message(fmt, exprs, values)
+        else:
+            message = f"unknown log site in line {line}"
+
+    if timestamps:
+        status = STATUSES[site & 0b111] if (site & 0b111) < len(STATUSES) else "?"
+        return f"{time:5} {status:<14} PTH: {message}"
+    return f"PTH: {message}"
+
+
+def main():
+    here = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="console output or binary records (default: stdin)")
+    parser.add_argument("--source", default=os.path.join(here, "predictive_tap_hold.c"), help="the predictive_tap_hold.c of the firmware")
+    parser.add_argument("--binary", action="store_true", help="the input is raw records")
+    parser.add_argument("--timestamps", action="store_true", help="prefix each message with its time and the PTH status")
+    args = parser.parse_args()
+
+    sites = read_sites(args.source)
+
+    if args.binary:
+        f    = open(args.input, "rb") if args.input else sys.stdin.buffer
+        data = f.read()
+        for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+            print(decode(RECORD.unpack_from(data, offset), sites, args.timestamps))
+        return
+
+    f = open(args.input) if args.input else sys.stdin
+    for line in f:
+        m = TRACE_LINE.search(line)
+        if not m:
+            sys.stdout.write(line)
+            continue
+        words  = [int(w, 16) for w in m.group(1).split()]
+        values = [w - 0x10000 if w >= 0x8000 else w for w in words[2:]]
+        print(decode((words[0], words[1], *values), sites, args.timestamps))
+
+
+if __name__ == "__main__":
+    main()